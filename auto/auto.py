@@ -4,6 +4,7 @@ from __future__ import print_function
 
 from clang.cindex import *
 import os
+import re
 import sys
 
 ###############################################################################
@@ -60,6 +61,7 @@ WRAPPER_FUNCTIONS = (
     "glIsEnabled",
     "glFlush",
     'glFinish',
+    "glActiveTexture",
 )
 
 # Those functions are exposed to API as a function pointers, but are read from
@@ -83,6 +85,142 @@ GETPROCADDR_FUNCTIONS = {
     ),
 }
 
+# Functions which might drain the pipeline, they are timed by the stall
+# detector.
+STALL_FUNCTIONS = (
+    "glFinish",
+    "glReadPixels",
+    "glGetTexImage",
+    "glGetBooleanv",
+    "glGetDoublev",
+    "glGetFloatv",
+    "glGetIntegerv",
+    "glXWaitGL",
+)
+
+# Draw calls which can be coalesced into a single multi-draw call. Any other
+# wrapper flushes pending draws before passing the call.
+BATCH_FUNCTIONS = (
+    "glDrawArrays",
+    "glDrawElements",
+)
+
+# Call frequency profile which defines order of the members of the internal
+# table of the global implementation.
+CALL_PROFILE = os.path.join(os.path.dirname(os.path.realpath(__file__)),
+                            "call_profile.txt")
+
+# Number of function pointers in a cache line of a 64 bit platform.
+CACHE_LINE_POINTERS = 8
+
+# Maximum number of arguments passed to the USDT probes of the wrappers.
+MAX_PROBE_ARGUMENTS = 6
+
+# Argument types which are not passed to the USDT probes.
+PROBE_SKIP_TYPES = (
+    "GLclampd",
+    "GLclampf",
+    "GLdouble",
+    "GLfloat",
+)
+
+# Extra code which is injected into the generated wrappers.
+#
+# Every hook is a tuple of (functions, declarations, prologue, epilogue),
+# where functions is either a list of function names, a predicate which is
+# called with the function name, or None for hooks which are injected into
+# all the wrappers. Declarations are put at the beginning of the wrapper,
+# since the generated code keeps declarations before statements. Prologue is
+# executed before the call is passed to the dynamically loaded symbol,
+# epilogue is executed after it. Non-void wrapper declares `result`, which
+# epilogue reads the value returned by the symbol from, and which hooks
+# returning early assign their value to. The {name} in the statements is
+# replaced with the wrapped function name, {entry_probe} and {return_probe}
+# are replaced with the USDT probe statements of the function. Hooks which
+# return early are to fire the return probe.
+#
+# Prologues are injected in the order of hooks, epilogues in reverse order.
+WRAPPER_HOOKS = (
+    (None,
+     (),
+     ("{entry_probe}", ),
+     ("{return_probe}", )),
+    (None,
+     (),
+     ("GLCEW_TRACK_CALL(\"{name}\");", ),
+     ()),
+    (lambda name: name not in BATCH_FUNCTIONS,
+     (),
+     ("GLCEW_BATCH_FLUSH();", ),
+     ()),
+    (("glDrawArrays", ),
+     (),
+     ("if (GLCEW_BATCH_DRAW_ARRAYS(mode, first, count)) {{\n"
+      "  {return_probe}\n"
+      "  return;\n"
+      "}}", ),
+     ()),
+    (("glDrawElements", ),
+     (),
+     ("if (GLCEW_BATCH_DRAW_ELEMENTS(mode, count, type, indices)) {{\n"
+      "  {return_probe}\n"
+      "  return;\n"
+      "}}", ),
+     ()),
+    (("glTexImage2D", ),
+     (),
+     (),
+     ("GLCEW_TEXTURE_POOL_TEX_IMAGE(target, level, internalFormat, "
+      "width, height);", )),
+    (("glBindTexture", ),
+     (),
+     (),
+     ("GLCEW_TEXTURE_POOL_BIND(target, texture);", )),
+    (("glActiveTexture", ),
+     (),
+     (),
+     ("GLCEW_TEXTURE_POOL_ACTIVE_TEXTURE(texture);", )),
+    (("glDeleteTextures", ),
+     (),
+     ("if (GLCEW_TEXTURE_POOL_DELETE(n, textures)) {{\n"
+      "  {return_probe}\n"
+      "  return;\n"
+      "}}", ),
+     ()),
+    (("glXChooseVisual", ),
+     (),
+     ("if (GLCEW_UNLIKELY(glcew_glx_cache_enabled)) {{\n"
+      "  result = glcew_glx_cache_choose_visual(dpy, screen, attribList);\n"
+      "  {return_probe}\n"
+      "  return result;\n"
+      "}}", ),
+     ()),
+    (("glXQueryExtensionsString", ),
+     (),
+     ("if (GLCEW_UNLIKELY(glcew_glx_cache_enabled)) {{\n"
+      "  result = glcew_glx_cache_query_extensions_string(dpy, screen);\n"
+      "  {return_probe}\n"
+      "  return result;\n"
+      "}}", ),
+     ()),
+    (("glXQueryVersion", ),
+     (),
+     ("if (GLCEW_UNLIKELY(glcew_glx_cache_enabled)) {{\n"
+      "  result = glcew_glx_cache_query_version(dpy, maj, min);\n"
+      "  {return_probe}\n"
+      "  return result;\n"
+      "}}", ),
+     ()),
+    (("glXSwapBuffers", ),
+     (),
+     ("glcew_profile_frame_boundary();", ),
+     ()),
+    (STALL_FUNCTIONS,
+     ("uint64_t stall_start_ns;", ),
+     ("stall_start_ns = GLCEW_STALL_BEGIN();", ),
+     ("GLCEW_STALL_END(\"{name}\");", )),
+)
+
 ###############################################################################
 # Parsing
 
@@ -328,6 +466,59 @@ def generate_wrapper_declarations(functions):
     return lines
 
 
+def get_probe_statements(function):
+    """
+    Get USDT probe statements fired on entry and on return of the wrapper.
+
+    Only integer and pointer arguments are passed to the probe, since
+    floating point ones are not handled well by the tracers.
+    """
+    arguments = [argument.name for argument in function.arguments
+                 if argument.type not in PROBE_SKIP_TYPES]
+    arguments = arguments[:MAX_PROBE_ARGUMENTS]
+    entry_probe = "GLCEW_PROBE{}({}" . format(len(arguments),
+                                              function.name + "__entry")
+    entry_probe += "" . join(", " + argument for argument in arguments)
+    entry_probe += ");"
+    if function.return_type == "void":
+        return_probe = "GLCEW_PROBE0({}__return);" . format(function.name)
+    else:
+        return_probe = "GLCEW_PROBE1({}__return, result);" . format(
+                function.name)
+    return entry_probe, return_probe
+
+
+def get_wrapper_hooks(function):
+    """
+    Get declarations, prologue and epilogue statements for the wrapper of
+    given function.
+    """
+    name = function.name
+    entry_probe, return_probe = get_probe_statements(function)
+    declarations = []
+    prologue = []
+    epilogue = []
+    for functions, hook_declarations, hook_prologue, hook_epilogue in \
+            WRAPPER_HOOKS:
+        if functions is None:
+            pass
+        elif callable(functions):
+            if not functions(name):
+                continue
+        elif name not in functions:
+            continue
+        declarations.extend(hook_declarations)
+        prologue.extend(statement.format(name=name,
+                                         entry_probe=entry_probe,
+                                         return_probe=return_probe)
+                        for statement in hook_prologue)
+        epilogue[0:0] = [statement.format(name=name,
+                                          entry_probe=entry_probe,
+                                          return_probe=return_probe)
+                         for statement in hook_epilogue]
+    return declarations, prologue, epilogue
+
+
 def generate_wrapper_implementations(functions):
     """
     Genrate function wrappers, which passes call to a dynload symbol.
@@ -347,14 +538,71 @@ def generate_wrapper_implementations(functions):
             arguments.append(str(argument))
             argument_names.append(argument.name)
         line += "({})" . format(", " . join(arguments)) + " {\n"
-        line += "  return {}_impl({});\n" . format(
-                function.name,
-                ", " . join(argument_names))
+        call = "GLCEW_DISPATCH_WRAPPER({})({})" . format(
+                function.name, ", " . join(argument_names))
+        declarations, prologue, epilogue = get_wrapper_hooks(function)
+        if not prologue and not epilogue:
+            line += "  return {};\n" . format(call)
+        else:
+            is_void = (function.return_type == "void")
+            if not is_void:
+                line += "  {} result;\n" . format(
+                        formatAndCleanType(function.return_type))
+            for declaration in declarations:
+                line += "  {}\n" . format(declaration)
+            for statement in prologue:
+                for statement_line in statement.split("\n"):
+                    line += "  {}\n" . format(statement_line)
+            if is_void:
+                line += "  {};\n" . format(call)
+            else:
+                line += "  result = {};\n" . format(call)
+            for statement in epilogue:
+                for statement_line in statement.split("\n"):
+                    line += "  {}\n" . format(statement_line)
+            if not is_void:
+                line += "  return result;\n"
+        line += "}"
+        lines.append(line)
+    return lines
+
+
+def generate_stub_implementations(functions):
+    """
+    Generate stubs which are used instead of the dynamically loaded symbols
+    when the library is unloaded. They do nothing and return zero.
+    """
+    lines = []
+    for function in functions:
+        if function.type != 'WRAPPER':
+            continue
+        line = ""
+        if lines:
+            line += "\n"
+        return_type = formatAndCleanType(function.return_type)
+        line += "static {} {}_stub" . format(return_type, function.name)
+        arguments = [str(argument) for argument in function.arguments]
+        line += "({})" . format(", " . join(arguments) or "void") + " {\n"
+        for argument in function.arguments:
+            line += "  (void) {};  /* Ignored. */\n" . format(argument.name)
+        if return_type != "void":
+            line += "  return ({})0;\n" . format(return_type)
         line += "}"
         lines.append(line)
     return lines
 
 
+def generate_stub_assignments(functions):
+    """
+    Generate lines "  foo_impl = foo_stub;"
+    """
+    lines = []
+    for function in getFunctionsWithType(functions, 'WRAPPER'):
+        line = "  {}_impl = {}_stub;" . format(function.name, function.name)
+        lines.append(line)
+    return lines
+
+
 def generate_single_type_dynload_calls(functions):
     """
     Generate lines which reads all functions from dynamic library.
@@ -383,6 +631,181 @@ def generate_dynload_calls(functions):
     return lines
 
 
+def load_call_profile(file_name):
+    """
+    Read call counts of functions from the profile.
+
+    Every line is either "name count", or a line of bpftrace map like
+    "@calls[usdt:/path/to/binary:glcew:name__entry]: count".
+    """
+    profile = {}
+    if not os.path.exists(file_name):
+        return profile
+    with open(file_name, "r") as input:
+        for line in input:
+            line = line.strip()
+            if not line or line.startswith("#"):
+                continue
+            match = re.search(r"(\w+?)(?:__entry)?\]?:?\s+(\d+)$", line)
+            if match:
+                name, count = match.group(1), int(match.group(2))
+                profile[name] = profile.get(name, 0) + count
+    return profile
+
+
+def generate_dispatch_table_members(functions):
+    """
+    Generate members of the dispatch table structure: "  tFoo foo;"
+    """
+    lines = []
+    for function in getFunctionsWithType(functions, 'WRAPPER'):
+        line = "  t{} {};" . format(function.name, function.name)
+        lines.append(line)
+    return lines
+
+
+def generate_global_table_members(functions, profile):
+    """
+    Generate members of the internal table of the global implementation,
+    which the wrappers dispatch through: "  tFoo foo;"
+
+    Functions which are called according to the profile go first, ordered
+    by decreasing call count, so they are packed into as few cache lines as
+    possible. Other functions follow in the declaration order, starting on
+    a new cache line.
+    """
+    wrappers = getFunctionsWithType(functions, 'WRAPPER')
+    hot = sorted((function for function in wrappers
+                  if profile.get(function.name, 0) > 0),
+                 key=lambda function: -profile[function.name])
+    cold = [function for function in wrappers
+            if profile.get(function.name, 0) == 0]
+    lines = []
+    if hot:
+        lines.append("  /* Hot entry points, ordered by call frequency. */")
+        for function in hot:
+            lines.append("  t{} {};" . format(function.name, function.name))
+        num_padding = -len(hot) % CACHE_LINE_POINTERS
+        if num_padding and cold:
+            lines.append("  /* Keep cold entry points off the cache lines "
+                         "of the hot ones. */")
+            lines.append("  void* cold_padding[{}];" . format(num_padding))
+        if cold:
+            lines.append("  /* Cold entry points. */")
+    for function in cold:
+        lines.append("  t{} {};" . format(function.name, function.name))
+    return lines
+
+
+def generate_global_table_update(functions):
+    """
+    Generate lines which copies global function pointers to the internal
+    table: "  global_table.foo = foo_impl;"
+    """
+    lines = []
+    for function in getFunctionsWithType(functions, 'WRAPPER'):
+        line = "  global_table.{} = {}_impl;" . format(function.name,
+                                                      function.name)
+        lines.append(line)
+    return lines
+
+
+def generate_global_table_entries(functions):
+    """
+    Generate lines of the name to offset map of the internal table:
+    "  {"foo", offsetof(GLCEWGlobalTable, foo)},"
+    """
+    lines = []
+    for function in getFunctionsWithType(functions, 'WRAPPER'):
+        line = "  {{\"{}\", offsetof(GLCEWGlobalTable, {})}}," . format(
+                function.name, function.name)
+        lines.append(line)
+    return lines
+
+
+def generate_dispatch_table_dynload_calls(functions):
+    """
+    Generate lines which reads all functions from dynamic library into a
+    dispatch table.
+    """
+    lines = []
+    for function in getFunctionsWithType(functions, 'WRAPPER'):
+        line = "  GL_LIBRARY_FIND_TABLE({});" . format(function.name)
+        lines.append(line)
+    return lines
+
+
+def generate_dispatch_table_global_copy(functions):
+    """
+    Generate lines which copies global function pointers to a dispatch table.
+    """
+    lines = []
+    for function in getFunctionsWithType(functions, 'WRAPPER'):
+        line = "  table->{} = global_table.{};" . format(function.name,
+                                                        function.name)
+        lines.append(line)
+    return lines
+
+
+def generate_dispatch_table_getprocaddr_calls(functions):
+    """
+    Generate lines which reads all functions into a dispatch table using
+    context-specific GetProcAddr.
+    """
+    lines = []
+    for function in getFunctionsWithType(functions, 'WRAPPER'):
+        line = "  GL_PROC_ADDRESS_FIND_TABLE({});" . format(function.name)
+        lines.append(line)
+    return lines
+
+
+def generate_cxx_function_enumerators(functions):
+    """
+    Generate enumerators of C++ function index: "  foo,"
+    """
+    lines = []
+    for function in getFunctionsWithType(functions, 'WRAPPER'):
+        lines.append("  {}," . format(function.name))
+    return lines
+
+
+def generate_cxx_function_traits(functions):
+    """
+    Generate mapping of C++ function index to dispatch table member.
+    """
+    lines = []
+    for function in getFunctionsWithType(functions, 'WRAPPER'):
+        lines.append("GLCEW_FUNCTION_TRAITS({});" . format(function.name))
+    return lines
+
+
+def generate_cxx_wrappers(functions):
+    """
+    Generate inline type-safe C++ wrappers, which calls function from the
+    dispatch table directly.
+    """
+    lines = []
+    for function in getFunctionsWithType(functions, 'WRAPPER'):
+        line = ""
+        if lines:
+            line += "\n"
+        arguments = []
+        argument_names = []
+        for argument in function.arguments:
+            arguments.append(str(argument))
+            argument_names.append(argument.name)
+        line += "GLCEW_ALWAYS_INLINE inline {} {}({}) {{\n" . format(
+                formatAndCleanType(function.return_type),
+                function.name,
+                ", " . join(arguments))
+        line += "  return call<Function::{}>({});\n" . format(
+                function.name,
+                ", " . join(argument_names))
+        line += "}"
+        lines.append(line)
+    return lines
+
+
 def add_functions_to_wrangler(header, wrangler, functions):
     # Function pointers, for things which we dlsym().
     pointer_typedefs = generate_function_pointer_typedefs(functions)
@@ -405,6 +828,40 @@ def add_functions_to_wrangler(header, wrangler, functions):
 
     wrangler["functions"]["dynload"].extend(dynload)
 
+    # Stubs which are used when the library is unloaded.
+    wrangler["functions"]["stub_implementations"].extend(
+            generate_stub_implementations(functions))
+    wrangler["functions"]["stub_assignments"].extend(
+            generate_stub_assignments(functions))
+
+    # Internal table of the global implementation, ordered by the call
+    # frequency profile.
+    wrangler["functions"]["global_table_members"].extend(
+            generate_global_table_members(functions,
+                                          load_call_profile(CALL_PROFILE)))
+    wrangler["functions"]["global_table_update"].extend(
+            generate_global_table_update(functions))
+    wrangler["functions"]["global_table_entries"].extend(
+            generate_global_table_entries(functions))
+
+    # Dispatch table, used by isolated instances of OpenGL implementation.
+    wrangler["functions"]["dispatch_table_members"].extend(
+            generate_dispatch_table_members(functions))
+    wrangler["functions"]["dispatch_table_dynload"].extend(
+            generate_dispatch_table_dynload_calls(functions))
+    wrangler["functions"]["dispatch_table_global_copy"].extend(
+            generate_dispatch_table_global_copy(functions))
+    wrangler["functions"]["dispatch_table_getprocaddr"].extend(
+            generate_dispatch_table_getprocaddr_calls(functions))
+
+    # Header-only C++ dispatch layer.
+    wrangler["functions"]["cxx_enumerators"].extend(
+            generate_cxx_function_enumerators(functions))
+    wrangler["functions"]["cxx_traits"].extend(
+            generate_cxx_function_traits(functions))
+    wrangler["functions"]["cxx_wrappers"].extend(
+            generate_cxx_wrappers(functions))
+
 
 def replace_template_variables(wrangler, data):
     """
@@ -442,6 +899,10 @@ def write_wrangler_to_files(wrangler):
             wrangler,
             os.path.join(path, "glcew.template.c"),
             os.path.join(path, "..", "source", "glcew.c"))
+    write_wrangler_to_file(
+            wrangler,
+            os.path.join(path, "glcew.template.hpp"),
+            os.path.join(path, "..", "include", "glcew.hpp"))
 
 ###############################################################################
 # Main logic
@@ -461,6 +922,18 @@ if __name__ == "__main__":
             "wrapper_declarations": [],
             "wrapper_implementations": [],
             "dynload": [],
+            "stub_implementations": [],
+            "stub_assignments": [],
+            "global_table_members": [],
+            "global_table_update": [],
+            "global_table_entries": [],
+            "dispatch_table_members": [],
+            "dispatch_table_dynload": [],
+            "dispatch_table_global_copy": [],
+            "dispatch_table_getprocaddr": [],
+            "cxx_enumerators": [],
+            "cxx_traits": [],
+            "cxx_wrappers": [],
         },
     }
     functions = []
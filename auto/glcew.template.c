@@ -23,11 +23,20 @@
 #  define _CRT_SECURE_NO_WARNINGS
 #endif
 
+#ifndef _WIN32
+/* Needed for dlmopen(). */
+#  define _GNU_SOURCE
+#endif
+
 #include <glcew.h>
+#include "glcew_intern.h"
 #include <assert.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 
 #ifdef _WIN32
 #  define WIN32_LEAN_AND_MEAN
@@ -43,12 +52,17 @@ typedef HMODULE DynamicLibrary;
 #  define dynamic_library_find(lib, symbol)  GetProcAddress(lib, symbol)
 #else
 #  include <dlfcn.h>
+#  include <pthread.h>
 
 typedef void* DynamicLibrary;
 
 #  define dynamic_library_open(path)         dlopen(path, RTLD_NOW)
 #  define dynamic_library_close(lib)         dlclose(lib)
 #  define dynamic_library_find(lib, symbol)  dlsym(lib, symbol)
+#  ifdef LM_ID_NEWLM
+#    define dynamic_library_open_isolated(path) \
+            dlmopen(LM_ID_NEWLM, path, RTLD_NOW | RTLD_LOCAL)
+#  endif
 #endif
 
 #define GLUE_IMPL(A, B) A ## B
@@ -85,22 +99,264 @@ typedef void* DynamicLibrary;
         _LIBRARY_FIND_IMPL_CHECKED(gl_lib, name)
 #define GL_LIBRARY_FIND_IMPL(name) _LIBRARY_FIND_IMPL(gl_lib, name)
 
+#define _LIBRARY_FIND_TABLE(lib, table, name)                          \
+        do {                                                           \
+          (table)->name = (t##name)dynamic_library_find(lib, #name);   \
+        } while (0)
+
+/* Reads symbol into a dispatch table, expects `lib` and `table` to be
+ * defined in the scope.
+ */
+#define GL_LIBRARY_FIND_TABLE(name) _LIBRARY_FIND_TABLE(lib, table, name)
+
+/* Reads context-specific function pointer into a dispatch table, keeping the
+ * existing one if the function is not known to GetProcAddr. Expects
+ * `get_proc_address` and `table` to be defined in the scope.
+ */
+#define GL_PROC_ADDRESS_FIND_TABLE(name)                                    \
+        do {                                                                \
+          t##name func = (t##name)get_proc_address((const GLubyte*)#name);  \
+          if (func != NULL) {                                               \
+            table->name = func;                                             \
+          }                                                                 \
+        } while (0)
+
+struct GLCEWInstance {
+  DynamicLibrary lib;
+  GLCEWDispatchTable table;
+  /* Number of threads which have the instance bound, or INSTANCE_DESTROYING
+   * once destroy has started, after which the instance is not bound again.
+   */
+  int num_bound_threads;
+};
+
+#define INSTANCE_DESTROYING -1
+
+/* Library paths. */
+#ifdef _WIN32
+static const char* gl_paths[] = {"opengl32.dll", NULL};
+#elif defined(__APPLE__)
+static const char* gl_paths[] = {NULL};
+#else
+/* TODO(sergey): Check on an order. Angular does other way around. */
+static const char* gl_paths[] = {"libGL.so",
+                                 "libGL.so.1",
+                                 NULL};
+#endif
+
 static DynamicLibrary gl_lib;
 
+/* Initialization state. */
+static int initialized = 0;
+static int init_result = 0;
+static int atexit_registered = 0;
+
+/* Library lifetime. Library loaded by glcewInit() stays loaded until exit,
+ * otherwise it is unloaded when the last glcewAcquire() reference is
+ * released and idle timeout has passed.
+ */
+static int keep_loaded = 0;
+static int num_references = 0;
+static unsigned int idle_timeout_ms = 0;
+static uint64_t idle_since_ns = 0;
+
+#ifdef _WIN32
+/* TODO(sergey): Initialization is not thread-safe on Windows yet. */
+#  define init_lock()
+#  define init_unlock()
+#else
+static pthread_mutex_t init_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_condition = PTHREAD_COND_INITIALIZER;
+static int idle_thread_running = 0;
+static int atfork_registered = 0;
+#  define init_lock() pthread_mutex_lock(&init_mutex)
+#  define init_unlock() pthread_mutex_unlock(&init_mutex)
+#endif
+
+GLCEW_THREAD_LOCAL_FAST const GLCEWDispatchTable* glcew_bound_table = NULL;
+static GLCEW_THREAD_LOCAL GLCEWInstance* bound_instance = NULL;
+#ifndef _WIN32
+/* Holds the bound instance as well, so binding of a thread which exits is
+ * released by the key destructor.
+ */
+static pthread_key_t bound_instance_key;
+static pthread_once_t bound_instance_key_once = PTHREAD_ONCE_INIT;
+#endif
+
+GLCEW_THREAD_LOCAL_FAST const char* glcew_last_call = NULL;
+
+unsigned int glcew_load_epoch = 0;
+
 /* ************************ Function definitions. ************************ */
 
 %functions_pointer_definitions%
 
+/* Copy of the *_impl pointers which the wrappers dispatch through. Members
+ * are ordered by the call frequency profile (auto/call_profile.txt), and the
+ * table is aligned to a cache line, so the hot entry points take as few
+ * lines as possible. It is updated whenever the library is loaded or
+ * unloaded.
+ */
+typedef struct GLCEWGlobalTable {
+%functions_global_table_members%
+} GLCEWGlobalTable;
+
+#ifdef _MSC_VER
+static __declspec(align(64)) GLCEWGlobalTable global_table;
+#else
+static GLCEWGlobalTable global_table __attribute__((aligned(64)));
+#endif
+
+#define GLCEW_DISPATCH_WRAPPER(name) \
+        GLCEW_DISPATCH_FROM(global_table.name, name)
+
+static void global_table_update(void) {
+%functions_global_table_update%
+}
+
+/* **************************** Function stubs. ************************** */
+
+%functions_stub_implementations%
+
 /* ************************** Function wrappers. ************************* */
 
 %functions_wrapper_implementations%
 
+/* ****************************** Utilities. ***************************** */
+
+uint64_t glcew_time_ns(void) {
+#ifdef _WIN32
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return (uint64_t)((double)counter.QuadPart * 1e9 /
+                    (double)frequency.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+void* glcew_find_global_symbol(const char* name) {
+#ifdef _WIN32
+  (void) name;  /* Ignored. */
+  return NULL;
+#else
+  return dlsym(RTLD_DEFAULT, name);
+#endif
+}
+
+#ifdef WITH_CALL_COUNTS
+static GLCEWCallCounter* call_counters = NULL;
+#  ifndef _WIN32
+static pthread_mutex_t call_counters_mutex = PTHREAD_MUTEX_INITIALIZER;
+#  endif
+
+static void call_counters_print(void) {
+  const char* file_name = getenv("GLCEW_CALL_COUNTS");
+  FILE* file = stderr;
+  const GLCEWCallCounter* counter;
+  if (file_name != NULL && file_name[0] != '\0') {
+    file = fopen(file_name, "w");
+    if (file == NULL) {
+      return;
+    }
+  }
+  /* Same format as the map of tools/bpftrace/glcew_call_counts.bt prints,
+   * only entry probes are of interest for the call profile.
+   */
+  for (counter = call_counters; counter != NULL; counter = counter->next) {
+    if (strstr(counter->name, "__entry") != NULL) {
+      fprintf(file, "@calls[glcew:%s]: %llu\n",
+              counter->name,
+              (unsigned long long)__atomic_load_n(&counter->count,
+                                                  __ATOMIC_RELAXED));
+    }
+  }
+  if (file != stderr) {
+    fclose(file);
+  }
+}
+
+void glcew_call_counter_register(GLCEWCallCounter* counter) {
+#  ifndef _WIN32
+  pthread_mutex_lock(&call_counters_mutex);
+#  endif
+  if (!counter->registered) {
+    if (call_counters == NULL) {
+      atexit(call_counters_print);
+    }
+    counter->next = call_counters;
+    call_counters = counter;
+    __atomic_store_n(&counter->registered, 1, __ATOMIC_RELEASE);
+  }
+#  ifndef _WIN32
+  pthread_mutex_unlock(&call_counters_mutex);
+#  endif
+}
+#endif
+
+/* ************************** Dispatch tables. *************************** */
+
+void glcew_dispatch_table_get_current(GLCEWDispatchTable* table) {
+  if (glcew_bound_table != NULL) {
+    *table = *glcew_bound_table;
+    return;
+  }
+%functions_dispatch_table_global_copy%
+}
+
+typedef struct GlobalTableEntry {
+  const char* name;
+  size_t offset;
+} GlobalTableEntry;
+
+static const GlobalTableEntry global_table_entries[] = {
+%functions_global_table_entries%
+};
+
+size_t glcew_global_table_offset(const char* name) {
+  size_t i;
+  for (i = 0; i < sizeof(global_table_entries) / sizeof(*global_table_entries);
+       ++i) {
+    if (strcmp(global_table_entries[i].name, name) == 0) {
+      return global_table_entries[i].offset;
+    }
+  }
+  return (size_t)-1;
+}
+
+void glcew_dispatch_table_load_proc_address(
+    GLCEWDispatchTable* table,
+    tglXGetProcAddressARB get_proc_address) {
+%functions_dispatch_table_getprocaddr%
+}
+
+const GLCEWDispatchTable* glcew_dispatch_table_bind(
+    const GLCEWDispatchTable* table) {
+  const GLCEWDispatchTable* previous_table = glcew_bound_table;
+  glcew_bound_table = table;
+  return previous_table;
+}
+
 /* ************************ Main wrangling logic. ************************ */
 
-static DynamicLibrary dynamic_library_open_find(const char** paths) {
+static DynamicLibrary dynamic_library_open_find(const char** paths,
+                                                int isolated) {
   int i = 0;
   while (paths[i] != NULL) {
-      DynamicLibrary lib = dynamic_library_open(paths[i]);
+      DynamicLibrary lib;
+#ifdef dynamic_library_open_isolated
+      if (isolated) {
+        lib = dynamic_library_open_isolated(paths[i]);
+      }
+      else
+#endif
+      {
+        (void) isolated;  /* Ignored. */
+        lib = dynamic_library_open(paths[i]);
+      }
       if (lib != NULL) {
         return lib;
       }
@@ -110,61 +366,377 @@ static DynamicLibrary dynamic_library_open_find(const char** paths) {
 }
 
 static void glcewExit(void) {
+  GLCEW_PROBE0(glcewExit__entry);
   if (gl_lib != NULL) {
     /*  Ignore errors. */
     dynamic_library_close(gl_lib);
     gl_lib = NULL;
   }
+  GLCEW_PROBE0(glcewExit__return);
 }
 
-int glcewInit(void) {
-  /* Library paths. */
-#ifdef _WIN32
-  const char* gl_paths[] = {"opengl32.dll"};
-#elif defined(__APPLE__)
-  const char* gl_paths[] = {NULL};
-#else
-  /* TODO(sergey): Check on an order. Angular does other way around. */
-  const char* gl_paths[] = {"libGL.so",
-                            "libGL.so.1",
-                            NULL};
-#endif
-  static int initialized = 0;
-  static int result = 0;
+static int glcew_init_locked(void) {
   int error;
 
   if (initialized) {
-    return result;
+    return init_result;
   }
 
   initialized = 1;
 
-  error = atexit(glcewExit);
-  if (error) {
-    result = GLCEW_ERROR_ATEXIT_FAILED;
-    return result;
+  if (!atexit_registered) {
+    error = atexit(glcewExit);
+    if (error) {
+      init_result = GLCEW_ERROR_ATEXIT_FAILED;
+      return init_result;
+    }
+    atexit_registered = 1;
   }
 
   /* Load library. */
-  gl_lib = dynamic_library_open_find(gl_paths);
+  gl_lib = dynamic_library_open_find(gl_paths, 0);
   if (gl_lib == NULL) {
-    result = GLCEW_ERROR_OPEN_FAILED;
-    return result;
+    init_result = GLCEW_ERROR_OPEN_FAILED;
+    return init_result;
   }
 
   /* Fetch all function pointers. */
 
 %functions_dynload%
 
-  result = GLCEW_SUCCESS;
+  global_table_update();
+
+  init_result = GLCEW_SUCCESS;
+  return init_result;
+}
+
+int glcewInit(void) {
+  int result;
+  GLCEW_PROBE0(glcewInit__entry);
+  init_lock();
+  keep_loaded = 1;
+  result = glcew_init_locked();
+  init_unlock();
+  GLCEW_PROBE1(glcewInit__return, result);
   return result;
 }
 
+void glcewUpdateDispatch(void) {
+  init_lock();
+  global_table_update();
+  init_unlock();
+}
+
+/* ****************************** Lifecycle. ***************************** */
+
+static void glcew_unload_locked(void) {
+  glcew_profile_unload();
+  glcew_validation_unload();
+  __atomic_add_fetch(&glcew_load_epoch, 1, __ATOMIC_RELEASE);
+  glcewExit();
+%functions_stub_assignments%
+  global_table_update();
+  initialized = 0;
+  init_result = 0;
+}
+
+static int glcew_can_unload_locked(void) {
+  return initialized && !keep_loaded && num_references == 0;
+}
+
+#ifndef _WIN32
+static void* idle_thread_run(void* user_data) {
+  (void) user_data;  /* Ignored. */
+  init_lock();
+  while (glcew_can_unload_locked()) {
+    const uint64_t deadline_ns = idle_since_ns +
+                                 (uint64_t)idle_timeout_ms * 1000000;
+    const uint64_t now_ns = glcew_time_ns();
+    struct timespec wakeup;
+    uint64_t remaining_ns;
+    if (now_ns >= deadline_ns) {
+      glcew_unload_locked();
+      break;
+    }
+    /* Condition variable waits on the realtime clock. */
+    remaining_ns = deadline_ns - now_ns;
+    clock_gettime(CLOCK_REALTIME, &wakeup);
+    wakeup.tv_sec += (time_t)(remaining_ns / 1000000000);
+    wakeup.tv_nsec += (long)(remaining_ns % 1000000000);
+    if (wakeup.tv_nsec >= 1000000000) {
+      wakeup.tv_nsec -= 1000000000;
+      ++wakeup.tv_sec;
+    }
+    pthread_cond_timedwait(&idle_condition, &init_mutex, &wakeup);
+  }
+  idle_thread_running = 0;
+  init_unlock();
+  return NULL;
+}
+#endif
+
+int glcewAcquire(void) {
+  int result;
+  init_lock();
+  result = glcew_init_locked();
+  if (result == GLCEW_SUCCESS) {
+    ++num_references;
+#ifndef _WIN32
+    pthread_cond_signal(&idle_condition);
+#endif
+  }
+  init_unlock();
+  return result;
+}
+
+void glcewRelease(void) {
+  init_lock();
+  assert(num_references > 0);
+  if (--num_references == 0 && glcew_can_unload_locked()) {
+#ifndef _WIN32
+    if (idle_timeout_ms != 0) {
+      idle_since_ns = glcew_time_ns();
+      if (!idle_thread_running) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, idle_thread_run, NULL) == 0) {
+          pthread_detach(thread);
+          idle_thread_running = 1;
+        }
+        else {
+          glcew_unload_locked();
+        }
+      }
+    }
+    else
+#endif
+    {
+      glcew_unload_locked();
+    }
+  }
+  init_unlock();
+}
+
+void glcewSetIdleTimeout(unsigned int timeout_ms) {
+  init_lock();
+  idle_timeout_ms = timeout_ms;
+#ifndef _WIN32
+  pthread_cond_signal(&idle_condition);
+#endif
+  init_unlock();
+}
+
+/* ***************************** Fork support. **************************** */
+
+#ifndef _WIN32
+static void atfork_prepare(void) {
+  init_lock();
+  glcew_stall_atfork_prepare();
+  glcew_texture_pool_atfork_prepare();
+  glcew_glx_cache_atfork_prepare();
+}
+
+static void atfork_parent(void) {
+  glcew_glx_cache_atfork_release();
+  glcew_texture_pool_atfork_release();
+  glcew_stall_atfork_release();
+  init_unlock();
+}
+
+static void atfork_child(void) {
+  /* Child only has the thread which called fork(), which is the one which
+   * holds the locks.
+   */
+  idle_thread_running = 0;
+  glcew_glx_cache_atfork_release();
+  glcew_texture_pool_atfork_release();
+  glcew_stall_atfork_release();
+  init_unlock();
+}
+
+static int atfork_register_locked(void) {
+  if (!atfork_registered) {
+    if (pthread_atfork(atfork_prepare, atfork_parent, atfork_child) != 0) {
+      return GLCEW_ERROR_ATFORK_FAILED;
+    }
+    atfork_registered = 1;
+  }
+  return GLCEW_SUCCESS;
+}
+#endif
+
+int glcew_atfork_register(void) {
+#ifdef _WIN32
+  return GLCEW_SUCCESS;
+#else
+  int result;
+  init_lock();
+  result = atfork_register_locked();
+  init_unlock();
+  return result;
+#endif
+}
+
+int glcewPrefork(void) {
+#ifdef _WIN32
+  return GLCEW_ERROR_UNSUPPORTED;
+#else
+  int result;
+  init_lock();
+  result = glcew_init_locked();
+  if (result == GLCEW_SUCCESS) {
+    result = atfork_register_locked();
+  }
+  init_unlock();
+  return result;
+#endif
+}
+
+/* ************************ Isolated instances. ************************* */
+
+static void dispatch_table_load(DynamicLibrary lib,
+                                GLCEWDispatchTable* table) {
+%functions_dispatch_table_dynload%
+}
+
+GLCEWInstance* glcewInstanceCreate(int* error) {
+  GLCEWInstance* instance;
+#ifndef dynamic_library_open_isolated
+  if (error != NULL) {
+    *error = GLCEW_ERROR_UNSUPPORTED;
+  }
+  return NULL;
+#else
+  instance = calloc(1, sizeof(GLCEWInstance));
+  if (instance == NULL) {
+    if (error != NULL) {
+      *error = GLCEW_ERROR_OPEN_FAILED;
+    }
+    return NULL;
+  }
+  instance->lib = dynamic_library_open_find(gl_paths, 1);
+  if (instance->lib == NULL) {
+    free(instance);
+    if (error != NULL) {
+      *error = GLCEW_ERROR_OPEN_FAILED;
+    }
+    return NULL;
+  }
+  dispatch_table_load(instance->lib, &instance->table);
+  if (error != NULL) {
+    *error = GLCEW_SUCCESS;
+  }
+  return instance;
+#endif
+}
+
+static void bound_instance_set(GLCEWInstance* instance);
+
+int glcewInstanceDestroy(GLCEWInstance* instance) {
+  int num_bound_here;
+  if (instance == NULL) {
+    return GLCEW_SUCCESS;
+  }
+  num_bound_here = (bound_instance == instance) ? 1 : 0;
+  /* Other threads would keep dispatching into the closed library. Binding
+   * and destroying is exclusive: once the state is switched no thread can
+   * bind the instance, and the switch fails if any thread has bound it.
+   */
+  if (!__atomic_compare_exchange_n(&instance->num_bound_threads,
+                                   &num_bound_here,
+                                   INSTANCE_DESTROYING,
+                                   0,
+                                   __ATOMIC_SEQ_CST,
+                                   __ATOMIC_SEQ_CST)) {
+    return GLCEW_ERROR_INSTANCE_BOUND;
+  }
+  if (num_bound_here) {
+    /* Binding count is gone with the state switch, only drop the thread's
+     * binding.
+     */
+    GLCEW_BATCH_FLUSH();
+    bound_instance_set(NULL);
+  }
+  /*  Ignore errors. */
+  dynamic_library_close(instance->lib);
+  free(instance);
+  return GLCEW_SUCCESS;
+}
+
+/* Returns zero if the instance is being destroyed. */
+static int instance_bind_thread(GLCEWInstance* instance) {
+  int num_bound_threads =
+      __atomic_load_n(&instance->num_bound_threads, __ATOMIC_SEQ_CST);
+  do {
+    if (num_bound_threads == INSTANCE_DESTROYING) {
+      return 0;
+    }
+  } while (!__atomic_compare_exchange_n(&instance->num_bound_threads,
+                                        &num_bound_threads,
+                                        num_bound_threads + 1,
+                                        1,
+                                        __ATOMIC_SEQ_CST,
+                                        __ATOMIC_SEQ_CST));
+  return 1;
+}
+
+static void instance_unbind_thread(GLCEWInstance* instance) {
+  __atomic_sub_fetch(&instance->num_bound_threads, 1, __ATOMIC_SEQ_CST);
+}
+
+#ifndef _WIN32
+static void bound_instance_key_destructor(void* instance) {
+  instance_unbind_thread(instance);
+}
+
+static void bound_instance_key_create(void) {
+  pthread_key_create(&bound_instance_key, bound_instance_key_destructor);
+}
+#endif
+
+static void bound_instance_set(GLCEWInstance* instance) {
+  bound_instance = instance;
+  glcew_bound_table = (instance != NULL) ? &instance->table : NULL;
+#ifndef _WIN32
+  pthread_once(&bound_instance_key_once, bound_instance_key_create);
+  pthread_setspecific(bound_instance_key, instance);
+#endif
+}
+
+int glcewInstanceBind(GLCEWInstance* instance) {
+  /* Queued draws are for the previously bound instance. */
+  GLCEW_BATCH_FLUSH();
+  if (instance == bound_instance) {
+    return GLCEW_SUCCESS;
+  }
+  if (instance != NULL && !instance_bind_thread(instance)) {
+    return GLCEW_ERROR_INSTANCE_DESTROYED;
+  }
+  if (bound_instance != NULL) {
+    instance_unbind_thread(bound_instance);
+  }
+  bound_instance_set(instance);
+  return GLCEW_SUCCESS;
+}
+
+GLCEWInstance* glcewInstanceGetBound(void) {
+  return bound_instance;
+}
+
+const GLCEWDispatchTable* glcewInstanceGetDispatchTable(
+    const GLCEWInstance* instance) {
+  return &instance->table;
+}
+
 const char* glcewErrorString(int error) {
   switch (error) {
     case GLCEW_SUCCESS: return "SUCCESS";
     case GLCEW_ERROR_OPEN_FAILED: return "OPEN_FAILED";
     case GLCEW_ERROR_ATEXIT_FAILED: return "ATEXIT_FAILED";
+    case GLCEW_ERROR_UNSUPPORTED: return "UNSUPPORTED";
+    case GLCEW_ERROR_ATFORK_FAILED: return "ATFORK_FAILED";
+    case GLCEW_ERROR_INSTANCE_BOUND: return "INSTANCE_BOUND";
+    case GLCEW_ERROR_INSTANCE_DESTROYED: return "INSTANCE_DESTROYED";
+    case GLCEW_ERROR_OUT_OF_MEMORY: return "OUT_OF_MEMORY";
   }
   return "UNKNOWN";
 }
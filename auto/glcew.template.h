@@ -18,6 +18,7 @@
 #define __GLCEW_H__
 
 #include <stdint.h>
+#include <stdio.h>
 #include <sys/types.h>
 
 #include <X11/Xlib.h>
@@ -74,6 +75,8 @@ typedef XID GLXPixmap;
 /* Function pointer declarations.
  *
  * Pointer to functions which are dynamically loaded from the library.
+ *
+ * NOTE: Wrappers do not read these on every call, see glcewUpdateDispatch().
  */
 
 %functions_pointer_declarations%
@@ -87,6 +90,26 @@ typedef XID GLXPixmap;
 
 %functions_wrapper_declarations%
 
+/* Dispatch table.
+ *
+ * Holds pointers to all the wrapped functions of a single loaded OpenGL
+ * implementation.
+ */
+
+typedef struct GLCEWDispatchTable {
+%functions_dispatch_table_members%
+} GLCEWDispatchTable;
+
+/* Dispatch table which the calling thread is bound to, by an instance or a
+ * pooled context, NULL when calls go to the global implementation. Read by
+ * the C++ dispatch layer, not to be assigned directly.
+ */
+#ifdef _MSC_VER
+extern __declspec(thread) const GLCEWDispatchTable* glcew_bound_table;
+#else
+extern __thread const GLCEWDispatchTable* glcew_bound_table;
+#endif
+
 /* ****************************************************************************
  * * GLCEW related API
  * */
@@ -95,11 +118,507 @@ enum {
   GLCEW_SUCCESS = 0,
   GLCEW_ERROR_OPEN_FAILED = -1,
   GLCEW_ERROR_ATEXIT_FAILED = -2,
+  GLCEW_ERROR_UNSUPPORTED = -3,
+  GLCEW_ERROR_ATFORK_FAILED = -4,
+  GLCEW_ERROR_INSTANCE_BOUND = -5,
+  GLCEW_ERROR_INSTANCE_DESTROYED = -6,
+  GLCEW_ERROR_OUT_OF_MEMORY = -7,
 };
 
 int glcewInit(void);
 const char* glcewErrorString(int error);
 
+/* Wrappers dispatch through an internal copy of the *_impl pointers, which
+ * is taken when the library is loaded or unloaded. Application which assigns
+ * the pointers afterwards (to intercept calls, for example) is to call this
+ * for the wrappers to follow them.
+ */
+void glcewUpdateDispatch(void);
+
+/* Reference-counted library lifetime.
+ *
+ * glcewAcquire() loads the library if needed. When the last reference is
+ * released and idle timeout has passed, the library is unloaded and all the
+ * function pointers are replaced with stubs which do nothing, the next
+ * glcewAcquire() loads the library again. Profiler, validation and draw
+ * batching are disabled by the unload, and are to be enabled again after
+ * the library is loaded if needed.
+ *
+ * Library loaded by glcewInit() is never unloaded before exit. Context pools
+ * which were created from the global implementation are to be destroyed
+ * before releasing the last reference.
+ */
+int glcewAcquire(void);
+void glcewRelease(void);
+void glcewSetIdleTimeout(unsigned int timeout_ms);
+
+/* Prepare process for forking workers.
+ *
+ * Initializes the wrangler, so forked children share the loaded library
+ * copy-on-write instead of loading it again, and registers fork handlers
+ * which keep GLCEW's internal locks consistent in the children. Driver
+ * work which depends on a context is still done by every child.
+ *
+ * Fork handlers are also registered by glcewStallDetectorEnable(),
+ * glcewTexturePoolEnable() and glcewGLXCacheEnable(), which fail with
+ * GLCEW_ERROR_ATFORK_FAILED if they can not be, so forking without prefork
+ * is safe as well.
+ *
+ * Must be called without any context being current.
+ */
+int glcewPrefork(void);
+
+/* ****************************************************************************
+ * * Isolated OpenGL implementations
+ * */
+
+typedef struct GLCEWInstance GLCEWInstance;
+
+/* Load an independent copy of the OpenGL library and all its dependencies
+ * into a new link-map namespace (dlmopen(LM_ID_NEWLM, ...)), so it does not
+ * share any global driver state with the other instances.
+ *
+ * NOTE: glibc limits number of namespaces to 16, including the default one.
+ * Only available on platforms with dlmopen(), otherwise NULL is returned and
+ * error is set to GLCEW_ERROR_UNSUPPORTED.
+ */
+GLCEWInstance* glcewInstanceCreate(int* error);
+
+/* Destroy the instance, releasing its binding to the calling thread. Fails
+ * with GLCEW_ERROR_INSTANCE_BOUND while any other thread has the instance
+ * bound, such threads are to bind another instance (or NULL) or to exit
+ * first. Binding and destroying are exclusive: once destroy has started,
+ * glcewInstanceBind() of the instance fails.
+ */
+int glcewInstanceDestroy(GLCEWInstance* instance);
+
+/* Make all wrappers called from the calling thread to dispatch to the given
+ * instance. Passing NULL makes the thread to use the global implementation
+ * loaded by glcewInit(). Instance stays bound until another one is bound or
+ * the thread exits.
+ *
+ * Returns GLCEW_ERROR_INSTANCE_DESTROYED if the instance is being destroyed
+ * by another thread, the calling thread keeps its previous binding then.
+ */
+int glcewInstanceBind(GLCEWInstance* instance);
+GLCEWInstance* glcewInstanceGetBound(void);
+const GLCEWDispatchTable* glcewInstanceGetDispatchTable(
+    const GLCEWInstance* instance);
+
+/* ****************************************************************************
+ * * Context pool
+ * */
+
+typedef struct GLCEWContextPool GLCEWContextPool;
+typedef struct GLCEWPooledContext GLCEWPooledContext;
+
+typedef struct GLCEWContextPoolSettings {
+  Display* display;
+  XVisualInfo* visual;
+  /* Number of contexts to be created. */
+  int size;
+  /* Share objects between all the contexts of the pool. */
+  int share_objects;
+  /* Request direct rendering contexts. */
+  int direct;
+  /* Size of GLX pixmaps which are created as context drawables. */
+  int width;
+  int height;
+  /* Issue a clear and a finish on every context, so the driver allocates
+   * its resources before the first acquire.
+   */
+  int warm_up;
+} GLCEWContextPoolSettings;
+
+typedef struct GLCEWContextPoolMetrics {
+  uint64_t num_acquires;
+  /* Acquires which failed because all the contexts were in use. */
+  uint64_t num_exhausted;
+  uint64_t total_acquire_ns;
+  uint64_t max_acquire_ns;
+} GLCEWContextPoolMetrics;
+
+/* Create all the contexts and drawables of the pool upfront.
+ *
+ * NOTE: When pool is used from multiple threads XInitThreads() is to be
+ * called by the application.
+ */
+GLCEWContextPool* glcewContextPoolCreate(
+    const GLCEWContextPoolSettings* settings, int* error);
+void glcewContextPoolDestroy(GLCEWContextPool* pool);
+
+/* Take an unused context from the pool and make it current for the calling
+ * thread, wrappers called from the thread will use entry points resolved for
+ * this context. Returns NULL if all the contexts are in use.
+ */
+GLCEWPooledContext* glcewContextPoolAcquire(GLCEWContextPool* pool);
+
+/* Reset commonly changed state and return context to the pool. Is to be
+ * called from the thread which acquired the context.
+ */
+void glcewContextPoolRelease(GLCEWContextPool* pool,
+                             GLCEWPooledContext* context);
+
+void glcewContextPoolGetMetrics(GLCEWContextPool* pool,
+                                GLCEWContextPoolMetrics* metrics);
+
+GLXContext glcewPooledContextGetContext(const GLCEWPooledContext* context);
+GLXDrawable glcewPooledContextGetDrawable(const GLCEWPooledContext* context);
+const GLCEWDispatchTable* glcewPooledContextGetDispatchTable(
+    const GLCEWPooledContext* context);
+
+/* ****************************************************************************
+ * * Validation
+ * */
+
+#define GLCEW_VALIDATION_MAX_MESSAGE_LENGTH 256
+
+enum {
+  /* Deliver messages from the thread which caused them, which makes the
+   * attribution to the wrapped function exact.
+   */
+  GLCEW_VALIDATION_SYNCHRONOUS = (1 << 0),
+  /* Also collect messages of notification severity. */
+  GLCEW_VALIDATION_NOTIFICATIONS = (1 << 1),
+};
+
+typedef struct GLCEWValidationMessage {
+  GLenum source;
+  GLenum type;
+  GLuint id;
+  GLenum severity;
+  /* Last wrapped function called from the thread which received the
+   * message, NULL if there was no such call.
+   */
+  const char* function;
+  char message[GLCEW_VALIDATION_MAX_MESSAGE_LENGTH];
+} GLCEWValidationMessage;
+
+/* Enable debug output for the context which is current for the calling
+ * thread and collect its messages, instead of checking glGetError() after
+ * every call. Returns GLCEW_ERROR_UNSUPPORTED unless the context is OpenGL
+ * 4.3 or has GL_KHR_debug or GL_ARB_debug_output.
+ *
+ * The context is not recreated with the debug flag, it is to be requested
+ * by the application when creating the context (GLX_CONTEXT_DEBUG_BIT_ARB),
+ * otherwise the driver might only report a subset of errors.
+ */
+int glcewValidationEnable(int flags);
+void glcewValidationDisable(void);
+
+/* Take the oldest collected message, returns 0 if there are none. */
+int glcewValidationPoll(GLCEWValidationMessage* message);
+
+/* Number of messages which were lost because the queue was full. */
+uint64_t glcewValidationNumDropped(void);
+
+/* ****************************************************************************
+ * * Draw call batching
+ * */
+
+/* Number of power-of-two buckets in the batch size histogram. */
+#define GLCEW_BATCH_HISTOGRAM_SIZE 12
+
+typedef struct GLCEWBatchStats {
+  /* Draw calls received by the wrappers while batching was enabled. */
+  uint64_t num_draws;
+  /* Multi-draw (or single draw) calls issued to the library. */
+  uint64_t num_flushes;
+  /* Bucket i counts flushes of [2^(i-1) + 1 .. 2^i] draws. */
+  uint64_t histogram[GLCEW_BATCH_HISTOGRAM_SIZE];
+} GLCEWBatchStats;
+
+/* Coalesce consecutive glDrawArrays()/glDrawElements() calls with the same
+ * mode (and index type) on the calling thread into glMultiDrawArrays() and
+ * glMultiDrawElements(). Queued draws are flushed by any other wrapper,
+ * by glcewBatchFlush(), by glcewBatchDisable() and before the thread
+ * switches to another context with glcewContextPoolAcquire() or to another
+ * instance with glcewInstanceBind().
+ *
+ * glDrawElements() with indices in client memory is never queued, since the
+ * indices might be gone by the time the batch is flushed. The element buffer
+ * binding is queried when a batch of indexed draws starts. Vertex data is
+ * expected to be in buffer objects.
+ *
+ * NOTE: Functions which are not wrapped by GLCEW (such as the ones loaded by
+ * GLEW) do not flush the queue, so glcewBatchFlush() is to be called before
+ * changing state with them.
+ */
+int glcewBatchEnable(void);
+void glcewBatchDisable(void);
+void glcewBatchFlush(void);
+void glcewBatchGetStats(GLCEWBatchStats* stats);
+
+/* ****************************************************************************
+ * * Texture pool
+ * */
+
+/* Make glDeleteTextures() park textures acquired from the pool instead of
+ * destroying them. Other textures are destroyed as usual.
+ */
+#define GLCEW_TEXTURE_POOL_WRAP_DELETE (1 << 0)
+
+typedef struct GLCEWTexturePoolStats {
+  /* Acquires which were satisfied by a parked texture. */
+  uint64_t num_hits;
+  /* Acquires which had to create a new texture. */
+  uint64_t num_misses;
+  /* Parked textures destroyed to stay under the memory limit. */
+  uint64_t num_evictions;
+  /* Textures currently parked in the pool and their estimated size. */
+  uint64_t num_parked;
+  uint64_t parked_bytes;
+} GLCEWTexturePoolStats;
+
+/* Recycle texture objects together with their storage. Parked textures are
+ * matched by target, internal format, size and number of levels, least
+ * recently parked ones are destroyed first when the estimated size of the
+ * parked textures exceeds max_bytes (0 means no limit).
+ *
+ * Parked textures are unbound from all the texture units they are bound to,
+ * as seen by the glBindTexture() and glActiveTexture() wrappers since the
+ * pool was enabled. They are not detached from framebuffers, this is to be
+ * done by the application before releasing them.
+ *
+ * NOTE: Texture names belong to a context (or a share group), the pool is
+ * to be used with a single one, which is to be current when calling any of
+ * the functions below and the wrappers above. Textures acquired from the
+ * pool are not to be bound by functions which are not wrapped by GLCEW.
+ */
+int glcewTexturePoolEnable(uint64_t max_bytes, int flags);
+/* Destroy all parked textures and stop recycling. */
+void glcewTexturePoolDisable(void);
+/* Get texture with the given storage, bound to the target. Texture is taken
+ * from the pool if possible, so its content is undefined. Otherwise a new
+ * texture is created, with storage allocated using the given format and type.
+ * Returns 0 if the pool is disabled.
+ *
+ * Filters, wrap modes, base and max level, compare mode and swizzle of a
+ * recycled texture are reset to the defaults of a new texture, other
+ * parameters (LOD range and bias, border color) keep the values set by its
+ * previous owner.
+ */
+GLuint glcewTexturePoolAcquire(GLenum target,
+                               GLsizei levels,
+                               GLenum internal_format,
+                               GLsizei width,
+                               GLsizei height,
+                               GLenum format,
+                               GLenum type);
+/* Park texture in the pool, texture is destroyed if it was not acquired
+ * from the pool. Acquired textures are to be returned with this function
+ * (or with glDeleteTextures() when GLCEW_TEXTURE_POOL_WRAP_DELETE is used),
+ * deleting them with glDeleteTextures() otherwise removes them from the pool.
+ */
+void glcewTexturePoolRelease(GLuint texture);
+void glcewTexturePoolGetStats(GLCEWTexturePoolStats* stats);
+
+/* ****************************************************************************
+ * * Frame export
+ * */
+
+/* Block in glcewFrameExportReadPixels() until the consumer frees a slot,
+ * instead of dropping the frame. Waiting is bounded by block_timeout_ms, so
+ * a consumer which crashed does not stall the producer. Once the wait timed
+ * out, frames are dropped without waiting until the consumer frees a slot.
+ */
+#define GLCEW_FRAME_EXPORT_BLOCK (1 << 0)
+
+typedef struct GLCEWFrameExport GLCEWFrameExport;
+typedef struct GLCEWFrameImport GLCEWFrameImport;
+
+typedef struct GLCEWFrameExportSettings {
+  /* Size of the region which is read back. */
+  int width;
+  int height;
+  /* Format and type passed to glReadPixels(). */
+  GLenum format;
+  GLenum type;
+  /* Number of frame slots in the ring. */
+  int num_slots;
+  int flags;
+  /* Longest wait for a free slot with GLCEW_FRAME_EXPORT_BLOCK, 0 means the
+   * default of one second.
+   */
+  int block_timeout_ms;
+} GLCEWFrameExportSettings;
+
+typedef struct GLCEWFrameExportStats {
+  uint64_t num_frames;
+  /* Frames which were dropped because the ring was full. */
+  uint64_t num_dropped;
+  /* Bytes written directly into the shared slots. */
+  uint64_t num_bytes;
+} GLCEWFrameExportStats;
+
+typedef struct GLCEWFrame {
+  const void* data;
+  int width;
+  int height;
+  /* Distance between rows in bytes. */
+  int stride;
+  GLenum format;
+  GLenum type;
+  /* Number of the frame, counting from 0, and its readback time. */
+  uint64_t sequence;
+  uint64_t timestamp_ns;
+} GLCEWFrame;
+
+/* Create a ring of frame slots in sealed anonymous shared memory, which is
+ * shared with a consumer process by the file descriptor. Frames are read
+ * back directly into the slots, and handed over to the consumer through
+ * futexes in the same memory.
+ *
+ * NOTE: Only available on Linux, otherwise NULL is returned and error is
+ * set to GLCEW_ERROR_UNSUPPORTED.
+ */
+GLCEWFrameExport* glcewFrameExportCreate(
+    const GLCEWFrameExportSettings* settings, int* error);
+void glcewFrameExportDestroy(GLCEWFrameExport* frame_export);
+
+/* Descriptor of the shared memory, to be passed to the consumer (for example
+ * over a UNIX socket, or inherited). Descriptor is owned by the export.
+ */
+int glcewFrameExportGetFd(const GLCEWFrameExport* frame_export);
+
+/* Read back the region at (x, y) of the current read buffer into the next
+ * slot and publish it. Returns 0 if the frame was dropped.
+ *
+ * NOTE: Pixel pack state other than GL_PACK_ALIGNMENT is to be left at its
+ * default values.
+ */
+int glcewFrameExportReadPixels(GLCEWFrameExport* frame_export, int x, int y);
+void glcewFrameExportGetStats(const GLCEWFrameExport* frame_export,
+                              GLCEWFrameExportStats* stats);
+
+/* Consumer side, which does not need OpenGL to be loaded. Descriptor is
+ * not owned by the import and can be closed once the import is opened.
+ */
+GLCEWFrameImport* glcewFrameImportOpen(int fd, int* error);
+void glcewFrameImportClose(GLCEWFrameImport* frame_import);
+
+/* Wait for the next frame for up to timeout_ms (negative waits forever).
+ * Returns 1 if the frame is available, 0 on timeout, and -1 if the export
+ * was destroyed and all its frames are consumed. Frame data stays valid
+ * until glcewFrameImportRelease() is called.
+ */
+int glcewFrameImportAcquire(GLCEWFrameImport* frame_import,
+                            int timeout_ms,
+                            GLCEWFrame* frame);
+void glcewFrameImportRelease(GLCEWFrameImport* frame_import);
+
+/* ****************************************************************************
+ * * GLX query cache
+ * */
+
+typedef struct GLCEWGLXCacheStats {
+  uint64_t num_hits;
+  /* Queries which were passed to the server. */
+  uint64_t num_misses;
+  /* Displays registered for the close notification, once per display
+   * until it is closed.
+   */
+  uint64_t num_registrations;
+} GLCEWGLXCacheStats;
+
+/* Memoize glXChooseVisual(), glXQueryExtensionsString() and
+ * glXQueryVersion() per display and screen, so repeated queries do not
+ * round-trip to the X server. Visuals are keyed by the normalized attribute
+ * list, so the order of attributes does not matter. Entries of a display
+ * are dropped when the display is closed.
+ *
+ * NOTE: Visual info returned by glXChooseVisual() is still to be freed by
+ * XFree(), as usual.
+ */
+int glcewGLXCacheEnable(void);
+/* Stop caching and drop all the cached queries. Displays stay registered
+ * for the close notification.
+ */
+void glcewGLXCacheDisable(void);
+/* Drop cached queries of the display, for example when server
+ * configuration changes.
+ */
+void glcewGLXCacheInvalidate(Display* display);
+void glcewGLXCacheGetStats(GLCEWGLXCacheStats* stats);
+
+/* ****************************************************************************
+ * * GPU profiling
+ * */
+
+/* Maximum number of frames for which results are allowed to be in flight
+ * before they are read back.
+ */
+#define GLCEW_PROFILE_MAX_FRAME_LATENCY 8
+
+/* Number of 1ms wide buckets in the frame time histogram. Last bucket
+ * accumulates all frames which took longer than that.
+ */
+#define GLCEW_PROFILE_HISTOGRAM_SIZE 64
+
+typedef struct GLCEWProfileStats {
+  const char* label;
+  uint64_t count;
+  double total_ms;
+  double min_ms;
+  double max_ms;
+  double mean_ms;
+  /* Percentiles are calculated over the most recent samples only. */
+  double p50_ms;
+  double p90_ms;
+  double p99_ms;
+} GLCEWProfileStats;
+
+/* Enable profiling for the OpenGL context which is current for the calling
+ * thread.
+ *
+ * Results are read back frame_latency frames after they were issued, so the
+ * profiler never waits for the GPU. Frame boundaries are taken from the
+ * glXSwapBuffers() wrapper, or can be marked with glcewProfileFrame().
+ * Frame boundaries and regions are only recorded from the calling thread
+ * while the same context is current, others are ignored.
+ */
+int glcewProfileEnable(int frame_latency);
+void glcewProfileDisable(void);
+void glcewProfileReset(void);
+
+/* Mark GPU time region. Regions can be nested, but must not span the frame
+ * boundary. Label is expected to be a string which stays valid while the
+ * profiler is used, identical labels are aggregated together.
+ */
+void glcewProfileBegin(const char* label);
+void glcewProfileEnd(void);
+void glcewProfileFrame(void);
+
+int glcewProfileNumLabels(void);
+int glcewProfileGetStats(int index, GLCEWProfileStats* stats);
+int glcewProfileGetFrameStats(GLCEWProfileStats* stats);
+void glcewProfileGetFrameHistogram(
+    uint64_t histogram[GLCEW_PROFILE_HISTOGRAM_SIZE]);
+int glcewProfileDumpJSON(FILE* file);
+
+/* ****************************************************************************
+ * * Pipeline stall detector
+ * */
+
+enum {
+  /* Print report to stderr when the application exits. */
+  GLCEW_STALL_REPORT_AT_EXIT = (1 << 0),
+};
+
+/* Enable timing of wrappers which might drain the pipeline (glFinish,
+ * glReadPixels, glGetTexImage, glGet*v, glXWaitGL).
+ *
+ * Only every sample_rate-th call is timed. Calls which took longer than
+ * threshold_us are recorded with a backtrace of the caller. Identical
+ * backtraces are merged together, keeping hit count and total stall time.
+ *
+ * Returns GLCEW_ERROR_UNSUPPORTED on Windows.
+ */
+int glcewStallDetectorEnable(uint64_t threshold_us, int sample_rate, int flags);
+void glcewStallDetectorDisable(void);
+void glcewStallDetectorReset(void);
+int glcewStallDetectorReport(FILE* file);
+
 #ifdef __cplusplus
 }
 #endif
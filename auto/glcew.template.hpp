@@ -0,0 +1,281 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#ifndef __GLCEW_HPP__
+#define __GLCEW_HPP__
+
+/* Header-only C++17 dispatch layer.
+ *
+ * Functions from this header call the loaded implementation directly,
+ * without going through the out-of-line wrappers of the C library. Every
+ * call compiles to a load of the thread local glcew_bound_table, a branch on
+ * it being NULL, a load of the entry point and an indirect call.
+ *
+ * Table bound to the thread is the one of the C library, so calls go to the
+ * same implementation as the C wrappers: the instance bound with
+ * glcewInstanceBind(), the pooled context acquired by the thread, or the
+ * global implementation (the *_impl pointers, which are read on every call,
+ * so the layer follows the library being loaded and unloaded).
+ *
+ * NOTE: Calls made through this layer bypass the wrapper hooks (profiler
+ * frame boundaries, stall detector, call tracking for validation, draw
+ * batching). Call glcewBatchFlush() before mixing them with batched draws of
+ * the C wrappers.
+ */
+
+#include <glcew.h>
+
+#include <utility>
+
+#if defined(__GNUC__) || defined(__clang__)
+#  define GLCEW_ALWAYS_INLINE [[gnu::always_inline]]
+#else
+#  define GLCEW_ALWAYS_INLINE
+#endif
+
+namespace glcew {
+
+/* ****************************************************************************
+ * * Dispatch table
+ * */
+
+/* Index of every wrapped function. */
+enum class Function : int {
+%functions_cxx_enumerators%
+  NUM_FUNCTIONS
+};
+
+template <Function F>
+struct FunctionTraits;
+
+#define GLCEW_FUNCTION_TRAITS(name)                               \
+  template <>                                                     \
+  struct FunctionTraits<Function::name> {                         \
+    static constexpr auto member = &GLCEWDispatchTable::name;     \
+    GLCEW_ALWAYS_INLINE static auto global() {                    \
+      return ::name##_impl;                                       \
+    }                                                             \
+  }
+
+%functions_cxx_traits%
+
+#undef GLCEW_FUNCTION_TRAITS
+
+template <Function F>
+GLCEW_ALWAYS_INLINE inline auto get() {
+  const GLCEWDispatchTable* table = ::glcew_bound_table;
+  return (table != nullptr) ? table->*FunctionTraits<F>::member
+                            : FunctionTraits<F>::global();
+}
+
+template <Function F, typename... Args>
+GLCEW_ALWAYS_INLINE inline decltype(auto) call(Args&&... args) {
+  return get<F>()(std::forward<Args>(args)...);
+}
+
+/* Make calls from the current thread, of both this layer and the C wrappers,
+ * go to the given table, or to the global implementation when it is nullptr.
+ * Table is not copied, it is to stay valid while it is bound. Binding of an
+ * instance or a pooled context replaces it. Returns previously bound table.
+ */
+inline const GLCEWDispatchTable* bindDispatchTable(
+    const GLCEWDispatchTable* table) {
+  const GLCEWDispatchTable* previous_table = ::glcew_bound_table;
+  ::glcew_bound_table = table;
+  return previous_table;
+}
+
+inline int init() {
+  return glcewInit();
+}
+
+/* ****************************************************************************
+ * * Functions
+ * */
+
+%functions_cxx_wrappers%
+
+/* ****************************************************************************
+ * * Typed enumerators
+ * */
+
+enum class Capability : GLenum {
+  BLEND = 0x0BE2,
+  CULL_FACE = 0x0B44,
+  DEPTH_TEST = 0x0B71,
+  SCISSOR_TEST = 0x0C11,
+  STENCIL_TEST = 0x0B90,
+  TEXTURE_2D = 0x0DE1,
+};
+
+enum class PrimitiveMode : GLenum {
+  POINTS = 0x0000,
+  LINES = 0x0001,
+  LINE_LOOP = 0x0002,
+  LINE_STRIP = 0x0003,
+  TRIANGLES = 0x0004,
+  TRIANGLE_STRIP = 0x0005,
+  TRIANGLE_FAN = 0x0006,
+};
+
+enum class IndexType : GLenum {
+  UNSIGNED_BYTE = 0x1401,
+  UNSIGNED_SHORT = 0x1403,
+  UNSIGNED_INT = 0x1405,
+};
+
+enum class TextureTarget : GLenum {
+  TEXTURE_1D = 0x0DE0,
+  TEXTURE_2D = 0x0DE1,
+};
+
+enum class ClearMask : GLbitfield {
+  DEPTH = 0x00000100,
+  STENCIL = 0x00000400,
+  COLOR = 0x00004000,
+};
+
+GLCEW_ALWAYS_INLINE inline constexpr ClearMask operator|(ClearMask a,
+                                                         ClearMask b) {
+  return static_cast<ClearMask>(static_cast<GLbitfield>(a) |
+                                static_cast<GLbitfield>(b));
+}
+
+GLCEW_ALWAYS_INLINE inline void glEnable(Capability cap) {
+  glcew::glEnable(static_cast<GLenum>(cap));
+}
+
+GLCEW_ALWAYS_INLINE inline void glDisable(Capability cap) {
+  glcew::glDisable(static_cast<GLenum>(cap));
+}
+
+GLCEW_ALWAYS_INLINE inline bool glIsEnabled(Capability cap) {
+  return glcew::glIsEnabled(static_cast<GLenum>(cap)) != 0;
+}
+
+GLCEW_ALWAYS_INLINE inline void glClear(ClearMask mask) {
+  glcew::glClear(static_cast<GLbitfield>(mask));
+}
+
+GLCEW_ALWAYS_INLINE inline void glBindTexture(TextureTarget target,
+                                              GLuint texture) {
+  glcew::glBindTexture(static_cast<GLenum>(target), texture);
+}
+
+GLCEW_ALWAYS_INLINE inline void glDrawArrays(PrimitiveMode mode,
+                                             GLint first,
+                                             GLsizei count) {
+  glcew::glDrawArrays(static_cast<GLenum>(mode), first, count);
+}
+
+GLCEW_ALWAYS_INLINE inline void glDrawElements(PrimitiveMode mode,
+                                               GLsizei count,
+                                               IndexType type,
+                                               const GLvoid* indices) {
+  glcew::glDrawElements(static_cast<GLenum>(mode),
+                        count,
+                        static_cast<GLenum>(type),
+                        indices);
+}
+
+/* ****************************************************************************
+ * * RAII helpers
+ * */
+
+/* Make context current for the lifetime of the object, restoring the
+ * previously current context afterwards.
+ */
+class ScopedMakeCurrent {
+ public:
+  ScopedMakeCurrent(Display* display, GLXDrawable drawable, GLXContext context)
+      : display_(display),
+        previous_drawable_(glcew::glXGetCurrentDrawable()),
+        previous_context_(glcew::glXGetCurrentContext()) {
+    is_current_ = glcew::glXMakeCurrent(display, drawable, context) != 0;
+  }
+
+  ~ScopedMakeCurrent() {
+    glcew::glXMakeCurrent(display_, previous_drawable_, previous_context_);
+  }
+
+  ScopedMakeCurrent(const ScopedMakeCurrent&) = delete;
+  ScopedMakeCurrent& operator=(const ScopedMakeCurrent&) = delete;
+
+  explicit operator bool() const {
+    return is_current_;
+  }
+
+ private:
+  Display* display_;
+  GLXDrawable previous_drawable_;
+  GLXContext previous_context_;
+  bool is_current_;
+};
+
+/* Bind calls from the current thread to an instance for the lifetime of the
+ * object.
+ */
+class ScopedInstanceBind {
+ public:
+  explicit ScopedInstanceBind(GLCEWInstance* instance)
+      : previous_instance_(glcewInstanceGetBound()) {
+    glcewInstanceBind(instance);
+  }
+
+  ~ScopedInstanceBind() {
+    glcewInstanceBind(previous_instance_);
+  }
+
+  ScopedInstanceBind(const ScopedInstanceBind&) = delete;
+  ScopedInstanceBind& operator=(const ScopedInstanceBind&) = delete;
+
+ private:
+  GLCEWInstance* previous_instance_;
+};
+
+/* Acquire context from the pool for the lifetime of the object. */
+class ScopedPooledContext {
+ public:
+  explicit ScopedPooledContext(GLCEWContextPool* pool)
+      : pool_(pool),
+        context_(glcewContextPoolAcquire(pool)) {
+  }
+
+  ~ScopedPooledContext() {
+    if (context_ != nullptr) {
+      glcewContextPoolRelease(pool_, context_);
+    }
+  }
+
+  ScopedPooledContext(const ScopedPooledContext&) = delete;
+  ScopedPooledContext& operator=(const ScopedPooledContext&) = delete;
+
+  explicit operator bool() const {
+    return context_ != nullptr;
+  }
+
+  GLCEWPooledContext* get() const {
+    return context_;
+  }
+
+ private:
+  GLCEWContextPool* pool_;
+  GLCEWPooledContext* context_;
+};
+
+}  // namespace glcew
+
+#endif  /* __GLCEW_HPP__ */
@@ -0,0 +1,310 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Draw batching benchmark.
+ *
+ * Every frame is a grid of 128x128 quads, each drawn by its own glDrawArrays()
+ * or glDrawElements() call, with and without batching. Images rendered with
+ * batching are compared against the ones rendered without it, including
+ * draws which take indices from client memory which is overwritten right
+ * after the call. Draws queued after the thread is bound to another dispatch
+ * table are merged into the multi-draw of that table.
+ *
+ * Usage: benchglcew_batch [num_frames]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "glcew.h"
+#include "glcew_intern.h"
+#include "glcewTestContext.h"
+
+#define GRID_SIZE 128
+#define NUM_QUADS (GRID_SIZE * GRID_SIZE)
+#define FRAMEBUFFER_SIZE 256
+
+#define GL_ARRAY_BUFFER 0x8892
+#define GL_ELEMENT_ARRAY_BUFFER 0x8893
+#define GL_STATIC_DRAW 0x88E4
+#define GL_VERTEX_ARRAY 0x8074
+#define GL_COLOR_ARRAY 0x8076
+#define GL_FLOAT 0x1406
+#define GL_UNSIGNED_BYTE 0x1401
+#define GL_UNSIGNED_INT 0x1405
+#define GL_RGBA 0x1908
+#define GL_TRIANGLES 0x0004
+
+typedef void (*tglGenBuffers) (GLsizei n, GLuint* buffers);
+typedef void (*tglBindBuffer) (GLenum target, GLuint buffer);
+typedef void (*tglBufferData) (GLenum target,
+                               intptr_t size,
+                               const void* data,
+                               GLenum usage);
+typedef void (*tglEnableClientState) (GLenum array);
+typedef void (*tglVertexPointer) (GLint size,
+                                  GLenum type,
+                                  GLsizei stride,
+                                  const void* pointer);
+
+typedef struct Vertex {
+  float position[2];
+  unsigned char color[4];
+} Vertex;
+
+static tglBindBuffer bind_buffer;
+static GLuint element_buffer;
+static unsigned char pixels[FRAMEBUFFER_SIZE * FRAMEBUFFER_SIZE * 4];
+
+static int scene_create(void) {
+  tglGenBuffers gen_buffers =
+      (tglGenBuffers)test_context_proc_address("glGenBuffers");
+  tglBufferData buffer_data =
+      (tglBufferData)test_context_proc_address("glBufferData");
+  tglEnableClientState enable_client_state =
+      (tglEnableClientState)test_context_proc_address("glEnableClientState");
+  tglVertexPointer vertex_pointer =
+      (tglVertexPointer)test_context_proc_address("glVertexPointer");
+  tglVertexPointer color_pointer =
+      (tglVertexPointer)test_context_proc_address("glColorPointer");
+  Vertex* vertices;
+  GLuint* indices;
+  GLuint buffers[2];
+  int x, y, i;
+  bind_buffer = (tglBindBuffer)test_context_proc_address("glBindBuffer");
+  if (gen_buffers == NULL || bind_buffer == NULL || buffer_data == NULL ||
+      enable_client_state == NULL || vertex_pointer == NULL ||
+      color_pointer == NULL) {
+    return 0;
+  }
+  vertices = malloc(sizeof(Vertex) * NUM_QUADS * 6);
+  indices = malloc(sizeof(GLuint) * NUM_QUADS * 6);
+  if (vertices == NULL || indices == NULL) {
+    free(vertices);
+    free(indices);
+    return 0;
+  }
+  /* Two triangles per grid cell, with a small gap between the cells. */
+  for (y = 0; y < GRID_SIZE; ++y) {
+    for (x = 0; x < GRID_SIZE; ++x) {
+      static const int corners[6][2] = {
+        {0, 0}, {1, 0}, {1, 1}, {0, 0}, {1, 1}, {0, 1}};
+      const float cell = 2.0f / GRID_SIZE;
+      const int quad = y * GRID_SIZE + x;
+      for (i = 0; i < 6; ++i) {
+        Vertex* vertex = &vertices[quad * 6 + i];
+        vertex->position[0] = -1.0f + cell * (x + corners[i][0] * 0.8f);
+        vertex->position[1] = -1.0f + cell * (y + corners[i][1] * 0.8f);
+        vertex->color[0] = (unsigned char)(x * 2);
+        vertex->color[1] = (unsigned char)(y * 2);
+        vertex->color[2] = (unsigned char)(quad * 7);
+        vertex->color[3] = 255;
+        indices[quad * 6 + i] = (GLuint)(quad * 6 + i);
+      }
+    }
+  }
+  gen_buffers(2, buffers);
+  bind_buffer(GL_ARRAY_BUFFER, buffers[0]);
+  buffer_data(GL_ARRAY_BUFFER,
+              sizeof(Vertex) * NUM_QUADS * 6, vertices, GL_STATIC_DRAW);
+  element_buffer = buffers[1];
+  bind_buffer(GL_ELEMENT_ARRAY_BUFFER, element_buffer);
+  buffer_data(GL_ELEMENT_ARRAY_BUFFER,
+              sizeof(GLuint) * NUM_QUADS * 6, indices, GL_STATIC_DRAW);
+  enable_client_state(GL_VERTEX_ARRAY);
+  enable_client_state(GL_COLOR_ARRAY);
+  vertex_pointer(2, GL_FLOAT, sizeof(Vertex), (const void*)0);
+  color_pointer(4, GL_UNSIGNED_BYTE, sizeof(Vertex),
+                (const void*)offsetof(Vertex, color));
+  free(vertices);
+  free(indices);
+  return 1;
+}
+
+static void draw_arrays_frame(void) {
+  int i;
+  glClear(GL_COLOR_BUFFER_BIT);
+  for (i = 0; i < NUM_QUADS; ++i) {
+    glDrawArrays(GL_TRIANGLES, i * 6, 6);
+  }
+  glcewBatchFlush();
+}
+
+static void draw_elements_frame(void) {
+  int i;
+  glClear(GL_COLOR_BUFFER_BIT);
+  for (i = 0; i < NUM_QUADS; ++i) {
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT,
+                   (const GLvoid*)(sizeof(GLuint) * 6 * i));
+  }
+  glcewBatchFlush();
+}
+
+/* Indices in client memory are overwritten right after every draw. */
+static void draw_client_indices_frame(void) {
+  GLuint indices[6];
+  int i, j;
+  bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  glClear(GL_COLOR_BUFFER_BIT);
+  for (i = 0; i < NUM_QUADS; i += 97) {
+    for (j = 0; j < 6; ++j) {
+      indices[j] = (GLuint)(i * 6 + j);
+    }
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, indices);
+    memset(indices, 0, sizeof(indices));
+  }
+  glcewBatchFlush();
+  bind_buffer(GL_ELEMENT_ARRAY_BUFFER, element_buffer);
+}
+
+static uint64_t framebuffer_hash(void) {
+  uint64_t hash = 14695981039346656037ULL;
+  size_t i;
+  glReadPixels(0, 0, FRAMEBUFFER_SIZE, FRAMEBUFFER_SIZE,
+               GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+  for (i = 0; i < sizeof(pixels); ++i) {
+    hash = (hash ^ pixels[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+typedef struct Workload {
+  const char* name;
+  void (*draw_frame)(void);
+} Workload;
+
+static double time_frames(void (*draw_frame)(void), int num_frames) {
+  uint64_t start_ns;
+  int i;
+  draw_frame();
+  glFinish();
+  start_ns = glcew_time_ns();
+  for (i = 0; i < num_frames; ++i) {
+    draw_frame();
+  }
+  glFinish();
+  return (glcew_time_ns() - start_ns) * 1e-6 / num_frames;
+}
+
+/* ***************************** Bound table. ***************************** */
+
+static int num_mock_multi_draws = 0;
+
+static void mock_multi_draw_arrays(GLenum mode,
+                                   const GLint* first,
+                                   const GLsizei* count,
+                                   GLsizei drawcount) {
+  (void) mode;  /* Ignored. */
+  (void) first;  /* Ignored. */
+  (void) count;  /* Ignored. */
+  (void) drawcount;  /* Ignored. */
+  ++num_mock_multi_draws;
+}
+
+static __GLXextFuncPtr mock_get_proc_address(const GLubyte* name) {
+  if (strcmp((const char*)name, "glMultiDrawArrays") == 0) {
+    return (__GLXextFuncPtr)mock_multi_draw_arrays;
+  }
+  return glXGetProcAddressARB_impl(name);
+}
+
+/* Table is bound after batching is enabled, as glcewInstanceBind() or
+ * glcewContextPoolAcquire() do.
+ */
+static int test_bound_table(void) {
+  GLCEWDispatchTable table;
+  const GLCEWDispatchTable* previous_table;
+  glcew_dispatch_table_get_current(&table);
+  table.glXGetProcAddressARB = mock_get_proc_address;
+  if (glcewBatchEnable() != GLCEW_SUCCESS) {
+    return 1;
+  }
+  previous_table = glcew_dispatch_table_bind(&table);
+  glDrawArrays(GL_TRIANGLES, 0, 6);
+  glDrawArrays(GL_TRIANGLES, 6, 6);
+  glcewBatchFlush();
+  glcew_dispatch_table_bind(previous_table);
+  glcewBatchDisable();
+  if (num_mock_multi_draws != 1) {
+    printf("Batch is not flushed to the multi-draw of the bound table\n");
+    return 0;
+  }
+  return 1;
+}
+
+int main(int argc, char* argv[]) {
+  static const Workload workloads[] = {
+    {"glDrawArrays", draw_arrays_frame},
+    {"glDrawElements", draw_elements_frame},
+    {"client indices", draw_client_indices_frame},
+  };
+  const int num_frames = (argc > 1) ? atoi(argv[1]) : 10;
+  int result = EXIT_SUCCESS;
+  size_t i;
+
+  if (glcewAcquire() != GLCEW_SUCCESS) {
+    printf("libGL not found\n");
+    return TEST_SKIP_RETURN_CODE;
+  }
+  if (!test_context_create(FRAMEBUFFER_SIZE, FRAMEBUFFER_SIZE) ||
+      !scene_create()) {
+    printf("No OpenGL context available\n");
+    glcewRelease();
+    return TEST_SKIP_RETURN_CODE;
+  }
+  printf("Renderer: %s\n", test_context_renderer());
+  printf("ms per frame without / with batching, draws per flush\n");
+
+  for (i = 0; i < sizeof(workloads) / sizeof(*workloads); ++i) {
+    const Workload* workload = &workloads[i];
+    GLCEWBatchStats stats_before, stats;
+    double direct_ms, batched_ms;
+    uint64_t direct_hash, batched_hash;
+    workload->draw_frame();
+    direct_hash = framebuffer_hash();
+    direct_ms = time_frames(workload->draw_frame, num_frames);
+    glcewBatchGetStats(&stats_before);
+    if (glcewBatchEnable() != GLCEW_SUCCESS) {
+      printf("Batching is not supported\n");
+      result = TEST_SKIP_RETURN_CODE;
+      break;
+    }
+    workload->draw_frame();
+    batched_hash = framebuffer_hash();
+    batched_ms = time_frames(workload->draw_frame, num_frames);
+    glcewBatchGetStats(&stats);
+    glcewBatchDisable();
+    stats.num_draws -= stats_before.num_draws;
+    stats.num_flushes -= stats_before.num_flushes;
+    printf("  %-16s %8.3f / %8.3f, %.1f\n",
+           workload->name, direct_ms, batched_ms,
+           stats.num_flushes ? (double)stats.num_draws / stats.num_flushes
+                             : 0.0);
+    if (direct_hash != batched_hash) {
+      printf("  %s: image rendered with batching differs\n", workload->name);
+      result = EXIT_FAILURE;
+    }
+  }
+  if (result == EXIT_SUCCESS && !test_bound_table()) {
+    result = EXIT_FAILURE;
+  }
+
+  test_context_destroy();
+  glcewRelease();
+  return result;
+}
@@ -0,0 +1,596 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Dispatch table layout benchmark.
+ *
+ * Renders a viewport redraw scene: textured objects with occasional material
+ * and blending changes, followed by a scissored UI overlay. This is also the
+ * run the call profile in auto/call_profile.txt is recorded from:
+ *
+ *   cmake -DWITH_CALL_COUNTS=ON ... && make benchglcew_dispatch
+ *   GLCEW_CALL_COUNTS=counts.txt ./benchglcew_dispatch 200 0
+ *
+ * Then the calls of the same scene are dispatched to the stubs which are
+ * left after the library is released, with the application touching enough
+ * memory between objects to evict L1. Two cache line aligned tables hold the
+ * stubs, one with the entries at their offsets in the profile-ordered table
+ * the wrappers use and one in declaration order, and both are dispatched
+ * through by the same code. Reported are the cache lines of the table
+ * touched per object and per frame, time, and L1D read misses when hardware
+ * counters are available. Nothing is asserted, timing depends on the
+ * machine.
+ *
+ * Usage: benchglcew_dispatch [num_frames] [num_layout_frames]
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#  include <linux/perf_event.h>
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+#include "glcew.h"
+#include "glcew_intern.h"
+#include "glcewTestContext.h"
+
+#define NUM_OBJECTS 256
+#define NUM_WIDGETS 32
+#define NUM_TEXTURES 8
+#define TEXTURE_SIZE 64
+#define FRAMEBUFFER_SIZE 256
+
+/* Memory touched by the application between objects, larger than L1D. */
+#define APP_MEMORY_SIZE (64 * 1024)
+#define CACHE_LINE_SIZE 64
+
+#define GL_ARRAY_BUFFER 0x8892
+#define GL_ELEMENT_ARRAY_BUFFER 0x8893
+#define GL_STATIC_DRAW 0x88E4
+#define GL_VERTEX_ARRAY 0x8074
+#define GL_TEXTURE_COORD_ARRAY 0x8078
+#define GL_FLOAT 0x1406
+#define GL_UNSIGNED_BYTE 0x1401
+#define GL_UNSIGNED_SHORT 0x1403
+#define GL_RGBA 0x1908
+#define GL_RGBA8 0x8058
+#define GL_TRIANGLES 0x0004
+#define GL_TRIANGLE_STRIP 0x0005
+#define GL_DEPTH_BUFFER_BIT 0x00000100
+#define GL_LEQUAL 0x0203
+#define GL_SRC_ALPHA 0x0302
+#define GL_ONE_MINUS_SRC_ALPHA 0x0303
+#define GL_TEXTURE_MIN_FILTER 0x2801
+#define GL_TEXTURE_MAG_FILTER 0x2800
+#define GL_LINEAR 0x2601
+#define GL_NEAREST 0x2600
+#define GL_VIEWPORT 0x0BA2
+
+typedef void (*tglGenBuffers) (GLsizei n, GLuint* buffers);
+typedef void (*tglBindBuffer) (GLenum target, GLuint buffer);
+typedef void (*tglBufferData) (GLenum target,
+                               intptr_t size,
+                               const void* data,
+                               GLenum usage);
+typedef void (*tglEnableClientState) (GLenum array);
+typedef void (*tglVertexPointer) (GLint size,
+                                  GLenum type,
+                                  GLsizei stride,
+                                  const void* pointer);
+
+/* ******************************** Scene. ******************************** */
+
+typedef struct SceneFunction {
+  const char* name;
+  size_t offset;
+} SceneFunction;
+
+#define SCENE_FUNCTION(name) {#name, offsetof(GLCEWDispatchTable, name)}
+
+/* Functions called for every object, and for the whole frame. Keep in sync
+ * with scene_draw_object(), scene_draw_frame() and layout_draw_frame(), frame
+ * functions are in the order of the SCENE_* enumerators.
+ */
+static const SceneFunction object_functions[] = {
+  SCENE_FUNCTION(glBindTexture),
+  SCENE_FUNCTION(glTexParameteri),
+  SCENE_FUNCTION(glEnable),
+  SCENE_FUNCTION(glBlendFunc),
+  SCENE_FUNCTION(glDrawElements),
+  SCENE_FUNCTION(glDisable),
+};
+
+static const SceneFunction frame_functions[] = {
+  SCENE_FUNCTION(glViewport),
+  SCENE_FUNCTION(glClearColor),
+  SCENE_FUNCTION(glClear),
+  SCENE_FUNCTION(glEnable),
+  SCENE_FUNCTION(glDepthFunc),
+  SCENE_FUNCTION(glBindTexture),
+  SCENE_FUNCTION(glTexParameteri),
+  SCENE_FUNCTION(glBlendFunc),
+  SCENE_FUNCTION(glDrawElements),
+  SCENE_FUNCTION(glDisable),
+  SCENE_FUNCTION(glScissor),
+  SCENE_FUNCTION(glDrawArrays),
+  SCENE_FUNCTION(glIsEnabled),
+  SCENE_FUNCTION(glGetIntegerv),
+  SCENE_FUNCTION(glPixelStorei),
+  SCENE_FUNCTION(glFlush),
+};
+
+static GLuint textures[NUM_TEXTURES];
+static volatile unsigned char app_memory[APP_MEMORY_SIZE];
+static int app_touch_memory = 0;
+
+static void app_work(void) {
+  size_t i;
+  unsigned char sum = 0;
+  if (!app_touch_memory) {
+    return;
+  }
+  for (i = 0; i < APP_MEMORY_SIZE; i += CACHE_LINE_SIZE) {
+    sum += app_memory[i];
+  }
+  app_memory[0] = sum;
+}
+
+static int scene_create(void) {
+  /* Cube of 24 vertices, followed by a quad used by the UI widgets. Every
+   * vertex is position and texture coordinate.
+   */
+  static const float cube_faces[6][4][3] = {
+    {{-1, -1, 1}, {1, -1, 1}, {1, 1, 1}, {-1, 1, 1}},
+    {{1, -1, -1}, {-1, -1, -1}, {-1, 1, -1}, {1, 1, -1}},
+    {{-1, -1, -1}, {-1, -1, 1}, {-1, 1, 1}, {-1, 1, -1}},
+    {{1, -1, 1}, {1, -1, -1}, {1, 1, -1}, {1, 1, 1}},
+    {{-1, 1, 1}, {1, 1, 1}, {1, 1, -1}, {-1, 1, -1}},
+    {{-1, -1, -1}, {1, -1, -1}, {1, -1, 1}, {-1, -1, 1}},
+  };
+  static const float uvs[4][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+  float vertices[28][5];
+  unsigned short indices[36];
+  unsigned char pixels[TEXTURE_SIZE * TEXTURE_SIZE * 4];
+  tglGenBuffers gen_buffers =
+      (tglGenBuffers)test_context_proc_address("glGenBuffers");
+  tglBindBuffer bind_buffer =
+      (tglBindBuffer)test_context_proc_address("glBindBuffer");
+  tglBufferData buffer_data =
+      (tglBufferData)test_context_proc_address("glBufferData");
+  tglEnableClientState enable_client_state =
+      (tglEnableClientState)test_context_proc_address("glEnableClientState");
+  tglVertexPointer vertex_pointer =
+      (tglVertexPointer)test_context_proc_address("glVertexPointer");
+  tglVertexPointer tex_coord_pointer_any =
+      (tglVertexPointer)test_context_proc_address("glTexCoordPointer");
+  GLuint buffers[2];
+  int face, corner, i;
+  if (gen_buffers == NULL || bind_buffer == NULL || buffer_data == NULL ||
+      enable_client_state == NULL || vertex_pointer == NULL ||
+      tex_coord_pointer_any == NULL) {
+    return 0;
+  }
+  for (face = 0; face < 6; ++face) {
+    for (corner = 0; corner < 4; ++corner) {
+      float* vertex = vertices[face * 4 + corner];
+      vertex[0] = cube_faces[face][corner][0] * 0.5f;
+      vertex[1] = cube_faces[face][corner][1] * 0.5f;
+      vertex[2] = cube_faces[face][corner][2] * 0.5f;
+      vertex[3] = uvs[corner][0];
+      vertex[4] = uvs[corner][1];
+    }
+    indices[face * 6 + 0] = (unsigned short)(face * 4 + 0);
+    indices[face * 6 + 1] = (unsigned short)(face * 4 + 1);
+    indices[face * 6 + 2] = (unsigned short)(face * 4 + 2);
+    indices[face * 6 + 3] = (unsigned short)(face * 4 + 0);
+    indices[face * 6 + 4] = (unsigned short)(face * 4 + 2);
+    indices[face * 6 + 5] = (unsigned short)(face * 4 + 3);
+  }
+  for (corner = 0; corner < 4; ++corner) {
+    float* vertex = vertices[24 + corner];
+    vertex[0] = (corner == 1 || corner == 3) ? 0.9f : 0.7f;
+    vertex[1] = (corner >= 2) ? 0.9f : 0.7f;
+    vertex[2] = 0.0f;
+    vertex[3] = uvs[corner][0];
+    vertex[4] = uvs[corner][1];
+  }
+  gen_buffers(2, buffers);
+  bind_buffer(GL_ARRAY_BUFFER, buffers[0]);
+  buffer_data(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+  bind_buffer(GL_ELEMENT_ARRAY_BUFFER, buffers[1]);
+  buffer_data(GL_ELEMENT_ARRAY_BUFFER,
+              sizeof(indices), indices, GL_STATIC_DRAW);
+  enable_client_state(GL_VERTEX_ARRAY);
+  enable_client_state(GL_TEXTURE_COORD_ARRAY);
+  vertex_pointer(3, GL_FLOAT, sizeof(vertices[0]), (const void*)0);
+  tex_coord_pointer_any(2, GL_FLOAT, sizeof(vertices[0]),
+                        (const void*)(sizeof(float) * 3));
+
+  glGenTextures(NUM_TEXTURES, textures);
+  for (i = 0; i < NUM_TEXTURES; ++i) {
+    memset(pixels, 32 * i, sizeof(pixels));
+    glBindTexture(GL_TEXTURE_2D, textures[i]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, TEXTURE_SIZE, TEXTURE_SIZE, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+  }
+  glEnable(GL_TEXTURE_2D);
+  return 1;
+}
+
+static void scene_draw_object(int index) {
+  glBindTexture(GL_TEXTURE_2D, textures[index % NUM_TEXTURES]);
+  /* Material with different sampling every few objects. */
+  if (index % 4 == 0) {
+    const GLint filter = (index % 8 == 0) ? GL_NEAREST : GL_LINEAR;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+  }
+  /* Transparent objects. */
+  if (index % 8 == 0) {
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  }
+  glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_SHORT, (const GLvoid*)0);
+  if (index % 8 == 0) {
+    glDisable(GL_BLEND);
+  }
+}
+
+static void scene_draw_frame(void) {
+  GLint viewport[4];
+  int i;
+  glViewport(0, 0, FRAMEBUFFER_SIZE, FRAMEBUFFER_SIZE);
+  glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  glEnable(GL_DEPTH_TEST);
+  glDepthFunc(GL_LEQUAL);
+  for (i = 0; i < NUM_OBJECTS; ++i) {
+    app_work();
+    scene_draw_object(i);
+  }
+  /* UI overlay. */
+  glDisable(GL_DEPTH_TEST);
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  for (i = 0; i < NUM_WIDGETS; ++i) {
+    app_work();
+    glScissor(i * 8, 0, 8, 8);
+    glEnable(GL_SCISSOR_TEST);
+    glDrawArrays(GL_TRIANGLE_STRIP, 24, 4);
+    glDisable(GL_SCISSOR_TEST);
+  }
+  if (glIsEnabled(GL_BLEND)) {
+    glDisable(GL_BLEND);
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glFlush();
+}
+
+/* ******************************* Layouts. ******************************* */
+
+typedef void (*tGenericFunction) (void);
+
+#define NUM_TABLE_ENTRIES \
+        (sizeof(GLCEWDispatchTable) / sizeof(tGenericFunction))
+
+/* Functions of the scene, in the order of frame_functions. */
+enum {
+  SCENE_glViewport,
+  SCENE_glClearColor,
+  SCENE_glClear,
+  SCENE_glEnable,
+  SCENE_glDepthFunc,
+  SCENE_glBindTexture,
+  SCENE_glTexParameteri,
+  SCENE_glBlendFunc,
+  SCENE_glDrawElements,
+  SCENE_glDisable,
+  SCENE_glScissor,
+  SCENE_glDrawArrays,
+  SCENE_glIsEnabled,
+  SCENE_glGetIntegerv,
+  SCENE_glPixelStorei,
+  SCENE_glFlush,
+  NUM_SCENE_FUNCTIONS,
+};
+
+/* Table of entry points with the scene functions at the given slots. */
+typedef struct SceneLayout {
+  tGenericFunction* table;
+  int slots[NUM_SCENE_FUNCTIONS];
+} SceneLayout;
+
+#define LAYOUT_CALL(layout, name) \
+        ((t##name)(layout)->table[(layout)->slots[SCENE_##name]])
+
+static int layout_slot_of(const SceneLayout* layout, const char* name) {
+  int i;
+  for (i = 0; i < NUM_SCENE_FUNCTIONS; ++i) {
+    if (strcmp(frame_functions[i].name, name) == 0) {
+      return layout->slots[i];
+    }
+  }
+  return -1;
+}
+
+/* Fill the slots from entry offsets, and the table with the stubs. */
+static int layout_create(SceneLayout* layout,
+                         tGenericFunction* table,
+                         const GLCEWDispatchTable* stubs,
+                         int profile_order) {
+  int i;
+  layout->table = table;
+  for (i = 0; i < NUM_SCENE_FUNCTIONS; ++i) {
+    const size_t stub_offset = frame_functions[i].offset;
+    const size_t offset =
+        profile_order ? glcew_global_table_offset(frame_functions[i].name)
+                      : stub_offset;
+    if (offset == (size_t)-1) {
+      return 0;
+    }
+    layout->slots[i] = (int)(offset / sizeof(tGenericFunction));
+    memcpy(&table[layout->slots[i]],
+           (const char*)stubs + stub_offset,
+           sizeof(tGenericFunction));
+  }
+  return 1;
+}
+
+/* Same calls as scene_draw_frame(). */
+static void layout_draw_frame(const SceneLayout* layout) {
+  GLint viewport[4];
+  int i;
+  LAYOUT_CALL(layout, glViewport)(0, 0, FRAMEBUFFER_SIZE, FRAMEBUFFER_SIZE);
+  LAYOUT_CALL(layout, glClearColor)(0.2f, 0.2f, 0.2f, 1.0f);
+  LAYOUT_CALL(layout, glClear)(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  LAYOUT_CALL(layout, glEnable)(GL_DEPTH_TEST);
+  LAYOUT_CALL(layout, glDepthFunc)(GL_LEQUAL);
+  for (i = 0; i < NUM_OBJECTS; ++i) {
+    app_work();
+    LAYOUT_CALL(layout, glBindTexture)(GL_TEXTURE_2D,
+                                       textures[i % NUM_TEXTURES]);
+    if (i % 4 == 0) {
+      const GLint filter = (i % 8 == 0) ? GL_NEAREST : GL_LINEAR;
+      LAYOUT_CALL(layout, glTexParameteri)(GL_TEXTURE_2D,
+                                           GL_TEXTURE_MIN_FILTER, filter);
+      LAYOUT_CALL(layout, glTexParameteri)(GL_TEXTURE_2D,
+                                           GL_TEXTURE_MAG_FILTER, filter);
+    }
+    if (i % 8 == 0) {
+      LAYOUT_CALL(layout, glEnable)(GL_BLEND);
+      LAYOUT_CALL(layout, glBlendFunc)(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+    LAYOUT_CALL(layout, glDrawElements)(GL_TRIANGLES, 36, GL_UNSIGNED_SHORT,
+                                        (const GLvoid*)0);
+    if (i % 8 == 0) {
+      LAYOUT_CALL(layout, glDisable)(GL_BLEND);
+    }
+  }
+  LAYOUT_CALL(layout, glDisable)(GL_DEPTH_TEST);
+  LAYOUT_CALL(layout, glGetIntegerv)(GL_VIEWPORT, viewport);
+  for (i = 0; i < NUM_WIDGETS; ++i) {
+    app_work();
+    LAYOUT_CALL(layout, glScissor)(i * 8, 0, 8, 8);
+    LAYOUT_CALL(layout, glEnable)(GL_SCISSOR_TEST);
+    LAYOUT_CALL(layout, glDrawArrays)(GL_TRIANGLE_STRIP, 24, 4);
+    LAYOUT_CALL(layout, glDisable)(GL_SCISSOR_TEST);
+  }
+  if (LAYOUT_CALL(layout, glIsEnabled)(GL_BLEND)) {
+    LAYOUT_CALL(layout, glDisable)(GL_BLEND);
+  }
+  LAYOUT_CALL(layout, glPixelStorei)(GL_UNPACK_ALIGNMENT, 4);
+  LAYOUT_CALL(layout, glFlush)();
+}
+
+static int count_lines(const SceneFunction* functions,
+                       int num_functions,
+                       const SceneLayout* layout) {
+  int lines[64];
+  int num_lines = 0;
+  int i, j;
+  for (i = 0; i < num_functions; ++i) {
+    const int line = layout_slot_of(layout, functions[i].name) *
+                     (int)sizeof(tGenericFunction) / CACHE_LINE_SIZE;
+    for (j = 0; j < num_lines; ++j) {
+      if (lines[j] == line) {
+        break;
+      }
+    }
+    if (j == num_lines) {
+      lines[num_lines++] = line;
+    }
+  }
+  return num_lines;
+}
+
+static int perf_open_l1d_misses(void) {
+#ifdef __linux__
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.config = PERF_COUNT_HW_CACHE_L1D |
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+  return -1;
+#endif
+}
+
+static uint64_t perf_read(int fd) {
+  uint64_t value = 0;
+#ifdef __linux__
+  if (fd >= 0 && read(fd, &value, sizeof(value)) != sizeof(value)) {
+    value = 0;
+  }
+#else
+  (void) fd;  /* Ignored. */
+#endif
+  return value;
+}
+
+typedef struct LayoutResult {
+  const char* name;
+  int object_lines;
+  int frame_lines;
+  uint64_t best_ns;
+  uint64_t misses;
+} LayoutResult;
+
+static void layout_run(const SceneLayout* layout,
+                       int num_frames,
+                       int perf_fd,
+                       LayoutResult* result) {
+  uint64_t start_ns, misses = 0;
+  int i;
+#ifdef __linux__
+  if (perf_fd >= 0) {
+    ioctl(perf_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+#endif
+  start_ns = glcew_time_ns();
+  for (i = 0; i < num_frames; ++i) {
+    layout_draw_frame(layout);
+  }
+  start_ns = glcew_time_ns() - start_ns;
+#ifdef __linux__
+  if (perf_fd >= 0) {
+    ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+    misses = perf_read(perf_fd);
+  }
+#endif
+  if (result->best_ns == 0 || start_ns < result->best_ns) {
+    result->best_ns = start_ns;
+    result->misses = misses;
+  }
+}
+
+static void layout_print(const LayoutResult* result,
+                         int num_frames,
+                         int perf_fd) {
+  const int num_objects = num_frames * (NUM_OBJECTS + NUM_WIDGETS);
+  printf("  %-18s %d / %d, %.1f",
+         result->name, result->object_lines, result->frame_lines,
+         (double)result->best_ns / num_objects);
+  if (perf_fd >= 0) {
+    printf(", %.2f", (double)result->misses / num_objects);
+  }
+  printf("\n");
+}
+
+/* ********************************* Main. ******************************** */
+
+int main(int argc, char* argv[]) {
+  static GLCEWDispatchTable stubs;
+  static tGenericFunction profile_table[NUM_TABLE_ENTRIES]
+      __attribute__((aligned(64)));
+  static tGenericFunction declaration_table[NUM_TABLE_ENTRIES]
+      __attribute__((aligned(64)));
+  const int num_frames = (argc > 1) ? atoi(argv[1]) : 20;
+  const int num_layout_frames = (argc > 2) ? atoi(argv[2]) : 200;
+  const int num_object_functions =
+      sizeof(object_functions) / sizeof(*object_functions);
+  const int num_frame_functions =
+      sizeof(frame_functions) / sizeof(*frame_functions);
+  LayoutResult profiled = {"profile order:", 0, 0, 0, 0};
+  LayoutResult declaration = {"declaration order:", 0, 0, 0, 0};
+  SceneLayout profile_layout, declaration_layout;
+  int perf_fd, i;
+
+  if (glcewAcquire() != GLCEW_SUCCESS) {
+    printf("libGL not found\n");
+    return TEST_SKIP_RETURN_CODE;
+  }
+
+  /* Scene rendered by the driver. */
+  if (num_frames > 0) {
+    uint64_t start_ns;
+    if (!test_context_create(FRAMEBUFFER_SIZE, FRAMEBUFFER_SIZE) ||
+        !scene_create()) {
+      printf("No OpenGL context available\n");
+      glcewRelease();
+      return TEST_SKIP_RETURN_CODE;
+    }
+    printf("Renderer: %s\n", test_context_renderer());
+    start_ns = glcew_time_ns();
+    for (i = 0; i < num_frames; ++i) {
+      scene_draw_frame();
+    }
+    glFinish();
+    start_ns = glcew_time_ns() - start_ns;
+    printf("Scene: %d frames, %.3f ms/frame\n",
+           num_frames, start_ns * 1e-6 / num_frames);
+    test_context_destroy();
+  }
+
+  /* Only the stubs are left in the tables from now on. */
+  glcewRelease();
+  if (num_layout_frames <= 0) {
+    return EXIT_SUCCESS;
+  }
+  glcew_dispatch_table_get_current(&stubs);
+  if (!layout_create(&profile_layout, profile_table, &stubs, 1) ||
+      !layout_create(&declaration_layout, declaration_table, &stubs, 0)) {
+    printf("Scene function is not wrapped\n");
+    return EXIT_FAILURE;
+  }
+  profiled.object_lines =
+      count_lines(object_functions, num_object_functions, &profile_layout);
+  profiled.frame_lines =
+      count_lines(frame_functions, num_frame_functions, &profile_layout);
+  declaration.object_lines = count_lines(
+      object_functions, num_object_functions, &declaration_layout);
+  declaration.frame_lines = count_lines(
+      frame_functions, num_frame_functions, &declaration_layout);
+
+  perf_fd = perf_open_l1d_misses();
+  app_touch_memory = 1;
+  /* Alternate the layouts, so drift of the clock or load affects both. */
+  for (i = 0; i < 10; ++i) {
+    layout_run(&profile_layout, num_layout_frames, perf_fd, &profiled);
+    layout_run(&declaration_layout, num_layout_frames, perf_fd, &declaration);
+  }
+
+  printf("Layout: cache lines per object / per frame, ns per object");
+  if (perf_fd >= 0) {
+    printf(", L1D read misses per object");
+  }
+  printf("\n");
+  layout_print(&profiled, num_layout_frames, perf_fd);
+  layout_print(&declaration, num_layout_frames, perf_fd);
+  if (perf_fd < 0) {
+    printf("  L1D read misses: no hardware counters (%s)\n", strerror(errno));
+  }
+  else {
+    close(perf_fd);
+  }
+  return EXIT_SUCCESS;
+}
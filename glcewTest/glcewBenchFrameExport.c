@@ -0,0 +1,278 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Frame export benchmark.
+ *
+ * Frames are read back into the shared ring and consumed by a forked process
+ * which checks every pixel of them, blocking and dropping when the ring is
+ * full, against reading back into private memory. Producer with a consumer
+ * which crashed without closing the import must not stall for longer than
+ * the block timeout.
+ *
+ * Usage: benchglcew_frame_export [num_frames]
+ */
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "glcew.h"
+#include "glcew_intern.h"
+#include "glcewTestContext.h"
+
+#define FRAME_WIDTH 1280
+#define FRAME_HEIGHT 720
+#define NUM_SLOTS 3
+
+#define GL_RGBA 0x1908
+#define GL_UNSIGNED_BYTE 0x1401
+
+#define CRASH_BLOCK_TIMEOUT_MS 100
+/* Frames read back after the consumer crashed. */
+#define NUM_CRASH_FRAMES 20
+
+static unsigned char pixels[FRAME_WIDTH * FRAME_HEIGHT * 4];
+
+/* Frame number is encoded in the red and green of the clear color. */
+static void draw_frame(int frame) {
+  glClearColor((frame & 0xff) / 255.0f, ((frame >> 8) & 0xff) / 255.0f,
+               0.0f, 1.0f);
+  glClear(GL_COLOR_BUFFER_BIT);
+}
+
+static int frame_number(const GLCEWFrame* frame) {
+  const unsigned char* pixel = frame->data;
+  return pixel[0] | (pixel[1] << 8);
+}
+
+/* Every pixel of the frame has the color of its first pixel. */
+static int frame_is_complete(const GLCEWFrame* frame) {
+  const uint32_t* rows = frame->data;
+  const uint32_t first = rows[0];
+  int x, y;
+  for (y = 0; y < frame->height; ++y) {
+    const uint32_t* row =
+        (const uint32_t*)((const unsigned char*)frame->data +
+                          (size_t)y * frame->stride);
+    for (x = 0; x < frame->width; ++x) {
+      if (row[x] != first) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+/* Consumer process, exits with failure if a frame is incomplete, or frames
+ * are out of order (or missing, if frames are not to be dropped).
+ */
+static void consumer_run(int fd, int expect_all_frames) {
+  GLCEWFrameImport* frame_import;
+  GLCEWFrame frame;
+  int previous = -1, num_frames = 0, ok = 1;
+  alarm(60);
+  frame_import = glcewFrameImportOpen(fd, NULL);
+  if (frame_import == NULL) {
+    printf("  consumer: import failed\n");
+    _exit(EXIT_FAILURE);
+  }
+  while (glcewFrameImportAcquire(frame_import, -1, &frame) == 1) {
+    const int number = frame_number(&frame);
+    if (!frame_is_complete(&frame) ||
+        number <= previous ||
+        (expect_all_frames && number != previous + 1)) {
+      ok = 0;
+    }
+    previous = number;
+    ++num_frames;
+    glcewFrameImportRelease(frame_import);
+  }
+  glcewFrameImportClose(frame_import);
+  if (!ok) {
+    printf("  consumer: frames are incomplete or out of order\n");
+  }
+  fflush(stdout);
+  _exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+static GLCEWFrameExport* export_create(int flags, int block_timeout_ms) {
+  GLCEWFrameExportSettings settings = {0};
+  settings.width = FRAME_WIDTH;
+  settings.height = FRAME_HEIGHT;
+  settings.format = GL_RGBA;
+  settings.type = GL_UNSIGNED_BYTE;
+  settings.num_slots = NUM_SLOTS;
+  settings.flags = flags;
+  settings.block_timeout_ms = block_timeout_ms;
+  return glcewFrameExportCreate(&settings, NULL);
+}
+
+/* Consumers are forked before the context is created. */
+static pid_t consumer_fork(GLCEWFrameExport* frame_export,
+                           int expect_all_frames) {
+  pid_t pid;
+  fflush(stdout);
+  pid = fork();
+  if (pid == 0) {
+    consumer_run(glcewFrameExportGetFd(frame_export), expect_all_frames);
+  }
+  return pid;
+}
+
+static int consumer_wait(pid_t pid) {
+  int status;
+  return waitpid(pid, &status, 0) == pid &&
+         WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+/* Consumer which opens the import and exits without closing it. */
+static pid_t crashed_consumer_fork(GLCEWFrameExport* frame_export) {
+  const pid_t pid = fork();
+  if (pid == 0) {
+    glcewFrameImportOpen(glcewFrameExportGetFd(frame_export), NULL);
+    _exit(EXIT_SUCCESS);
+  }
+  return pid;
+}
+
+static double time_private_readback(int num_frames) {
+  uint64_t start_ns;
+  int i;
+  glFinish();
+  start_ns = glcew_time_ns();
+  for (i = 0; i < num_frames; ++i) {
+    draw_frame(i);
+    glReadPixels(0, 0, FRAME_WIDTH, FRAME_HEIGHT,
+                 GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+  }
+  return (glcew_time_ns() - start_ns) * 1e-9;
+}
+
+static int run_export(const char* name,
+                      GLCEWFrameExport* frame_export,
+                      pid_t consumer,
+                      int num_frames) {
+  GLCEWFrameExportStats stats;
+  uint64_t start_ns;
+  double seconds;
+  int i, ok;
+  glFinish();
+  start_ns = glcew_time_ns();
+  for (i = 0; i < num_frames; ++i) {
+    draw_frame(i);
+    glcewFrameExportReadPixels(frame_export, 0, 0);
+  }
+  seconds = (glcew_time_ns() - start_ns) * 1e-9;
+  glcewFrameExportGetStats(frame_export, &stats);
+  glcewFrameExportDestroy(frame_export);
+  ok = consumer_wait(consumer);
+  /* Dropped frames are read back too, but never reach the consumer. */
+  printf("  %-16s %8.1f %10.1f %8.1f %8d\n",
+         name,
+         num_frames / seconds,
+         (num_frames - (double)stats.num_dropped) / seconds,
+         stats.num_bytes / seconds / 1e6,
+         (int)stats.num_dropped);
+  return ok;
+}
+
+/* Producer waits for the crashed consumer once, and then drops frames
+ * without waiting.
+ */
+static int run_crashed(GLCEWFrameExport* frame_export) {
+  GLCEWFrameExportStats stats;
+  uint64_t start_ns;
+  double elapsed_ms;
+  int i;
+  start_ns = glcew_time_ns();
+  for (i = 0; i < NUM_SLOTS + NUM_CRASH_FRAMES; ++i) {
+    draw_frame(i);
+    glcewFrameExportReadPixels(frame_export, 0, 0);
+  }
+  elapsed_ms = (glcew_time_ns() - start_ns) * 1e-6;
+  glcewFrameExportGetStats(frame_export, &stats);
+  glcewFrameExportDestroy(frame_export);
+  printf("Crashed consumer: %d frames dropped in %.1f ms\n",
+         (int)stats.num_dropped, elapsed_ms);
+  if (stats.num_dropped != NUM_CRASH_FRAMES ||
+      elapsed_ms > 2 * CRASH_BLOCK_TIMEOUT_MS + 1000) {
+    printf("Producer stalls on a crashed consumer\n");
+    return 0;
+  }
+  return 1;
+}
+
+int main(int argc, char* argv[]) {
+  const int num_frames = (argc > 1) ? atoi(argv[1]) : 200;
+  GLCEWFrameExport *blocking, *dropping, *crashed;
+  pid_t blocking_consumer, dropping_consumer, crashed_consumer;
+  double seconds;
+  int ok = 1;
+
+  /* Stalled producer fails the benchmark instead of hanging it. */
+  alarm(120);
+  if (glcewAcquire() != GLCEW_SUCCESS) {
+    printf("libGL not found\n");
+    return TEST_SKIP_RETURN_CODE;
+  }
+  blocking = export_create(GLCEW_FRAME_EXPORT_BLOCK, 0);
+  dropping = export_create(0, 0);
+  crashed = export_create(GLCEW_FRAME_EXPORT_BLOCK, CRASH_BLOCK_TIMEOUT_MS);
+  if (blocking == NULL || dropping == NULL || crashed == NULL) {
+    printf("Frame export is not supported\n");
+    glcewRelease();
+    return TEST_SKIP_RETURN_CODE;
+  }
+  blocking_consumer = consumer_fork(blocking, 1);
+  dropping_consumer = consumer_fork(dropping, 0);
+  crashed_consumer = crashed_consumer_fork(crashed);
+  ok &= consumer_wait(crashed_consumer);
+
+  if (!test_context_create(FRAME_WIDTH, FRAME_HEIGHT)) {
+    printf("No OpenGL context available\n");
+    glcewFrameExportDestroy(blocking);
+    glcewFrameExportDestroy(dropping);
+    glcewFrameExportDestroy(crashed);
+    consumer_wait(blocking_consumer);
+    consumer_wait(dropping_consumer);
+    glcewRelease();
+    return TEST_SKIP_RETURN_CODE;
+  }
+  printf("Renderer: %s\n", test_context_renderer());
+  printf("%dx%d RGBA, frames/s, delivered frames/s, MB/s, dropped frames\n",
+         FRAME_WIDTH, FRAME_HEIGHT);
+  seconds = time_private_readback(num_frames);
+  printf("  %-16s %8.1f %10.1f %8.1f %8d\n",
+         "private memory", num_frames / seconds, num_frames / seconds,
+         (double)sizeof(pixels) * num_frames / seconds / 1e6, 0);
+  if (!run_export("export, block", blocking, blocking_consumer,
+                  num_frames)) {
+    printf("Consumer of the blocking export failed\n");
+    ok = 0;
+  }
+  if (!run_export("export, drop", dropping, dropping_consumer, num_frames)) {
+    printf("Consumer of the dropping export failed\n");
+    ok = 0;
+  }
+  ok &= run_crashed(crashed);
+
+  test_context_destroy();
+  glcewRelease();
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* GLX query cache benchmark.
+ *
+ * Queries are timed against a private Xvfb server with and without the
+ * cache, and the display is checked to be registered once across disabling
+ * and invalidating the cache, and again after it is reopened. Reported as
+ * skipped when Xvfb is not installed.
+ *
+ * Usage: benchglcew_glx_cache [num_queries]
+ */
+
+#include <dlfcn.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "glcew.h"
+#include "glcew_intern.h"
+
+#define TEST_SKIP_RETURN_CODE 77
+
+#define GLX_RGBA 4
+#define GLX_DOUBLEBUFFER 5
+#define GLX_DEPTH_SIZE 12
+
+typedef Display* (*tXOpenDisplay) (const char* name);
+typedef int (*tXCloseDisplay) (Display* display);
+typedef int (*tXFree) (void* data);
+
+static tXOpenDisplay open_display;
+static tXCloseDisplay close_display;
+static tXFree free_data;
+
+static int attributes[] = {GLX_RGBA, GLX_DOUBLEBUFFER,
+                           GLX_DEPTH_SIZE, 24, None};
+
+/* Start Xvfb on a free display, returns its pid and the display name, or
+ * -1 if it could not be started.
+ */
+static pid_t xvfb_start(char* name, size_t name_size) {
+  char fd_string[16];
+  char number[16];
+  ssize_t length;
+  int fds[2];
+  pid_t pid;
+  if (pipe(fds) != 0) {
+    return -1;
+  }
+  snprintf(fd_string, sizeof(fd_string), "%d", fds[1]);
+  pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    execlp("Xvfb", "Xvfb", "-displayfd", fd_string,
+           "-screen", "0", "640x480x24", "-nolisten", "tcp", (char*)NULL);
+    _exit(EXIT_FAILURE);
+  }
+  close(fds[1]);
+  /* Server writes the display number once it accepts connections. */
+  length = (pid > 0) ? read(fds[0], number, sizeof(number) - 1) : -1;
+  close(fds[0]);
+  if (length <= 0) {
+    if (pid > 0) {
+      waitpid(pid, NULL, 0);
+    }
+    return -1;
+  }
+  number[length] = '\0';
+  number[strcspn(number, "\n")] = '\0';
+  snprintf(name, name_size, ":%s", number);
+  return pid;
+}
+
+static void xvfb_stop(pid_t pid) {
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+}
+
+static int xlib_load(void) {
+  /* Global, so the cache finds the registration functions. */
+  void* lib = dlopen("libX11.so.6", RTLD_NOW | RTLD_GLOBAL);
+  if (lib == NULL) {
+    return 0;
+  }
+  open_display = (tXOpenDisplay)dlsym(lib, "XOpenDisplay");
+  close_display = (tXCloseDisplay)dlsym(lib, "XCloseDisplay");
+  free_data = (tXFree)dlsym(lib, "XFree");
+  return open_display != NULL && close_display != NULL && free_data != NULL;
+}
+
+/* Microseconds per round of the three queries. */
+static double time_queries(Display* display, int num_queries) {
+  uint64_t start_ns = glcew_time_ns();
+  int i;
+  for (i = 0; i < num_queries; ++i) {
+    int major, minor;
+    XVisualInfo* visual = glXChooseVisual(display, 0, attributes);
+    if (visual != NULL) {
+      free_data(visual);
+    }
+    glXQueryExtensionsString(display, 0);
+    glXQueryVersion(display, &major, &minor);
+  }
+  return (glcew_time_ns() - start_ns) * 1e-3 / num_queries;
+}
+
+static uint64_t num_registrations(void) {
+  GLCEWGLXCacheStats stats;
+  glcewGLXCacheGetStats(&stats);
+  return stats.num_registrations;
+}
+
+static int run(const char* name, int num_queries) {
+  GLCEWGLXCacheStats stats;
+  Display* display = open_display(name);
+  double uncached_us, cached_us;
+  int i, ok = 1;
+  if (display == NULL) {
+    printf("Display %s can not be opened\n", name);
+    return 0;
+  }
+  uncached_us = time_queries(display, num_queries);
+  if (glcewGLXCacheEnable() != GLCEW_SUCCESS) {
+    printf("GLX query cache is not supported\n");
+    close_display(display);
+    return 0;
+  }
+  cached_us = time_queries(display, num_queries);
+  glcewGLXCacheGetStats(&stats);
+  printf("us per round of queries without / with cache: %.2f / %.2f, "
+         "%d misses\n",
+         uncached_us, cached_us, (int)stats.num_misses);
+
+  for (i = 0; i < 10; ++i) {
+    glcewGLXCacheInvalidate(display);
+    time_queries(display, 1);
+    glcewGLXCacheDisable();
+    glcewGLXCacheEnable();
+    time_queries(display, 1);
+  }
+  if (num_registrations() != 1) {
+    printf("Display is registered again after invalidate or disable\n");
+    ok = 0;
+  }
+  close_display(display);
+  display = open_display(name);
+  if (display != NULL) {
+    time_queries(display, 1);
+    if (num_registrations() != 2) {
+      printf("Reopened display is not registered\n");
+      ok = 0;
+    }
+    close_display(display);
+  }
+  glcewGLXCacheDisable();
+  return ok;
+}
+
+int main(int argc, char* argv[]) {
+  const int num_queries = (argc > 1) ? atoi(argv[1]) : 1000;
+  char name[32];
+  pid_t xvfb;
+  int ok;
+
+  if (glcewAcquire() != GLCEW_SUCCESS || !xlib_load()) {
+    printf("libGL or libX11 not found\n");
+    return TEST_SKIP_RETURN_CODE;
+  }
+  xvfb = xvfb_start(name, sizeof(name));
+  if (xvfb == -1) {
+    printf("Xvfb is not available\n");
+    glcewRelease();
+    return TEST_SKIP_RETURN_CODE;
+  }
+  ok = run(name, num_queries);
+  xvfb_stop(xvfb);
+  glcewRelease();
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
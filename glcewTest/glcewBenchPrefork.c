@@ -0,0 +1,197 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Prefork benchmark.
+ *
+ * Workers are forked from a parent which did not load the library, which
+ * called glcewInit(), and which called glcewPrefork(). Every worker creates
+ * a context and reads back its first frame. Reported are the medians of the
+ * time from fork() to glcewInit() returning and to the first frame, and of
+ * the memory of the worker which is not shared with the parent.
+ *
+ * Usage: benchglcew_prefork [num_workers]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "glcew.h"
+#include "glcew_intern.h"
+#include "glcewTestContext.h"
+
+#define GL_RGBA 0x1908
+#define GL_UNSIGNED_BYTE 0x1401
+
+#define MAX_WORKERS 256
+
+typedef enum ParentSetup {
+  PARENT_NONE,
+  PARENT_INIT,
+  PARENT_PREFORK,
+} ParentSetup;
+
+typedef struct WorkerResult {
+  /* Zero if the worker could not render its first frame. */
+  int ok;
+  uint64_t init_ns;
+  uint64_t startup_ns;
+  long rss_kb;
+  long private_kb;
+} WorkerResult;
+
+/* Resident and private (not shared with any other process) memory. */
+static void memory_kb(long* rss_kb, long* private_kb) {
+  FILE* file = fopen("/proc/self/smaps_rollup", "r");
+  char line[256];
+  *rss_kb = *private_kb = -1;
+  if (file == NULL) {
+    return;
+  }
+  *private_kb = 0;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    long value;
+    if (sscanf(line, "Rss: %ld", &value) == 1) {
+      *rss_kb = value;
+    }
+    else if (sscanf(line, "Private_Clean: %ld", &value) == 1 ||
+             sscanf(line, "Private_Dirty: %ld", &value) == 1) {
+      *private_kb += value;
+    }
+  }
+  fclose(file);
+}
+
+static void worker_run(uint64_t fork_ns, int fd) {
+  WorkerResult result = {0};
+  unsigned char pixel[4] = {0};
+  const int init_result = glcewInit();
+  result.init_ns = glcew_time_ns() - fork_ns;
+  if (init_result == GLCEW_SUCCESS && test_context_create(16, 16)) {
+    glClearColor(1.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glReadPixels(0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixel);
+    result.startup_ns = glcew_time_ns() - fork_ns;
+    result.ok = (pixel[0] == 255);
+    memory_kb(&result.rss_kb, &result.private_kb);
+    test_context_destroy();
+  }
+  if (write(fd, &result, sizeof(result)) != sizeof(result)) {
+    _exit(EXIT_FAILURE);
+  }
+  _exit(EXIT_SUCCESS);
+}
+
+static int compare_uint64(const void* a_v, const void* b_v) {
+  const uint64_t a = *(const uint64_t*)a_v, b = *(const uint64_t*)b_v;
+  return (a > b) - (a < b);
+}
+
+static uint64_t median(uint64_t* values, int num_values) {
+  qsort(values, num_values, sizeof(uint64_t), compare_uint64);
+  return values[num_values / 2];
+}
+
+/* Runs in its own process, so setups do not affect each other. Returns
+ * exit code of the runner.
+ */
+static int runner_run(const char* name, ParentSetup setup, int num_workers) {
+  uint64_t init_ns[MAX_WORKERS], startup_ns[MAX_WORKERS];
+  uint64_t rss_kb[MAX_WORKERS];
+  uint64_t private_kb[MAX_WORKERS];
+  int i, fds[2];
+  if ((setup == PARENT_INIT && glcewInit() != GLCEW_SUCCESS) ||
+      (setup == PARENT_PREFORK && glcewPrefork() != GLCEW_SUCCESS)) {
+    printf("libGL not found\n");
+    return TEST_SKIP_RETURN_CODE;
+  }
+  if (pipe(fds) != 0) {
+    return EXIT_FAILURE;
+  }
+  for (i = 0; i < num_workers; ++i) {
+    WorkerResult result;
+    uint64_t fork_ns;
+    pid_t pid;
+    fflush(stdout);
+    fork_ns = glcew_time_ns();
+    pid = fork();
+    if (pid == 0) {
+      close(fds[0]);
+      worker_run(fork_ns, fds[1]);
+    }
+    if (pid < 0 ||
+        read(fds[0], &result, sizeof(result)) != sizeof(result)) {
+      printf("Worker failed\n");
+      return EXIT_FAILURE;
+    }
+    waitpid(pid, NULL, 0);
+    if (!result.ok) {
+      printf("Worker has no OpenGL context\n");
+      return TEST_SKIP_RETURN_CODE;
+    }
+    init_ns[i] = result.init_ns;
+    startup_ns[i] = result.startup_ns;
+    rss_kb[i] = (uint64_t)result.rss_kb;
+    private_kb[i] = (uint64_t)result.private_kb;
+  }
+  printf("  %-14s %10.3f %10.2f %10d %10d\n",
+         name,
+         median(init_ns, num_workers) * 1e-6,
+         median(startup_ns, num_workers) * 1e-6,
+         (int)median(rss_kb, num_workers),
+         (int)median(private_kb, num_workers));
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[]) {
+  static const struct {
+    const char* name;
+    ParentSetup setup;
+  } setups[] = {
+    {"not loaded", PARENT_NONE},
+    {"glcewInit", PARENT_INIT},
+    {"glcewPrefork", PARENT_PREFORK},
+  };
+  int num_workers = (argc > 1) ? atoi(argv[1]) : 20;
+  size_t i;
+  if (num_workers < 1 || num_workers > MAX_WORKERS) {
+    num_workers = 20;
+  }
+  printf("Parent state, ms to init, ms to first frame, RSS KB, private KB "
+         "(medians of %d workers)\n", num_workers);
+  for (i = 0; i < sizeof(setups) / sizeof(*setups); ++i) {
+    int status;
+    pid_t pid;
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0) {
+      const int exit_code =
+          runner_run(setups[i].name, setups[i].setup, num_workers);
+      fflush(stdout);
+      _exit(exit_code);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) {
+      return EXIT_FAILURE;
+    }
+    if (WEXITSTATUS(status) != EXIT_SUCCESS) {
+      return WEXITSTATUS(status);
+    }
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#include "glcewTestContext.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <stddef.h>
+
+#include "glcew.h"
+
+#define GL_RENDERER 0x1F01
+#define GL_RGBA8 0x8058
+#define GL_DEPTH_COMPONENT24 0x81A6
+#define GL_FRAMEBUFFER 0x8D40
+#define GL_RENDERBUFFER 0x8D41
+#define GL_COLOR_ATTACHMENT0 0x8CE0
+#define GL_DEPTH_ATTACHMENT 0x8D00
+#define GL_FRAMEBUFFER_COMPLETE 0x8CD5
+
+typedef void (*tglGenFramebuffers) (GLsizei n, GLuint* framebuffers);
+typedef void (*tglBindFramebuffer) (GLenum target, GLuint framebuffer);
+typedef void (*tglGenRenderbuffers) (GLsizei n, GLuint* renderbuffers);
+typedef void (*tglBindRenderbuffer) (GLenum target, GLuint renderbuffer);
+typedef void (*tglRenderbufferStorage) (GLenum target,
+                                        GLenum internal_format,
+                                        GLsizei width,
+                                        GLsizei height);
+typedef void (*tglFramebufferRenderbuffer) (GLenum target,
+                                            GLenum attachment,
+                                            GLenum renderbuffer_target,
+                                            GLuint renderbuffer);
+typedef GLenum (*tglCheckFramebufferStatus) (GLenum target);
+
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLContext context = EGL_NO_CONTEXT;
+
+static int framebuffer_create(int width, int height) {
+  tglGenFramebuffers gen_framebuffers =
+      (tglGenFramebuffers)test_context_proc_address("glGenFramebuffers");
+  tglBindFramebuffer bind_framebuffer =
+      (tglBindFramebuffer)test_context_proc_address("glBindFramebuffer");
+  tglGenRenderbuffers gen_renderbuffers =
+      (tglGenRenderbuffers)test_context_proc_address("glGenRenderbuffers");
+  tglBindRenderbuffer bind_renderbuffer =
+      (tglBindRenderbuffer)test_context_proc_address("glBindRenderbuffer");
+  tglRenderbufferStorage renderbuffer_storage =
+      (tglRenderbufferStorage)test_context_proc_address(
+          "glRenderbufferStorage");
+  tglFramebufferRenderbuffer framebuffer_renderbuffer =
+      (tglFramebufferRenderbuffer)test_context_proc_address(
+          "glFramebufferRenderbuffer");
+  tglCheckFramebufferStatus check_framebuffer_status =
+      (tglCheckFramebufferStatus)test_context_proc_address(
+          "glCheckFramebufferStatus");
+  GLuint framebuffer, renderbuffers[2];
+  if (gen_framebuffers == NULL || bind_framebuffer == NULL ||
+      gen_renderbuffers == NULL || bind_renderbuffer == NULL ||
+      renderbuffer_storage == NULL || framebuffer_renderbuffer == NULL ||
+      check_framebuffer_status == NULL) {
+    return 0;
+  }
+  gen_renderbuffers(2, renderbuffers);
+  bind_renderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+  renderbuffer_storage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  bind_renderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+  renderbuffer_storage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+  gen_framebuffers(1, &framebuffer);
+  bind_framebuffer(GL_FRAMEBUFFER, framebuffer);
+  framebuffer_renderbuffer(GL_FRAMEBUFFER,
+                           GL_COLOR_ATTACHMENT0,
+                           GL_RENDERBUFFER,
+                           renderbuffers[0]);
+  framebuffer_renderbuffer(GL_FRAMEBUFFER,
+                           GL_DEPTH_ATTACHMENT,
+                           GL_RENDERBUFFER,
+                           renderbuffers[1]);
+  /* There is no drawable to take the initial viewport from. */
+  glViewport(0, 0, width, height);
+  return check_framebuffer_status(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+}
+
+int test_context_create(int width, int height) {
+  PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display;
+  const EGLint attributes[] = {
+      EGL_CONTEXT_MAJOR_VERSION, 3,
+      EGL_CONTEXT_MINOR_VERSION, 0,
+      EGL_CONTEXT_OPENGL_PROFILE_MASK,
+      EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+      EGL_NONE,
+  };
+  EGLint major, minor;
+  get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress(
+      "eglGetPlatformDisplayEXT");
+  if (get_platform_display == NULL) {
+    return 0;
+  }
+  display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                 EGL_DEFAULT_DISPLAY,
+                                 NULL);
+  if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+    return 0;
+  }
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    return 0;
+  }
+  context = eglCreateContext(display,
+                             EGL_NO_CONFIG_KHR,
+                             EGL_NO_CONTEXT,
+                             attributes);
+  if (context == EGL_NO_CONTEXT) {
+    return 0;
+  }
+  if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+    return 0;
+  }
+  return framebuffer_create(width, height);
+}
+
+void test_context_destroy(void) {
+  if (context != EGL_NO_CONTEXT) {
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(display, context);
+    context = EGL_NO_CONTEXT;
+  }
+  if (display != EGL_NO_DISPLAY) {
+    eglTerminate(display);
+    display = EGL_NO_DISPLAY;
+  }
+}
+
+void* test_context_proc_address(const char* name) {
+  return (void*)eglGetProcAddress(name);
+}
+
+const char* test_context_renderer(void) {
+  return (const char*)glGetString(GL_RENDERER);
+}
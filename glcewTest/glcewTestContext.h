@@ -0,0 +1,44 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* OpenGL context for tests and benchmarks which do not have an X server.
+ *
+ * Context is created by EGL on the surfaceless platform (llvmpipe or any
+ * other Mesa driver). Wrappers reach it through the dispatch of libGL, which
+ * routes calls to the context current on the thread regardless of the window
+ * system binding which made it current.
+ */
+
+#ifndef __GLCEW_TEST_CONTEXT_H__
+#define __GLCEW_TEST_CONTEXT_H__
+
+/* Exit code which makes CTest report the test as skipped. */
+#define TEST_SKIP_RETURN_CODE 77
+
+/* Create compatibility profile context and make it current for the calling
+ * thread, with a framebuffer of the given size (color and depth) bound for
+ * drawing and reading. Returns 0 if there is no driver to create it with.
+ */
+int test_context_create(int width, int height);
+void test_context_destroy(void);
+
+/* Entry point of a function which is not wrapped by GLCEW. */
+void* test_context_proc_address(const char* name);
+
+/* Name of the renderer of the current context. */
+const char* test_context_renderer(void);
+
+#endif  /* __GLCEW_TEST_CONTEXT_H__ */
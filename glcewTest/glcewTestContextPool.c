@@ -0,0 +1,398 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Context pool test.
+ *
+ * Xlib pixmap functions are replaced by the ones exported from this
+ * executable, and GLX and OpenGL calls are dispatched to a table bound by
+ * the thread, which keeps state of every mock context, so no X server is
+ * needed. Acquired contexts are current and receive the wrapper calls,
+ * released ones are reset, texture pool sees the reset, and metrics count
+ * acquires and exhaustion.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "glcew.h"
+#include "glcew_intern.h"
+
+#define GL_RGBA 0x1908
+#define GL_RGBA8 0x8058
+#define GL_RGBA16F 0x881A
+#define GL_UNSIGNED_BYTE 0x1401
+
+#define POOL_SIZE 2
+
+typedef struct MockContext {
+  int created;
+  int blend;
+  GLfloat clear_red;
+  GLint unpack_alignment;
+  GLuint bound_texture;
+} MockContext;
+
+/* Context handles point to the mock state, first one is of the caller. */
+static MockContext mock_contexts[POOL_SIZE + 1];
+
+static GLCEWDispatchTable mock_table;
+static MockContext* current_context = NULL;
+/* Calls without a current context go here and are ignored, as by GLX. */
+static MockContext no_context;
+static GLXDrawable current_drawable = 0;
+static Pixmap next_pixmap = 1;
+static int num_pixmaps = 0;
+static GLuint next_texture = 100;
+
+static int check(int condition, const char* message) {
+  if (!condition) {
+    printf("%s\n", message);
+  }
+  return condition;
+}
+
+/* ******************************** Mocks. ********************************* */
+
+Pixmap XCreatePixmap(Display* display,
+                     Drawable drawable,
+                     unsigned int width,
+                     unsigned int height,
+                     unsigned int depth) {
+  (void) display;  /* Ignored. */
+  (void) drawable;  /* Ignored. */
+  (void) width;  /* Ignored. */
+  (void) height;  /* Ignored. */
+  (void) depth;  /* Ignored. */
+  ++num_pixmaps;
+  return next_pixmap++;
+}
+
+int XFreePixmap(Display* display, Pixmap pixmap) {
+  (void) display;  /* Ignored. */
+  (void) pixmap;  /* Ignored. */
+  --num_pixmaps;
+  return 1;
+}
+
+static GLXPixmap mock_create_glx_pixmap(Display* display,
+                                        XVisualInfo* visual,
+                                        Pixmap pixmap) {
+  (void) display;  /* Ignored. */
+  (void) visual;  /* Ignored. */
+  return pixmap;
+}
+
+static void mock_destroy_glx_pixmap(Display* display, GLXPixmap pixmap) {
+  (void) display;  /* Ignored. */
+  (void) pixmap;  /* Ignored. */
+}
+
+static __GLXextFuncPtr mock_get_proc_address(const GLubyte* name) {
+  if (strcmp((const char*)name, "glXCreateGLXPixmap") == 0) {
+    return (__GLXextFuncPtr)mock_create_glx_pixmap;
+  }
+  if (strcmp((const char*)name, "glXDestroyGLXPixmap") == 0) {
+    return (__GLXextFuncPtr)mock_destroy_glx_pixmap;
+  }
+  return NULL;
+}
+
+static GLXContext mock_create_context(Display* display,
+                                      XVisualInfo* visual,
+                                      GLXContext share_context,
+                                      int direct) {
+  int i;
+  (void) display;  /* Ignored. */
+  (void) visual;  /* Ignored. */
+  (void) share_context;  /* Ignored. */
+  (void) direct;  /* Ignored. */
+  /* First context is the one of the caller. */
+  for (i = 1; i < POOL_SIZE + 1; ++i) {
+    if (!mock_contexts[i].created) {
+      mock_contexts[i].created = 1;
+      return (GLXContext)&mock_contexts[i];
+    }
+  }
+  return NULL;
+}
+
+static void mock_destroy_context(Display* display, GLXContext context) {
+  (void) display;  /* Ignored. */
+  ((MockContext*)context)->created = 0;
+}
+
+static int mock_make_current(Display* display,
+                             GLXDrawable drawable,
+                             GLXContext context) {
+  (void) display;  /* Ignored. */
+  current_context = (MockContext*)context;
+  current_drawable = drawable;
+  return 1;
+}
+
+static MockContext* state(void) {
+  return (current_context != NULL) ? current_context : &no_context;
+}
+
+static GLXContext mock_get_current_context(void) {
+  return (GLXContext)current_context;
+}
+
+static GLXDrawable mock_get_current_drawable(void) {
+  return current_drawable;
+}
+
+static void mock_enable(GLenum cap) {
+  if (cap == GL_BLEND) {
+    state()->blend = 1;
+  }
+}
+
+static void mock_disable(GLenum cap) {
+  if (cap == GL_BLEND) {
+    state()->blend = 0;
+  }
+}
+
+static void mock_clear_color(GLclampf red,
+                             GLclampf green,
+                             GLclampf blue,
+                             GLclampf alpha) {
+  (void) green;  /* Ignored. */
+  (void) blue;  /* Ignored. */
+  (void) alpha;  /* Ignored. */
+  state()->clear_red = red;
+}
+
+static void mock_pixel_store(GLenum name, GLint param) {
+  if (name == GL_UNPACK_ALIGNMENT) {
+    state()->unpack_alignment = param;
+  }
+}
+
+static void mock_bind_texture(GLenum target, GLuint texture) {
+  (void) target;  /* Ignored. */
+  state()->bound_texture = texture;
+}
+
+static void mock_viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+  (void) x;  /* Ignored. */
+  (void) y;  /* Ignored. */
+  (void) width;  /* Ignored. */
+  (void) height;  /* Ignored. */
+}
+
+static const GLubyte* mock_get_string(GLenum name) {
+  return (const GLubyte*)((name == GL_VERSION) ? "4.6 Mock" : "");
+}
+
+static void mock_get_integer(GLenum name, GLint* params) {
+  *params = (name == GL_ACTIVE_TEXTURE) ? GL_TEXTURE0 : 0;
+}
+
+static void mock_gen_textures(GLsizei n, GLuint* textures) {
+  GLsizei i;
+  for (i = 0; i < n; ++i) {
+    textures[i] = next_texture++;
+  }
+}
+
+static void mock_delete_textures(GLsizei n, const GLuint* textures) {
+  (void) n;  /* Ignored. */
+  (void) textures;  /* Ignored. */
+}
+
+static void mock_active_texture(GLenum texture) {
+  (void) texture;  /* Ignored. */
+}
+
+static void mock_tex_image(GLenum target,
+                           GLint level,
+                           GLint internal_format,
+                           GLsizei width,
+                           GLsizei height,
+                           GLint border,
+                           GLenum format,
+                           GLenum type,
+                           const GLvoid* pixels) {
+  (void) target;  /* Ignored. */
+  (void) level;  /* Ignored. */
+  (void) internal_format;  /* Ignored. */
+  (void) width;  /* Ignored. */
+  (void) height;  /* Ignored. */
+  (void) border;  /* Ignored. */
+  (void) format;  /* Ignored. */
+  (void) type;  /* Ignored. */
+  (void) pixels;  /* Ignored. */
+}
+
+static void mock_tex_parameter(GLenum target, GLenum name, GLint param) {
+  (void) target;  /* Ignored. */
+  (void) name;  /* Ignored. */
+  (void) param;  /* Ignored. */
+}
+
+static void mock_table_init(void) {
+  mock_table.glXGetProcAddressARB = mock_get_proc_address;
+  mock_table.glXCreateContext = mock_create_context;
+  mock_table.glXDestroyContext = mock_destroy_context;
+  mock_table.glXMakeCurrent = mock_make_current;
+  mock_table.glXGetCurrentContext = mock_get_current_context;
+  mock_table.glXGetCurrentDrawable = mock_get_current_drawable;
+  mock_table.glEnable = mock_enable;
+  mock_table.glDisable = mock_disable;
+  mock_table.glClearColor = mock_clear_color;
+  mock_table.glPixelStorei = mock_pixel_store;
+  mock_table.glBindTexture = mock_bind_texture;
+  mock_table.glViewport = mock_viewport;
+  mock_table.glGetString = mock_get_string;
+  mock_table.glGetIntegerv = mock_get_integer;
+  mock_table.glGenTextures = mock_gen_textures;
+  mock_table.glDeleteTextures = mock_delete_textures;
+  mock_table.glActiveTexture = mock_active_texture;
+  mock_table.glTexImage2D = mock_tex_image;
+  mock_table.glTexParameteri = mock_tex_parameter;
+}
+
+/* ***************************** Acquire/release. ************************** */
+
+static int test_acquire(GLCEWContextPool* pool) {
+  GLCEWContextPoolMetrics metrics;
+  GLCEWPooledContext* contexts[POOL_SIZE];
+  MockContext* mock;
+  int i, ok = 1;
+  for (i = 0; i < POOL_SIZE; ++i) {
+    contexts[i] = glcewContextPoolAcquire(pool);
+  }
+  ok &= check(contexts[0] != NULL && contexts[1] != NULL &&
+              contexts[0] != contexts[1],
+              "Pool contexts are not acquired");
+  ok &= check(glcewContextPoolAcquire(pool) == NULL,
+              "Context is acquired from the exhausted pool");
+  if (!ok) {
+    return 0;
+  }
+  mock = (MockContext*)glcewPooledContextGetContext(contexts[1]);
+  ok &= check(current_context == mock &&
+              current_drawable == glcewPooledContextGetDrawable(contexts[1]),
+              "Acquired context is not current");
+  ok &= check(glcew_bound_table ==
+                  glcewPooledContextGetDispatchTable(contexts[1]),
+              "Table of the acquired context is not bound");
+
+  /* State changed by a job is reset once the context is released. */
+  glEnable(GL_BLEND);
+  glClearColor(1.0f, 0.0f, 0.0f, 1.0f);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glBindTexture(GL_TEXTURE_2D, 1);
+  ok &= check(mock->blend && mock->clear_red == 1.0f &&
+              mock->unpack_alignment == 1 && mock->bound_texture == 1,
+              "Wrappers are not dispatched to the acquired context");
+  glcewContextPoolRelease(pool, contexts[1]);
+  ok &= check(!mock->blend && mock->clear_red == 0.0f &&
+              mock->unpack_alignment == 4 && mock->bound_texture == 0,
+              "Released context is not reset");
+  ok &= check(current_context == NULL,
+              "Released context is still current");
+  glcewContextPoolRelease(pool, contexts[0]);
+  ok &= check(glcew_bound_table == &mock_table,
+              "Table bound before acquire is not restored");
+
+  glcewContextPoolGetMetrics(pool, &metrics);
+  ok &= check(metrics.num_acquires == POOL_SIZE &&
+              metrics.num_exhausted == 1,
+              "Acquires are not counted");
+  ok &= check(metrics.max_acquire_ns <= metrics.total_acquire_ns,
+              "Acquire time is not accumulated");
+  return ok;
+}
+
+/* Texture unbound by the reset is not redefined by calls for texture 0 on
+ * the next acquire, so it is recycled with its original storage.
+ */
+static int test_texture_pool_reset(GLCEWContextPool* pool) {
+  GLCEWTexturePoolStats stats;
+  GLCEWPooledContext* context = glcewContextPoolAcquire(pool);
+  GLuint texture;
+  int ok = 1;
+  if (glcewTexturePoolEnable(0, 0) != GLCEW_SUCCESS) {
+    printf("Texture pool is not enabled\n");
+    return 0;
+  }
+  texture = glcewTexturePoolAcquire(GL_TEXTURE_2D, 1, GL_RGBA8, 64, 64,
+                                    GL_RGBA, GL_UNSIGNED_BYTE);
+  glcewContextPoolRelease(pool, context);
+
+  context = glcewContextPoolAcquire(pool);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, 128, 128, 0,
+               GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  glcewTexturePoolRelease(texture);
+  ok &= check(glcewTexturePoolAcquire(GL_TEXTURE_2D, 1, GL_RGBA8, 64, 64,
+                                      GL_RGBA, GL_UNSIGNED_BYTE) == texture,
+              "Texture unbound by the reset is redefined");
+  glcewTexturePoolGetStats(&stats);
+  ok &= check(stats.num_hits == 1, "Texture is not recycled");
+  glcewContextPoolRelease(pool, context);
+  glcewTexturePoolDisable();
+  return ok;
+}
+
+int main(void) {
+  GLCEWContextPoolSettings settings = {0};
+  XVisualInfo visual = {0};
+  GLCEWContextPool* pool;
+  _XPrivDisplay display;
+  Screen screen = {0};
+  int error, ok = 1;
+
+  mock_table_init();
+  glcew_bound_table = &mock_table;
+  /* RootWindow() reads the screens of the display. */
+  display = calloc(1, sizeof(*display));
+  display->screens = &screen;
+  display->nscreens = 1;
+  visual.depth = 24;
+  settings.display = (Display*)display;
+  settings.visual = &visual;
+  settings.size = POOL_SIZE;
+  settings.width = settings.height = 16;
+  /* Context of the caller is restored after the pool is created. */
+  mock_make_current(NULL, 1, (GLXContext)&mock_contexts[0]);
+  pool = glcewContextPoolCreate(&settings, &error);
+  if (pool == NULL) {
+    printf("Pool is not created: %s\n", glcewErrorString(error));
+    return EXIT_FAILURE;
+  }
+  ok &= check(current_context == &mock_contexts[0] && current_drawable == 1,
+              "Context of the caller is not restored");
+  ok &= check(num_pixmaps == POOL_SIZE, "Pixmaps are not created");
+  mock_make_current(NULL, 0, NULL);
+
+  ok &= test_acquire(pool);
+  ok &= test_texture_pool_reset(pool);
+
+  glcewContextPoolDestroy(pool);
+  ok &= check(num_pixmaps == 0 && !mock_contexts[1].created &&
+              !mock_contexts[2].created,
+              "Pool resources are not freed");
+  free(display);
+  if (!ok) {
+    return EXIT_FAILURE;
+  }
+  printf("OK\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* C++ dispatch layer test.
+ *
+ * Table bound with glcew::bindDispatchTable() only affects the thread which
+ * bound it, calls of both the layer and the C wrappers go to the table the
+ * thread is bound to (including an instance bound with ScopedInstanceBind),
+ * and calls of unbound threads follow the library being unloaded and loaded
+ * again.
+ */
+
+#include "glcew.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+#define TEST_SKIP_RETURN_CODE 77
+
+namespace {
+
+std::atomic<int> num_bound_calls(0);
+
+void boundClear(GLbitfield mask) {
+  (void) mask;  /* Ignored. */
+  ++num_bound_calls;
+}
+
+bool check(bool condition, const char* message) {
+  if (!condition) {
+    std::printf("%s\n", message);
+  }
+  return condition;
+}
+
+}  // namespace
+
+int main() {
+  if (glcewAcquire() != GLCEW_SUCCESS) {
+    std::printf("libGL not found\n");
+    return TEST_SKIP_RETURN_CODE;
+  }
+  const tglClear loaded_clear = glcew::get<glcew::Function::glClear>();
+  bool ok = check(loaded_clear == ::glClear_impl,
+                  "Unbound call does not go to the global implementation");
+
+  GLCEWDispatchTable table = {};
+  table.glClear = boundClear;
+  std::atomic<bool> bound(false), checked(false);
+  std::thread bound_thread([&]() {
+    glcew::bindDispatchTable(&table);
+    bound = true;
+    glcew::glClear(0);
+    ::glClear(0);
+    while (!checked) {
+      std::this_thread::yield();
+    }
+    glcew::bindDispatchTable(nullptr);
+  });
+  while (!bound) {
+    std::this_thread::yield();
+  }
+  /* Binding of the other thread is not visible here. */
+  ok &= check(glcew::get<glcew::Function::glClear>() == loaded_clear,
+              "Binding leaked to another thread");
+  checked = true;
+  bound_thread.join();
+  ok &= check(num_bound_calls == 2, "Call did not go to the bound table");
+
+  int error;
+  GLCEWInstance* instance = glcewInstanceCreate(&error);
+  if (instance != nullptr) {
+    {
+      glcew::ScopedInstanceBind instance_bind(instance);
+      ok &= check(glcew::get<glcew::Function::glClear>() ==
+                      glcewInstanceGetDispatchTable(instance)->glClear,
+                  "Call does not go to the bound instance");
+    }
+    ok &= check(glcew::get<glcew::Function::glClear>() == loaded_clear,
+                "Call goes to the instance after it is unbound");
+    glcewInstanceDestroy(instance);
+  }
+  else {
+    std::printf("Isolated instance is not available: %s\n",
+                glcewErrorString(error));
+  }
+
+  glcewRelease();
+  ok &= check(glcew::get<glcew::Function::glClear>() != loaded_clear &&
+                  glcew::get<glcew::Function::glClear>() == ::glClear_impl,
+              "Call goes to the unloaded library");
+  glcew::glClear(0);
+
+  glcewAcquire();
+  ok &= check(glcew::get<glcew::Function::glClear>() == ::glClear_impl,
+              "Call does not go to the reloaded library");
+  glcewRelease();
+
+  if (!ok) {
+    return EXIT_FAILURE;
+  }
+  std::printf("OK\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,197 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* GLX query cache test.
+ *
+ * Xlib registration functions are replaced by the ones exported from this
+ * executable, and queries are dispatched to a table bound by the thread, so
+ * no X server is needed. Display is registered once until it is closed, no
+ * matter how often the cache is disabled, invalidated or raced on, and the
+ * cache lock is consistent in the children forked while it is used, without
+ * calling glcewPrefork().
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "glcew.h"
+#include "glcew_intern.h"
+
+#define TEST_SKIP_RETURN_CODE 77
+
+#define NUM_RACING_THREADS 8
+#define NUM_FORKS 200
+
+typedef int (*tCloseDisplayProc) (Display* display, XExtCodes* codes);
+
+/* Any distinct addresses do, displays are never dereferenced. */
+static char fake_displays[4];
+#define DISPLAY(index) ((Display*)&fake_displays[index])
+
+static XExtCodes codes;
+static tCloseDisplayProc close_display_proc = NULL;
+static int num_server_queries = 0;
+
+static int check(int condition, const char* message) {
+  if (!condition) {
+    printf("%s\n", message);
+  }
+  return condition;
+}
+
+/* ******************************** Mocks. ********************************* */
+
+XExtCodes* XAddExtension(Display* display) {
+  (void) display;  /* Ignored. */
+  /* Give racing threads time to register the same display. */
+  usleep(1000);
+  return &codes;
+}
+
+int (*XESetCloseDisplay(Display* display,
+                        int extension,
+                        tCloseDisplayProc proc))(Display*, XExtCodes*) {
+  (void) display;  /* Ignored. */
+  (void) extension;  /* Ignored. */
+  close_display_proc = proc;
+  return NULL;
+}
+
+static int mock_query_version(Display* display, int* major, int* minor) {
+  (void) display;  /* Ignored. */
+  __atomic_add_fetch(&num_server_queries, 1, __ATOMIC_SEQ_CST);
+  *major = 1;
+  *minor = 4;
+  return 1;
+}
+
+static GLCEWDispatchTable mock_table;
+
+static int query(Display* display) {
+  int major = 0, minor = 0;
+  return glXQueryVersion(display, &major, &minor) && major == 1 && minor == 4;
+}
+
+static uint64_t num_registrations(void) {
+  GLCEWGLXCacheStats stats;
+  glcewGLXCacheGetStats(&stats);
+  return stats.num_registrations;
+}
+
+/* ***************************** Registration. ***************************** */
+
+static int test_registration(void) {
+  int ok = 1;
+  ok &= check(query(DISPLAY(0)) && query(DISPLAY(0)), "Query failed");
+  ok &= check(num_server_queries == 1, "Query is not cached");
+  ok &= check(num_registrations() == 1, "Display is not registered");
+
+  glcewGLXCacheInvalidate(DISPLAY(0));
+  query(DISPLAY(0));
+  glcewGLXCacheDisable();
+  glcewGLXCacheEnable();
+  query(DISPLAY(0));
+  ok &= check(num_server_queries == 3, "Dropped queries are still cached");
+  ok &= check(num_registrations() == 1,
+              "Display is registered again after invalidate or disable");
+
+  /* Display which was closed is registered again once it is used. */
+  close_display_proc(DISPLAY(0), &codes);
+  query(DISPLAY(0));
+  ok &= check(num_registrations() == 2,
+              "Closed display is not registered again");
+  return ok;
+}
+
+static void* racing_thread_run(void* user_data) {
+  glcew_bound_table = &mock_table;
+  query(user_data);
+  return NULL;
+}
+
+static int test_racing_registration(void) {
+  pthread_t threads[NUM_RACING_THREADS];
+  const uint64_t num_registrations_begin = num_registrations();
+  int i;
+  for (i = 0; i < NUM_RACING_THREADS; ++i) {
+    pthread_create(&threads[i], NULL, racing_thread_run, DISPLAY(1));
+  }
+  for (i = 0; i < NUM_RACING_THREADS; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+  return check(num_registrations() == num_registrations_begin + 1,
+               "Display is registered by every racing thread");
+}
+
+/* ******************************** Forking. ******************************* */
+
+static volatile int hammer_thread_stop = 0;
+
+/* Keep both the registration and the cache lock busy. */
+static void* hammer_thread_run(void* user_data) {
+  (void) user_data;  /* Ignored. */
+  glcew_bound_table = &mock_table;
+  while (!hammer_thread_stop) {
+    close_display_proc(DISPLAY(2), &codes);
+    query(DISPLAY(2));
+    glcewGLXCacheInvalidate(DISPLAY(2));
+  }
+  return NULL;
+}
+
+static int test_fork(void) {
+  pthread_t thread;
+  int i, ok = 1;
+  /* Fork handlers are registered by enabling the cache, without prefork. */
+  pthread_create(&thread, NULL, hammer_thread_run, NULL);
+  for (i = 0; i < NUM_FORKS && ok; ++i) {
+    int status;
+    const pid_t pid = fork();
+    if (pid == 0) {
+      alarm(5);
+      _exit(query(DISPLAY(3)) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) != pid ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      ok = check(0, "Child inherited the cache lock locked");
+    }
+  }
+  hammer_thread_stop = 1;
+  pthread_join(thread, NULL);
+  return ok;
+}
+
+int main(void) {
+  int ok = 1;
+  mock_table.glXQueryVersion = mock_query_version;
+  glcew_bound_table = &mock_table;
+  if (glcewGLXCacheEnable() != GLCEW_SUCCESS) {
+    printf("Xlib registration functions are not found\n");
+    return TEST_SKIP_RETURN_CODE;
+  }
+  ok &= test_registration();
+  ok &= test_racing_registration();
+  ok &= test_fork();
+  glcewGLXCacheDisable();
+  if (!ok) {
+    return EXIT_FAILURE;
+  }
+  printf("OK\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,161 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Isolated instance test.
+ *
+ * Calls dispatched through two instances go to their own copy of the
+ * library. Instance which is bound by another thread is not destroyed,
+ * binding of a thread which exits is released, and so is binding of the
+ * thread which destroys the instance.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "glcew.h"
+
+#define TEST_SKIP_RETURN_CODE 77
+
+typedef struct BindThread {
+  pthread_t thread;
+  GLCEWInstance* instance;
+  int unbind;
+  volatile int bound;
+  volatile int done;
+} BindThread;
+
+static int check(int condition, const char* message) {
+  if (!condition) {
+    printf("%s\n", message);
+  }
+  return condition;
+}
+
+/* Entry point returned by the library of the bound instance. */
+static __GLXextFuncPtr bound_proc_address(GLCEWInstance* instance) {
+  glcewInstanceBind(instance);
+  return glXGetProcAddressARB((const GLubyte*)"glClear");
+}
+
+static int test_isolation(GLCEWInstance* instance) {
+  const GLCEWDispatchTable* table = glcewInstanceGetDispatchTable(instance);
+  const GLCEWDispatchTable* other_table;
+  __GLXextFuncPtr proc, other_proc;
+  GLCEWInstance* other_instance;
+  int error, ok = 1;
+  other_instance = glcewInstanceCreate(&error);
+  if (other_instance == NULL) {
+    printf("Second instance is not available: %s\n",
+           glcewErrorString(error));
+    return 0;
+  }
+  other_table = glcewInstanceGetDispatchTable(other_instance);
+  ok &= check(table->glXGetProcAddressARB != NULL &&
+              other_table->glXGetProcAddressARB != NULL &&
+              table->glXGetProcAddressARB !=
+                  other_table->glXGetProcAddressARB,
+              "Instances share the library");
+  proc = bound_proc_address(instance);
+  other_proc = bound_proc_address(other_instance);
+  ok &= check(proc != NULL && other_proc != NULL && proc != other_proc,
+              "Calls of both instances go to the same library");
+  ok &= check(proc == table->glXGetProcAddressARB(
+                          (const GLubyte*)"glClear") &&
+              other_proc == other_table->glXGetProcAddressARB(
+                                (const GLubyte*)"glClear"),
+              "Call is not dispatched to the bound instance");
+  glcewInstanceBind(NULL);
+  ok &= check(glcewInstanceDestroy(other_instance) == GLCEW_SUCCESS,
+              "Second instance is not destroyed");
+  return ok;
+}
+
+static void* bind_thread_run(void* user_data) {
+  BindThread* bind_thread = user_data;
+  glcewInstanceBind(bind_thread->instance);
+  __atomic_store_n(&bind_thread->bound, 1, __ATOMIC_SEQ_CST);
+  while (!__atomic_load_n(&bind_thread->done, __ATOMIC_SEQ_CST)) {
+    sched_yield();
+  }
+  if (bind_thread->unbind) {
+    glcewInstanceBind(NULL);
+  }
+  return NULL;
+}
+
+static void bind_thread_start(BindThread* bind_thread,
+                              GLCEWInstance* instance,
+                              int unbind) {
+  bind_thread->instance = instance;
+  bind_thread->unbind = unbind;
+  bind_thread->bound = 0;
+  bind_thread->done = 0;
+  pthread_create(&bind_thread->thread, NULL, bind_thread_run, bind_thread);
+  while (!__atomic_load_n(&bind_thread->bound, __ATOMIC_SEQ_CST)) {
+    sched_yield();
+  }
+}
+
+static void bind_thread_finish(BindThread* bind_thread) {
+  __atomic_store_n(&bind_thread->done, 1, __ATOMIC_SEQ_CST);
+  pthread_join(bind_thread->thread, NULL);
+}
+
+int main(void) {
+  BindThread bind_thread;
+  GLCEWInstance* instance;
+  int error, ok = 1;
+
+  instance = glcewInstanceCreate(&error);
+  if (instance == NULL) {
+    printf("Isolated instance is not available: %s\n",
+           glcewErrorString(error));
+    return TEST_SKIP_RETURN_CODE;
+  }
+
+  ok &= test_isolation(instance);
+
+  /* Bound by another thread until it unbinds. */
+  bind_thread_start(&bind_thread, instance, 1);
+  ok &= check(glcewInstanceDestroy(instance) == GLCEW_ERROR_INSTANCE_BOUND,
+              "Instance bound by another thread is destroyed");
+  bind_thread_finish(&bind_thread);
+
+  /* Binding of the exited thread is released, bound by both threads until
+   * then.
+   */
+  glcewInstanceBind(instance);
+  bind_thread_start(&bind_thread, instance, 0);
+  ok &= check(glcewInstanceDestroy(instance) == GLCEW_ERROR_INSTANCE_BOUND,
+              "Instance bound by two threads is destroyed");
+  ok &= check(glcewInstanceGetBound() == instance,
+              "Refused destroy unbound the calling thread");
+  bind_thread_finish(&bind_thread);
+
+  /* Only bound by the calling thread. */
+  ok &= check(glcewInstanceDestroy(instance) == GLCEW_SUCCESS,
+              "Instance is not destroyed once other threads are gone");
+  ok &= check(glcewInstanceGetBound() == NULL,
+              "Destroyed instance is still bound");
+
+  if (!ok) {
+    return EXIT_FAILURE;
+  }
+  printf("OK\n");
+  return EXIT_SUCCESS;
+}
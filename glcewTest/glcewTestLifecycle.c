@@ -0,0 +1,188 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Library lifecycle test.
+ *
+ * Memory mapped for the library must be returned by glcewRelease(), repeated
+ * glcewAcquire()/glcewRelease() must not grow resident memory, every
+ * entry point must be resolved again once the library is reloaded, state of
+ * the hooks which refers to the library must not outlive the unload, and
+ * wrappers follow *_impl pointers assigned by the application once
+ * glcewUpdateDispatch() is called.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "glcew.h"
+#include "glcew_intern.h"
+
+#define TEST_SKIP_RETURN_CODE 77
+
+#define GL_TRIANGLES 0x0004
+
+#define NUM_WARMUP_CYCLES 20
+#define NUM_CYCLES 500
+/* Allowed growth of resident memory over all the cycles. */
+#define MAX_RSS_GROWTH_KB 1024
+/* Resident memory which is expected to be returned by the unload. libGL
+ * with its dependencies maps about 2 MB.
+ */
+#define MIN_RSS_RELEASED_KB 512
+
+typedef void (*tGenericFunction)(void);
+
+#define NUM_ENTRY_POINTS \
+        (sizeof(GLCEWDispatchTable) / sizeof(tGenericFunction))
+
+static void get_entry_points(tGenericFunction functions[NUM_ENTRY_POINTS]) {
+  GLCEWDispatchTable table;
+  glcew_dispatch_table_get_current(&table);
+  memcpy(functions, &table, sizeof(table));
+}
+
+static long rss_kb(void) {
+  FILE* file = fopen("/proc/self/statm", "r");
+  long size, resident;
+  if (file == NULL) {
+    return -1;
+  }
+  if (fscanf(file, "%ld %ld", &size, &resident) != 2) {
+    resident = -1;
+  }
+  fclose(file);
+  return (resident < 0) ? -1 : resident * 4;
+}
+
+/* Every entry point is resolved to something else than a stub. */
+static int test_reload(const tGenericFunction stubs[NUM_ENTRY_POINTS]) {
+  tGenericFunction functions[NUM_ENTRY_POINTS];
+  size_t i;
+  get_entry_points(functions);
+  for (i = 0; i < NUM_ENTRY_POINTS; ++i) {
+    if (functions[i] == NULL || functions[i] == stubs[i]) {
+      printf("Entry point %d is not resolved after reload\n", (int)i);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int num_intercepted_clears = 0;
+
+static void intercepted_clear(GLbitfield mask) {
+  (void) mask;  /* Ignored. */
+  ++num_intercepted_clears;
+}
+
+static int test_update_dispatch(void) {
+  tglClear loaded_clear;
+  int ok;
+  glcewAcquire();
+  loaded_clear = glClear_impl;
+  glClear_impl = intercepted_clear;
+  glcewUpdateDispatch();
+  glClear(0);
+  glClear_impl = loaded_clear;
+  glcewUpdateDispatch();
+  glcewRelease();
+  ok = (num_intercepted_clears == 1);
+  if (!ok) {
+    printf("Wrapper does not follow the assigned *_impl pointer\n");
+  }
+  return ok;
+}
+
+/* Hooks which were enabled while the library was loaded must not call into
+ * it once it is unloaded.
+ */
+static void test_hooks_after_unload(void) {
+  glcewAcquire();
+  glcewProfileEnable(2);
+  glcewValidationEnable(0);
+  if (glcewBatchEnable() == GLCEW_SUCCESS) {
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glDrawArrays(GL_TRIANGLES, 3, 3);
+  }
+  glcewRelease();
+  glXSwapBuffers(NULL, 0);
+  glcewProfileBegin("region");
+  glcewProfileEnd();
+  glcewProfileFrame();
+  glcewProfileDisable();
+  glcewValidationDisable();
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glcewBatchFlush();
+  glcewBatchDisable();
+}
+
+int main(void) {
+  tGenericFunction stubs[NUM_ENTRY_POINTS];
+  long rss_unloaded_kb, rss_loaded_kb, rss_released_kb;
+  long rss_begin_kb, rss_end_kb;
+  int i;
+
+  rss_unloaded_kb = rss_kb();
+  if (glcewAcquire() != GLCEW_SUCCESS) {
+    printf("libGL not found\n");
+    return TEST_SKIP_RETURN_CODE;
+  }
+  rss_loaded_kb = rss_kb();
+  glcewRelease();
+  rss_released_kb = rss_kb();
+  get_entry_points(stubs);
+  printf("RSS before load: %ld KB, loaded: %ld KB, released: %ld KB\n",
+         rss_unloaded_kb, rss_loaded_kb, rss_released_kb);
+  if (rss_loaded_kb >= 0 &&
+      rss_loaded_kb - rss_released_kb < MIN_RSS_RELEASED_KB) {
+    printf("Memory of the library is not released\n");
+    return EXIT_FAILURE;
+  }
+
+  for (i = 0; i < NUM_WARMUP_CYCLES; ++i) {
+    glcewAcquire();
+    glcewRelease();
+  }
+  rss_begin_kb = rss_kb();
+  for (i = 0; i < NUM_CYCLES; ++i) {
+    int ok;
+    if (glcewAcquire() != GLCEW_SUCCESS) {
+      printf("Reload %d failed\n", i);
+      return EXIT_FAILURE;
+    }
+    ok = test_reload(stubs);
+    glcewRelease();
+    if (!ok) {
+      return EXIT_FAILURE;
+    }
+  }
+  rss_end_kb = rss_kb();
+  printf("RSS after %d cycles: %ld KB, after %d more: %ld KB\n",
+         NUM_WARMUP_CYCLES, rss_begin_kb, NUM_CYCLES, rss_end_kb);
+  if (rss_begin_kb >= 0 && rss_end_kb - rss_begin_kb > MAX_RSS_GROWTH_KB) {
+    printf("Resident memory grows with every reload\n");
+    return EXIT_FAILURE;
+  }
+
+  if (!test_update_dispatch()) {
+    return EXIT_FAILURE;
+  }
+  test_hooks_after_unload();
+
+  printf("OK\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* GPU time profiler test.
+ *
+ * Nested regions are aggregated per label, regions begun deeper than the
+ * profiler tracks are dropped without closing the enclosing region early,
+ * frame boundaries and regions from another thread are ignored, and the
+ * JSON dump matches the aggregates returned by the API.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "glcew.h"
+#include "glcewTestContext.h"
+
+#define GL_COLOR_BUFFER_BIT 0x00004000
+
+#define NUM_FRAMES 20
+/* Profiler tracks 32 nested regions, "outer" takes one of them. */
+#define MAX_REGION_DEPTH 32
+#define NUM_DEEP_REGIONS 40
+#define NUM_DROPPED_DEEP_REGIONS (NUM_DEEP_REGIONS - MAX_REGION_DEPTH + 1)
+/* GPU is idle for this long before "outer" ends. */
+#define OUTER_SLEEP_MS 5
+
+static int check(int condition, const char* message) {
+  if (!condition) {
+    printf("%s\n", message);
+  }
+  return condition;
+}
+
+static int find_stats(const char* label, GLCEWProfileStats* stats) {
+  int i;
+  for (i = 0; i < glcewProfileNumLabels(); ++i) {
+    if (glcewProfileGetStats(i, stats) && strcmp(stats->label, label) == 0) {
+      return 1;
+    }
+  }
+  memset(stats, 0, sizeof(*stats));
+  return 0;
+}
+
+static void draw_frame(void) {
+  int i;
+  glcewProfileBegin("outer");
+  glcewProfileBegin("inner");
+  glClear(GL_COLOR_BUFFER_BIT);
+  glcewProfileEnd();
+  for (i = 0; i < NUM_DEEP_REGIONS; ++i) {
+    glcewProfileBegin("deep");
+  }
+  for (i = 0; i < NUM_DEEP_REGIONS; ++i) {
+    glcewProfileEnd();
+  }
+  /* If one of the dropped regions closed "outer", it ends before this. */
+  glFinish();
+  usleep(OUTER_SLEEP_MS * 1000);
+  glClear(GL_COLOR_BUFFER_BIT);
+  glcewProfileEnd();
+  glFinish();
+  glcewProfileFrame();
+}
+
+static void* foreign_thread_run(void* user_data) {
+  int i;
+  (void) user_data;  /* Ignored. */
+  for (i = 0; i < 4 * NUM_FRAMES; ++i) {
+    glcewProfileBegin("foreign");
+    glcewProfileEnd();
+    glcewProfileFrame();
+  }
+  return NULL;
+}
+
+static int test_regions(void) {
+  GLCEWProfileStats outer, inner, deep, frame;
+  pthread_t thread;
+  int i, ok = 1;
+  pthread_create(&thread, NULL, foreign_thread_run, NULL);
+  pthread_join(thread, NULL);
+  for (i = 0; i < NUM_FRAMES; ++i) {
+    draw_frame();
+  }
+  ok &= check(find_stats("outer", &outer) &&
+              find_stats("inner", &inner) &&
+              find_stats("deep", &deep),
+              "Region is not recorded");
+  ok &= check(!find_stats("foreign", &frame),
+              "Region of another thread is recorded");
+  ok &= check(glcewProfileGetFrameStats(&frame) &&
+              frame.count <= NUM_FRAMES,
+              "Frame boundary of another thread is recorded");
+  ok &= check(outer.count > 0 && inner.count == outer.count &&
+              deep.count == outer.count * (MAX_REGION_DEPTH - 1),
+              "Nested regions are not aggregated per label");
+  ok &= check(outer.total_ms >= inner.total_ms &&
+              outer.min_ms >= OUTER_SLEEP_MS * 0.8,
+              "Enclosing region is closed early");
+  printf("outer %.3f ms, inner %.3f ms, deep %.3f ms, frame %.3f ms "
+         "(%d frames)\n",
+         outer.mean_ms, inner.mean_ms, deep.mean_ms, frame.mean_ms,
+         (int)frame.count);
+  return ok;
+}
+
+static int test_json(void) {
+  GLCEWProfileStats outer;
+  char expected[128];
+  char json[8192];
+  size_t length;
+  FILE* file = tmpfile();
+  int ok = 1;
+  if (file == NULL || !glcewProfileDumpJSON(file)) {
+    printf("JSON can not be written\n");
+    return 0;
+  }
+  rewind(file);
+  length = fread(json, 1, sizeof(json) - 1, file);
+  json[length] = '\0';
+  fclose(file);
+  snprintf(expected, sizeof(expected), "\"dropped_regions\": %d",
+           NUM_FRAMES * NUM_DROPPED_DEEP_REGIONS);
+  ok &= check(strstr(json, expected) != NULL,
+              "Dropped regions do not match");
+  find_stats("outer", &outer);
+  snprintf(expected, sizeof(expected),
+           "{\"label\": \"outer\", \"count\": %llu, \"total_ms\": %f",
+           (unsigned long long)outer.count, outer.total_ms);
+  ok &= check(strstr(json, expected) != NULL,
+              "JSON does not match the API statistics");
+  return ok;
+}
+
+int main(void) {
+  int result, ok = 1;
+  if (glcewAcquire() != GLCEW_SUCCESS) {
+    printf("libGL not found\n");
+    return TEST_SKIP_RETURN_CODE;
+  }
+  if (!test_context_create(64, 64)) {
+    printf("No OpenGL context available\n");
+    glcewRelease();
+    return TEST_SKIP_RETURN_CODE;
+  }
+  result = glcewProfileEnable(1);
+  if (result != GLCEW_SUCCESS) {
+    printf("Profiler is not supported: %s\n", glcewErrorString(result));
+    test_context_destroy();
+    glcewRelease();
+    return TEST_SKIP_RETURN_CODE;
+  }
+  ok &= test_regions();
+  ok &= test_json();
+  glcewProfileDisable();
+  test_context_destroy();
+  glcewRelease();
+  if (!ok) {
+    return EXIT_FAILURE;
+  }
+  printf("OK\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Pipeline stall detector test.
+ *
+ * glFinish() is dispatched to a table bound by the thread, which stalls for
+ * the requested time, so no driver is needed. Calls below the threshold
+ * are not recorded, only every sample_rate-th call is timed, stalls from
+ * the same call site are merged while the ones from another call site are
+ * not, and the report lists all of it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "glcew.h"
+#include "glcew_intern.h"
+
+#define TEST_SKIP_RETURN_CODE 77
+
+#define THRESHOLD_US 2000
+#define STALL_US 5000
+#define SAMPLE_RATE 4
+
+static GLCEWDispatchTable mock_table;
+static unsigned int stall_us = 0;
+
+static int check(int condition, const char* message) {
+  if (!condition) {
+    printf("%s\n", message);
+  }
+  return condition;
+}
+
+static void mock_finish(void) {
+  if (stall_us != 0) {
+    usleep(stall_us);
+  }
+}
+
+/* Distinct call sites of the stalling call. */
+static GLCEW_NOINLINE void finish_at_site_a(void) {
+  glFinish();
+}
+
+static GLCEW_NOINLINE void finish_at_site_b(void) {
+  glFinish();
+}
+
+/* Report as a string, empty if it could not be written. */
+static void report(char* text, size_t text_size) {
+  FILE* file = tmpfile();
+  size_t length = 0;
+  if (file != NULL && glcewStallDetectorReport(file)) {
+    rewind(file);
+    length = fread(text, 1, text_size - 1, file);
+  }
+  text[length] = '\0';
+  if (file != NULL) {
+    fclose(file);
+  }
+}
+
+static int count_lines(const char* text, const char* prefix) {
+  const size_t prefix_length = strlen(prefix);
+  int num_lines = 0;
+  while (text != NULL && *text != '\0') {
+    if (strncmp(text, prefix, prefix_length) == 0) {
+      ++num_lines;
+    }
+    text = strchr(text, '\n');
+    if (text != NULL) {
+      ++text;
+    }
+  }
+  return num_lines;
+}
+
+static int test_threshold_and_dedup(void) {
+  char text[8192];
+  int i, ok = 1;
+  glcewStallDetectorEnable(THRESHOLD_US, 1, 0);
+  stall_us = 0;
+  for (i = 0; i < 10; ++i) {
+    finish_at_site_a();
+  }
+  report(text, sizeof(text));
+  ok &= check(count_lines(text, "  glFinish:") == 0,
+              "Call below the threshold is recorded");
+
+  stall_us = STALL_US;
+  for (i = 0; i < 3; ++i) {
+    finish_at_site_a();
+  }
+  finish_at_site_b();
+  report(text, sizeof(text));
+  ok &= check(strstr(text, "threshold 2000 us, sampling 1/1") != NULL,
+              "Report does not state the settings");
+  ok &= check(count_lines(text, "  glFinish: 3 hits") == 1 &&
+              count_lines(text, "  glFinish: 1 hits") == 1 &&
+              count_lines(text, "  glFinish:") == 2,
+              "Stalls are not merged per call site");
+  ok &= check(count_lines(text, "    #0 ") == 2,
+              "Report has no backtraces");
+  glcewStallDetectorReset();
+  report(text, sizeof(text));
+  ok &= check(count_lines(text, "  glFinish:") == 0,
+              "Reset keeps the records");
+  return ok;
+}
+
+static int test_sampling(void) {
+  char text[8192];
+  int i, ok = 1;
+  glcewStallDetectorEnable(THRESHOLD_US, SAMPLE_RATE, 0);
+  stall_us = STALL_US;
+  for (i = 0; i < 2 * SAMPLE_RATE; ++i) {
+    finish_at_site_a();
+  }
+  report(text, sizeof(text));
+  ok &= check(strstr(text, "sampling 1/4") != NULL,
+              "Report does not state the sampling");
+  ok &= check(count_lines(text, "  glFinish: 2 hits") == 1,
+              "Calls are not sampled");
+
+  /* Disabled detector does not time anything. */
+  glcewStallDetectorDisable();
+  glcewStallDetectorReset();
+  for (i = 0; i < 2 * SAMPLE_RATE; ++i) {
+    finish_at_site_a();
+  }
+  report(text, sizeof(text));
+  ok &= check(count_lines(text, "  glFinish:") == 0,
+              "Disabled detector records stalls");
+  return ok;
+}
+
+int main(void) {
+  int ok = 1;
+  mock_table.glFinish = mock_finish;
+  glcew_bound_table = &mock_table;
+  if (glcewStallDetectorEnable(THRESHOLD_US, 1, 0) != GLCEW_SUCCESS) {
+    printf("Stall detector is not supported\n");
+    return TEST_SKIP_RETURN_CODE;
+  }
+  ok &= test_threshold_and_dedup();
+  ok &= test_sampling();
+  if (!ok) {
+    return EXIT_FAILURE;
+  }
+  printf("OK\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,239 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Texture pool test.
+ *
+ * Parked textures are unbound from every unit they were bound to, textures
+ * which were not acquired from the pool are deleted for real, recycled
+ * textures have the default sampling parameters, and the pool lock is
+ * consistent in the children forked while it is used.
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "glcew.h"
+#include "glcew_intern.h"
+#include "glcewTestContext.h"
+
+#define GL_RGBA 0x1908
+#define GL_RGBA8 0x8058
+#define GL_UNSIGNED_BYTE 0x1401
+#define GL_TEXTURE_BINDING_2D 0x8069
+#define GL_NEAREST 0x2600
+
+#define NUM_FORKS 200
+
+typedef GLboolean (*tglIsTexture) (GLuint texture);
+typedef GLenum (*tglGetError) (void);
+typedef void (*tglGetTexParameteriv) (GLenum target,
+                                      GLenum name,
+                                      GLint* params);
+
+static int check(int condition, const char* message) {
+  if (!condition) {
+    printf("%s\n", message);
+  }
+  return condition;
+}
+
+static GLint binding_on_unit(int unit) {
+  GLint texture = -1;
+  glActiveTexture(GL_TEXTURE0 + unit);
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+  return texture;
+}
+
+/* ******************************** Forking. ******************************* */
+
+static volatile int stats_thread_stop = 0;
+
+static void* stats_thread_run(void* user_data) {
+  GLCEWTexturePoolStats stats;
+  (void) user_data;  /* Ignored. */
+  while (!stats_thread_stop) {
+    glcewTexturePoolGetStats(&stats);
+  }
+  return NULL;
+}
+
+/* Children forked while another thread holds the pool lock are not to
+ * inherit it locked.
+ */
+static int test_fork(void) {
+  pthread_t thread;
+  int i, ok = 1;
+  if (glcewPrefork() != GLCEW_SUCCESS) {
+    printf("Prefork failed\n");
+    return 0;
+  }
+  pthread_create(&thread, NULL, stats_thread_run, NULL);
+  for (i = 0; i < NUM_FORKS && ok; ++i) {
+    int status;
+    const pid_t pid = fork();
+    if (pid == 0) {
+      GLCEWTexturePoolStats stats;
+      alarm(5);
+      glcewTexturePoolGetStats(&stats);
+      _exit(0);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) != pid ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      ok = check(0, "Child inherited the pool lock locked");
+    }
+  }
+  stats_thread_stop = 1;
+  pthread_join(thread, NULL);
+  return ok;
+}
+
+/* ******************************** Parking. ******************************* */
+
+static int test_parking(void) {
+  tglIsTexture is_texture =
+      (tglIsTexture)test_context_proc_address("glIsTexture");
+  GLCEWTexturePoolStats stats;
+  GLuint texture, other, unknown;
+  int ok = 1;
+
+  if (glcewTexturePoolEnable(0, GLCEW_TEXTURE_POOL_WRAP_DELETE) !=
+      GLCEW_SUCCESS) {
+    printf("Texture pool is not available\n");
+    return 0;
+  }
+
+  /* Acquired texture bound to several units. */
+  texture = glcewTexturePoolAcquire(GL_TEXTURE_2D, 1, GL_RGBA8, 64, 64,
+                                    GL_RGBA, GL_UNSIGNED_BYTE);
+  glActiveTexture(GL_TEXTURE0 + 3);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glActiveTexture(GL_TEXTURE0 + 5);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glActiveTexture(GL_TEXTURE0 + 1);
+  glDeleteTextures(1, &texture);
+  glcewTexturePoolGetStats(&stats);
+  ok &= check(stats.num_parked == 1, "Acquired texture is not parked");
+  ok &= check(binding_on_unit(0) == 0 &&
+                  binding_on_unit(3) == 0 &&
+                  binding_on_unit(5) == 0,
+              "Parked texture is still bound");
+
+  /* Active unit is restored after unbinding from the other units. */
+  other = glcewTexturePoolAcquire(GL_TEXTURE_2D, 1, GL_RGBA8, 64, 64,
+                                  GL_RGBA, GL_UNSIGNED_BYTE);
+  ok &= check(other == texture, "Parked texture is not recycled");
+  glActiveTexture(GL_TEXTURE0 + 2);
+  glBindTexture(GL_TEXTURE_2D, other);
+  glActiveTexture(GL_TEXTURE0 + 4);
+  glcewTexturePoolRelease(other);
+  {
+    GLint active = 0;
+    glGetIntegerv(GL_ACTIVE_TEXTURE, &active);
+    ok &= check(active == GL_TEXTURE0 + 4, "Active unit is not restored");
+  }
+  ok &= check(binding_on_unit(2) == 0, "Released texture is still bound");
+
+  /* Texture which was not acquired from the pool is deleted. */
+  glActiveTexture(GL_TEXTURE0);
+  glGenTextures(1, &unknown);
+  glBindTexture(GL_TEXTURE_2D, unknown);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 64, 64, 0,
+               GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  glDeleteTextures(1, &unknown);
+  glcewTexturePoolGetStats(&stats);
+  ok &= check(stats.num_parked == 1, "Unknown texture is parked");
+  if (is_texture != NULL) {
+    ok &= check(!is_texture(unknown), "Unknown texture is not deleted");
+  }
+
+  glcewTexturePoolDisable();
+  return ok;
+}
+
+/* ****************************** Parameters. ***************************** */
+
+static int test_parameters(void) {
+  tglGetTexParameteriv get_parameter = (tglGetTexParameteriv)
+      test_context_proc_address("glGetTexParameteriv");
+  tglGetError get_error = (tglGetError)test_context_proc_address("glGetError");
+  GLint min_filter, wrap_s, base_level, max_level, swizzle_r;
+  GLuint texture;
+  int has_swizzle, ok = 1;
+
+  if (get_parameter == NULL || get_error == NULL ||
+      glcewTexturePoolEnable(0, 0) != GLCEW_SUCCESS) {
+    printf("Texture parameters can not be queried\n");
+    return 0;
+  }
+  texture = glcewTexturePoolAcquire(GL_TEXTURE_2D, 3, GL_RGBA8, 64, 64,
+                                    GL_RGBA, GL_UNSIGNED_BYTE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 1);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_R, GL_GREEN);
+  get_parameter(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_R, &swizzle_r);
+  has_swizzle = (swizzle_r == GL_GREEN);
+  glcewTexturePoolRelease(texture);
+
+  ok &= check(glcewTexturePoolAcquire(GL_TEXTURE_2D, 3, GL_RGBA8, 64, 64,
+                                      GL_RGBA, GL_UNSIGNED_BYTE) == texture,
+              "Parked texture is not recycled");
+  get_parameter(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, &min_filter);
+  get_parameter(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, &wrap_s);
+  get_parameter(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, &base_level);
+  get_parameter(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &max_level);
+  get_parameter(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_R, &swizzle_r);
+  ok &= check(min_filter == GL_NEAREST_MIPMAP_LINEAR &&
+              wrap_s == GL_REPEAT &&
+              base_level == 0 &&
+              max_level == 2,
+              "Recycled texture keeps parameters of the previous owner");
+  ok &= check(!has_swizzle || swizzle_r == GL_RED,
+              "Recycled texture keeps swizzle of the previous owner");
+  ok &= check(get_error() == 0, "Parameters reset raised an error");
+  glcewTexturePoolRelease(texture);
+  glcewTexturePoolDisable();
+  return ok;
+}
+
+int main(void) {
+  int ok;
+  if (glcewAcquire() != GLCEW_SUCCESS) {
+    printf("libGL not found\n");
+    return TEST_SKIP_RETURN_CODE;
+  }
+  /* Prefork is to be done without a context. */
+  ok = test_fork();
+  if (!test_context_create(64, 64)) {
+    printf("No OpenGL context available\n");
+    glcewRelease();
+    return ok ? TEST_SKIP_RETURN_CODE : EXIT_FAILURE;
+  }
+  ok &= test_parking();
+  ok &= test_parameters();
+  test_context_destroy();
+  glcewRelease();
+  if (!ok) {
+    return EXIT_FAILURE;
+  }
+  printf("OK\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,44 @@
+# Copyright 2018 Blender Foundation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License
+
+# USDT probe test.
+#
+# Notes of the library built with WITH_USDT are to have the probes of the
+# wrappers and of the API, so tracers can attach to them. Provider and probes
+# can be overridden to check the notes of another binary.
+#
+# Usage: cmake -DREADELF=<readelf> -DLIBRARY=<library>
+#              [-DPROVIDER=<provider>] [-DPROBES=<probe;...>]
+#              -P glcewTestUSDT.cmake
+
+if(NOT DEFINED PROVIDER)
+  set(PROVIDER glcew)
+endif()
+if(NOT DEFINED PROBES)
+  set(PROBES glDrawArrays__entry glcewInit__entry)
+endif()
+
+execute_process(COMMAND ${READELF} -n ${LIBRARY}
+                OUTPUT_VARIABLE NOTES
+                RESULT_VARIABLE RESULT)
+if(NOT RESULT EQUAL 0)
+  message(FATAL_ERROR "${READELF} -n ${LIBRARY} failed")
+endif()
+
+foreach(PROBE ${PROBES})
+  if(NOT NOTES MATCHES "Provider: ${PROVIDER}\n +Name: ${PROBE}\n")
+    message(FATAL_ERROR "Probe ${PROBE} is missing in ${LIBRARY}")
+  endif()
+endforeach()
+message(STATUS "OK")
@@ -0,0 +1,296 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Validation test.
+ *
+ * Debug output entry points are dispatched to a table bound by every thread,
+ * so no driver is needed. Validation is refused for a context without debug
+ * output support, and messages pushed from several threads at once, which
+ * also enable validation at the same time, are polled by several threads
+ * exactly once and attributed to the wrapper called by the pushing thread.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "glcew.h"
+#include "glcew_intern.h"
+
+#define NUM_PRODUCERS 4
+#define NUM_CONSUMERS 2
+#define NUM_MESSAGES_PER_PRODUCER 20000
+#define NUM_MESSAGES (NUM_PRODUCERS * NUM_MESSAGES_PER_PRODUCER)
+/* Producers wait while this many messages are not polled yet, so none are
+ * dropped. Queue holds 256 messages.
+ */
+#define MAX_MESSAGES_IN_FLIGHT 128
+
+typedef void (*tDebugProc) (GLenum source,
+                            GLenum type,
+                            GLuint id,
+                            GLenum severity,
+                            GLsizei length,
+                            const char* message,
+                            const void* user_param);
+
+static GLCEWDispatchTable mock_table;
+static const char* mock_version = NULL;
+static const char* mock_extensions = NULL;
+static tDebugProc debug_proc = NULL;
+static char debug_message_callback_name[64];
+static int debug_output_enabled = 0;
+
+static unsigned char received[NUM_PRODUCERS][NUM_MESSAGES_PER_PRODUCER];
+static int num_pushed = 0;
+static int num_received = 0;
+static int num_misattributed = 0;
+static int num_duplicates = 0;
+
+static int check(int condition, const char* message) {
+  if (!condition) {
+    printf("%s\n", message);
+  }
+  return condition;
+}
+
+/* ******************************** Mocks. ********************************* */
+
+static const GLubyte* mock_get_string(GLenum name) {
+  return (const GLubyte*)((name == GL_VERSION) ? mock_version
+                                               : mock_extensions);
+}
+
+static void mock_enable(GLenum cap) {
+  if (cap == GL_DEBUG_OUTPUT) {
+    debug_output_enabled = 1;
+  }
+}
+
+static void mock_disable(GLenum cap) {
+  (void) cap;  /* Ignored. */
+}
+
+static void mock_clear(GLbitfield mask) {
+  (void) mask;  /* Ignored. */
+}
+
+static void mock_flush(void) {
+}
+
+static void mock_finish(void) {
+}
+
+static void mock_clear_color(GLclampf red,
+                             GLclampf green,
+                             GLclampf blue,
+                             GLclampf alpha) {
+  (void) red;  /* Ignored. */
+  (void) green;  /* Ignored. */
+  (void) blue;  /* Ignored. */
+  (void) alpha;  /* Ignored. */
+}
+
+static void mock_debug_message_callback(tDebugProc callback,
+                                        const void* user_param) {
+  (void) user_param;  /* Ignored. */
+  if (callback != NULL) {
+    debug_proc = callback;
+  }
+}
+
+static void mock_debug_message_control(GLenum source,
+                                       GLenum type,
+                                       GLenum severity,
+                                       GLsizei count,
+                                       const GLuint* ids,
+                                       GLboolean enabled) {
+  (void) source;  /* Ignored. */
+  (void) type;  /* Ignored. */
+  (void) severity;  /* Ignored. */
+  (void) count;  /* Ignored. */
+  (void) ids;  /* Ignored. */
+  (void) enabled;  /* Ignored. */
+}
+
+/* Like the one of a real driver, returns non-NULL for any name. */
+static __GLXextFuncPtr mock_get_proc_address(const GLubyte* name) {
+  if (strncmp((const char*)name, "glDebugMessageCallback", 22) == 0) {
+    snprintf(debug_message_callback_name,
+             sizeof(debug_message_callback_name), "%s", (const char*)name);
+    return (__GLXextFuncPtr)mock_debug_message_callback;
+  }
+  if (strncmp((const char*)name, "glDebugMessageControl", 21) == 0) {
+    return (__GLXextFuncPtr)mock_debug_message_control;
+  }
+  return (__GLXextFuncPtr)mock_flush;
+}
+
+/* ***************************** Support check. **************************** */
+
+static int test_support(void) {
+  int ok = 1;
+  mock_version = "3.0 Mock";
+  mock_extensions = "GL_ARB_foo GL_KHR_debug_foo GL_ARB_debug_output2";
+  ok &= check(glcewValidationEnable(0) == GLCEW_ERROR_UNSUPPORTED,
+              "Validation is enabled without debug output");
+
+  mock_version = "2.1 Mock";
+  mock_extensions = "GL_ARB_foo GL_ARB_debug_output";
+  ok &= check(glcewValidationEnable(0) == GLCEW_SUCCESS &&
+              strcmp(debug_message_callback_name,
+                     "glDebugMessageCallbackARB") == 0 &&
+              !debug_output_enabled,
+              "GL_ARB_debug_output is not used");
+  glcewValidationDisable();
+
+  mock_version = "4.6 Mock";
+  mock_extensions = "";
+  debug_proc = NULL;
+  return ok;
+}
+
+/* ****************************** Messages. ******************************* */
+
+typedef struct Producer {
+  pthread_t thread;
+  int index;
+  int enable_result;
+} Producer;
+
+/* Wrapped function which every producer calls before pushing, and name the
+ * messages are expected to be attributed to.
+ */
+static void producer_call(int index) {
+  switch (index) {
+    case 0: glClear(0); break;
+    case 1: glFlush(); break;
+    case 2: glFinish(); break;
+    default: glClearColor(0.0f, 0.0f, 0.0f, 0.0f); break;
+  }
+}
+
+static const char* producer_function(int index) {
+  static const char* names[] = {"glClear", "glFlush", "glFinish",
+                                "glClearColor"};
+  return names[(index < 3) ? index : 3];
+}
+
+static void* producer_run(void* user_data) {
+  Producer* producer = user_data;
+  char message[64];
+  int i;
+  glcew_bound_table = &mock_table;
+  /* Every producer enables validation, racing on queue initialization. */
+  producer->enable_result =
+      glcewValidationEnable(GLCEW_VALIDATION_SYNCHRONOUS);
+  if (producer->enable_result != GLCEW_SUCCESS) {
+    return NULL;
+  }
+  for (i = 0; i < NUM_MESSAGES_PER_PRODUCER; ++i) {
+    while (__atomic_load_n(&num_pushed, __ATOMIC_SEQ_CST) -
+               __atomic_load_n(&num_received, __ATOMIC_SEQ_CST) >=
+           MAX_MESSAGES_IN_FLIGHT) {
+      sched_yield();
+    }
+    producer_call(producer->index);
+    snprintf(message, sizeof(message), "%d %d", producer->index, i);
+    debug_proc(0, 0, (GLuint)i, 0, -1, message, NULL);
+    __atomic_add_fetch(&num_pushed, 1, __ATOMIC_SEQ_CST);
+  }
+  return NULL;
+}
+
+static void* consumer_run(void* user_data) {
+  GLCEWValidationMessage message;
+  (void) user_data;  /* Ignored. */
+  while (__atomic_load_n(&num_received, __ATOMIC_SEQ_CST) +
+             (int)glcewValidationNumDropped() < NUM_MESSAGES) {
+    int producer, index;
+    if (!glcewValidationPoll(&message)) {
+      sched_yield();
+      continue;
+    }
+    if (sscanf(message.message, "%d %d", &producer, &index) != 2 ||
+        producer < 0 || producer >= NUM_PRODUCERS ||
+        index < 0 || index >= NUM_MESSAGES_PER_PRODUCER ||
+        message.function == NULL ||
+        strcmp(message.function, producer_function(producer)) != 0) {
+      __atomic_add_fetch(&num_misattributed, 1, __ATOMIC_SEQ_CST);
+    }
+    else if (__atomic_exchange_n(&received[producer][index], 1,
+                                 __ATOMIC_SEQ_CST)) {
+      __atomic_add_fetch(&num_duplicates, 1, __ATOMIC_SEQ_CST);
+    }
+    __atomic_add_fetch(&num_received, 1, __ATOMIC_SEQ_CST);
+  }
+  return NULL;
+}
+
+static int test_messages(void) {
+  Producer producers[NUM_PRODUCERS];
+  pthread_t consumers[NUM_CONSUMERS];
+  int i, ok = 1;
+  for (i = 0; i < NUM_CONSUMERS; ++i) {
+    pthread_create(&consumers[i], NULL, consumer_run, NULL);
+  }
+  for (i = 0; i < NUM_PRODUCERS; ++i) {
+    producers[i].index = i;
+    pthread_create(&producers[i].thread, NULL, producer_run, &producers[i]);
+  }
+  for (i = 0; i < NUM_PRODUCERS; ++i) {
+    pthread_join(producers[i].thread, NULL);
+    ok &= check(producers[i].enable_result == GLCEW_SUCCESS,
+                "Validation is not enabled");
+  }
+  if (!ok) {
+    /* Consumers would wait for messages forever. */
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < NUM_CONSUMERS; ++i) {
+    pthread_join(consumers[i], NULL);
+  }
+  printf("%d messages received, %d dropped\n",
+         num_received, (int)glcewValidationNumDropped());
+  ok &= check(num_misattributed == 0,
+              "Message is attributed to another function");
+  ok &= check(num_duplicates == 0, "Message is received twice");
+  ok &= check(num_received == NUM_MESSAGES, "Message is lost");
+  ok &= check(debug_output_enabled, "GL_DEBUG_OUTPUT is not enabled");
+  return ok;
+}
+
+int main(void) {
+  int ok = 1;
+  mock_table.glXGetProcAddressARB = mock_get_proc_address;
+  mock_table.glGetString = mock_get_string;
+  mock_table.glEnable = mock_enable;
+  mock_table.glDisable = mock_disable;
+  mock_table.glClear = mock_clear;
+  mock_table.glFlush = mock_flush;
+  mock_table.glFinish = mock_finish;
+  mock_table.glClearColor = mock_clear_color;
+  glcew_bound_table = &mock_table;
+  ok &= test_support();
+  ok &= test_messages();
+  if (!ok) {
+    return EXIT_FAILURE;
+  }
+  printf("OK\n");
+  return EXIT_SUCCESS;
+}
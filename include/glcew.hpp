@@ -0,0 +1,547 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#ifndef __GLCEW_HPP__
+#define __GLCEW_HPP__
+
+/* Header-only C++17 dispatch layer.
+ *
+ * Functions from this header call the loaded implementation directly,
+ * without going through the out-of-line wrappers of the C library. Every
+ * call compiles to a load of the thread local glcew_bound_table, a branch on
+ * it being NULL, a load of the entry point and an indirect call.
+ *
+ * Table bound to the thread is the one of the C library, so calls go to the
+ * same implementation as the C wrappers: the instance bound with
+ * glcewInstanceBind(), the pooled context acquired by the thread, or the
+ * global implementation (the *_impl pointers, which are read on every call,
+ * so the layer follows the library being loaded and unloaded).
+ *
+ * NOTE: Calls made through this layer bypass the wrapper hooks (profiler
+ * frame boundaries, stall detector, call tracking for validation, draw
+ * batching). Call glcewBatchFlush() before mixing them with batched draws of
+ * the C wrappers.
+ */
+
+#include <glcew.h>
+
+#include <utility>
+
+#if defined(__GNUC__) || defined(__clang__)
+#  define GLCEW_ALWAYS_INLINE [[gnu::always_inline]]
+#else
+#  define GLCEW_ALWAYS_INLINE
+#endif
+
+namespace glcew {
+
+/* ****************************************************************************
+ * * Dispatch table
+ * */
+
+/* Index of every wrapped function. */
+enum class Function : int {
+  glClearColor,
+  glClear,
+  glBlendFunc,
+  glPolygonMode,
+  glScissor,
+  glDrawBuffer,
+  glReadBuffer,
+  glEnable,
+  glDisable,
+  glIsEnabled,
+  glGetBooleanv,
+  glGetDoublev,
+  glGetFloatv,
+  glGetIntegerv,
+  glGetString,
+  glFinish,
+  glFlush,
+  glDepthFunc,
+  glViewport,
+  glDrawArrays,
+  glDrawElements,
+  glPixelStorei,
+  glReadPixels,
+  glTexParameteri,
+  glGetTexLevelParameteriv,
+  glTexImage2D,
+  glGetTexImage,
+  glGenTextures,
+  glDeleteTextures,
+  glBindTexture,
+  glActiveTexture,
+  glXChooseVisual,
+  glXCreateContext,
+  glXDestroyContext,
+  glXMakeCurrent,
+  glXSwapBuffers,
+  glXQueryExtension,
+  glXQueryVersion,
+  glXGetCurrentContext,
+  glXGetCurrentDrawable,
+  glXWaitGL,
+  glXWaitX,
+  glXQueryExtensionsString,
+  glXGetClientString,
+  glXGetProcAddressARB,
+  NUM_FUNCTIONS
+};
+
+template <Function F>
+struct FunctionTraits;
+
+#define GLCEW_FUNCTION_TRAITS(name)                               \
+  template <>                                                     \
+  struct FunctionTraits<Function::name> {                         \
+    static constexpr auto member = &GLCEWDispatchTable::name;     \
+    GLCEW_ALWAYS_INLINE static auto global() {                    \
+      return ::name##_impl;                                       \
+    }                                                             \
+  }
+
+GLCEW_FUNCTION_TRAITS(glClearColor);
+GLCEW_FUNCTION_TRAITS(glClear);
+GLCEW_FUNCTION_TRAITS(glBlendFunc);
+GLCEW_FUNCTION_TRAITS(glPolygonMode);
+GLCEW_FUNCTION_TRAITS(glScissor);
+GLCEW_FUNCTION_TRAITS(glDrawBuffer);
+GLCEW_FUNCTION_TRAITS(glReadBuffer);
+GLCEW_FUNCTION_TRAITS(glEnable);
+GLCEW_FUNCTION_TRAITS(glDisable);
+GLCEW_FUNCTION_TRAITS(glIsEnabled);
+GLCEW_FUNCTION_TRAITS(glGetBooleanv);
+GLCEW_FUNCTION_TRAITS(glGetDoublev);
+GLCEW_FUNCTION_TRAITS(glGetFloatv);
+GLCEW_FUNCTION_TRAITS(glGetIntegerv);
+GLCEW_FUNCTION_TRAITS(glGetString);
+GLCEW_FUNCTION_TRAITS(glFinish);
+GLCEW_FUNCTION_TRAITS(glFlush);
+GLCEW_FUNCTION_TRAITS(glDepthFunc);
+GLCEW_FUNCTION_TRAITS(glViewport);
+GLCEW_FUNCTION_TRAITS(glDrawArrays);
+GLCEW_FUNCTION_TRAITS(glDrawElements);
+GLCEW_FUNCTION_TRAITS(glPixelStorei);
+GLCEW_FUNCTION_TRAITS(glReadPixels);
+GLCEW_FUNCTION_TRAITS(glTexParameteri);
+GLCEW_FUNCTION_TRAITS(glGetTexLevelParameteriv);
+GLCEW_FUNCTION_TRAITS(glTexImage2D);
+GLCEW_FUNCTION_TRAITS(glGetTexImage);
+GLCEW_FUNCTION_TRAITS(glGenTextures);
+GLCEW_FUNCTION_TRAITS(glDeleteTextures);
+GLCEW_FUNCTION_TRAITS(glBindTexture);
+GLCEW_FUNCTION_TRAITS(glActiveTexture);
+GLCEW_FUNCTION_TRAITS(glXChooseVisual);
+GLCEW_FUNCTION_TRAITS(glXCreateContext);
+GLCEW_FUNCTION_TRAITS(glXDestroyContext);
+GLCEW_FUNCTION_TRAITS(glXMakeCurrent);
+GLCEW_FUNCTION_TRAITS(glXSwapBuffers);
+GLCEW_FUNCTION_TRAITS(glXQueryExtension);
+GLCEW_FUNCTION_TRAITS(glXQueryVersion);
+GLCEW_FUNCTION_TRAITS(glXGetCurrentContext);
+GLCEW_FUNCTION_TRAITS(glXGetCurrentDrawable);
+GLCEW_FUNCTION_TRAITS(glXWaitGL);
+GLCEW_FUNCTION_TRAITS(glXWaitX);
+GLCEW_FUNCTION_TRAITS(glXQueryExtensionsString);
+GLCEW_FUNCTION_TRAITS(glXGetClientString);
+GLCEW_FUNCTION_TRAITS(glXGetProcAddressARB);
+
+#undef GLCEW_FUNCTION_TRAITS
+
+template <Function F>
+GLCEW_ALWAYS_INLINE inline auto get() {
+  const GLCEWDispatchTable* table = ::glcew_bound_table;
+  return (table != nullptr) ? table->*FunctionTraits<F>::member
+                            : FunctionTraits<F>::global();
+}
+
+template <Function F, typename... Args>
+GLCEW_ALWAYS_INLINE inline decltype(auto) call(Args&&... args) {
+  return get<F>()(std::forward<Args>(args)...);
+}
+
+/* Make calls from the current thread, of both this layer and the C wrappers,
+ * go to the given table, or to the global implementation when it is nullptr.
+ * Table is not copied, it is to stay valid while it is bound. Binding of an
+ * instance or a pooled context replaces it. Returns previously bound table.
+ */
+inline const GLCEWDispatchTable* bindDispatchTable(
+    const GLCEWDispatchTable* table) {
+  const GLCEWDispatchTable* previous_table = ::glcew_bound_table;
+  ::glcew_bound_table = table;
+  return previous_table;
+}
+
+inline int init() {
+  return glcewInit();
+}
+
+/* ****************************************************************************
+ * * Functions
+ * */
+
+GLCEW_ALWAYS_INLINE inline void glClearColor(GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha) {
+  return call<Function::glClearColor>(red, green, blue, alpha);
+}
+
+GLCEW_ALWAYS_INLINE inline void glClear(GLbitfield mask) {
+  return call<Function::glClear>(mask);
+}
+
+GLCEW_ALWAYS_INLINE inline void glBlendFunc(GLenum sfactor, GLenum dfactor) {
+  return call<Function::glBlendFunc>(sfactor, dfactor);
+}
+
+GLCEW_ALWAYS_INLINE inline void glPolygonMode(GLenum face, GLenum mode) {
+  return call<Function::glPolygonMode>(face, mode);
+}
+
+GLCEW_ALWAYS_INLINE inline void glScissor(GLint x, GLint y, GLsizei width, GLsizei height) {
+  return call<Function::glScissor>(x, y, width, height);
+}
+
+GLCEW_ALWAYS_INLINE inline void glDrawBuffer(GLenum mode) {
+  return call<Function::glDrawBuffer>(mode);
+}
+
+GLCEW_ALWAYS_INLINE inline void glReadBuffer(GLenum mode) {
+  return call<Function::glReadBuffer>(mode);
+}
+
+GLCEW_ALWAYS_INLINE inline void glEnable(GLenum cap) {
+  return call<Function::glEnable>(cap);
+}
+
+GLCEW_ALWAYS_INLINE inline void glDisable(GLenum cap) {
+  return call<Function::glDisable>(cap);
+}
+
+GLCEW_ALWAYS_INLINE inline GLboolean glIsEnabled(GLenum cap) {
+  return call<Function::glIsEnabled>(cap);
+}
+
+GLCEW_ALWAYS_INLINE inline void glGetBooleanv(GLenum pname, GLboolean* params) {
+  return call<Function::glGetBooleanv>(pname, params);
+}
+
+GLCEW_ALWAYS_INLINE inline void glGetDoublev(GLenum pname, GLdouble* params) {
+  return call<Function::glGetDoublev>(pname, params);
+}
+
+GLCEW_ALWAYS_INLINE inline void glGetFloatv(GLenum pname, GLfloat* params) {
+  return call<Function::glGetFloatv>(pname, params);
+}
+
+GLCEW_ALWAYS_INLINE inline void glGetIntegerv(GLenum pname, GLint* params) {
+  return call<Function::glGetIntegerv>(pname, params);
+}
+
+GLCEW_ALWAYS_INLINE inline const GLubyte* glGetString(GLenum name) {
+  return call<Function::glGetString>(name);
+}
+
+GLCEW_ALWAYS_INLINE inline void glFinish() {
+  return call<Function::glFinish>();
+}
+
+GLCEW_ALWAYS_INLINE inline void glFlush() {
+  return call<Function::glFlush>();
+}
+
+GLCEW_ALWAYS_INLINE inline void glDepthFunc(GLenum func) {
+  return call<Function::glDepthFunc>(func);
+}
+
+GLCEW_ALWAYS_INLINE inline void glViewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+  return call<Function::glViewport>(x, y, width, height);
+}
+
+GLCEW_ALWAYS_INLINE inline void glDrawArrays(GLenum mode, GLint first, GLsizei count) {
+  return call<Function::glDrawArrays>(mode, first, count);
+}
+
+GLCEW_ALWAYS_INLINE inline void glDrawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices) {
+  return call<Function::glDrawElements>(mode, count, type, indices);
+}
+
+GLCEW_ALWAYS_INLINE inline void glPixelStorei(GLenum pname, GLint param) {
+  return call<Function::glPixelStorei>(pname, param);
+}
+
+GLCEW_ALWAYS_INLINE inline void glReadPixels(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, GLvoid* pixels) {
+  return call<Function::glReadPixels>(x, y, width, height, format, type, pixels);
+}
+
+GLCEW_ALWAYS_INLINE inline void glTexParameteri(GLenum target, GLenum pname, GLint param) {
+  return call<Function::glTexParameteri>(target, pname, param);
+}
+
+GLCEW_ALWAYS_INLINE inline void glGetTexLevelParameteriv(GLenum target, GLint level, GLenum pname, GLint* params) {
+  return call<Function::glGetTexLevelParameteriv>(target, level, pname, params);
+}
+
+GLCEW_ALWAYS_INLINE inline void glTexImage2D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid* pixels) {
+  return call<Function::glTexImage2D>(target, level, internalFormat, width, height, border, format, type, pixels);
+}
+
+GLCEW_ALWAYS_INLINE inline void glGetTexImage(GLenum target, GLint level, GLenum format, GLenum type, GLvoid* pixels) {
+  return call<Function::glGetTexImage>(target, level, format, type, pixels);
+}
+
+GLCEW_ALWAYS_INLINE inline void glGenTextures(GLsizei n, GLuint* textures) {
+  return call<Function::glGenTextures>(n, textures);
+}
+
+GLCEW_ALWAYS_INLINE inline void glDeleteTextures(GLsizei n, const GLuint* textures) {
+  return call<Function::glDeleteTextures>(n, textures);
+}
+
+GLCEW_ALWAYS_INLINE inline void glBindTexture(GLenum target, GLuint texture) {
+  return call<Function::glBindTexture>(target, texture);
+}
+
+GLCEW_ALWAYS_INLINE inline void glActiveTexture(GLenum texture) {
+  return call<Function::glActiveTexture>(texture);
+}
+
+GLCEW_ALWAYS_INLINE inline XVisualInfo* glXChooseVisual(Display* dpy, int screen, int* attribList) {
+  return call<Function::glXChooseVisual>(dpy, screen, attribList);
+}
+
+GLCEW_ALWAYS_INLINE inline GLXContext glXCreateContext(Display* dpy, XVisualInfo* vis, GLXContext shareList, int direct) {
+  return call<Function::glXCreateContext>(dpy, vis, shareList, direct);
+}
+
+GLCEW_ALWAYS_INLINE inline void glXDestroyContext(Display* dpy, GLXContext ctx) {
+  return call<Function::glXDestroyContext>(dpy, ctx);
+}
+
+GLCEW_ALWAYS_INLINE inline int glXMakeCurrent(Display* dpy, GLXDrawable drawable, GLXContext ctx) {
+  return call<Function::glXMakeCurrent>(dpy, drawable, ctx);
+}
+
+GLCEW_ALWAYS_INLINE inline void glXSwapBuffers(Display* dpy, GLXDrawable drawable) {
+  return call<Function::glXSwapBuffers>(dpy, drawable);
+}
+
+GLCEW_ALWAYS_INLINE inline int glXQueryExtension(Display* dpy, int* errorb, int* event) {
+  return call<Function::glXQueryExtension>(dpy, errorb, event);
+}
+
+GLCEW_ALWAYS_INLINE inline int glXQueryVersion(Display* dpy, int* maj, int* min) {
+  return call<Function::glXQueryVersion>(dpy, maj, min);
+}
+
+GLCEW_ALWAYS_INLINE inline GLXContext glXGetCurrentContext() {
+  return call<Function::glXGetCurrentContext>();
+}
+
+GLCEW_ALWAYS_INLINE inline GLXDrawable glXGetCurrentDrawable() {
+  return call<Function::glXGetCurrentDrawable>();
+}
+
+GLCEW_ALWAYS_INLINE inline void glXWaitGL() {
+  return call<Function::glXWaitGL>();
+}
+
+GLCEW_ALWAYS_INLINE inline void glXWaitX() {
+  return call<Function::glXWaitX>();
+}
+
+GLCEW_ALWAYS_INLINE inline const char* glXQueryExtensionsString(Display* dpy, int screen) {
+  return call<Function::glXQueryExtensionsString>(dpy, screen);
+}
+
+GLCEW_ALWAYS_INLINE inline const char* glXGetClientString(Display* dpy, int name) {
+  return call<Function::glXGetClientString>(dpy, name);
+}
+
+GLCEW_ALWAYS_INLINE inline __GLXextFuncPtr glXGetProcAddressARB(const GLubyte* arg1) {
+  return call<Function::glXGetProcAddressARB>(arg1);
+}
+
+/* ****************************************************************************
+ * * Typed enumerators
+ * */
+
+enum class Capability : GLenum {
+  BLEND = 0x0BE2,
+  CULL_FACE = 0x0B44,
+  DEPTH_TEST = 0x0B71,
+  SCISSOR_TEST = 0x0C11,
+  STENCIL_TEST = 0x0B90,
+  TEXTURE_2D = 0x0DE1,
+};
+
+enum class PrimitiveMode : GLenum {
+  POINTS = 0x0000,
+  LINES = 0x0001,
+  LINE_LOOP = 0x0002,
+  LINE_STRIP = 0x0003,
+  TRIANGLES = 0x0004,
+  TRIANGLE_STRIP = 0x0005,
+  TRIANGLE_FAN = 0x0006,
+};
+
+enum class IndexType : GLenum {
+  UNSIGNED_BYTE = 0x1401,
+  UNSIGNED_SHORT = 0x1403,
+  UNSIGNED_INT = 0x1405,
+};
+
+enum class TextureTarget : GLenum {
+  TEXTURE_1D = 0x0DE0,
+  TEXTURE_2D = 0x0DE1,
+};
+
+enum class ClearMask : GLbitfield {
+  DEPTH = 0x00000100,
+  STENCIL = 0x00000400,
+  COLOR = 0x00004000,
+};
+
+GLCEW_ALWAYS_INLINE inline constexpr ClearMask operator|(ClearMask a,
+                                                         ClearMask b) {
+  return static_cast<ClearMask>(static_cast<GLbitfield>(a) |
+                                static_cast<GLbitfield>(b));
+}
+
+GLCEW_ALWAYS_INLINE inline void glEnable(Capability cap) {
+  glcew::glEnable(static_cast<GLenum>(cap));
+}
+
+GLCEW_ALWAYS_INLINE inline void glDisable(Capability cap) {
+  glcew::glDisable(static_cast<GLenum>(cap));
+}
+
+GLCEW_ALWAYS_INLINE inline bool glIsEnabled(Capability cap) {
+  return glcew::glIsEnabled(static_cast<GLenum>(cap)) != 0;
+}
+
+GLCEW_ALWAYS_INLINE inline void glClear(ClearMask mask) {
+  glcew::glClear(static_cast<GLbitfield>(mask));
+}
+
+GLCEW_ALWAYS_INLINE inline void glBindTexture(TextureTarget target,
+                                              GLuint texture) {
+  glcew::glBindTexture(static_cast<GLenum>(target), texture);
+}
+
+GLCEW_ALWAYS_INLINE inline void glDrawArrays(PrimitiveMode mode,
+                                             GLint first,
+                                             GLsizei count) {
+  glcew::glDrawArrays(static_cast<GLenum>(mode), first, count);
+}
+
+GLCEW_ALWAYS_INLINE inline void glDrawElements(PrimitiveMode mode,
+                                               GLsizei count,
+                                               IndexType type,
+                                               const GLvoid* indices) {
+  glcew::glDrawElements(static_cast<GLenum>(mode),
+                        count,
+                        static_cast<GLenum>(type),
+                        indices);
+}
+
+/* ****************************************************************************
+ * * RAII helpers
+ * */
+
+/* Make context current for the lifetime of the object, restoring the
+ * previously current context afterwards.
+ */
+class ScopedMakeCurrent {
+ public:
+  ScopedMakeCurrent(Display* display, GLXDrawable drawable, GLXContext context)
+      : display_(display),
+        previous_drawable_(glcew::glXGetCurrentDrawable()),
+        previous_context_(glcew::glXGetCurrentContext()) {
+    is_current_ = glcew::glXMakeCurrent(display, drawable, context) != 0;
+  }
+
+  ~ScopedMakeCurrent() {
+    glcew::glXMakeCurrent(display_, previous_drawable_, previous_context_);
+  }
+
+  ScopedMakeCurrent(const ScopedMakeCurrent&) = delete;
+  ScopedMakeCurrent& operator=(const ScopedMakeCurrent&) = delete;
+
+  explicit operator bool() const {
+    return is_current_;
+  }
+
+ private:
+  Display* display_;
+  GLXDrawable previous_drawable_;
+  GLXContext previous_context_;
+  bool is_current_;
+};
+
+/* Bind calls from the current thread to an instance for the lifetime of the
+ * object.
+ */
+class ScopedInstanceBind {
+ public:
+  explicit ScopedInstanceBind(GLCEWInstance* instance)
+      : previous_instance_(glcewInstanceGetBound()) {
+    glcewInstanceBind(instance);
+  }
+
+  ~ScopedInstanceBind() {
+    glcewInstanceBind(previous_instance_);
+  }
+
+  ScopedInstanceBind(const ScopedInstanceBind&) = delete;
+  ScopedInstanceBind& operator=(const ScopedInstanceBind&) = delete;
+
+ private:
+  GLCEWInstance* previous_instance_;
+};
+
+/* Acquire context from the pool for the lifetime of the object. */
+class ScopedPooledContext {
+ public:
+  explicit ScopedPooledContext(GLCEWContextPool* pool)
+      : pool_(pool),
+        context_(glcewContextPoolAcquire(pool)) {
+  }
+
+  ~ScopedPooledContext() {
+    if (context_ != nullptr) {
+      glcewContextPoolRelease(pool_, context_);
+    }
+  }
+
+  ScopedPooledContext(const ScopedPooledContext&) = delete;
+  ScopedPooledContext& operator=(const ScopedPooledContext&) = delete;
+
+  explicit operator bool() const {
+    return context_ != nullptr;
+  }
+
+  GLCEWPooledContext* get() const {
+    return context_;
+  }
+
+ private:
+  GLCEWContextPool* pool_;
+  GLCEWPooledContext* context_;
+};
+
+}  // namespace glcew
+
+#endif  /* __GLCEW_HPP__ */
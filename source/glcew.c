@@ -23,11 +23,20 @@
 #  define _CRT_SECURE_NO_WARNINGS
 #endif
 
+#ifndef _WIN32
+/* Needed for dlmopen(). */
+#  define _GNU_SOURCE
+#endif
+
 #include <glcew.h>
+#include "glcew_intern.h"
 #include <assert.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 
 #ifdef _WIN32
 #  define WIN32_LEAN_AND_MEAN
@@ -43,12 +52,17 @@ typedef HMODULE DynamicLibrary;
 #  define dynamic_library_find(lib, symbol)  GetProcAddress(lib, symbol)
 #else
 #  include <dlfcn.h>
+#  include <pthread.h>
 
 typedef void* DynamicLibrary;
 
 #  define dynamic_library_open(path)         dlopen(path, RTLD_NOW)
 #  define dynamic_library_close(lib)         dlclose(lib)
 #  define dynamic_library_find(lib, symbol)  dlsym(lib, symbol)
+#  ifdef LM_ID_NEWLM
+#    define dynamic_library_open_isolated(path) \
+            dlmopen(LM_ID_NEWLM, path, RTLD_NOW | RTLD_LOCAL)
+#  endif
 #endif
 
 #define GLUE_IMPL(A, B) A ## B
@@ -85,8 +99,94 @@ typedef void* DynamicLibrary;
         _LIBRARY_FIND_IMPL_CHECKED(gl_lib, name)
 #define GL_LIBRARY_FIND_IMPL(name) _LIBRARY_FIND_IMPL(gl_lib, name)
 
+#define _LIBRARY_FIND_TABLE(lib, table, name)                          \
+        do {                                                           \
+          (table)->name = (t##name)dynamic_library_find(lib, #name);   \
+        } while (0)
+
+/* Reads symbol into a dispatch table, expects `lib` and `table` to be
+ * defined in the scope.
+ */
+#define GL_LIBRARY_FIND_TABLE(name) _LIBRARY_FIND_TABLE(lib, table, name)
+
+/* Reads context-specific function pointer into a dispatch table, keeping the
+ * existing one if the function is not known to GetProcAddr. Expects
+ * `get_proc_address` and `table` to be defined in the scope.
+ */
+#define GL_PROC_ADDRESS_FIND_TABLE(name)                                    \
+        do {                                                                \
+          t##name func = (t##name)get_proc_address((const GLubyte*)#name);  \
+          if (func != NULL) {                                               \
+            table->name = func;                                             \
+          }                                                                 \
+        } while (0)
+
+struct GLCEWInstance {
+  DynamicLibrary lib;
+  GLCEWDispatchTable table;
+  /* Number of threads which have the instance bound, or INSTANCE_DESTROYING
+   * once destroy has started, after which the instance is not bound again.
+   */
+  int num_bound_threads;
+};
+
+#define INSTANCE_DESTROYING -1
+
+/* Library paths. */
+#ifdef _WIN32
+static const char* gl_paths[] = {"opengl32.dll", NULL};
+#elif defined(__APPLE__)
+static const char* gl_paths[] = {NULL};
+#else
+/* TODO(sergey): Check on an order. Angular does other way around. */
+static const char* gl_paths[] = {"libGL.so",
+                                 "libGL.so.1",
+                                 NULL};
+#endif
+
 static DynamicLibrary gl_lib;
 
+/* Initialization state. */
+static int initialized = 0;
+static int init_result = 0;
+static int atexit_registered = 0;
+
+/* Library lifetime. Library loaded by glcewInit() stays loaded until exit,
+ * otherwise it is unloaded when the last glcewAcquire() reference is
+ * released and idle timeout has passed.
+ */
+static int keep_loaded = 0;
+static int num_references = 0;
+static unsigned int idle_timeout_ms = 0;
+static uint64_t idle_since_ns = 0;
+
+#ifdef _WIN32
+/* TODO(sergey): Initialization is not thread-safe on Windows yet. */
+#  define init_lock()
+#  define init_unlock()
+#else
+static pthread_mutex_t init_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_condition = PTHREAD_COND_INITIALIZER;
+static int idle_thread_running = 0;
+static int atfork_registered = 0;
+#  define init_lock() pthread_mutex_lock(&init_mutex)
+#  define init_unlock() pthread_mutex_unlock(&init_mutex)
+#endif
+
+GLCEW_THREAD_LOCAL_FAST const GLCEWDispatchTable* glcew_bound_table = NULL;
+static GLCEW_THREAD_LOCAL GLCEWInstance* bound_instance = NULL;
+#ifndef _WIN32
+/* Holds the bound instance as well, so binding of a thread which exits is
+ * released by the key destructor.
+ */
+static pthread_key_t bound_instance_key;
+static pthread_once_t bound_instance_key_once = PTHREAD_ONCE_INIT;
+#endif
+
+GLCEW_THREAD_LOCAL_FAST const char* glcew_last_call = NULL;
+
+unsigned int glcew_load_epoch = 0;
+
 /* ************************ Function definitions. ************************ */
 
 /* Dynamic functions. */
@@ -122,6 +222,7 @@ tglGetTexImage glGetTexImage_impl;
 tglGenTextures glGenTextures_impl;
 tglDeleteTextures glDeleteTextures_impl;
 tglBindTexture glBindTexture_impl;
+tglActiveTexture glActiveTexture_impl;
 tglXChooseVisual glXChooseVisual_impl;
 tglXCreateContext glXCreateContext_impl;
 tglXDestroyContext glXDestroyContext_impl;
@@ -139,190 +240,1077 @@ tglXGetProcAddressARB glXGetProcAddressARB_impl;
 
 /* Functions read using gl's GetProcAddr. */
 
+/* Copy of the *_impl pointers which the wrappers dispatch through. Members
+ * are ordered by the call frequency profile (auto/call_profile.txt), and the
+ * table is aligned to a cache line, so the hot entry points take as few
+ * lines as possible. It is updated whenever the library is loaded or
+ * unloaded.
+ */
+typedef struct GLCEWGlobalTable {
+  /* Hot entry points, ordered by call frequency. */
+  tglBindTexture glBindTexture;
+  tglDrawElements glDrawElements;
+  tglTexParameteri glTexParameteri;
+  tglEnable glEnable;
+  tglDisable glDisable;
+  tglBlendFunc glBlendFunc;
+  tglScissor glScissor;
+  tglDrawArrays glDrawArrays;
+  tglViewport glViewport;
+  tglClearColor glClearColor;
+  tglClear glClear;
+  tglIsEnabled glIsEnabled;
+  tglGetIntegerv glGetIntegerv;
+  tglFlush glFlush;
+  tglDepthFunc glDepthFunc;
+  tglPixelStorei glPixelStorei;
+  tglTexImage2D glTexImage2D;
+  tglGetString glGetString;
+  tglFinish glFinish;
+  tglGenTextures glGenTextures;
+  /* Keep cold entry points off the cache lines of the hot ones. */
+  void* cold_padding[4];
+  /* Cold entry points. */
+  tglPolygonMode glPolygonMode;
+  tglDrawBuffer glDrawBuffer;
+  tglReadBuffer glReadBuffer;
+  tglGetBooleanv glGetBooleanv;
+  tglGetDoublev glGetDoublev;
+  tglGetFloatv glGetFloatv;
+  tglReadPixels glReadPixels;
+  tglGetTexLevelParameteriv glGetTexLevelParameteriv;
+  tglGetTexImage glGetTexImage;
+  tglDeleteTextures glDeleteTextures;
+  tglActiveTexture glActiveTexture;
+  tglXChooseVisual glXChooseVisual;
+  tglXCreateContext glXCreateContext;
+  tglXDestroyContext glXDestroyContext;
+  tglXMakeCurrent glXMakeCurrent;
+  tglXSwapBuffers glXSwapBuffers;
+  tglXQueryExtension glXQueryExtension;
+  tglXQueryVersion glXQueryVersion;
+  tglXGetCurrentContext glXGetCurrentContext;
+  tglXGetCurrentDrawable glXGetCurrentDrawable;
+  tglXWaitGL glXWaitGL;
+  tglXWaitX glXWaitX;
+  tglXQueryExtensionsString glXQueryExtensionsString;
+  tglXGetClientString glXGetClientString;
+  tglXGetProcAddressARB glXGetProcAddressARB;
+} GLCEWGlobalTable;
+
+#ifdef _MSC_VER
+static __declspec(align(64)) GLCEWGlobalTable global_table;
+#else
+static GLCEWGlobalTable global_table __attribute__((aligned(64)));
+#endif
+
+#define GLCEW_DISPATCH_WRAPPER(name) \
+        GLCEW_DISPATCH_FROM(global_table.name, name)
+
+static void global_table_update(void) {
+  global_table.glClearColor = glClearColor_impl;
+  global_table.glClear = glClear_impl;
+  global_table.glBlendFunc = glBlendFunc_impl;
+  global_table.glPolygonMode = glPolygonMode_impl;
+  global_table.glScissor = glScissor_impl;
+  global_table.glDrawBuffer = glDrawBuffer_impl;
+  global_table.glReadBuffer = glReadBuffer_impl;
+  global_table.glEnable = glEnable_impl;
+  global_table.glDisable = glDisable_impl;
+  global_table.glIsEnabled = glIsEnabled_impl;
+  global_table.glGetBooleanv = glGetBooleanv_impl;
+  global_table.glGetDoublev = glGetDoublev_impl;
+  global_table.glGetFloatv = glGetFloatv_impl;
+  global_table.glGetIntegerv = glGetIntegerv_impl;
+  global_table.glGetString = glGetString_impl;
+  global_table.glFinish = glFinish_impl;
+  global_table.glFlush = glFlush_impl;
+  global_table.glDepthFunc = glDepthFunc_impl;
+  global_table.glViewport = glViewport_impl;
+  global_table.glDrawArrays = glDrawArrays_impl;
+  global_table.glDrawElements = glDrawElements_impl;
+  global_table.glPixelStorei = glPixelStorei_impl;
+  global_table.glReadPixels = glReadPixels_impl;
+  global_table.glTexParameteri = glTexParameteri_impl;
+  global_table.glGetTexLevelParameteriv = glGetTexLevelParameteriv_impl;
+  global_table.glTexImage2D = glTexImage2D_impl;
+  global_table.glGetTexImage = glGetTexImage_impl;
+  global_table.glGenTextures = glGenTextures_impl;
+  global_table.glDeleteTextures = glDeleteTextures_impl;
+  global_table.glBindTexture = glBindTexture_impl;
+  global_table.glActiveTexture = glActiveTexture_impl;
+  global_table.glXChooseVisual = glXChooseVisual_impl;
+  global_table.glXCreateContext = glXCreateContext_impl;
+  global_table.glXDestroyContext = glXDestroyContext_impl;
+  global_table.glXMakeCurrent = glXMakeCurrent_impl;
+  global_table.glXSwapBuffers = glXSwapBuffers_impl;
+  global_table.glXQueryExtension = glXQueryExtension_impl;
+  global_table.glXQueryVersion = glXQueryVersion_impl;
+  global_table.glXGetCurrentContext = glXGetCurrentContext_impl;
+  global_table.glXGetCurrentDrawable = glXGetCurrentDrawable_impl;
+  global_table.glXWaitGL = glXWaitGL_impl;
+  global_table.glXWaitX = glXWaitX_impl;
+  global_table.glXQueryExtensionsString = glXQueryExtensionsString_impl;
+  global_table.glXGetClientString = glXGetClientString_impl;
+  global_table.glXGetProcAddressARB = glXGetProcAddressARB_impl;
+}
+
+/* **************************** Function stubs. ************************** */
+
+static void glClearColor_stub(GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha) {
+  (void) red;  /* Ignored. */
+  (void) green;  /* Ignored. */
+  (void) blue;  /* Ignored. */
+  (void) alpha;  /* Ignored. */
+}
+
+static void glClear_stub(GLbitfield mask) {
+  (void) mask;  /* Ignored. */
+}
+
+static void glBlendFunc_stub(GLenum sfactor, GLenum dfactor) {
+  (void) sfactor;  /* Ignored. */
+  (void) dfactor;  /* Ignored. */
+}
+
+static void glPolygonMode_stub(GLenum face, GLenum mode) {
+  (void) face;  /* Ignored. */
+  (void) mode;  /* Ignored. */
+}
+
+static void glScissor_stub(GLint x, GLint y, GLsizei width, GLsizei height) {
+  (void) x;  /* Ignored. */
+  (void) y;  /* Ignored. */
+  (void) width;  /* Ignored. */
+  (void) height;  /* Ignored. */
+}
+
+static void glDrawBuffer_stub(GLenum mode) {
+  (void) mode;  /* Ignored. */
+}
+
+static void glReadBuffer_stub(GLenum mode) {
+  (void) mode;  /* Ignored. */
+}
+
+static void glEnable_stub(GLenum cap) {
+  (void) cap;  /* Ignored. */
+}
+
+static void glDisable_stub(GLenum cap) {
+  (void) cap;  /* Ignored. */
+}
+
+static GLboolean glIsEnabled_stub(GLenum cap) {
+  (void) cap;  /* Ignored. */
+  return (GLboolean)0;
+}
+
+static void glGetBooleanv_stub(GLenum pname, GLboolean* params) {
+  (void) pname;  /* Ignored. */
+  (void) params;  /* Ignored. */
+}
+
+static void glGetDoublev_stub(GLenum pname, GLdouble* params) {
+  (void) pname;  /* Ignored. */
+  (void) params;  /* Ignored. */
+}
+
+static void glGetFloatv_stub(GLenum pname, GLfloat* params) {
+  (void) pname;  /* Ignored. */
+  (void) params;  /* Ignored. */
+}
+
+static void glGetIntegerv_stub(GLenum pname, GLint* params) {
+  (void) pname;  /* Ignored. */
+  (void) params;  /* Ignored. */
+}
+
+static const GLubyte* glGetString_stub(GLenum name) {
+  (void) name;  /* Ignored. */
+  return (const GLubyte*)0;
+}
+
+static void glFinish_stub(void) {
+}
+
+static void glFlush_stub(void) {
+}
+
+static void glDepthFunc_stub(GLenum func) {
+  (void) func;  /* Ignored. */
+}
+
+static void glViewport_stub(GLint x, GLint y, GLsizei width, GLsizei height) {
+  (void) x;  /* Ignored. */
+  (void) y;  /* Ignored. */
+  (void) width;  /* Ignored. */
+  (void) height;  /* Ignored. */
+}
+
+static void glDrawArrays_stub(GLenum mode, GLint first, GLsizei count) {
+  (void) mode;  /* Ignored. */
+  (void) first;  /* Ignored. */
+  (void) count;  /* Ignored. */
+}
+
+static void glDrawElements_stub(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices) {
+  (void) mode;  /* Ignored. */
+  (void) count;  /* Ignored. */
+  (void) type;  /* Ignored. */
+  (void) indices;  /* Ignored. */
+}
+
+static void glPixelStorei_stub(GLenum pname, GLint param) {
+  (void) pname;  /* Ignored. */
+  (void) param;  /* Ignored. */
+}
+
+static void glReadPixels_stub(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, GLvoid* pixels) {
+  (void) x;  /* Ignored. */
+  (void) y;  /* Ignored. */
+  (void) width;  /* Ignored. */
+  (void) height;  /* Ignored. */
+  (void) format;  /* Ignored. */
+  (void) type;  /* Ignored. */
+  (void) pixels;  /* Ignored. */
+}
+
+static void glTexParameteri_stub(GLenum target, GLenum pname, GLint param) {
+  (void) target;  /* Ignored. */
+  (void) pname;  /* Ignored. */
+  (void) param;  /* Ignored. */
+}
+
+static void glGetTexLevelParameteriv_stub(GLenum target, GLint level, GLenum pname, GLint* params) {
+  (void) target;  /* Ignored. */
+  (void) level;  /* Ignored. */
+  (void) pname;  /* Ignored. */
+  (void) params;  /* Ignored. */
+}
+
+static void glTexImage2D_stub(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid* pixels) {
+  (void) target;  /* Ignored. */
+  (void) level;  /* Ignored. */
+  (void) internalFormat;  /* Ignored. */
+  (void) width;  /* Ignored. */
+  (void) height;  /* Ignored. */
+  (void) border;  /* Ignored. */
+  (void) format;  /* Ignored. */
+  (void) type;  /* Ignored. */
+  (void) pixels;  /* Ignored. */
+}
+
+static void glGetTexImage_stub(GLenum target, GLint level, GLenum format, GLenum type, GLvoid* pixels) {
+  (void) target;  /* Ignored. */
+  (void) level;  /* Ignored. */
+  (void) format;  /* Ignored. */
+  (void) type;  /* Ignored. */
+  (void) pixels;  /* Ignored. */
+}
+
+static void glGenTextures_stub(GLsizei n, GLuint* textures) {
+  (void) n;  /* Ignored. */
+  (void) textures;  /* Ignored. */
+}
+
+static void glDeleteTextures_stub(GLsizei n, const GLuint* textures) {
+  (void) n;  /* Ignored. */
+  (void) textures;  /* Ignored. */
+}
+
+static void glBindTexture_stub(GLenum target, GLuint texture) {
+  (void) target;  /* Ignored. */
+  (void) texture;  /* Ignored. */
+}
+
+static void glActiveTexture_stub(GLenum texture) {
+  (void) texture;  /* Ignored. */
+}
+
+static XVisualInfo* glXChooseVisual_stub(Display* dpy, int screen, int* attribList) {
+  (void) dpy;  /* Ignored. */
+  (void) screen;  /* Ignored. */
+  (void) attribList;  /* Ignored. */
+  return (XVisualInfo*)0;
+}
+
+static GLXContext glXCreateContext_stub(Display* dpy, XVisualInfo* vis, GLXContext shareList, int direct) {
+  (void) dpy;  /* Ignored. */
+  (void) vis;  /* Ignored. */
+  (void) shareList;  /* Ignored. */
+  (void) direct;  /* Ignored. */
+  return (GLXContext)0;
+}
+
+static void glXDestroyContext_stub(Display* dpy, GLXContext ctx) {
+  (void) dpy;  /* Ignored. */
+  (void) ctx;  /* Ignored. */
+}
+
+static int glXMakeCurrent_stub(Display* dpy, GLXDrawable drawable, GLXContext ctx) {
+  (void) dpy;  /* Ignored. */
+  (void) drawable;  /* Ignored. */
+  (void) ctx;  /* Ignored. */
+  return (int)0;
+}
+
+static void glXSwapBuffers_stub(Display* dpy, GLXDrawable drawable) {
+  (void) dpy;  /* Ignored. */
+  (void) drawable;  /* Ignored. */
+}
+
+static int glXQueryExtension_stub(Display* dpy, int* errorb, int* event) {
+  (void) dpy;  /* Ignored. */
+  (void) errorb;  /* Ignored. */
+  (void) event;  /* Ignored. */
+  return (int)0;
+}
+
+static int glXQueryVersion_stub(Display* dpy, int* maj, int* min) {
+  (void) dpy;  /* Ignored. */
+  (void) maj;  /* Ignored. */
+  (void) min;  /* Ignored. */
+  return (int)0;
+}
+
+static GLXContext glXGetCurrentContext_stub(void) {
+  return (GLXContext)0;
+}
+
+static GLXDrawable glXGetCurrentDrawable_stub(void) {
+  return (GLXDrawable)0;
+}
+
+static void glXWaitGL_stub(void) {
+}
+
+static void glXWaitX_stub(void) {
+}
+
+static const char* glXQueryExtensionsString_stub(Display* dpy, int screen) {
+  (void) dpy;  /* Ignored. */
+  (void) screen;  /* Ignored. */
+  return (const char*)0;
+}
+
+static const char* glXGetClientString_stub(Display* dpy, int name) {
+  (void) dpy;  /* Ignored. */
+  (void) name;  /* Ignored. */
+  return (const char*)0;
+}
+
+static __GLXextFuncPtr glXGetProcAddressARB_stub(const GLubyte* arg1) {
+  (void) arg1;  /* Ignored. */
+  return (__GLXextFuncPtr)0;
+}
+
 /* ************************** Function wrappers. ************************* */
 
 void glClearColor(GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha) {
-  return glClearColor_impl(red, green, blue, alpha);
+  GLCEW_PROBE0(glClearColor__entry);
+  GLCEW_TRACK_CALL("glClearColor");
+  GLCEW_BATCH_FLUSH();
+  GLCEW_DISPATCH_WRAPPER(glClearColor)(red, green, blue, alpha);
+  GLCEW_PROBE0(glClearColor__return);
 }
 
 void glClear(GLbitfield mask) {
-  return glClear_impl(mask);
+  GLCEW_PROBE1(glClear__entry, mask);
+  GLCEW_TRACK_CALL("glClear");
+  GLCEW_BATCH_FLUSH();
+  GLCEW_DISPATCH_WRAPPER(glClear)(mask);
+  GLCEW_PROBE0(glClear__return);
 }
 
 void glBlendFunc(GLenum sfactor, GLenum dfactor) {
-  return glBlendFunc_impl(sfactor, dfactor);
+  GLCEW_PROBE2(glBlendFunc__entry, sfactor, dfactor);
+  GLCEW_TRACK_CALL("glBlendFunc");
+  GLCEW_BATCH_FLUSH();
+  GLCEW_DISPATCH_WRAPPER(glBlendFunc)(sfactor, dfactor);
+  GLCEW_PROBE0(glBlendFunc__return);
 }
 
 void glPolygonMode(GLenum face, GLenum mode) {
-  return glPolygonMode_impl(face, mode);
+  GLCEW_PROBE2(glPolygonMode__entry, face, mode);
+  GLCEW_TRACK_CALL("glPolygonMode");
+  GLCEW_BATCH_FLUSH();
+  GLCEW_DISPATCH_WRAPPER(glPolygonMode)(face, mode);
+  GLCEW_PROBE0(glPolygonMode__return);
 }
 
 void glScissor(GLint x, GLint y, GLsizei width, GLsizei height) {
-  return glScissor_impl(x, y, width, height);
+  GLCEW_PROBE4(glScissor__entry, x, y, width, height);
+  GLCEW_TRACK_CALL("glScissor");
+  GLCEW_BATCH_FLUSH();
+  GLCEW_DISPATCH_WRAPPER(glScissor)(x, y, width, height);
+  GLCEW_PROBE0(glScissor__return);
 }
 
 void glDrawBuffer(GLenum mode) {
-  return glDrawBuffer_impl(mode);
+  GLCEW_PROBE1(glDrawBuffer__entry, mode);
+  GLCEW_TRACK_CALL("glDrawBuffer");
+  GLCEW_BATCH_FLUSH();
+  GLCEW_DISPATCH_WRAPPER(glDrawBuffer)(mode);
+  GLCEW_PROBE0(glDrawBuffer__return);
 }
 
 void glReadBuffer(GLenum mode) {
-  return glReadBuffer_impl(mode);
+  GLCEW_PROBE1(glReadBuffer__entry, mode);
+  GLCEW_TRACK_CALL("glReadBuffer");
+  GLCEW_BATCH_FLUSH();
+  GLCEW_DISPATCH_WRAPPER(glReadBuffer)(mode);
+  GLCEW_PROBE0(glReadBuffer__return);
 }
 
 void glEnable(GLenum cap) {
-  return glEnable_impl(cap);
+  GLCEW_PROBE1(glEnable__entry, cap);
+  GLCEW_TRACK_CALL("glEnable");
+  GLCEW_BATCH_FLUSH();
+  GLCEW_DISPATCH_WRAPPER(glEnable)(cap);
+  GLCEW_PROBE0(glEnable__return);
 }
 
 void glDisable(GLenum cap) {
-  return glDisable_impl(cap);
+  GLCEW_PROBE1(glDisable__entry, cap);
+  GLCEW_TRACK_CALL("glDisable");
+  GLCEW_BATCH_FLUSH();
+  GLCEW_DISPATCH_WRAPPER(glDisable)(cap);
+  GLCEW_PROBE0(glDisable__return);
 }
 
 GLboolean glIsEnabled(GLenum cap) {
-  return glIsEnabled_impl(cap);
+  GLboolean result;
+  GLCEW_PROBE1(glIsEnabled__entry, cap);
+  GLCEW_TRACK_CALL("glIsEnabled");
+  GLCEW_BATCH_FLUSH();
+  result = GLCEW_DISPATCH_WRAPPER(glIsEnabled)(cap);
+  GLCEW_PROBE1(glIsEnabled__return, result);
+  return result;
 }
 
 void glGetBooleanv(GLenum pname, GLboolean* params) {
-  return glGetBooleanv_impl(pname, params);
+  uint64_t stall_start_ns;
+  GLCEW_PROBE2(glGetBooleanv__entry, pname, params);
+  GLCEW_TRACK_CALL("glGetBooleanv");
+  GLCEW_BATCH_FLUSH();
+  stall_start_ns = GLCEW_STALL_BEGIN();
+  GLCEW_DISPATCH_WRAPPER(glGetBooleanv)(pname, params);
+  GLCEW_STALL_END("glGetBooleanv");
+  GLCEW_PROBE0(glGetBooleanv__return);
 }
 
 void glGetDoublev(GLenum pname, GLdouble* params) {
-  return glGetDoublev_impl(pname, params);
+  uint64_t stall_start_ns;
+  GLCEW_PROBE2(glGetDoublev__entry, pname, params);
+  GLCEW_TRACK_CALL("glGetDoublev");
+  GLCEW_BATCH_FLUSH();
+  stall_start_ns = GLCEW_STALL_BEGIN();
+  GLCEW_DISPATCH_WRAPPER(glGetDoublev)(pname, params);
+  GLCEW_STALL_END("glGetDoublev");
+  GLCEW_PROBE0(glGetDoublev__return);
 }
 
 void glGetFloatv(GLenum pname, GLfloat* params) {
-  return glGetFloatv_impl(pname, params);
+  uint64_t stall_start_ns;
+  GLCEW_PROBE2(glGetFloatv__entry, pname, params);
+  GLCEW_TRACK_CALL("glGetFloatv");
+  GLCEW_BATCH_FLUSH();
+  stall_start_ns = GLCEW_STALL_BEGIN();
+  GLCEW_DISPATCH_WRAPPER(glGetFloatv)(pname, params);
+  GLCEW_STALL_END("glGetFloatv");
+  GLCEW_PROBE0(glGetFloatv__return);
 }
 
 void glGetIntegerv(GLenum pname, GLint* params) {
-  return glGetIntegerv_impl(pname, params);
+  uint64_t stall_start_ns;
+  GLCEW_PROBE2(glGetIntegerv__entry, pname, params);
+  GLCEW_TRACK_CALL("glGetIntegerv");
+  GLCEW_BATCH_FLUSH();
+  stall_start_ns = GLCEW_STALL_BEGIN();
+  GLCEW_DISPATCH_WRAPPER(glGetIntegerv)(pname, params);
+  GLCEW_STALL_END("glGetIntegerv");
+  GLCEW_PROBE0(glGetIntegerv__return);
 }
 
 const GLubyte* glGetString(GLenum name) {
-  return glGetString_impl(name);
+  const GLubyte* result;
+  GLCEW_PROBE1(glGetString__entry, name);
+  GLCEW_TRACK_CALL("glGetString");
+  GLCEW_BATCH_FLUSH();
+  result = GLCEW_DISPATCH_WRAPPER(glGetString)(name);
+  GLCEW_PROBE1(glGetString__return, result);
+  return result;
 }
 
 void glFinish() {
-  return glFinish_impl();
+  uint64_t stall_start_ns;
+  GLCEW_PROBE0(glFinish__entry);
+  GLCEW_TRACK_CALL("glFinish");
+  GLCEW_BATCH_FLUSH();
+  stall_start_ns = GLCEW_STALL_BEGIN();
+  GLCEW_DISPATCH_WRAPPER(glFinish)();
+  GLCEW_STALL_END("glFinish");
+  GLCEW_PROBE0(glFinish__return);
 }
 
 void glFlush() {
-  return glFlush_impl();
+  GLCEW_PROBE0(glFlush__entry);
+  GLCEW_TRACK_CALL("glFlush");
+  GLCEW_BATCH_FLUSH();
+  GLCEW_DISPATCH_WRAPPER(glFlush)();
+  GLCEW_PROBE0(glFlush__return);
 }
 
 void glDepthFunc(GLenum func) {
-  return glDepthFunc_impl(func);
+  GLCEW_PROBE1(glDepthFunc__entry, func);
+  GLCEW_TRACK_CALL("glDepthFunc");
+  GLCEW_BATCH_FLUSH();
+  GLCEW_DISPATCH_WRAPPER(glDepthFunc)(func);
+  GLCEW_PROBE0(glDepthFunc__return);
 }
 
 void glViewport(GLint x, GLint y, GLsizei width, GLsizei height) {
-  return glViewport_impl(x, y, width, height);
+  GLCEW_PROBE4(glViewport__entry, x, y, width, height);
+  GLCEW_TRACK_CALL("glViewport");
+  GLCEW_BATCH_FLUSH();
+  GLCEW_DISPATCH_WRAPPER(glViewport)(x, y, width, height);
+  GLCEW_PROBE0(glViewport__return);
 }
 
 void glDrawArrays(GLenum mode, GLint first, GLsizei count) {
-  return glDrawArrays_impl(mode, first, count);
+  GLCEW_PROBE3(glDrawArrays__entry, mode, first, count);
+  GLCEW_TRACK_CALL("glDrawArrays");
+  if (GLCEW_BATCH_DRAW_ARRAYS(mode, first, count)) {
+    GLCEW_PROBE0(glDrawArrays__return);
+    return;
+  }
+  GLCEW_DISPATCH_WRAPPER(glDrawArrays)(mode, first, count);
+  GLCEW_PROBE0(glDrawArrays__return);
 }
 
 void glDrawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices) {
-  return glDrawElements_impl(mode, count, type, indices);
+  GLCEW_PROBE4(glDrawElements__entry, mode, count, type, indices);
+  GLCEW_TRACK_CALL("glDrawElements");
+  if (GLCEW_BATCH_DRAW_ELEMENTS(mode, count, type, indices)) {
+    GLCEW_PROBE0(glDrawElements__return);
+    return;
+  }
+  GLCEW_DISPATCH_WRAPPER(glDrawElements)(mode, count, type, indices);
+  GLCEW_PROBE0(glDrawElements__return);
 }
 
 void glPixelStorei(GLenum pname, GLint param) {
-  return glPixelStorei_impl(pname, param);
+  GLCEW_PROBE2(glPixelStorei__entry, pname, param);
+  GLCEW_TRACK_CALL("glPixelStorei");
+  GLCEW_BATCH_FLUSH();
+  GLCEW_DISPATCH_WRAPPER(glPixelStorei)(pname, param);
+  GLCEW_PROBE0(glPixelStorei__return);
 }
 
 void glReadPixels(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, GLvoid* pixels) {
-  return glReadPixels_impl(x, y, width, height, format, type, pixels);
+  uint64_t stall_start_ns;
+  GLCEW_PROBE6(glReadPixels__entry, x, y, width, height, format, type);
+  GLCEW_TRACK_CALL("glReadPixels");
+  GLCEW_BATCH_FLUSH();
+  stall_start_ns = GLCEW_STALL_BEGIN();
+  GLCEW_DISPATCH_WRAPPER(glReadPixels)(x, y, width, height, format, type, pixels);
+  GLCEW_STALL_END("glReadPixels");
+  GLCEW_PROBE0(glReadPixels__return);
 }
 
 void glTexParameteri(GLenum target, GLenum pname, GLint param) {
-  return glTexParameteri_impl(target, pname, param);
+  GLCEW_PROBE3(glTexParameteri__entry, target, pname, param);
+  GLCEW_TRACK_CALL("glTexParameteri");
+  GLCEW_BATCH_FLUSH();
+  GLCEW_DISPATCH_WRAPPER(glTexParameteri)(target, pname, param);
+  GLCEW_PROBE0(glTexParameteri__return);
 }
 
 void glGetTexLevelParameteriv(GLenum target, GLint level, GLenum pname, GLint* params) {
-  return glGetTexLevelParameteriv_impl(target, level, pname, params);
+  GLCEW_PROBE4(glGetTexLevelParameteriv__entry, target, level, pname, params);
+  GLCEW_TRACK_CALL("glGetTexLevelParameteriv");
+  GLCEW_BATCH_FLUSH();
+  GLCEW_DISPATCH_WRAPPER(glGetTexLevelParameteriv)(target, level, pname, params);
+  GLCEW_PROBE0(glGetTexLevelParameteriv__return);
 }
 
 void glTexImage2D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid* pixels) {
-  return glTexImage2D_impl(target, level, internalFormat, width, height, border, format, type, pixels);
+  GLCEW_PROBE6(glTexImage2D__entry, target, level, internalFormat, width, height, border);
+  GLCEW_TRACK_CALL("glTexImage2D");
+  GLCEW_BATCH_FLUSH();
+  GLCEW_DISPATCH_WRAPPER(glTexImage2D)(target, level, internalFormat, width, height, border, format, type, pixels);
+  GLCEW_TEXTURE_POOL_TEX_IMAGE(target, level, internalFormat, width, height);
+  GLCEW_PROBE0(glTexImage2D__return);
 }
 
 void glGetTexImage(GLenum target, GLint level, GLenum format, GLenum type, GLvoid* pixels) {
-  return glGetTexImage_impl(target, level, format, type, pixels);
+  uint64_t stall_start_ns;
+  GLCEW_PROBE5(glGetTexImage__entry, target, level, format, type, pixels);
+  GLCEW_TRACK_CALL("glGetTexImage");
+  GLCEW_BATCH_FLUSH();
+  stall_start_ns = GLCEW_STALL_BEGIN();
+  GLCEW_DISPATCH_WRAPPER(glGetTexImage)(target, level, format, type, pixels);
+  GLCEW_STALL_END("glGetTexImage");
+  GLCEW_PROBE0(glGetTexImage__return);
 }
 
 void glGenTextures(GLsizei n, GLuint* textures) {
-  return glGenTextures_impl(n, textures);
+  GLCEW_PROBE2(glGenTextures__entry, n, textures);
+  GLCEW_TRACK_CALL("glGenTextures");
+  GLCEW_BATCH_FLUSH();
+  GLCEW_DISPATCH_WRAPPER(glGenTextures)(n, textures);
+  GLCEW_PROBE0(glGenTextures__return);
 }
 
 void glDeleteTextures(GLsizei n, const GLuint* textures) {
-  return glDeleteTextures_impl(n, textures);
+  GLCEW_PROBE2(glDeleteTextures__entry, n, textures);
+  GLCEW_TRACK_CALL("glDeleteTextures");
+  GLCEW_BATCH_FLUSH();
+  if (GLCEW_TEXTURE_POOL_DELETE(n, textures)) {
+    GLCEW_PROBE0(glDeleteTextures__return);
+    return;
+  }
+  GLCEW_DISPATCH_WRAPPER(glDeleteTextures)(n, textures);
+  GLCEW_PROBE0(glDeleteTextures__return);
 }
 
 void glBindTexture(GLenum target, GLuint texture) {
-  return glBindTexture_impl(target, texture);
+  GLCEW_PROBE2(glBindTexture__entry, target, texture);
+  GLCEW_TRACK_CALL("glBindTexture");
+  GLCEW_BATCH_FLUSH();
+  GLCEW_DISPATCH_WRAPPER(glBindTexture)(target, texture);
+  GLCEW_TEXTURE_POOL_BIND(target, texture);
+  GLCEW_PROBE0(glBindTexture__return);
+}
+
+void glActiveTexture(GLenum texture) {
+  GLCEW_PROBE1(glActiveTexture__entry, texture);
+  GLCEW_TRACK_CALL("glActiveTexture");
+  GLCEW_BATCH_FLUSH();
+  GLCEW_DISPATCH_WRAPPER(glActiveTexture)(texture);
+  GLCEW_TEXTURE_POOL_ACTIVE_TEXTURE(texture);
+  GLCEW_PROBE0(glActiveTexture__return);
 }
 
 XVisualInfo* glXChooseVisual(Display* dpy, int screen, int* attribList) {
-  return glXChooseVisual_impl(dpy, screen, attribList);
+  XVisualInfo* result;
+  GLCEW_PROBE3(glXChooseVisual__entry, dpy, screen, attribList);
+  GLCEW_TRACK_CALL("glXChooseVisual");
+  GLCEW_BATCH_FLUSH();
+  if (GLCEW_UNLIKELY(glcew_glx_cache_enabled)) {
+    result = glcew_glx_cache_choose_visual(dpy, screen, attribList);
+    GLCEW_PROBE1(glXChooseVisual__return, result);
+    return result;
+  }
+  result = GLCEW_DISPATCH_WRAPPER(glXChooseVisual)(dpy, screen, attribList);
+  GLCEW_PROBE1(glXChooseVisual__return, result);
+  return result;
 }
 
 GLXContext glXCreateContext(Display* dpy, XVisualInfo* vis, GLXContext shareList, int direct) {
-  return glXCreateContext_impl(dpy, vis, shareList, direct);
+  GLXContext result;
+  GLCEW_PROBE4(glXCreateContext__entry, dpy, vis, shareList, direct);
+  GLCEW_TRACK_CALL("glXCreateContext");
+  GLCEW_BATCH_FLUSH();
+  result = GLCEW_DISPATCH_WRAPPER(glXCreateContext)(dpy, vis, shareList, direct);
+  GLCEW_PROBE1(glXCreateContext__return, result);
+  return result;
 }
 
 void glXDestroyContext(Display* dpy, GLXContext ctx) {
-  return glXDestroyContext_impl(dpy, ctx);
+  GLCEW_PROBE2(glXDestroyContext__entry, dpy, ctx);
+  GLCEW_TRACK_CALL("glXDestroyContext");
+  GLCEW_BATCH_FLUSH();
+  GLCEW_DISPATCH_WRAPPER(glXDestroyContext)(dpy, ctx);
+  GLCEW_PROBE0(glXDestroyContext__return);
 }
 
 int glXMakeCurrent(Display* dpy, GLXDrawable drawable, GLXContext ctx) {
-  return glXMakeCurrent_impl(dpy, drawable, ctx);
+  int result;
+  GLCEW_PROBE3(glXMakeCurrent__entry, dpy, drawable, ctx);
+  GLCEW_TRACK_CALL("glXMakeCurrent");
+  GLCEW_BATCH_FLUSH();
+  result = GLCEW_DISPATCH_WRAPPER(glXMakeCurrent)(dpy, drawable, ctx);
+  GLCEW_PROBE1(glXMakeCurrent__return, result);
+  return result;
 }
 
 void glXSwapBuffers(Display* dpy, GLXDrawable drawable) {
-  return glXSwapBuffers_impl(dpy, drawable);
+  GLCEW_PROBE2(glXSwapBuffers__entry, dpy, drawable);
+  GLCEW_TRACK_CALL("glXSwapBuffers");
+  GLCEW_BATCH_FLUSH();
+  glcew_profile_frame_boundary();
+  GLCEW_DISPATCH_WRAPPER(glXSwapBuffers)(dpy, drawable);
+  GLCEW_PROBE0(glXSwapBuffers__return);
 }
 
 int glXQueryExtension(Display* dpy, int* errorb, int* event) {
-  return glXQueryExtension_impl(dpy, errorb, event);
+  int result;
+  GLCEW_PROBE3(glXQueryExtension__entry, dpy, errorb, event);
+  GLCEW_TRACK_CALL("glXQueryExtension");
+  GLCEW_BATCH_FLUSH();
+  result = GLCEW_DISPATCH_WRAPPER(glXQueryExtension)(dpy, errorb, event);
+  GLCEW_PROBE1(glXQueryExtension__return, result);
+  return result;
 }
 
 int glXQueryVersion(Display* dpy, int* maj, int* min) {
-  return glXQueryVersion_impl(dpy, maj, min);
+  int result;
+  GLCEW_PROBE3(glXQueryVersion__entry, dpy, maj, min);
+  GLCEW_TRACK_CALL("glXQueryVersion");
+  GLCEW_BATCH_FLUSH();
+  if (GLCEW_UNLIKELY(glcew_glx_cache_enabled)) {
+    result = glcew_glx_cache_query_version(dpy, maj, min);
+    GLCEW_PROBE1(glXQueryVersion__return, result);
+    return result;
+  }
+  result = GLCEW_DISPATCH_WRAPPER(glXQueryVersion)(dpy, maj, min);
+  GLCEW_PROBE1(glXQueryVersion__return, result);
+  return result;
 }
 
 GLXContext glXGetCurrentContext() {
-  return glXGetCurrentContext_impl();
+  GLXContext result;
+  GLCEW_PROBE0(glXGetCurrentContext__entry);
+  GLCEW_TRACK_CALL("glXGetCurrentContext");
+  GLCEW_BATCH_FLUSH();
+  result = GLCEW_DISPATCH_WRAPPER(glXGetCurrentContext)();
+  GLCEW_PROBE1(glXGetCurrentContext__return, result);
+  return result;
 }
 
 GLXDrawable glXGetCurrentDrawable() {
-  return glXGetCurrentDrawable_impl();
+  GLXDrawable result;
+  GLCEW_PROBE0(glXGetCurrentDrawable__entry);
+  GLCEW_TRACK_CALL("glXGetCurrentDrawable");
+  GLCEW_BATCH_FLUSH();
+  result = GLCEW_DISPATCH_WRAPPER(glXGetCurrentDrawable)();
+  GLCEW_PROBE1(glXGetCurrentDrawable__return, result);
+  return result;
 }
 
 void glXWaitGL() {
-  return glXWaitGL_impl();
+  uint64_t stall_start_ns;
+  GLCEW_PROBE0(glXWaitGL__entry);
+  GLCEW_TRACK_CALL("glXWaitGL");
+  GLCEW_BATCH_FLUSH();
+  stall_start_ns = GLCEW_STALL_BEGIN();
+  GLCEW_DISPATCH_WRAPPER(glXWaitGL)();
+  GLCEW_STALL_END("glXWaitGL");
+  GLCEW_PROBE0(glXWaitGL__return);
 }
 
 void glXWaitX() {
-  return glXWaitX_impl();
+  GLCEW_PROBE0(glXWaitX__entry);
+  GLCEW_TRACK_CALL("glXWaitX");
+  GLCEW_BATCH_FLUSH();
+  GLCEW_DISPATCH_WRAPPER(glXWaitX)();
+  GLCEW_PROBE0(glXWaitX__return);
 }
 
 const char* glXQueryExtensionsString(Display* dpy, int screen) {
-  return glXQueryExtensionsString_impl(dpy, screen);
+  const char* result;
+  GLCEW_PROBE2(glXQueryExtensionsString__entry, dpy, screen);
+  GLCEW_TRACK_CALL("glXQueryExtensionsString");
+  GLCEW_BATCH_FLUSH();
+  if (GLCEW_UNLIKELY(glcew_glx_cache_enabled)) {
+    result = glcew_glx_cache_query_extensions_string(dpy, screen);
+    GLCEW_PROBE1(glXQueryExtensionsString__return, result);
+    return result;
+  }
+  result = GLCEW_DISPATCH_WRAPPER(glXQueryExtensionsString)(dpy, screen);
+  GLCEW_PROBE1(glXQueryExtensionsString__return, result);
+  return result;
 }
 
 const char* glXGetClientString(Display* dpy, int name) {
-  return glXGetClientString_impl(dpy, name);
+  const char* result;
+  GLCEW_PROBE2(glXGetClientString__entry, dpy, name);
+  GLCEW_TRACK_CALL("glXGetClientString");
+  GLCEW_BATCH_FLUSH();
+  result = GLCEW_DISPATCH_WRAPPER(glXGetClientString)(dpy, name);
+  GLCEW_PROBE1(glXGetClientString__return, result);
+  return result;
 }
 
 __GLXextFuncPtr glXGetProcAddressARB(const GLubyte* arg1) {
-  return glXGetProcAddressARB_impl(arg1);
+  __GLXextFuncPtr result;
+  GLCEW_PROBE1(glXGetProcAddressARB__entry, arg1);
+  GLCEW_TRACK_CALL("glXGetProcAddressARB");
+  GLCEW_BATCH_FLUSH();
+  result = GLCEW_DISPATCH_WRAPPER(glXGetProcAddressARB)(arg1);
+  GLCEW_PROBE1(glXGetProcAddressARB__return, result);
+  return result;
+}
+
+/* ****************************** Utilities. ***************************** */
+
+uint64_t glcew_time_ns(void) {
+#ifdef _WIN32
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return (uint64_t)((double)counter.QuadPart * 1e9 /
+                    (double)frequency.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+void* glcew_find_global_symbol(const char* name) {
+#ifdef _WIN32
+  (void) name;  /* Ignored. */
+  return NULL;
+#else
+  return dlsym(RTLD_DEFAULT, name);
+#endif
+}
+
+#ifdef WITH_CALL_COUNTS
+static GLCEWCallCounter* call_counters = NULL;
+#  ifndef _WIN32
+static pthread_mutex_t call_counters_mutex = PTHREAD_MUTEX_INITIALIZER;
+#  endif
+
+static void call_counters_print(void) {
+  const char* file_name = getenv("GLCEW_CALL_COUNTS");
+  FILE* file = stderr;
+  const GLCEWCallCounter* counter;
+  if (file_name != NULL && file_name[0] != '\0') {
+    file = fopen(file_name, "w");
+    if (file == NULL) {
+      return;
+    }
+  }
+  /* Same format as the map of tools/bpftrace/glcew_call_counts.bt prints,
+   * only entry probes are of interest for the call profile.
+   */
+  for (counter = call_counters; counter != NULL; counter = counter->next) {
+    if (strstr(counter->name, "__entry") != NULL) {
+      fprintf(file, "@calls[glcew:%s]: %llu\n",
+              counter->name,
+              (unsigned long long)__atomic_load_n(&counter->count,
+                                                  __ATOMIC_RELAXED));
+    }
+  }
+  if (file != stderr) {
+    fclose(file);
+  }
+}
+
+void glcew_call_counter_register(GLCEWCallCounter* counter) {
+#  ifndef _WIN32
+  pthread_mutex_lock(&call_counters_mutex);
+#  endif
+  if (!counter->registered) {
+    if (call_counters == NULL) {
+      atexit(call_counters_print);
+    }
+    counter->next = call_counters;
+    call_counters = counter;
+    __atomic_store_n(&counter->registered, 1, __ATOMIC_RELEASE);
+  }
+#  ifndef _WIN32
+  pthread_mutex_unlock(&call_counters_mutex);
+#  endif
+}
+#endif
+
+/* ************************** Dispatch tables. *************************** */
+
+void glcew_dispatch_table_get_current(GLCEWDispatchTable* table) {
+  if (glcew_bound_table != NULL) {
+    *table = *glcew_bound_table;
+    return;
+  }
+  table->glClearColor = global_table.glClearColor;
+  table->glClear = global_table.glClear;
+  table->glBlendFunc = global_table.glBlendFunc;
+  table->glPolygonMode = global_table.glPolygonMode;
+  table->glScissor = global_table.glScissor;
+  table->glDrawBuffer = global_table.glDrawBuffer;
+  table->glReadBuffer = global_table.glReadBuffer;
+  table->glEnable = global_table.glEnable;
+  table->glDisable = global_table.glDisable;
+  table->glIsEnabled = global_table.glIsEnabled;
+  table->glGetBooleanv = global_table.glGetBooleanv;
+  table->glGetDoublev = global_table.glGetDoublev;
+  table->glGetFloatv = global_table.glGetFloatv;
+  table->glGetIntegerv = global_table.glGetIntegerv;
+  table->glGetString = global_table.glGetString;
+  table->glFinish = global_table.glFinish;
+  table->glFlush = global_table.glFlush;
+  table->glDepthFunc = global_table.glDepthFunc;
+  table->glViewport = global_table.glViewport;
+  table->glDrawArrays = global_table.glDrawArrays;
+  table->glDrawElements = global_table.glDrawElements;
+  table->glPixelStorei = global_table.glPixelStorei;
+  table->glReadPixels = global_table.glReadPixels;
+  table->glTexParameteri = global_table.glTexParameteri;
+  table->glGetTexLevelParameteriv = global_table.glGetTexLevelParameteriv;
+  table->glTexImage2D = global_table.glTexImage2D;
+  table->glGetTexImage = global_table.glGetTexImage;
+  table->glGenTextures = global_table.glGenTextures;
+  table->glDeleteTextures = global_table.glDeleteTextures;
+  table->glBindTexture = global_table.glBindTexture;
+  table->glActiveTexture = global_table.glActiveTexture;
+  table->glXChooseVisual = global_table.glXChooseVisual;
+  table->glXCreateContext = global_table.glXCreateContext;
+  table->glXDestroyContext = global_table.glXDestroyContext;
+  table->glXMakeCurrent = global_table.glXMakeCurrent;
+  table->glXSwapBuffers = global_table.glXSwapBuffers;
+  table->glXQueryExtension = global_table.glXQueryExtension;
+  table->glXQueryVersion = global_table.glXQueryVersion;
+  table->glXGetCurrentContext = global_table.glXGetCurrentContext;
+  table->glXGetCurrentDrawable = global_table.glXGetCurrentDrawable;
+  table->glXWaitGL = global_table.glXWaitGL;
+  table->glXWaitX = global_table.glXWaitX;
+  table->glXQueryExtensionsString = global_table.glXQueryExtensionsString;
+  table->glXGetClientString = global_table.glXGetClientString;
+  table->glXGetProcAddressARB = global_table.glXGetProcAddressARB;
+}
+
+typedef struct GlobalTableEntry {
+  const char* name;
+  size_t offset;
+} GlobalTableEntry;
+
+static const GlobalTableEntry global_table_entries[] = {
+  {"glClearColor", offsetof(GLCEWGlobalTable, glClearColor)},
+  {"glClear", offsetof(GLCEWGlobalTable, glClear)},
+  {"glBlendFunc", offsetof(GLCEWGlobalTable, glBlendFunc)},
+  {"glPolygonMode", offsetof(GLCEWGlobalTable, glPolygonMode)},
+  {"glScissor", offsetof(GLCEWGlobalTable, glScissor)},
+  {"glDrawBuffer", offsetof(GLCEWGlobalTable, glDrawBuffer)},
+  {"glReadBuffer", offsetof(GLCEWGlobalTable, glReadBuffer)},
+  {"glEnable", offsetof(GLCEWGlobalTable, glEnable)},
+  {"glDisable", offsetof(GLCEWGlobalTable, glDisable)},
+  {"glIsEnabled", offsetof(GLCEWGlobalTable, glIsEnabled)},
+  {"glGetBooleanv", offsetof(GLCEWGlobalTable, glGetBooleanv)},
+  {"glGetDoublev", offsetof(GLCEWGlobalTable, glGetDoublev)},
+  {"glGetFloatv", offsetof(GLCEWGlobalTable, glGetFloatv)},
+  {"glGetIntegerv", offsetof(GLCEWGlobalTable, glGetIntegerv)},
+  {"glGetString", offsetof(GLCEWGlobalTable, glGetString)},
+  {"glFinish", offsetof(GLCEWGlobalTable, glFinish)},
+  {"glFlush", offsetof(GLCEWGlobalTable, glFlush)},
+  {"glDepthFunc", offsetof(GLCEWGlobalTable, glDepthFunc)},
+  {"glViewport", offsetof(GLCEWGlobalTable, glViewport)},
+  {"glDrawArrays", offsetof(GLCEWGlobalTable, glDrawArrays)},
+  {"glDrawElements", offsetof(GLCEWGlobalTable, glDrawElements)},
+  {"glPixelStorei", offsetof(GLCEWGlobalTable, glPixelStorei)},
+  {"glReadPixels", offsetof(GLCEWGlobalTable, glReadPixels)},
+  {"glTexParameteri", offsetof(GLCEWGlobalTable, glTexParameteri)},
+  {"glGetTexLevelParameteriv", offsetof(GLCEWGlobalTable, glGetTexLevelParameteriv)},
+  {"glTexImage2D", offsetof(GLCEWGlobalTable, glTexImage2D)},
+  {"glGetTexImage", offsetof(GLCEWGlobalTable, glGetTexImage)},
+  {"glGenTextures", offsetof(GLCEWGlobalTable, glGenTextures)},
+  {"glDeleteTextures", offsetof(GLCEWGlobalTable, glDeleteTextures)},
+  {"glBindTexture", offsetof(GLCEWGlobalTable, glBindTexture)},
+  {"glActiveTexture", offsetof(GLCEWGlobalTable, glActiveTexture)},
+  {"glXChooseVisual", offsetof(GLCEWGlobalTable, glXChooseVisual)},
+  {"glXCreateContext", offsetof(GLCEWGlobalTable, glXCreateContext)},
+  {"glXDestroyContext", offsetof(GLCEWGlobalTable, glXDestroyContext)},
+  {"glXMakeCurrent", offsetof(GLCEWGlobalTable, glXMakeCurrent)},
+  {"glXSwapBuffers", offsetof(GLCEWGlobalTable, glXSwapBuffers)},
+  {"glXQueryExtension", offsetof(GLCEWGlobalTable, glXQueryExtension)},
+  {"glXQueryVersion", offsetof(GLCEWGlobalTable, glXQueryVersion)},
+  {"glXGetCurrentContext", offsetof(GLCEWGlobalTable, glXGetCurrentContext)},
+  {"glXGetCurrentDrawable", offsetof(GLCEWGlobalTable, glXGetCurrentDrawable)},
+  {"glXWaitGL", offsetof(GLCEWGlobalTable, glXWaitGL)},
+  {"glXWaitX", offsetof(GLCEWGlobalTable, glXWaitX)},
+  {"glXQueryExtensionsString", offsetof(GLCEWGlobalTable, glXQueryExtensionsString)},
+  {"glXGetClientString", offsetof(GLCEWGlobalTable, glXGetClientString)},
+  {"glXGetProcAddressARB", offsetof(GLCEWGlobalTable, glXGetProcAddressARB)},
+};
+
+size_t glcew_global_table_offset(const char* name) {
+  size_t i;
+  for (i = 0; i < sizeof(global_table_entries) / sizeof(*global_table_entries);
+       ++i) {
+    if (strcmp(global_table_entries[i].name, name) == 0) {
+      return global_table_entries[i].offset;
+    }
+  }
+  return (size_t)-1;
+}
+
+void glcew_dispatch_table_load_proc_address(
+    GLCEWDispatchTable* table,
+    tglXGetProcAddressARB get_proc_address) {
+  GL_PROC_ADDRESS_FIND_TABLE(glClearColor);
+  GL_PROC_ADDRESS_FIND_TABLE(glClear);
+  GL_PROC_ADDRESS_FIND_TABLE(glBlendFunc);
+  GL_PROC_ADDRESS_FIND_TABLE(glPolygonMode);
+  GL_PROC_ADDRESS_FIND_TABLE(glScissor);
+  GL_PROC_ADDRESS_FIND_TABLE(glDrawBuffer);
+  GL_PROC_ADDRESS_FIND_TABLE(glReadBuffer);
+  GL_PROC_ADDRESS_FIND_TABLE(glEnable);
+  GL_PROC_ADDRESS_FIND_TABLE(glDisable);
+  GL_PROC_ADDRESS_FIND_TABLE(glIsEnabled);
+  GL_PROC_ADDRESS_FIND_TABLE(glGetBooleanv);
+  GL_PROC_ADDRESS_FIND_TABLE(glGetDoublev);
+  GL_PROC_ADDRESS_FIND_TABLE(glGetFloatv);
+  GL_PROC_ADDRESS_FIND_TABLE(glGetIntegerv);
+  GL_PROC_ADDRESS_FIND_TABLE(glGetString);
+  GL_PROC_ADDRESS_FIND_TABLE(glFinish);
+  GL_PROC_ADDRESS_FIND_TABLE(glFlush);
+  GL_PROC_ADDRESS_FIND_TABLE(glDepthFunc);
+  GL_PROC_ADDRESS_FIND_TABLE(glViewport);
+  GL_PROC_ADDRESS_FIND_TABLE(glDrawArrays);
+  GL_PROC_ADDRESS_FIND_TABLE(glDrawElements);
+  GL_PROC_ADDRESS_FIND_TABLE(glPixelStorei);
+  GL_PROC_ADDRESS_FIND_TABLE(glReadPixels);
+  GL_PROC_ADDRESS_FIND_TABLE(glTexParameteri);
+  GL_PROC_ADDRESS_FIND_TABLE(glGetTexLevelParameteriv);
+  GL_PROC_ADDRESS_FIND_TABLE(glTexImage2D);
+  GL_PROC_ADDRESS_FIND_TABLE(glGetTexImage);
+  GL_PROC_ADDRESS_FIND_TABLE(glGenTextures);
+  GL_PROC_ADDRESS_FIND_TABLE(glDeleteTextures);
+  GL_PROC_ADDRESS_FIND_TABLE(glBindTexture);
+  GL_PROC_ADDRESS_FIND_TABLE(glActiveTexture);
+  GL_PROC_ADDRESS_FIND_TABLE(glXChooseVisual);
+  GL_PROC_ADDRESS_FIND_TABLE(glXCreateContext);
+  GL_PROC_ADDRESS_FIND_TABLE(glXDestroyContext);
+  GL_PROC_ADDRESS_FIND_TABLE(glXMakeCurrent);
+  GL_PROC_ADDRESS_FIND_TABLE(glXSwapBuffers);
+  GL_PROC_ADDRESS_FIND_TABLE(glXQueryExtension);
+  GL_PROC_ADDRESS_FIND_TABLE(glXQueryVersion);
+  GL_PROC_ADDRESS_FIND_TABLE(glXGetCurrentContext);
+  GL_PROC_ADDRESS_FIND_TABLE(glXGetCurrentDrawable);
+  GL_PROC_ADDRESS_FIND_TABLE(glXWaitGL);
+  GL_PROC_ADDRESS_FIND_TABLE(glXWaitX);
+  GL_PROC_ADDRESS_FIND_TABLE(glXQueryExtensionsString);
+  GL_PROC_ADDRESS_FIND_TABLE(glXGetClientString);
+  GL_PROC_ADDRESS_FIND_TABLE(glXGetProcAddressARB);
+}
+
+const GLCEWDispatchTable* glcew_dispatch_table_bind(
+    const GLCEWDispatchTable* table) {
+  const GLCEWDispatchTable* previous_table = glcew_bound_table;
+  glcew_bound_table = table;
+  return previous_table;
 }
 
 /* ************************ Main wrangling logic. ************************ */
 
-static DynamicLibrary dynamic_library_open_find(const char** paths) {
+static DynamicLibrary dynamic_library_open_find(const char** paths,
+                                                int isolated) {
   int i = 0;
   while (paths[i] != NULL) {
-      DynamicLibrary lib = dynamic_library_open(paths[i]);
+      DynamicLibrary lib;
+#ifdef dynamic_library_open_isolated
+      if (isolated) {
+        lib = dynamic_library_open_isolated(paths[i]);
+      }
+      else
+#endif
+      {
+        (void) isolated;  /* Ignored. */
+        lib = dynamic_library_open(paths[i]);
+      }
       if (lib != NULL) {
         return lib;
       }
@@ -332,46 +1320,38 @@ static DynamicLibrary dynamic_library_open_find(const char** paths) {
 }
 
 static void glcewExit(void) {
+  GLCEW_PROBE0(glcewExit__entry);
   if (gl_lib != NULL) {
     /*  Ignore errors. */
     dynamic_library_close(gl_lib);
     gl_lib = NULL;
   }
+  GLCEW_PROBE0(glcewExit__return);
 }
 
-int glcewInit(void) {
-  /* Library paths. */
-#ifdef _WIN32
-  const char* gl_paths[] = {"opengl32.dll"};
-#elif defined(__APPLE__)
-  const char* gl_paths[] = {NULL};
-#else
-  /* TODO(sergey): Check on an order. Angular does other way around. */
-  const char* gl_paths[] = {"libGL.so",
-                            "libGL.so.1",
-                            NULL};
-#endif
-  static int initialized = 0;
-  static int result = 0;
+static int glcew_init_locked(void) {
   int error;
 
   if (initialized) {
-    return result;
+    return init_result;
   }
 
   initialized = 1;
 
-  error = atexit(glcewExit);
-  if (error) {
-    result = GLCEW_ERROR_ATEXIT_FAILED;
-    return result;
+  if (!atexit_registered) {
+    error = atexit(glcewExit);
+    if (error) {
+      init_result = GLCEW_ERROR_ATEXIT_FAILED;
+      return init_result;
+    }
+    atexit_registered = 1;
   }
 
   /* Load library. */
-  gl_lib = dynamic_library_open_find(gl_paths);
+  gl_lib = dynamic_library_open_find(gl_paths, 0);
   if (gl_lib == NULL) {
-    result = GLCEW_ERROR_OPEN_FAILED;
-    return result;
+    init_result = GLCEW_ERROR_OPEN_FAILED;
+    return init_result;
   }
 
   /* Fetch all function pointers. */
@@ -409,6 +1389,7 @@ int glcewInit(void) {
   GL_LIBRARY_FIND_IMPL(glGenTextures);
   GL_LIBRARY_FIND_IMPL(glDeleteTextures);
   GL_LIBRARY_FIND_IMPL(glBindTexture);
+  GL_LIBRARY_FIND_IMPL(glActiveTexture);
   GL_LIBRARY_FIND_IMPL(glXChooseVisual);
   GL_LIBRARY_FIND_IMPL(glXCreateContext);
   GL_LIBRARY_FIND_IMPL(glXDestroyContext);
@@ -424,8 +1405,415 @@ int glcewInit(void) {
   GL_LIBRARY_FIND_IMPL(glXGetClientString);
   GL_LIBRARY_FIND_IMPL(glXGetProcAddressARB);
 
-  result = GLCEW_SUCCESS;
+  global_table_update();
+
+  init_result = GLCEW_SUCCESS;
+  return init_result;
+}
+
+int glcewInit(void) {
+  int result;
+  GLCEW_PROBE0(glcewInit__entry);
+  init_lock();
+  keep_loaded = 1;
+  result = glcew_init_locked();
+  init_unlock();
+  GLCEW_PROBE1(glcewInit__return, result);
+  return result;
+}
+
+void glcewUpdateDispatch(void) {
+  init_lock();
+  global_table_update();
+  init_unlock();
+}
+
+/* ****************************** Lifecycle. ***************************** */
+
+static void glcew_unload_locked(void) {
+  glcew_profile_unload();
+  glcew_validation_unload();
+  __atomic_add_fetch(&glcew_load_epoch, 1, __ATOMIC_RELEASE);
+  glcewExit();
+  glClearColor_impl = glClearColor_stub;
+  glClear_impl = glClear_stub;
+  glBlendFunc_impl = glBlendFunc_stub;
+  glPolygonMode_impl = glPolygonMode_stub;
+  glScissor_impl = glScissor_stub;
+  glDrawBuffer_impl = glDrawBuffer_stub;
+  glReadBuffer_impl = glReadBuffer_stub;
+  glEnable_impl = glEnable_stub;
+  glDisable_impl = glDisable_stub;
+  glIsEnabled_impl = glIsEnabled_stub;
+  glGetBooleanv_impl = glGetBooleanv_stub;
+  glGetDoublev_impl = glGetDoublev_stub;
+  glGetFloatv_impl = glGetFloatv_stub;
+  glGetIntegerv_impl = glGetIntegerv_stub;
+  glGetString_impl = glGetString_stub;
+  glFinish_impl = glFinish_stub;
+  glFlush_impl = glFlush_stub;
+  glDepthFunc_impl = glDepthFunc_stub;
+  glViewport_impl = glViewport_stub;
+  glDrawArrays_impl = glDrawArrays_stub;
+  glDrawElements_impl = glDrawElements_stub;
+  glPixelStorei_impl = glPixelStorei_stub;
+  glReadPixels_impl = glReadPixels_stub;
+  glTexParameteri_impl = glTexParameteri_stub;
+  glGetTexLevelParameteriv_impl = glGetTexLevelParameteriv_stub;
+  glTexImage2D_impl = glTexImage2D_stub;
+  glGetTexImage_impl = glGetTexImage_stub;
+  glGenTextures_impl = glGenTextures_stub;
+  glDeleteTextures_impl = glDeleteTextures_stub;
+  glBindTexture_impl = glBindTexture_stub;
+  glActiveTexture_impl = glActiveTexture_stub;
+  glXChooseVisual_impl = glXChooseVisual_stub;
+  glXCreateContext_impl = glXCreateContext_stub;
+  glXDestroyContext_impl = glXDestroyContext_stub;
+  glXMakeCurrent_impl = glXMakeCurrent_stub;
+  glXSwapBuffers_impl = glXSwapBuffers_stub;
+  glXQueryExtension_impl = glXQueryExtension_stub;
+  glXQueryVersion_impl = glXQueryVersion_stub;
+  glXGetCurrentContext_impl = glXGetCurrentContext_stub;
+  glXGetCurrentDrawable_impl = glXGetCurrentDrawable_stub;
+  glXWaitGL_impl = glXWaitGL_stub;
+  glXWaitX_impl = glXWaitX_stub;
+  glXQueryExtensionsString_impl = glXQueryExtensionsString_stub;
+  glXGetClientString_impl = glXGetClientString_stub;
+  glXGetProcAddressARB_impl = glXGetProcAddressARB_stub;
+  global_table_update();
+  initialized = 0;
+  init_result = 0;
+}
+
+static int glcew_can_unload_locked(void) {
+  return initialized && !keep_loaded && num_references == 0;
+}
+
+#ifndef _WIN32
+static void* idle_thread_run(void* user_data) {
+  (void) user_data;  /* Ignored. */
+  init_lock();
+  while (glcew_can_unload_locked()) {
+    const uint64_t deadline_ns = idle_since_ns +
+                                 (uint64_t)idle_timeout_ms * 1000000;
+    const uint64_t now_ns = glcew_time_ns();
+    struct timespec wakeup;
+    uint64_t remaining_ns;
+    if (now_ns >= deadline_ns) {
+      glcew_unload_locked();
+      break;
+    }
+    /* Condition variable waits on the realtime clock. */
+    remaining_ns = deadline_ns - now_ns;
+    clock_gettime(CLOCK_REALTIME, &wakeup);
+    wakeup.tv_sec += (time_t)(remaining_ns / 1000000000);
+    wakeup.tv_nsec += (long)(remaining_ns % 1000000000);
+    if (wakeup.tv_nsec >= 1000000000) {
+      wakeup.tv_nsec -= 1000000000;
+      ++wakeup.tv_sec;
+    }
+    pthread_cond_timedwait(&idle_condition, &init_mutex, &wakeup);
+  }
+  idle_thread_running = 0;
+  init_unlock();
+  return NULL;
+}
+#endif
+
+int glcewAcquire(void) {
+  int result;
+  init_lock();
+  result = glcew_init_locked();
+  if (result == GLCEW_SUCCESS) {
+    ++num_references;
+#ifndef _WIN32
+    pthread_cond_signal(&idle_condition);
+#endif
+  }
+  init_unlock();
+  return result;
+}
+
+void glcewRelease(void) {
+  init_lock();
+  assert(num_references > 0);
+  if (--num_references == 0 && glcew_can_unload_locked()) {
+#ifndef _WIN32
+    if (idle_timeout_ms != 0) {
+      idle_since_ns = glcew_time_ns();
+      if (!idle_thread_running) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, idle_thread_run, NULL) == 0) {
+          pthread_detach(thread);
+          idle_thread_running = 1;
+        }
+        else {
+          glcew_unload_locked();
+        }
+      }
+    }
+    else
+#endif
+    {
+      glcew_unload_locked();
+    }
+  }
+  init_unlock();
+}
+
+void glcewSetIdleTimeout(unsigned int timeout_ms) {
+  init_lock();
+  idle_timeout_ms = timeout_ms;
+#ifndef _WIN32
+  pthread_cond_signal(&idle_condition);
+#endif
+  init_unlock();
+}
+
+/* ***************************** Fork support. **************************** */
+
+#ifndef _WIN32
+static void atfork_prepare(void) {
+  init_lock();
+  glcew_stall_atfork_prepare();
+  glcew_texture_pool_atfork_prepare();
+  glcew_glx_cache_atfork_prepare();
+}
+
+static void atfork_parent(void) {
+  glcew_glx_cache_atfork_release();
+  glcew_texture_pool_atfork_release();
+  glcew_stall_atfork_release();
+  init_unlock();
+}
+
+static void atfork_child(void) {
+  /* Child only has the thread which called fork(), which is the one which
+   * holds the locks.
+   */
+  idle_thread_running = 0;
+  glcew_glx_cache_atfork_release();
+  glcew_texture_pool_atfork_release();
+  glcew_stall_atfork_release();
+  init_unlock();
+}
+
+static int atfork_register_locked(void) {
+  if (!atfork_registered) {
+    if (pthread_atfork(atfork_prepare, atfork_parent, atfork_child) != 0) {
+      return GLCEW_ERROR_ATFORK_FAILED;
+    }
+    atfork_registered = 1;
+  }
+  return GLCEW_SUCCESS;
+}
+#endif
+
+int glcew_atfork_register(void) {
+#ifdef _WIN32
+  return GLCEW_SUCCESS;
+#else
+  int result;
+  init_lock();
+  result = atfork_register_locked();
+  init_unlock();
+  return result;
+#endif
+}
+
+int glcewPrefork(void) {
+#ifdef _WIN32
+  return GLCEW_ERROR_UNSUPPORTED;
+#else
+  int result;
+  init_lock();
+  result = glcew_init_locked();
+  if (result == GLCEW_SUCCESS) {
+    result = atfork_register_locked();
+  }
+  init_unlock();
   return result;
+#endif
+}
+
+/* ************************ Isolated instances. ************************* */
+
+static void dispatch_table_load(DynamicLibrary lib,
+                                GLCEWDispatchTable* table) {
+  GL_LIBRARY_FIND_TABLE(glClearColor);
+  GL_LIBRARY_FIND_TABLE(glClear);
+  GL_LIBRARY_FIND_TABLE(glBlendFunc);
+  GL_LIBRARY_FIND_TABLE(glPolygonMode);
+  GL_LIBRARY_FIND_TABLE(glScissor);
+  GL_LIBRARY_FIND_TABLE(glDrawBuffer);
+  GL_LIBRARY_FIND_TABLE(glReadBuffer);
+  GL_LIBRARY_FIND_TABLE(glEnable);
+  GL_LIBRARY_FIND_TABLE(glDisable);
+  GL_LIBRARY_FIND_TABLE(glIsEnabled);
+  GL_LIBRARY_FIND_TABLE(glGetBooleanv);
+  GL_LIBRARY_FIND_TABLE(glGetDoublev);
+  GL_LIBRARY_FIND_TABLE(glGetFloatv);
+  GL_LIBRARY_FIND_TABLE(glGetIntegerv);
+  GL_LIBRARY_FIND_TABLE(glGetString);
+  GL_LIBRARY_FIND_TABLE(glFinish);
+  GL_LIBRARY_FIND_TABLE(glFlush);
+  GL_LIBRARY_FIND_TABLE(glDepthFunc);
+  GL_LIBRARY_FIND_TABLE(glViewport);
+  GL_LIBRARY_FIND_TABLE(glDrawArrays);
+  GL_LIBRARY_FIND_TABLE(glDrawElements);
+  GL_LIBRARY_FIND_TABLE(glPixelStorei);
+  GL_LIBRARY_FIND_TABLE(glReadPixels);
+  GL_LIBRARY_FIND_TABLE(glTexParameteri);
+  GL_LIBRARY_FIND_TABLE(glGetTexLevelParameteriv);
+  GL_LIBRARY_FIND_TABLE(glTexImage2D);
+  GL_LIBRARY_FIND_TABLE(glGetTexImage);
+  GL_LIBRARY_FIND_TABLE(glGenTextures);
+  GL_LIBRARY_FIND_TABLE(glDeleteTextures);
+  GL_LIBRARY_FIND_TABLE(glBindTexture);
+  GL_LIBRARY_FIND_TABLE(glActiveTexture);
+  GL_LIBRARY_FIND_TABLE(glXChooseVisual);
+  GL_LIBRARY_FIND_TABLE(glXCreateContext);
+  GL_LIBRARY_FIND_TABLE(glXDestroyContext);
+  GL_LIBRARY_FIND_TABLE(glXMakeCurrent);
+  GL_LIBRARY_FIND_TABLE(glXSwapBuffers);
+  GL_LIBRARY_FIND_TABLE(glXQueryExtension);
+  GL_LIBRARY_FIND_TABLE(glXQueryVersion);
+  GL_LIBRARY_FIND_TABLE(glXGetCurrentContext);
+  GL_LIBRARY_FIND_TABLE(glXGetCurrentDrawable);
+  GL_LIBRARY_FIND_TABLE(glXWaitGL);
+  GL_LIBRARY_FIND_TABLE(glXWaitX);
+  GL_LIBRARY_FIND_TABLE(glXQueryExtensionsString);
+  GL_LIBRARY_FIND_TABLE(glXGetClientString);
+  GL_LIBRARY_FIND_TABLE(glXGetProcAddressARB);
+}
+
+GLCEWInstance* glcewInstanceCreate(int* error) {
+  GLCEWInstance* instance;
+#ifndef dynamic_library_open_isolated
+  if (error != NULL) {
+    *error = GLCEW_ERROR_UNSUPPORTED;
+  }
+  return NULL;
+#else
+  instance = calloc(1, sizeof(GLCEWInstance));
+  if (instance == NULL) {
+    if (error != NULL) {
+      *error = GLCEW_ERROR_OPEN_FAILED;
+    }
+    return NULL;
+  }
+  instance->lib = dynamic_library_open_find(gl_paths, 1);
+  if (instance->lib == NULL) {
+    free(instance);
+    if (error != NULL) {
+      *error = GLCEW_ERROR_OPEN_FAILED;
+    }
+    return NULL;
+  }
+  dispatch_table_load(instance->lib, &instance->table);
+  if (error != NULL) {
+    *error = GLCEW_SUCCESS;
+  }
+  return instance;
+#endif
+}
+
+static void bound_instance_set(GLCEWInstance* instance);
+
+int glcewInstanceDestroy(GLCEWInstance* instance) {
+  int num_bound_here;
+  if (instance == NULL) {
+    return GLCEW_SUCCESS;
+  }
+  num_bound_here = (bound_instance == instance) ? 1 : 0;
+  /* Other threads would keep dispatching into the closed library. Binding
+   * and destroying is exclusive: once the state is switched no thread can
+   * bind the instance, and the switch fails if any thread has bound it.
+   */
+  if (!__atomic_compare_exchange_n(&instance->num_bound_threads,
+                                   &num_bound_here,
+                                   INSTANCE_DESTROYING,
+                                   0,
+                                   __ATOMIC_SEQ_CST,
+                                   __ATOMIC_SEQ_CST)) {
+    return GLCEW_ERROR_INSTANCE_BOUND;
+  }
+  if (num_bound_here) {
+    /* Binding count is gone with the state switch, only drop the thread's
+     * binding.
+     */
+    GLCEW_BATCH_FLUSH();
+    bound_instance_set(NULL);
+  }
+  /*  Ignore errors. */
+  dynamic_library_close(instance->lib);
+  free(instance);
+  return GLCEW_SUCCESS;
+}
+
+/* Returns zero if the instance is being destroyed. */
+static int instance_bind_thread(GLCEWInstance* instance) {
+  int num_bound_threads =
+      __atomic_load_n(&instance->num_bound_threads, __ATOMIC_SEQ_CST);
+  do {
+    if (num_bound_threads == INSTANCE_DESTROYING) {
+      return 0;
+    }
+  } while (!__atomic_compare_exchange_n(&instance->num_bound_threads,
+                                        &num_bound_threads,
+                                        num_bound_threads + 1,
+                                        1,
+                                        __ATOMIC_SEQ_CST,
+                                        __ATOMIC_SEQ_CST));
+  return 1;
+}
+
+static void instance_unbind_thread(GLCEWInstance* instance) {
+  __atomic_sub_fetch(&instance->num_bound_threads, 1, __ATOMIC_SEQ_CST);
+}
+
+#ifndef _WIN32
+static void bound_instance_key_destructor(void* instance) {
+  instance_unbind_thread(instance);
+}
+
+static void bound_instance_key_create(void) {
+  pthread_key_create(&bound_instance_key, bound_instance_key_destructor);
+}
+#endif
+
+static void bound_instance_set(GLCEWInstance* instance) {
+  bound_instance = instance;
+  glcew_bound_table = (instance != NULL) ? &instance->table : NULL;
+#ifndef _WIN32
+  pthread_once(&bound_instance_key_once, bound_instance_key_create);
+  pthread_setspecific(bound_instance_key, instance);
+#endif
+}
+
+int glcewInstanceBind(GLCEWInstance* instance) {
+  /* Queued draws are for the previously bound instance. */
+  GLCEW_BATCH_FLUSH();
+  if (instance == bound_instance) {
+    return GLCEW_SUCCESS;
+  }
+  if (instance != NULL && !instance_bind_thread(instance)) {
+    return GLCEW_ERROR_INSTANCE_DESTROYED;
+  }
+  if (bound_instance != NULL) {
+    instance_unbind_thread(bound_instance);
+  }
+  bound_instance_set(instance);
+  return GLCEW_SUCCESS;
+}
+
+GLCEWInstance* glcewInstanceGetBound(void) {
+  return bound_instance;
+}
+
+const GLCEWDispatchTable* glcewInstanceGetDispatchTable(
+    const GLCEWInstance* instance) {
+  return &instance->table;
 }
 
 const char* glcewErrorString(int error) {
@@ -433,6 +1821,11 @@ const char* glcewErrorString(int error) {
     case GLCEW_SUCCESS: return "SUCCESS";
     case GLCEW_ERROR_OPEN_FAILED: return "OPEN_FAILED";
     case GLCEW_ERROR_ATEXIT_FAILED: return "ATEXIT_FAILED";
+    case GLCEW_ERROR_UNSUPPORTED: return "UNSUPPORTED";
+    case GLCEW_ERROR_ATFORK_FAILED: return "ATFORK_FAILED";
+    case GLCEW_ERROR_INSTANCE_BOUND: return "INSTANCE_BOUND";
+    case GLCEW_ERROR_INSTANCE_DESTROYED: return "INSTANCE_DESTROYED";
+    case GLCEW_ERROR_OUT_OF_MEMORY: return "OUT_OF_MEMORY";
   }
   return "UNKNOWN";
 }
@@ -0,0 +1,276 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Draw call batching.
+ *
+ * Draws are queued per thread, since every thread has its own current
+ * context. Queue is flushed as soon as a draw which can not be merged is
+ * received, or any other wrapper is called, so the state seen by the queued
+ * draws is the same as if they were issued immediately.
+ *
+ * Batching of a thread ends when the library is unloaded, draws which were
+ * queued by then are dropped together with the context they were for.
+ *
+ * Multi-draw entry points are looked up again when the thread dispatches to
+ * another implementation than on the previous flush, such as after binding
+ * an instance or acquiring a pooled context.
+ */
+
+#include <glcew.h>
+#include "glcew_intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#  include <pthread.h>
+#endif
+
+#define MAX_BATCH_SIZE 1024
+
+typedef void (*tglMultiDrawArrays) (GLenum mode,
+                                    const GLint* first,
+                                    const GLsizei* count,
+                                    GLsizei drawcount);
+typedef void (*tglMultiDrawElements) (GLenum mode,
+                                      const GLsizei* count,
+                                      GLenum type,
+                                      const GLvoid* const* indices,
+                                      GLsizei drawcount);
+
+typedef struct DrawBatch {
+  /* Entry points of the implementation which get_proc_address belongs to,
+   * NULL if it has no multi-draw.
+   */
+  tglXGetProcAddressARB get_proc_address;
+  tglMultiDrawArrays glMultiDrawArrays;
+  tglMultiDrawElements glMultiDrawElements;
+  /* Parameters which all the queued draws have in common. */
+  int is_elements;
+  GLenum mode;
+  GLenum type;
+  GLint firsts[MAX_BATCH_SIZE];
+  GLsizei counts[MAX_BATCH_SIZE];
+  const GLvoid* indices[MAX_BATCH_SIZE];
+  GLCEWBatchStats stats;
+  /* Library load the multi-draw entry points belong to. */
+  unsigned int load_epoch;
+} DrawBatch;
+
+GLCEW_THREAD_LOCAL_FAST int glcew_batch_enabled = 0;
+GLCEW_THREAD_LOCAL_FAST int glcew_batch_num_pending = 0;
+static GLCEW_THREAD_LOCAL DrawBatch* batch = NULL;
+#ifndef _WIN32
+/* Holds the batch as well, so it is freed when the thread exits. */
+static pthread_key_t batch_key;
+static pthread_once_t batch_key_once = PTHREAD_ONCE_INIT;
+
+static void batch_key_create(void) {
+  pthread_key_create(&batch_key, free);
+}
+#endif
+
+static void stats_add_flush(GLCEWBatchStats* stats, int num_draws) {
+  int bucket = 0;
+  while ((1 << bucket) < num_draws &&
+         bucket < GLCEW_BATCH_HISTOGRAM_SIZE - 1) {
+    ++bucket;
+  }
+  ++stats->histogram[bucket];
+  ++stats->num_flushes;
+}
+
+/* Disable batching if the library was unloaded since it was enabled.
+ * Returns non-zero if it was.
+ */
+static int batch_expire(void) {
+  if (GLCEW_LIKELY(batch->load_epoch ==
+                   __atomic_load_n(&glcew_load_epoch, __ATOMIC_ACQUIRE))) {
+    return 0;
+  }
+  glcew_batch_enabled = 0;
+  glcew_batch_num_pending = 0;
+  return 1;
+}
+
+/* Look up multi-draw entry points of the implementation the calling thread
+ * dispatches to, unless they are already known.
+ */
+static void batch_find_multi_draw(void) {
+  const tglXGetProcAddressARB get_proc_address =
+      GLCEW_DISPATCH(glXGetProcAddressARB);
+  if (GLCEW_LIKELY(batch->get_proc_address == get_proc_address)) {
+    return;
+  }
+  batch->get_proc_address = get_proc_address;
+  batch->glMultiDrawArrays = NULL;
+  batch->glMultiDrawElements = NULL;
+  if (get_proc_address != NULL) {
+    batch->glMultiDrawArrays = (tglMultiDrawArrays)get_proc_address(
+        (const GLubyte*)"glMultiDrawArrays");
+    batch->glMultiDrawElements = (tglMultiDrawElements)get_proc_address(
+        (const GLubyte*)"glMultiDrawElements");
+  }
+}
+
+void glcew_batch_flush_impl(void) {
+  const int num_draws = glcew_batch_num_pending;
+  int i;
+  if (batch_expire()) {
+    return;
+  }
+  glcew_batch_num_pending = 0;
+  if (num_draws == 0) {
+    return;
+  }
+  batch_find_multi_draw();
+  /* Single draw is passed as-is, it is cheaper than a multi-draw. Draws are
+   * passed one by one to an implementation without multi-draw.
+   */
+  if (batch->is_elements) {
+    if (num_draws == 1 || batch->glMultiDrawElements == NULL) {
+      for (i = 0; i < num_draws; ++i) {
+        GLCEW_DISPATCH(glDrawElements)(batch->mode,
+                                       batch->counts[i],
+                                       batch->type,
+                                       batch->indices[i]);
+      }
+    }
+    else {
+      batch->glMultiDrawElements(batch->mode,
+                                 batch->counts,
+                                 batch->type,
+                                 batch->indices,
+                                 num_draws);
+    }
+  }
+  else {
+    if (num_draws == 1 || batch->glMultiDrawArrays == NULL) {
+      for (i = 0; i < num_draws; ++i) {
+        GLCEW_DISPATCH(glDrawArrays)(batch->mode,
+                                     batch->firsts[i],
+                                     batch->counts[i]);
+      }
+    }
+    else {
+      batch->glMultiDrawArrays(batch->mode,
+                               batch->firsts,
+                               batch->counts,
+                               num_draws);
+    }
+  }
+  stats_add_flush(&batch->stats, num_draws);
+}
+
+int glcew_batch_draw_arrays_impl(GLenum mode, GLint first, GLsizei count) {
+  if (batch_expire()) {
+    return 0;
+  }
+  if (glcew_batch_num_pending != 0 &&
+      (batch->is_elements || batch->mode != mode)) {
+    glcew_batch_flush_impl();
+  }
+  if (glcew_batch_num_pending == 0) {
+    batch->is_elements = 0;
+    batch->mode = mode;
+  }
+  batch->firsts[glcew_batch_num_pending] = first;
+  batch->counts[glcew_batch_num_pending] = count;
+  ++batch->stats.num_draws;
+  if (++glcew_batch_num_pending == MAX_BATCH_SIZE) {
+    glcew_batch_flush_impl();
+  }
+  return 1;
+}
+
+int glcew_batch_draw_elements_impl(GLenum mode,
+                                   GLsizei count,
+                                   GLenum type,
+                                   const GLvoid* indices) {
+  if (batch_expire()) {
+    return 0;
+  }
+  if (glcew_batch_num_pending != 0 &&
+      (!batch->is_elements || batch->mode != mode || batch->type != type)) {
+    glcew_batch_flush_impl();
+  }
+  if (glcew_batch_num_pending == 0) {
+    GLint element_buffer = 0;
+    /* Indices in client memory are only valid for the duration of the call,
+     * such draws are passed as-is.
+     */
+    GLCEW_DISPATCH(glGetIntegerv)(GL_ELEMENT_ARRAY_BUFFER_BINDING,
+                                  &element_buffer);
+    if (element_buffer == 0) {
+      return 0;
+    }
+    batch->is_elements = 1;
+    batch->mode = mode;
+    batch->type = type;
+  }
+  batch->counts[glcew_batch_num_pending] = count;
+  batch->indices[glcew_batch_num_pending] = indices;
+  ++batch->stats.num_draws;
+  if (++glcew_batch_num_pending == MAX_BATCH_SIZE) {
+    glcew_batch_flush_impl();
+  }
+  return 1;
+}
+
+int glcewBatchEnable(void) {
+  if (glcew_batch_enabled && !batch_expire()) {
+    return GLCEW_SUCCESS;
+  }
+  if (GLCEW_DISPATCH(glXGetProcAddressARB) == NULL) {
+    return GLCEW_ERROR_OPEN_FAILED;
+  }
+  if (batch == NULL) {
+    batch = calloc(1, sizeof(DrawBatch));
+    if (batch == NULL) {
+      return GLCEW_ERROR_UNSUPPORTED;
+    }
+#ifndef _WIN32
+    pthread_once(&batch_key_once, batch_key_create);
+    pthread_setspecific(batch_key, batch);
+#endif
+  }
+  /* Entry points of the previous load are not to be trusted. */
+  batch->get_proc_address = NULL;
+  batch_find_multi_draw();
+  if (batch->glMultiDrawArrays == NULL || batch->glMultiDrawElements == NULL) {
+    return GLCEW_ERROR_UNSUPPORTED;
+  }
+  batch->load_epoch = __atomic_load_n(&glcew_load_epoch, __ATOMIC_ACQUIRE);
+  glcew_batch_enabled = 1;
+  return GLCEW_SUCCESS;
+}
+
+void glcewBatchDisable(void) {
+  GLCEW_BATCH_FLUSH();
+  glcew_batch_enabled = 0;
+}
+
+void glcewBatchFlush(void) {
+  GLCEW_BATCH_FLUSH();
+}
+
+void glcewBatchGetStats(GLCEWBatchStats* stats) {
+  if (batch == NULL) {
+    memset(stats, 0, sizeof(*stats));
+    return;
+  }
+  *stats = batch->stats;
+}
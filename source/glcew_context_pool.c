@@ -0,0 +1,335 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Pool of pre-created OpenGL contexts.
+ *
+ * Unused contexts are kept in a lock-free stack. Head of the stack contains
+ * index of the top context in the lower 32 bits and a tag in the upper ones,
+ * tag is incremented on every change, which avoids ABA problem.
+ */
+
+#include <glcew.h>
+#include "glcew_intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef Pixmap (*tXCreatePixmap) (Display* display,
+                                  Drawable drawable,
+                                  unsigned int width,
+                                  unsigned int height,
+                                  unsigned int depth);
+typedef int (*tXFreePixmap) (Display* display, Pixmap pixmap);
+typedef GLXPixmap (*tglXCreateGLXPixmap) (Display* dpy,
+                                          XVisualInfo* visual,
+                                          Pixmap pixmap);
+typedef void (*tglXDestroyGLXPixmap) (Display* dpy, GLXPixmap pixmap);
+
+struct GLCEWPooledContext {
+  GLXContext context;
+  Pixmap pixmap;
+  GLXPixmap drawable;
+  /* Entry points resolved while this context was current. */
+  GLCEWDispatchTable table;
+  /* Table which was bound to the thread before acquire. */
+  const GLCEWDispatchTable* previous_table;
+  /* Index of the next unused context plus one, 0 terminates the stack. */
+  uint32_t next;
+};
+
+struct GLCEWContextPool {
+  Display* display;
+  int width;
+  int height;
+  GLCEWPooledContext* contexts;
+  int size;
+  uint64_t free_head;
+
+  tXCreatePixmap XCreatePixmap;
+  tXFreePixmap XFreePixmap;
+  tglXCreateGLXPixmap glXCreateGLXPixmap;
+  tglXDestroyGLXPixmap glXDestroyGLXPixmap;
+
+  uint64_t num_acquires;
+  uint64_t num_exhausted;
+  uint64_t total_acquire_ns;
+  uint64_t max_acquire_ns;
+};
+
+/* ************************** Lock-free stack. *************************** */
+
+static GLCEWPooledContext* stack_pop(GLCEWContextPool* pool) {
+  uint64_t head = __atomic_load_n(&pool->free_head, __ATOMIC_ACQUIRE);
+  for (;;) {
+    const uint32_t index = (uint32_t)head;
+    uint64_t new_head;
+    if (index == 0) {
+      return NULL;
+    }
+    new_head = (((head >> 32) + 1) << 32) |
+               __atomic_load_n(&pool->contexts[index - 1].next,
+                               __ATOMIC_RELAXED);
+    if (__atomic_compare_exchange_n(&pool->free_head, &head, new_head, 1,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      return &pool->contexts[index - 1];
+    }
+  }
+}
+
+static void stack_push(GLCEWContextPool* pool, GLCEWPooledContext* context) {
+  const uint32_t index = (uint32_t)(context - pool->contexts) + 1;
+  uint64_t head = __atomic_load_n(&pool->free_head, __ATOMIC_RELAXED);
+  uint64_t new_head;
+  do {
+    __atomic_store_n(&context->next, (uint32_t)head, __ATOMIC_RELAXED);
+    new_head = (((head >> 32) + 1) << 32) | index;
+  } while (!__atomic_compare_exchange_n(&pool->free_head, &head, new_head, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* ****************************** Contexts. ****************************** */
+
+static void pooled_context_free(GLCEWContextPool* pool,
+                                GLCEWPooledContext* context) {
+  if (context->context != NULL) {
+    context->table.glXDestroyContext(pool->display, context->context);
+  }
+  if (context->drawable != 0) {
+    pool->glXDestroyGLXPixmap(pool->display, context->drawable);
+  }
+  if (context->pixmap != 0) {
+    pool->XFreePixmap(pool->display, context->pixmap);
+  }
+}
+
+static int pooled_context_init(GLCEWContextPool* pool,
+                               GLCEWPooledContext* context,
+                               const GLCEWContextPoolSettings* settings,
+                               const GLCEWDispatchTable* base_table,
+                               GLXContext share_context) {
+  XVisualInfo* visual = settings->visual;
+  context->table = *base_table;
+  context->context = base_table->glXCreateContext(pool->display,
+                                                  visual,
+                                                  share_context,
+                                                  settings->direct);
+  if (context->context == NULL) {
+    return 0;
+  }
+  context->pixmap = pool->XCreatePixmap(
+      pool->display,
+      RootWindow(pool->display, visual->screen),
+      pool->width, pool->height, visual->depth);
+  if (context->pixmap == 0) {
+    return 0;
+  }
+  context->drawable = pool->glXCreateGLXPixmap(pool->display,
+                                               visual,
+                                               context->pixmap);
+  if (context->drawable == 0) {
+    return 0;
+  }
+  if (!base_table->glXMakeCurrent(pool->display,
+                                  context->drawable,
+                                  context->context)) {
+    return 0;
+  }
+  glcew_dispatch_table_load_proc_address(
+      &context->table, base_table->glXGetProcAddressARB);
+  if (settings->warm_up) {
+    context->table.glViewport(0, 0, pool->width, pool->height);
+    context->table.glClear(GL_COLOR_BUFFER_BIT);
+    context->table.glFinish();
+  }
+  return 1;
+}
+
+/* Reset state which is commonly changed by jobs, so the next user of the
+ * context starts from a known state.
+ */
+static void pooled_context_reset(GLCEWContextPool* pool,
+                                 GLCEWPooledContext* context) {
+  const GLCEWDispatchTable* table = &context->table;
+  table->glBindTexture(GL_TEXTURE_2D, 0);
+  /* Texture pool is to see the unbind, as if the wrapper was called. */
+  GLCEW_TEXTURE_POOL_BIND(GL_TEXTURE_2D, 0);
+  table->glDisable(GL_BLEND);
+  table->glDisable(GL_DEPTH_TEST);
+  table->glDisable(GL_SCISSOR_TEST);
+  table->glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  table->glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  table->glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+  table->glViewport(0, 0, pool->width, pool->height);
+}
+
+/* ********************************* API. ******************************** */
+
+GLCEWContextPool* glcewContextPoolCreate(
+    const GLCEWContextPoolSettings* settings, int* error) {
+  GLCEWContextPool* pool;
+  GLCEWDispatchTable base_table;
+  GLXContext previous_context;
+  GLXDrawable previous_drawable;
+  int i, result = GLCEW_SUCCESS;
+  glcew_dispatch_table_get_current(&base_table);
+  if (base_table.glXCreateContext == NULL ||
+      base_table.glXGetProcAddressARB == NULL) {
+    result = GLCEW_ERROR_OPEN_FAILED;
+    goto fail;
+  }
+  pool = calloc(1, sizeof(GLCEWContextPool));
+  if (pool == NULL) {
+    result = GLCEW_ERROR_OUT_OF_MEMORY;
+    goto fail;
+  }
+  pool->display = settings->display;
+  pool->width = (settings->width > 0) ? settings->width : 1;
+  pool->height = (settings->height > 0) ? settings->height : 1;
+  pool->XCreatePixmap =
+      (tXCreatePixmap)glcew_find_global_symbol("XCreatePixmap");
+  pool->XFreePixmap = (tXFreePixmap)glcew_find_global_symbol("XFreePixmap");
+  pool->glXCreateGLXPixmap = (tglXCreateGLXPixmap)
+      base_table.glXGetProcAddressARB((const GLubyte*)"glXCreateGLXPixmap");
+  pool->glXDestroyGLXPixmap = (tglXDestroyGLXPixmap)
+      base_table.glXGetProcAddressARB((const GLubyte*)"glXDestroyGLXPixmap");
+  if (pool->XCreatePixmap == NULL || pool->XFreePixmap == NULL ||
+      pool->glXCreateGLXPixmap == NULL || pool->glXDestroyGLXPixmap == NULL) {
+    free(pool);
+    result = GLCEW_ERROR_UNSUPPORTED;
+    goto fail;
+  }
+  pool->size = (settings->size > 0) ? settings->size : 1;
+  pool->contexts = calloc(pool->size, sizeof(GLCEWPooledContext));
+  if (pool->contexts == NULL) {
+    free(pool);
+    result = GLCEW_ERROR_OUT_OF_MEMORY;
+    goto fail;
+  }
+  /* Contexts are made current during creation, restore the context of the
+   * caller afterwards.
+   */
+  previous_context = base_table.glXGetCurrentContext();
+  previous_drawable = base_table.glXGetCurrentDrawable();
+  for (i = 0; i < pool->size; ++i) {
+    GLXContext share_context = (settings->share_objects && i != 0)
+                                   ? pool->contexts[0].context
+                                   : NULL;
+    if (!pooled_context_init(pool, &pool->contexts[i], settings,
+                             &base_table, share_context)) {
+      result = GLCEW_ERROR_UNSUPPORTED;
+      break;
+    }
+  }
+  base_table.glXMakeCurrent(pool->display,
+                            previous_drawable,
+                            previous_context);
+  if (result != GLCEW_SUCCESS) {
+    /* Free contexts in the reverse order, so the share context goes last. */
+    for (; i >= 0; --i) {
+      pooled_context_free(pool, &pool->contexts[i]);
+    }
+    free(pool->contexts);
+    free(pool);
+    goto fail;
+  }
+  for (i = pool->size - 1; i >= 0; --i) {
+    stack_push(pool, &pool->contexts[i]);
+  }
+  if (error != NULL) {
+    *error = GLCEW_SUCCESS;
+  }
+  return pool;
+fail:
+  if (error != NULL) {
+    *error = result;
+  }
+  return NULL;
+}
+
+void glcewContextPoolDestroy(GLCEWContextPool* pool) {
+  int i;
+  if (pool == NULL) {
+    return;
+  }
+  for (i = pool->size - 1; i >= 0; --i) {
+    pooled_context_free(pool, &pool->contexts[i]);
+  }
+  free(pool->contexts);
+  free(pool);
+}
+
+GLCEWPooledContext* glcewContextPoolAcquire(GLCEWContextPool* pool) {
+  const uint64_t start_ns = glcew_time_ns();
+  GLCEWPooledContext* context = stack_pop(pool);
+  uint64_t elapsed_ns, max_ns;
+  /* Queued draws belong to the context which is current now. */
+  GLCEW_BATCH_FLUSH();
+  if (context == NULL) {
+    __atomic_fetch_add(&pool->num_exhausted, 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+  if (!context->table.glXMakeCurrent(pool->display,
+                                     context->drawable,
+                                     context->context)) {
+    stack_push(pool, context);
+    return NULL;
+  }
+  context->previous_table = glcew_dispatch_table_bind(&context->table);
+  elapsed_ns = glcew_time_ns() - start_ns;
+  __atomic_fetch_add(&pool->num_acquires, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&pool->total_acquire_ns, elapsed_ns, __ATOMIC_RELAXED);
+  max_ns = __atomic_load_n(&pool->max_acquire_ns, __ATOMIC_RELAXED);
+  while (elapsed_ns > max_ns &&
+         !__atomic_compare_exchange_n(&pool->max_acquire_ns, &max_ns,
+                                      elapsed_ns, 1, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED)) {
+  }
+  return context;
+}
+
+void glcewContextPoolRelease(GLCEWContextPool* pool,
+                             GLCEWPooledContext* context) {
+  GLCEW_BATCH_FLUSH();
+  pooled_context_reset(pool, context);
+  context->table.glXMakeCurrent(pool->display, None, NULL);
+  glcew_dispatch_table_bind(context->previous_table);
+  stack_push(pool, context);
+}
+
+void glcewContextPoolGetMetrics(GLCEWContextPool* pool,
+                                GLCEWContextPoolMetrics* metrics) {
+  metrics->num_acquires =
+      __atomic_load_n(&pool->num_acquires, __ATOMIC_RELAXED);
+  metrics->num_exhausted =
+      __atomic_load_n(&pool->num_exhausted, __ATOMIC_RELAXED);
+  metrics->total_acquire_ns =
+      __atomic_load_n(&pool->total_acquire_ns, __ATOMIC_RELAXED);
+  metrics->max_acquire_ns =
+      __atomic_load_n(&pool->max_acquire_ns, __ATOMIC_RELAXED);
+}
+
+GLXContext glcewPooledContextGetContext(const GLCEWPooledContext* context) {
+  return context->context;
+}
+
+GLXDrawable glcewPooledContextGetDrawable(const GLCEWPooledContext* context) {
+  return context->drawable;
+}
+
+const GLCEWDispatchTable* glcewPooledContextGetDispatchTable(
+    const GLCEWPooledContext* context) {
+  return &context->table;
+}
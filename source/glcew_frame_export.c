@@ -0,0 +1,594 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Frame export through shared memory.
+ *
+ * Shared memory starts with a header, followed by the frame slots. Producer
+ * only writes the head counter and consumer only writes the tail counter,
+ * slot head % num_slots is the next one to be written and slot
+ * tail % num_slots is the next one to be read. Side which is about to sleep
+ * sets its waiting flag first, so the other side only does a wake-up
+ * syscall when somebody actually sleeps.
+ */
+
+#ifdef __linux__
+#  define _GNU_SOURCE
+#endif
+
+#include <glcew.h>
+#include "glcew_intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#  include <fcntl.h>
+#  include <limits.h>
+#  include <linux/futex.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+#ifdef __linux__
+
+#define SHARED_MAGIC 0x57454347  /* "GCEW" */
+#define SHARED_VERSION 1
+#define DEFAULT_NUM_SLOTS 3
+#define DEFAULT_BLOCK_TIMEOUT_MS 1000
+/* Largest GL_PACK_ALIGNMENT, slots are sized for it. */
+#define MAX_PACK_ALIGNMENT 8
+
+typedef struct SharedSlot {
+  uint64_t sequence;
+  uint64_t timestamp_ns;
+  uint32_t stride;
+  uint32_t padding;
+} SharedSlot;
+
+typedef struct SharedHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_slots;
+  uint32_t width;
+  uint32_t height;
+  uint32_t format;
+  uint32_t type;
+  uint32_t padding;
+  uint64_t slot_size;
+  uint64_t data_offset;
+  uint32_t producer_closed;
+  uint32_t consumer_closed;
+  /* Counters of the producer and the consumer are on different cache
+   * lines, so they do not bounce between the processes.
+   */
+  uint32_t head __attribute__((aligned(64)));
+  uint32_t producer_waiting;
+  uint32_t tail __attribute__((aligned(64)));
+  uint32_t consumer_waiting;
+  SharedSlot slots[] __attribute__((aligned(64)));
+} SharedHeader;
+
+/* Private copy of the layout, the other process can write to the shared
+ * header, so it is only trusted for the counters.
+ */
+typedef struct FrameLayout {
+  uint32_t num_slots;
+  uint32_t width;
+  uint32_t height;
+  GLenum format;
+  GLenum type;
+  uint64_t slot_size;
+} FrameLayout;
+
+struct GLCEWFrameExport {
+  int fd;
+  SharedHeader* header;
+  size_t size;
+  uint8_t* data;
+  FrameLayout layout;
+  uint32_t head;
+  int flags;
+  int block_timeout_ms;
+  int bytes_per_pixel;
+  /* Consumer did not free a slot within the timeout, and has not done so
+   * since, at the given tail.
+   */
+  int consumer_stalled;
+  uint32_t stalled_tail;
+  GLCEWFrameExportStats stats;
+};
+
+struct GLCEWFrameImport {
+  SharedHeader* header;
+  size_t size;
+  uint8_t* data;
+  FrameLayout layout;
+  /* Smallest stride the producer can use for a row of the frame. */
+  uint64_t min_stride;
+  uint32_t tail;
+};
+
+/* ******************************** Futexes. ******************************** */
+
+static void futex_wait(uint32_t* address, uint32_t value, int64_t timeout_ns) {
+  struct timespec timeout;
+  if (timeout_ns >= 0) {
+    timeout.tv_sec = timeout_ns / 1000000000;
+    timeout.tv_nsec = timeout_ns % 1000000000;
+  }
+  /* Memory is shared between processes, so no FUTEX_PRIVATE_FLAG. Spurious
+   * wake-ups and EINTR are handled by the caller re-checking the counter.
+   */
+  syscall(SYS_futex, address, FUTEX_WAIT, value,
+          (timeout_ns >= 0) ? &timeout : NULL, NULL, 0);
+}
+
+static void futex_wake(uint32_t* address) {
+  syscall(SYS_futex, address, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Wait until counter is changed from the value. Returns 1 if it was
+ * changed, 0 on timeout and -1 if the other side is closed.
+ */
+static int wait_for_change(uint32_t* counter,
+                           uint32_t* waiting,
+                           uint32_t value,
+                           const uint32_t* closed,
+                           int timeout_ms) {
+  const uint64_t deadline_ns =
+      glcew_time_ns() + (uint64_t)((timeout_ms > 0) ? timeout_ms : 0) *
+                        1000000ull;
+  int result;
+  for (;;) {
+    int64_t remaining_ns = -1;
+    __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(counter, __ATOMIC_SEQ_CST) != value) {
+      result = 1;
+      break;
+    }
+    if (__atomic_load_n(closed, __ATOMIC_SEQ_CST)) {
+      result = -1;
+      break;
+    }
+    if (timeout_ms >= 0) {
+      const uint64_t now_ns = glcew_time_ns();
+      if (now_ns >= deadline_ns) {
+        result = 0;
+        break;
+      }
+      remaining_ns = (int64_t)(deadline_ns - now_ns);
+    }
+    futex_wait(counter, value, remaining_ns);
+  }
+  __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+  return result;
+}
+
+/* ********************************* Export. ******************************** */
+
+static int bytes_per_pixel(GLenum format, GLenum type) {
+  int num_components, component_size;
+  switch (type) {
+    case 0x8035:  /* GL_UNSIGNED_INT_8_8_8_8 */
+    case 0x8367:  /* GL_UNSIGNED_INT_8_8_8_8_REV */
+    case 0x8368:  /* GL_UNSIGNED_INT_2_10_10_10_REV */
+      return 4;
+  }
+  switch (format) {
+    case 0x1902:  /* GL_DEPTH_COMPONENT */
+    case 0x1903:  /* GL_RED */
+    case 0x1906:  /* GL_ALPHA */
+      num_components = 1;
+      break;
+    case 0x8227:  /* GL_RG */
+      num_components = 2;
+      break;
+    case 0x1907:  /* GL_RGB */
+    case 0x80E0:  /* GL_BGR */
+      num_components = 3;
+      break;
+    case 0x1908:  /* GL_RGBA */
+    case 0x80E1:  /* GL_BGRA */
+      num_components = 4;
+      break;
+    default:
+      return 0;
+  }
+  switch (type) {
+    case 0x1400:  /* GL_BYTE */
+    case 0x1401:  /* GL_UNSIGNED_BYTE */
+      component_size = 1;
+      break;
+    case 0x1402:  /* GL_SHORT */
+    case 0x1403:  /* GL_UNSIGNED_SHORT */
+    case 0x140B:  /* GL_HALF_FLOAT */
+      component_size = 2;
+      break;
+    case 0x1404:  /* GL_INT */
+    case 0x1405:  /* GL_UNSIGNED_INT */
+    case 0x1406:  /* GL_FLOAT */
+      component_size = 4;
+      break;
+    default:
+      return 0;
+  }
+  return num_components * component_size;
+}
+
+static uint64_t align_up(uint64_t value, uint64_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+GLCEWFrameExport* glcewFrameExportCreate(
+    const GLCEWFrameExportSettings* settings, int* error) {
+  const uint64_t page_size = (uint64_t)sysconf(_SC_PAGESIZE);
+  const int num_slots = (settings->num_slots > 0) ? settings->num_slots
+                                                  : DEFAULT_NUM_SLOTS;
+  GLCEWFrameExport* frame_export;
+  SharedHeader* header;
+  uint64_t data_offset, slot_size, size;
+  int result = GLCEW_SUCCESS;
+  const int pixel_size = bytes_per_pixel(settings->format, settings->type);
+  if (pixel_size == 0 || settings->width <= 0 || settings->height <= 0) {
+    result = GLCEW_ERROR_UNSUPPORTED;
+    goto fail;
+  }
+  data_offset = align_up(sizeof(SharedHeader) +
+                         sizeof(SharedSlot) * num_slots, page_size);
+  slot_size = align_up(
+      align_up((uint64_t)settings->width * pixel_size, MAX_PACK_ALIGNMENT) *
+          settings->height,
+      page_size);
+  size = data_offset + slot_size * num_slots;
+  frame_export = calloc(1, sizeof(GLCEWFrameExport));
+  if (frame_export == NULL) {
+    result = GLCEW_ERROR_OPEN_FAILED;
+    goto fail;
+  }
+  frame_export->flags = settings->flags;
+  frame_export->block_timeout_ms = (settings->block_timeout_ms > 0)
+                                       ? settings->block_timeout_ms
+                                       : DEFAULT_BLOCK_TIMEOUT_MS;
+  frame_export->bytes_per_pixel = pixel_size;
+  frame_export->size = size;
+  frame_export->fd = memfd_create("glcew-frames",
+                                  MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (frame_export->fd == -1) {
+    result = GLCEW_ERROR_OPEN_FAILED;
+    goto fail_free;
+  }
+  /* Consumer relies on the size never changing, otherwise accessing its
+   * mapping could raise SIGBUS.
+   */
+  if (ftruncate(frame_export->fd, (off_t)size) != 0 ||
+      fcntl(frame_export->fd, F_ADD_SEALS,
+            F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+    result = GLCEW_ERROR_OPEN_FAILED;
+    goto fail_close;
+  }
+  header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                frame_export->fd, 0);
+  if (header == MAP_FAILED) {
+    result = GLCEW_ERROR_OPEN_FAILED;
+    goto fail_close;
+  }
+  frame_export->layout.num_slots = (uint32_t)num_slots;
+  frame_export->layout.width = (uint32_t)settings->width;
+  frame_export->layout.height = (uint32_t)settings->height;
+  frame_export->layout.format = settings->format;
+  frame_export->layout.type = settings->type;
+  frame_export->layout.slot_size = slot_size;
+  header->num_slots = frame_export->layout.num_slots;
+  header->width = frame_export->layout.width;
+  header->height = frame_export->layout.height;
+  header->format = frame_export->layout.format;
+  header->type = frame_export->layout.type;
+  header->slot_size = slot_size;
+  header->data_offset = data_offset;
+  header->version = SHARED_VERSION;
+  __atomic_store_n(&header->magic, SHARED_MAGIC, __ATOMIC_RELEASE);
+  frame_export->header = header;
+  frame_export->data = (uint8_t*)header + data_offset;
+  if (error != NULL) {
+    *error = GLCEW_SUCCESS;
+  }
+  return frame_export;
+fail_close:
+  close(frame_export->fd);
+fail_free:
+  free(frame_export);
+fail:
+  if (error != NULL) {
+    *error = result;
+  }
+  return NULL;
+}
+
+void glcewFrameExportDestroy(GLCEWFrameExport* frame_export) {
+  if (frame_export == NULL) {
+    return;
+  }
+  __atomic_store_n(&frame_export->header->producer_closed, 1,
+                   __ATOMIC_SEQ_CST);
+  futex_wake(&frame_export->header->head);
+  munmap(frame_export->header, frame_export->size);
+  close(frame_export->fd);
+  free(frame_export);
+}
+
+int glcewFrameExportGetFd(const GLCEWFrameExport* frame_export) {
+  return frame_export->fd;
+}
+
+int glcewFrameExportReadPixels(GLCEWFrameExport* frame_export, int x, int y) {
+  SharedHeader* header = frame_export->header;
+  const FrameLayout* layout = &frame_export->layout;
+  const uint32_t head = frame_export->head;
+  const uint32_t slot_index = head % layout->num_slots;
+  SharedSlot* slot;
+  GLint alignment = 4;
+  uint32_t stride;
+  for (;;) {
+    const uint32_t tail = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+    if (head - tail < layout->num_slots) {
+      frame_export->consumer_stalled = 0;
+      break;
+    }
+    /* Consumer which crashed never closes the import, so the wait is
+     * bounded, and once it timed out frames are dropped without waiting
+     * until the consumer makes progress again.
+     */
+    if ((frame_export->flags & GLCEW_FRAME_EXPORT_BLOCK) &&
+        !(frame_export->consumer_stalled &&
+          frame_export->stalled_tail == tail)) {
+      const int result = wait_for_change(&header->tail,
+                                         &header->producer_waiting,
+                                         tail,
+                                         &header->consumer_closed,
+                                         frame_export->block_timeout_ms);
+      if (result == 1) {
+        continue;
+      }
+      if (result == 0) {
+        frame_export->consumer_stalled = 1;
+        frame_export->stalled_tail = tail;
+      }
+    }
+    ++frame_export->stats.num_dropped;
+    return 0;
+  }
+  GLCEW_DISPATCH(glGetIntegerv)(GL_PACK_ALIGNMENT, &alignment);
+  if (alignment < 1 || alignment > MAX_PACK_ALIGNMENT) {
+    alignment = MAX_PACK_ALIGNMENT;
+  }
+  stride = (uint32_t)align_up(
+      (uint64_t)layout->width * frame_export->bytes_per_pixel, alignment);
+  slot = &header->slots[slot_index];
+  /* Go through the wrapper, so the readback is seen by the stall
+   * detector.
+   */
+  glReadPixels(x, y,
+               (GLsizei)layout->width, (GLsizei)layout->height,
+               layout->format, layout->type,
+               frame_export->data + slot_index * layout->slot_size);
+  slot->sequence = frame_export->stats.num_frames;
+  slot->timestamp_ns = glcew_time_ns();
+  slot->stride = stride;
+  frame_export->head = head + 1;
+  __atomic_store_n(&header->head, frame_export->head, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&header->consumer_waiting, __ATOMIC_SEQ_CST)) {
+    futex_wake(&header->head);
+  }
+  ++frame_export->stats.num_frames;
+  frame_export->stats.num_bytes += (uint64_t)stride * layout->height;
+  return 1;
+}
+
+void glcewFrameExportGetStats(const GLCEWFrameExport* frame_export,
+                              GLCEWFrameExportStats* stats) {
+  *stats = frame_export->stats;
+}
+
+/* ********************************* Import. ******************************** */
+
+GLCEWFrameImport* glcewFrameImportOpen(int fd, int* error) {
+  GLCEWFrameImport* frame_import;
+  SharedHeader* header;
+  FrameLayout layout;
+  struct stat st;
+  uint64_t size, data_offset;
+  int pixel_size;
+  const int seals = fcntl(fd, F_GET_SEALS);
+  int result = GLCEW_SUCCESS;
+  if (seals == -1 || !(seals & F_SEAL_SHRINK) ||
+      fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(SharedHeader)) {
+    result = GLCEW_ERROR_OPEN_FAILED;
+    goto fail;
+  }
+  size = (uint64_t)st.st_size;
+  header = mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                fd, 0);
+  if (header == MAP_FAILED) {
+    result = GLCEW_ERROR_OPEN_FAILED;
+    goto fail;
+  }
+  /* Validate a private copy, the producer can change the shared one at any
+   * time. Products are only compared after division, so they can not
+   * overflow.
+   */
+  layout.num_slots = header->num_slots;
+  layout.width = header->width;
+  layout.height = header->height;
+  layout.format = header->format;
+  layout.type = header->type;
+  layout.slot_size = header->slot_size;
+  data_offset = header->data_offset;
+  pixel_size = bytes_per_pixel(layout.format, layout.type);
+  if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != SHARED_MAGIC ||
+      header->version != SHARED_VERSION ||
+      layout.num_slots == 0 ||
+      pixel_size == 0 ||
+      layout.num_slots > (size - sizeof(SharedHeader)) / sizeof(SharedSlot) ||
+      data_offset < sizeof(SharedHeader) +
+                    sizeof(SharedSlot) * layout.num_slots ||
+      data_offset > size ||
+      layout.slot_size > (size - data_offset) / layout.num_slots) {
+    munmap(header, (size_t)size);
+    result = GLCEW_ERROR_OPEN_FAILED;
+    goto fail;
+  }
+  frame_import = calloc(1, sizeof(GLCEWFrameImport));
+  if (frame_import == NULL) {
+    munmap(header, (size_t)size);
+    result = GLCEW_ERROR_OPEN_FAILED;
+    goto fail;
+  }
+  frame_import->header = header;
+  frame_import->size = (size_t)size;
+  frame_import->layout = layout;
+  frame_import->min_stride = (uint64_t)layout.width * pixel_size;
+  frame_import->tail = __atomic_load_n(&header->tail, __ATOMIC_RELAXED);
+  frame_import->data = (uint8_t*)header + data_offset;
+  if (error != NULL) {
+    *error = GLCEW_SUCCESS;
+  }
+  return frame_import;
+fail:
+  if (error != NULL) {
+    *error = result;
+  }
+  return NULL;
+}
+
+void glcewFrameImportClose(GLCEWFrameImport* frame_import) {
+  if (frame_import == NULL) {
+    return;
+  }
+  __atomic_store_n(&frame_import->header->consumer_closed, 1,
+                   __ATOMIC_SEQ_CST);
+  futex_wake(&frame_import->header->tail);
+  munmap(frame_import->header, frame_import->size);
+  free(frame_import);
+}
+
+int glcewFrameImportAcquire(GLCEWFrameImport* frame_import,
+                            int timeout_ms,
+                            GLCEWFrame* frame) {
+  SharedHeader* header = frame_import->header;
+  const FrameLayout* layout = &frame_import->layout;
+  const uint32_t tail = frame_import->tail;
+  const uint32_t slot_index = tail % layout->num_slots;
+  const SharedSlot* slot;
+  uint32_t stride;
+  if (__atomic_load_n(&header->head, __ATOMIC_ACQUIRE) == tail) {
+    const int result = wait_for_change(&header->head,
+                                       &header->consumer_waiting,
+                                       tail,
+                                       &header->producer_closed,
+                                       timeout_ms);
+    if (result != 1) {
+      return result;
+    }
+  }
+  slot = &header->slots[slot_index];
+  /* Producer is not trusted to keep the frame inside of its slot, with
+   * every row being at least as wide as the frame.
+   */
+  stride = __atomic_load_n(&slot->stride, __ATOMIC_RELAXED);
+  if (stride < frame_import->min_stride ||
+      (uint64_t)stride * layout->height > layout->slot_size) {
+    return -1;
+  }
+  frame->data = frame_import->data + slot_index * layout->slot_size;
+  frame->width = (int)layout->width;
+  frame->height = (int)layout->height;
+  frame->stride = (int)stride;
+  frame->format = layout->format;
+  frame->type = layout->type;
+  frame->sequence = slot->sequence;
+  frame->timestamp_ns = slot->timestamp_ns;
+  return 1;
+}
+
+void glcewFrameImportRelease(GLCEWFrameImport* frame_import) {
+  SharedHeader* header = frame_import->header;
+  __atomic_store_n(&header->tail, ++frame_import->tail, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&header->producer_waiting, __ATOMIC_SEQ_CST)) {
+    futex_wake(&header->tail);
+  }
+}
+
+#else  /* __linux__ */
+
+GLCEWFrameExport* glcewFrameExportCreate(
+    const GLCEWFrameExportSettings* settings, int* error) {
+  (void) settings;  /* Ignored. */
+  if (error != NULL) {
+    *error = GLCEW_ERROR_UNSUPPORTED;
+  }
+  return NULL;
+}
+
+void glcewFrameExportDestroy(GLCEWFrameExport* frame_export) {
+  (void) frame_export;  /* Ignored. */
+}
+
+int glcewFrameExportGetFd(const GLCEWFrameExport* frame_export) {
+  (void) frame_export;  /* Ignored. */
+  return -1;
+}
+
+int glcewFrameExportReadPixels(GLCEWFrameExport* frame_export, int x, int y) {
+  (void) frame_export;  /* Ignored. */
+  (void) x;  /* Ignored. */
+  (void) y;  /* Ignored. */
+  return 0;
+}
+
+void glcewFrameExportGetStats(const GLCEWFrameExport* frame_export,
+                              GLCEWFrameExportStats* stats) {
+  (void) frame_export;  /* Ignored. */
+  memset(stats, 0, sizeof(*stats));
+}
+
+GLCEWFrameImport* glcewFrameImportOpen(int fd, int* error) {
+  (void) fd;  /* Ignored. */
+  if (error != NULL) {
+    *error = GLCEW_ERROR_UNSUPPORTED;
+  }
+  return NULL;
+}
+
+void glcewFrameImportClose(GLCEWFrameImport* frame_import) {
+  (void) frame_import;  /* Ignored. */
+}
+
+int glcewFrameImportAcquire(GLCEWFrameImport* frame_import,
+                            int timeout_ms,
+                            GLCEWFrame* frame) {
+  (void) frame_import;  /* Ignored. */
+  (void) timeout_ms;  /* Ignored. */
+  (void) frame;  /* Ignored. */
+  return -1;
+}
+
+void glcewFrameImportRelease(GLCEWFrameImport* frame_import) {
+  (void) frame_import;  /* Ignored. */
+}
+
+#endif  /* __linux__ */
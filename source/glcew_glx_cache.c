@@ -0,0 +1,422 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* GLX query cache.
+ *
+ * Every display has an entry with the cached queries, entry is created on
+ * the first miss together with an Xlib extension record, which is used to
+ * get notified when the display is closed. Entry stays until the display is
+ * closed, even when the cache is disabled or invalidated, so the display is
+ * only registered once. X calls are never done with the cache lock held,
+ * since Xlib might call the close notification with its own locks held.
+ */
+
+#include <glcew.h>
+#include "glcew_intern.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Maximum number of attribute-value pairs in a cacheable attribute list. */
+#define MAX_ATTRIBUTES 64
+
+/* Attributes of glXChooseVisual() which are not followed by a value. */
+#define GLX_USE_GL 1
+#define GLX_RGBA 4
+#define GLX_DOUBLEBUFFER 5
+#define GLX_STEREO 6
+
+typedef int (*tCloseDisplayProc) (Display* display, XExtCodes* codes);
+typedef XExtCodes* (*tXAddExtension) (Display* display);
+typedef tCloseDisplayProc (*tXESetCloseDisplay) (Display* display,
+                                                 int extension,
+                                                 tCloseDisplayProc proc);
+
+typedef struct VisualEntry {
+  struct VisualEntry* next;
+  int screen;
+  /* Attribute-value pairs sorted by attribute. */
+  int num_attributes;
+  int attributes[MAX_ATTRIBUTES * 2];
+  /* Result of the query, NULL results are cached as well. */
+  int found;
+  XVisualInfo visual;
+} VisualEntry;
+
+typedef struct ExtensionsEntry {
+  struct ExtensionsEntry* next;
+  int screen;
+  /* String is owned by GLX and stays valid until the display is closed. */
+  const char* extensions;
+} ExtensionsEntry;
+
+typedef struct DisplayEntry {
+  struct DisplayEntry* next;
+  Display* display;
+  VisualEntry* visuals;
+  ExtensionsEntry* extensions;
+  int has_version;
+  int version_result;
+  int major;
+  int minor;
+} DisplayEntry;
+
+typedef struct GLXCache {
+  DisplayEntry* displays;
+  tXAddExtension XAddExtension;
+  tXESetCloseDisplay XESetCloseDisplay;
+  GLCEWGLXCacheStats stats;
+} GLXCache;
+
+int glcew_glx_cache_enabled = 0;
+static GLXCache cache;
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Serializes registration of the displays, taken before the cache lock and
+ * held while calling X.
+ */
+static pthread_mutex_t register_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* ******************************** Entries. ******************************** */
+
+static DisplayEntry** display_slot(Display* display) {
+  DisplayEntry** slot = &cache.displays;
+  while (*slot != NULL && (*slot)->display != display) {
+    slot = &(*slot)->next;
+  }
+  return slot;
+}
+
+static void display_clear(DisplayEntry* entry) {
+  while (entry->visuals != NULL) {
+    VisualEntry* next = entry->visuals->next;
+    free(entry->visuals);
+    entry->visuals = next;
+  }
+  while (entry->extensions != NULL) {
+    ExtensionsEntry* next = entry->extensions->next;
+    free(entry->extensions);
+    entry->extensions = next;
+  }
+  entry->has_version = 0;
+}
+
+static int close_display(Display* display, XExtCodes* codes) {
+  DisplayEntry** slot;
+  (void) codes;  /* Ignored. */
+  pthread_mutex_lock(&cache_mutex);
+  slot = display_slot(display);
+  if (*slot != NULL) {
+    DisplayEntry* entry = *slot;
+    *slot = entry->next;
+    display_clear(entry);
+    free(entry);
+  }
+  pthread_mutex_unlock(&cache_mutex);
+  return 0;
+}
+
+/* Make sure display has an entry, which is removed when display is closed.
+ * Returns entry with the lock held, or NULL with the lock released.
+ */
+static DisplayEntry* display_ensure_lock(Display* display) {
+  DisplayEntry* entry;
+  XExtCodes* codes;
+  pthread_mutex_lock(&cache_mutex);
+  entry = *display_slot(display);
+  if (entry != NULL) {
+    return entry;
+  }
+  pthread_mutex_unlock(&cache_mutex);
+  pthread_mutex_lock(&register_mutex);
+  /* Another thread might have registered the display meanwhile. */
+  pthread_mutex_lock(&cache_mutex);
+  entry = *display_slot(display);
+  pthread_mutex_unlock(&cache_mutex);
+  if (entry == NULL) {
+    entry = calloc(1, sizeof(DisplayEntry));
+    codes = (entry != NULL) ? cache.XAddExtension(display) : NULL;
+    if (codes == NULL) {
+      pthread_mutex_unlock(&register_mutex);
+      free(entry);
+      return NULL;
+    }
+    cache.XESetCloseDisplay(display, codes->extension, close_display);
+    entry->display = display;
+    pthread_mutex_lock(&cache_mutex);
+    entry->next = cache.displays;
+    cache.displays = entry;
+    ++cache.stats.num_registrations;
+    pthread_mutex_unlock(&cache_mutex);
+  }
+  /* Display can be closed as soon as the lock is released, so its entry
+   * is looked up again.
+   */
+  pthread_mutex_lock(&cache_mutex);
+  pthread_mutex_unlock(&register_mutex);
+  entry = *display_slot(display);
+  if (entry == NULL) {
+    pthread_mutex_unlock(&cache_mutex);
+  }
+  return entry;
+}
+
+/* ******************************* Attributes. ****************************** */
+
+static int compare_attributes(const void* a_v, const void* b_v) {
+  const int* a = (const int*)a_v;
+  const int* b = (const int*)b_v;
+  return (a[0] > b[0]) - (a[0] < b[0]);
+}
+
+/* Convert attribute list to sorted attribute-value pairs, where boolean
+ * attributes get value of 1 and later duplicates override earlier ones.
+ * Returns number of pairs, or -1 if the list is too long to be cached.
+ */
+static int normalize_attributes(const int* attributes, int* normalized) {
+  int num_attributes = 0;
+  int i, j;
+  if (attributes == NULL) {
+    return 0;
+  }
+  for (i = 0; attributes[i] != None; ++i) {
+    const int attribute = attributes[i];
+    int value = 1;
+    if (attribute != GLX_USE_GL && attribute != GLX_RGBA &&
+        attribute != GLX_DOUBLEBUFFER && attribute != GLX_STEREO) {
+      value = attributes[++i];
+    }
+    for (j = 0; j < num_attributes; ++j) {
+      if (normalized[j * 2] == attribute) {
+        break;
+      }
+    }
+    if (j == num_attributes) {
+      if (num_attributes == MAX_ATTRIBUTES) {
+        return -1;
+      }
+      ++num_attributes;
+    }
+    normalized[j * 2] = attribute;
+    normalized[j * 2 + 1] = value;
+  }
+  qsort(normalized, num_attributes, sizeof(int) * 2, compare_attributes);
+  return num_attributes;
+}
+
+/* ******************************** Queries. ******************************** */
+
+static XVisualInfo* visual_copy(const VisualEntry* entry) {
+  XVisualInfo* visual;
+  if (!entry->found) {
+    return NULL;
+  }
+  /* XFree() releases memory with free(). */
+  visual = malloc(sizeof(XVisualInfo));
+  if (visual != NULL) {
+    *visual = entry->visual;
+  }
+  return visual;
+}
+
+XVisualInfo* glcew_glx_cache_choose_visual(Display* display,
+                                           int screen,
+                                           int* attributes) {
+  VisualEntry key;
+  DisplayEntry* display_entry;
+  VisualEntry* entry;
+  XVisualInfo* visual;
+  key.num_attributes = normalize_attributes(attributes, key.attributes);
+  if (key.num_attributes == -1) {
+    return GLCEW_DISPATCH(glXChooseVisual)(display, screen, attributes);
+  }
+  pthread_mutex_lock(&cache_mutex);
+  display_entry = *display_slot(display);
+  for (entry = (display_entry != NULL) ? display_entry->visuals : NULL;
+       entry != NULL;
+       entry = entry->next) {
+    if (entry->screen == screen &&
+        entry->num_attributes == key.num_attributes &&
+        memcmp(entry->attributes, key.attributes,
+               sizeof(int) * 2 * key.num_attributes) == 0) {
+      ++cache.stats.num_hits;
+      pthread_mutex_unlock(&cache_mutex);
+      return visual_copy(entry);
+    }
+  }
+  ++cache.stats.num_misses;
+  pthread_mutex_unlock(&cache_mutex);
+  visual = GLCEW_DISPATCH(glXChooseVisual)(display, screen, attributes);
+  display_entry = display_ensure_lock(display);
+  if (display_entry == NULL) {
+    return visual;
+  }
+  entry = malloc(sizeof(VisualEntry));
+  if (entry != NULL) {
+    *entry = key;
+    entry->screen = screen;
+    entry->found = (visual != NULL);
+    if (visual != NULL) {
+      entry->visual = *visual;
+    }
+    entry->next = display_entry->visuals;
+    display_entry->visuals = entry;
+  }
+  pthread_mutex_unlock(&cache_mutex);
+  return visual;
+}
+
+const char* glcew_glx_cache_query_extensions_string(Display* display,
+                                                    int screen) {
+  DisplayEntry* display_entry;
+  ExtensionsEntry* entry;
+  const char* extensions;
+  pthread_mutex_lock(&cache_mutex);
+  display_entry = *display_slot(display);
+  for (entry = (display_entry != NULL) ? display_entry->extensions : NULL;
+       entry != NULL;
+       entry = entry->next) {
+    if (entry->screen == screen) {
+      ++cache.stats.num_hits;
+      pthread_mutex_unlock(&cache_mutex);
+      return entry->extensions;
+    }
+  }
+  ++cache.stats.num_misses;
+  pthread_mutex_unlock(&cache_mutex);
+  extensions = GLCEW_DISPATCH(glXQueryExtensionsString)(display, screen);
+  if (extensions == NULL) {
+    return NULL;
+  }
+  display_entry = display_ensure_lock(display);
+  if (display_entry == NULL) {
+    return extensions;
+  }
+  entry = malloc(sizeof(ExtensionsEntry));
+  if (entry != NULL) {
+    entry->screen = screen;
+    entry->extensions = extensions;
+    entry->next = display_entry->extensions;
+    display_entry->extensions = entry;
+  }
+  pthread_mutex_unlock(&cache_mutex);
+  return extensions;
+}
+
+int glcew_glx_cache_query_version(Display* display, int* major, int* minor) {
+  DisplayEntry* display_entry;
+  int result, queried_major = 0, queried_minor = 0;
+  pthread_mutex_lock(&cache_mutex);
+  display_entry = *display_slot(display);
+  if (display_entry != NULL && display_entry->has_version) {
+    ++cache.stats.num_hits;
+    result = display_entry->version_result;
+    queried_major = display_entry->major;
+    queried_minor = display_entry->minor;
+    pthread_mutex_unlock(&cache_mutex);
+  }
+  else {
+    ++cache.stats.num_misses;
+    pthread_mutex_unlock(&cache_mutex);
+    result = GLCEW_DISPATCH(glXQueryVersion)(display,
+                                             &queried_major,
+                                             &queried_minor);
+    display_entry = display_ensure_lock(display);
+    if (display_entry != NULL) {
+      display_entry->has_version = 1;
+      display_entry->version_result = result;
+      display_entry->major = queried_major;
+      display_entry->minor = queried_minor;
+      pthread_mutex_unlock(&cache_mutex);
+    }
+  }
+  /* Arguments are only written on success, same as GLX does. */
+  if (result) {
+    if (major != NULL) {
+      *major = queried_major;
+    }
+    if (minor != NULL) {
+      *minor = queried_minor;
+    }
+  }
+  return result;
+}
+
+/* ********************************* API. ******************************** */
+
+int glcewGLXCacheEnable(void) {
+  tXAddExtension add_extension =
+      (tXAddExtension)glcew_find_global_symbol("XAddExtension");
+  tXESetCloseDisplay set_close_display =
+      (tXESetCloseDisplay)glcew_find_global_symbol("XESetCloseDisplay");
+  int result;
+  /* Without close notification entries of a closed display could be
+   * returned for a new display allocated at the same address.
+   */
+  if (add_extension == NULL || set_close_display == NULL) {
+    return GLCEW_ERROR_UNSUPPORTED;
+  }
+  result = glcew_atfork_register();
+  if (result != GLCEW_SUCCESS) {
+    return result;
+  }
+  pthread_mutex_lock(&cache_mutex);
+  cache.XAddExtension = add_extension;
+  cache.XESetCloseDisplay = set_close_display;
+  pthread_mutex_unlock(&cache_mutex);
+  glcew_glx_cache_enabled = 1;
+  return GLCEW_SUCCESS;
+}
+
+void glcewGLXCacheDisable(void) {
+  DisplayEntry* entry;
+  glcew_glx_cache_enabled = 0;
+  pthread_mutex_lock(&cache_mutex);
+  /* Entries are kept, since close notifications are registered for them. */
+  for (entry = cache.displays; entry != NULL; entry = entry->next) {
+    display_clear(entry);
+  }
+  pthread_mutex_unlock(&cache_mutex);
+}
+
+void glcewGLXCacheInvalidate(Display* display) {
+  DisplayEntry* entry;
+  pthread_mutex_lock(&cache_mutex);
+  /* Entry is kept, since close notification is already registered for it. */
+  entry = *display_slot(display);
+  if (entry != NULL) {
+    display_clear(entry);
+  }
+  pthread_mutex_unlock(&cache_mutex);
+}
+
+void glcewGLXCacheGetStats(GLCEWGLXCacheStats* stats) {
+  pthread_mutex_lock(&cache_mutex);
+  *stats = cache.stats;
+  pthread_mutex_unlock(&cache_mutex);
+}
+
+/* ******************************** Forking. ******************************* */
+
+void glcew_glx_cache_atfork_prepare(void) {
+  pthread_mutex_lock(&register_mutex);
+  pthread_mutex_lock(&cache_mutex);
+}
+
+void glcew_glx_cache_atfork_release(void) {
+  pthread_mutex_unlock(&cache_mutex);
+  pthread_mutex_unlock(&register_mutex);
+}
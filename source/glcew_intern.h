@@ -0,0 +1,364 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Internal declarations shared between the generated wrangler and the
+ * hand-written GLCEW modules. Not a part of public API.
+ */
+
+#ifndef __GLCEW_INTERN_H__
+#define __GLCEW_INTERN_H__
+
+#include <glcew.h>
+
+#ifdef _MSC_VER
+#  define GLCEW_LIKELY(x) (x)
+#  define GLCEW_UNLIKELY(x) (x)
+#else
+#  define GLCEW_LIKELY(x) __builtin_expect(!!(x), 1)
+#  define GLCEW_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#endif
+
+#ifdef _MSC_VER
+#  define GLCEW_THREAD_LOCAL __declspec(thread)
+#  define GLCEW_NOINLINE __declspec(noinline)
+#else
+#  define GLCEW_THREAD_LOCAL __thread
+#  define GLCEW_NOINLINE __attribute__((noinline))
+#endif
+
+/* Thread local storage which is accessed from every wrapper.
+ *
+ * Initial-exec model is a single load relative to the thread pointer, but is
+ * only safe when the library is linked into the executable: module which is
+ * dlopen()'ed with initial-exec TLS fails to load once the static TLS space
+ * of the process is exhausted. Other builds use the default model.
+ */
+#if defined(WITH_INITIAL_EXEC_TLS) && !defined(_MSC_VER)
+#  define GLCEW_THREAD_LOCAL_FAST \
+          __thread __attribute__((tls_model("initial-exec")))
+#else
+#  define GLCEW_THREAD_LOCAL_FAST GLCEW_THREAD_LOCAL
+#endif
+
+/* OpenGL types and tokens which are not a part of the hardcoded subset in
+ * the public header.
+ */
+
+typedef int64_t GLint64;
+typedef uint64_t GLuint64;
+
+#define GL_QUERY_RESULT 0x8866
+#define GL_QUERY_RESULT_AVAILABLE 0x8867
+#define GL_TIMESTAMP 0x8E28
+
+#define GL_DEBUG_OUTPUT 0x92E0
+#define GL_DEBUG_OUTPUT_SYNCHRONOUS 0x8242
+#define GL_DEBUG_SEVERITY_NOTIFICATION 0x826B
+#define GL_DONT_CARE 0x1100
+#define GL_VERSION 0x1F02
+#define GL_EXTENSIONS 0x1F03
+#define GL_NUM_EXTENSIONS 0x821D
+
+#define GL_BLEND 0x0BE2
+#define GL_COLOR_BUFFER_BIT 0x00004000
+#define GL_DEPTH_TEST 0x0B71
+#define GL_ELEMENT_ARRAY_BUFFER_BINDING 0x8895
+#define GL_PACK_ALIGNMENT 0x0D05
+#define GL_SCISSOR_TEST 0x0C11
+#define GL_TEXTURE0 0x84C0
+#define GL_ACTIVE_TEXTURE 0x84E0
+#define GL_TEXTURE_2D 0x0DE1
+#define GL_TEXTURE_MAX_LEVEL 0x813D
+#define GL_TEXTURE_RECTANGLE 0x84F5
+#define GL_UNPACK_ALIGNMENT 0x0CF5
+
+#define GL_NONE 0
+#define GL_RED 0x1903
+#define GL_GREEN 0x1904
+#define GL_BLUE 0x1905
+#define GL_ALPHA 0x1906
+#define GL_LINEAR 0x2601
+#define GL_NEAREST_MIPMAP_LINEAR 0x2702
+#define GL_REPEAT 0x2901
+#define GL_CLAMP_TO_EDGE 0x812F
+#define GL_TEXTURE_MAG_FILTER 0x2800
+#define GL_TEXTURE_MIN_FILTER 0x2801
+#define GL_TEXTURE_WRAP_S 0x2802
+#define GL_TEXTURE_WRAP_T 0x2803
+#define GL_TEXTURE_BASE_LEVEL 0x813C
+#define GL_TEXTURE_COMPARE_MODE 0x884C
+#define GL_TEXTURE_SWIZZLE_R 0x8E42
+#define GL_TEXTURE_SWIZZLE_G 0x8E43
+#define GL_TEXTURE_SWIZZLE_B 0x8E44
+#define GL_TEXTURE_SWIZZLE_A 0x8E45
+
+/* Dispatch table of the instance bound to the current thread, NULL when the
+ * global implementation is to be used.
+ */
+extern GLCEW_THREAD_LOCAL_FAST const GLCEWDispatchTable* glcew_bound_table;
+
+#define GLCEW_DISPATCH_FROM(global, name)                     \
+        (GLCEW_UNLIKELY(glcew_bound_table != NULL)            \
+             ? glcew_bound_table->name                        \
+             : (global))
+
+#define GLCEW_DISPATCH(name) GLCEW_DISPATCH_FROM(name##_impl, name)
+
+/* Copy dispatch table which is used by the current thread. */
+void glcew_dispatch_table_get_current(GLCEWDispatchTable* table);
+
+/* Offset of the entry of the wrapped function in the table of the global
+ * implementation which the wrappers dispatch through, (size_t)-1 if the
+ * function is not wrapped. Table is aligned to a cache line.
+ */
+size_t glcew_global_table_offset(const char* name);
+
+/* Replace pointers in the table with the ones returned by the given
+ * GetProcAddr, which are specific to the current context.
+ */
+void glcew_dispatch_table_load_proc_address(
+    GLCEWDispatchTable* table,
+    tglXGetProcAddressARB get_proc_address);
+
+/* Make wrappers called from the current thread to dispatch to the given
+ * table. Returns previously bound table.
+ */
+const GLCEWDispatchTable* glcew_dispatch_table_bind(
+    const GLCEWDispatchTable* table);
+
+/* Name of the last wrapped function called from the current thread, used to
+ * attribute debug output messages to a call site.
+ */
+extern GLCEW_THREAD_LOCAL_FAST const char* glcew_last_call;
+
+#define GLCEW_TRACK_CALL(name) (glcew_last_call = (name))
+
+/* USDT probes of the "glcew" provider, a single NOP when not traced.
+ *
+ * Builds with WITH_CALL_COUNTS count the probe hits instead, and print the
+ * counts at exit, for recording the call profile without bpftrace.
+ */
+#ifdef WITH_USDT
+#  include <sys/sdt.h>
+#  define GLCEW_PROBE0(name) DTRACE_PROBE(glcew, name)
+#  define GLCEW_PROBE1(name, a) DTRACE_PROBE1(glcew, name, a)
+#  define GLCEW_PROBE2(name, a, b) DTRACE_PROBE2(glcew, name, a, b)
+#  define GLCEW_PROBE3(name, a, b, c) DTRACE_PROBE3(glcew, name, a, b, c)
+#  define GLCEW_PROBE4(name, a, b, c, d) \
+          DTRACE_PROBE4(glcew, name, a, b, c, d)
+#  define GLCEW_PROBE5(name, a, b, c, d, e) \
+          DTRACE_PROBE5(glcew, name, a, b, c, d, e)
+#  define GLCEW_PROBE6(name, a, b, c, d, e, f) \
+          DTRACE_PROBE6(glcew, name, a, b, c, d, e, f)
+#elif defined(WITH_CALL_COUNTS)
+typedef struct GLCEWCallCounter {
+  const char* name;
+  uint64_t count;
+  int registered;
+  struct GLCEWCallCounter* next;
+} GLCEWCallCounter;
+
+void glcew_call_counter_register(GLCEWCallCounter* counter);
+
+#  define GLCEW_COUNT_CALL(name)                                            \
+          do {                                                              \
+            static GLCEWCallCounter counter = {#name, 0, 0, NULL};          \
+            if (GLCEW_UNLIKELY(!__atomic_load_n(&counter.registered,        \
+                                                __ATOMIC_ACQUIRE))) {       \
+              glcew_call_counter_register(&counter);                        \
+            }                                                               \
+            __atomic_add_fetch(&counter.count, 1, __ATOMIC_RELAXED);        \
+          } while (0)
+#  define GLCEW_PROBE0(name) GLCEW_COUNT_CALL(name)
+#  define GLCEW_PROBE1(name, a) GLCEW_COUNT_CALL(name)
+#  define GLCEW_PROBE2(name, a, b) GLCEW_COUNT_CALL(name)
+#  define GLCEW_PROBE3(name, a, b, c) GLCEW_COUNT_CALL(name)
+#  define GLCEW_PROBE4(name, a, b, c, d) GLCEW_COUNT_CALL(name)
+#  define GLCEW_PROBE5(name, a, b, c, d, e) GLCEW_COUNT_CALL(name)
+#  define GLCEW_PROBE6(name, a, b, c, d, e, f) GLCEW_COUNT_CALL(name)
+#else
+#  define GLCEW_PROBE0(name) ((void)0)
+#  define GLCEW_PROBE1(name, a) ((void)0)
+#  define GLCEW_PROBE2(name, a, b) ((void)0)
+#  define GLCEW_PROBE3(name, a, b, c) ((void)0)
+#  define GLCEW_PROBE4(name, a, b, c, d) ((void)0)
+#  define GLCEW_PROBE5(name, a, b, c, d, e) ((void)0)
+#  define GLCEW_PROBE6(name, a, b, c, d, e, f) ((void)0)
+#endif
+
+/* Monotonic time in nanoseconds. */
+uint64_t glcew_time_ns(void);
+
+/* Find symbol in the libraries already loaded into the process, used for
+ * libraries which application is linked against, such as Xlib.
+ */
+void* glcew_find_global_symbol(const char* name);
+
+/* Register fork handlers which hold every internal lock across fork(), once
+ * per process. Called by glcewPrefork() and when a module which has a lock
+ * is enabled, so children are consistent whether prefork was used or not.
+ * Returns GLCEW_ERROR_ATFORK_FAILED if the handlers can not be registered.
+ */
+int glcew_atfork_register(void);
+
+/* ***************************** Library unload. *************************** */
+
+/* Incremented every time the library is unloaded. Per-thread state which
+ * refers to the library, such as draw batches, compares it against the value
+ * it was set up at, since it can not be reached from the unloading thread.
+ */
+extern unsigned int glcew_load_epoch;
+
+/* Drop state which refers to the library which is about to be unloaded.
+ * Called with the library lock held, no OpenGL calls are made since the
+ * context might be gone already.
+ */
+void glcew_profile_unload(void);
+void glcew_validation_unload(void);
+
+/* ******************************** Profiler. ******************************* */
+
+extern int glcew_profile_enabled;
+
+void glcew_profile_frame_boundary_impl(void);
+
+#define glcew_profile_frame_boundary()                    \
+        do {                                              \
+          if (GLCEW_UNLIKELY(glcew_profile_enabled)) {    \
+            glcew_profile_frame_boundary_impl();          \
+          }                                               \
+        } while (0)
+
+/* **************************** Stall detector. *************************** */
+
+extern int glcew_stall_enabled;
+
+uint64_t glcew_stall_sample_impl(void);
+void glcew_stall_end_impl(uint64_t start_ns, const char* function);
+
+/* Hold the detector lock across fork(), so the child never inherits it in a
+ * locked state.
+ */
+void glcew_stall_atfork_prepare(void);
+void glcew_stall_atfork_release(void);
+
+/* Start time of the sampled call, or 0 if the call is not sampled. */
+#define GLCEW_STALL_BEGIN()                                         \
+        (GLCEW_UNLIKELY(glcew_stall_enabled)                        \
+             ? glcew_stall_sample_impl()                            \
+             : 0)
+
+#define GLCEW_STALL_END(function)                                   \
+        do {                                                        \
+          if (GLCEW_UNLIKELY(stall_start_ns != 0)) {                \
+            glcew_stall_end_impl(stall_start_ns, function);         \
+          }                                                         \
+        } while (0)
+
+/* ***************************** Draw batching. **************************** */
+
+/* Batching state of the current thread. */
+extern GLCEW_THREAD_LOCAL_FAST int glcew_batch_enabled;
+extern GLCEW_THREAD_LOCAL_FAST int glcew_batch_num_pending;
+
+int glcew_batch_draw_arrays_impl(GLenum mode, GLint first, GLsizei count);
+int glcew_batch_draw_elements_impl(GLenum mode,
+                                   GLsizei count,
+                                   GLenum type,
+                                   const GLvoid* indices);
+void glcew_batch_flush_impl(void);
+
+/* Non-zero if the draw was queued and is not to be passed to the library. */
+#define GLCEW_BATCH_DRAW_ARRAYS(mode, first, count)                      \
+        (GLCEW_UNLIKELY(glcew_batch_enabled) &&                          \
+         glcew_batch_draw_arrays_impl(mode, first, count))
+
+#define GLCEW_BATCH_DRAW_ELEMENTS(mode, count, type, indices)            \
+        (GLCEW_UNLIKELY(glcew_batch_enabled) &&                          \
+         glcew_batch_draw_elements_impl(mode, count, type, indices))
+
+#define GLCEW_BATCH_FLUSH()                                              \
+        do {                                                             \
+          if (GLCEW_UNLIKELY(glcew_batch_num_pending != 0)) {            \
+            glcew_batch_flush_impl();                                    \
+          }                                                              \
+        } while (0)
+
+/* ***************************** Texture pool. **************************** */
+
+extern int glcew_texture_pool_tracking;
+
+void glcew_texture_pool_tex_image_impl(GLenum target,
+                                       GLint level,
+                                       GLint internal_format,
+                                       GLsizei width,
+                                       GLsizei height);
+int glcew_texture_pool_delete_impl(GLsizei n, const GLuint* textures);
+void glcew_texture_pool_bind_impl(GLenum target, GLuint texture);
+void glcew_texture_pool_active_texture_impl(GLenum texture);
+
+/* Hold the pool lock across fork(). */
+void glcew_texture_pool_atfork_prepare(void);
+void glcew_texture_pool_atfork_release(void);
+
+#define GLCEW_TEXTURE_POOL_TEX_IMAGE(target, level, format, width, height) \
+        do {                                                                \
+          if (GLCEW_UNLIKELY(glcew_texture_pool_tracking)) {                \
+            glcew_texture_pool_tex_image_impl(target, level, format,        \
+                                              width, height);               \
+          }                                                                 \
+        } while (0)
+
+/* Non-zero if the textures were handled by the pool. */
+#define GLCEW_TEXTURE_POOL_DELETE(n, textures)                              \
+        (GLCEW_UNLIKELY(glcew_texture_pool_tracking) &&                     \
+         glcew_texture_pool_delete_impl(n, textures))
+
+#define GLCEW_TEXTURE_POOL_BIND(target, texture)                            \
+        do {                                                                \
+          if (GLCEW_UNLIKELY(glcew_texture_pool_tracking)) {                \
+            glcew_texture_pool_bind_impl(target, texture);                  \
+          }                                                                 \
+        } while (0)
+
+#define GLCEW_TEXTURE_POOL_ACTIVE_TEXTURE(texture)                          \
+        do {                                                                \
+          if (GLCEW_UNLIKELY(glcew_texture_pool_tracking)) {                \
+            glcew_texture_pool_active_texture_impl(texture);                \
+          }                                                                 \
+        } while (0)
+
+/* **************************** GLX query cache. *************************** */
+
+extern int glcew_glx_cache_enabled;
+
+/* Cached versions of the queries, passing the call to the library on
+ * cache miss.
+ */
+XVisualInfo* glcew_glx_cache_choose_visual(Display* display,
+                                           int screen,
+                                           int* attributes);
+const char* glcew_glx_cache_query_extensions_string(Display* display,
+                                                    int screen);
+int glcew_glx_cache_query_version(Display* display, int* major, int* minor);
+
+/* Lock the cache around fork(), so the child does not inherit it locked by
+ * another thread.
+ */
+void glcew_glx_cache_atfork_prepare(void);
+void glcew_glx_cache_atfork_release(void);
+
+#endif  /* __GLCEW_INTERN_H__ */
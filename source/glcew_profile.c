@@ -0,0 +1,577 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* GPU time profiler.
+ *
+ * Every region boundary is a GL_TIMESTAMP query, which allows regions to be
+ * nested. Queries are taken from a pool and are recycled once their results
+ * are read. Results of a frame are only read once the GPU reported them as
+ * available, and no earlier than frame_latency frames after the frame was
+ * finished, so the profiler never stalls the pipeline.
+ *
+ * Profiler belongs to the thread and the context which were current when it
+ * was enabled. Frame boundaries and regions from any other thread or context
+ * are ignored, since the query objects only exist in the owning context.
+ */
+
+#include <glcew.h>
+#include "glcew_intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LABELS 128
+#define MAX_REGIONS_PER_FRAME 256
+#define MAX_REGION_DEPTH 32
+#define MAX_SAMPLES 512
+#define QUERY_POOL_GROW 64
+
+typedef void (*tglGenQueries) (GLsizei n, GLuint* ids);
+typedef void (*tglDeleteQueries) (GLsizei n, const GLuint* ids);
+typedef void (*tglQueryCounter) (GLuint id, GLenum target);
+typedef void (*tglGetQueryObjectiv) (GLuint id, GLenum pname, GLint* params);
+typedef void (*tglGetQueryObjectui64v) (GLuint id,
+                                        GLenum pname,
+                                        GLuint64* params);
+
+typedef struct ProfileSeries {
+  const char* label;
+  uint64_t count;
+  uint64_t total_ns;
+  uint64_t min_ns;
+  uint64_t max_ns;
+  /* Ring buffer of the most recent samples, used for percentiles. */
+  uint64_t samples[MAX_SAMPLES];
+} ProfileSeries;
+
+typedef struct ProfileRegion {
+  int label;
+  GLuint begin_query;
+  GLuint end_query;
+} ProfileRegion;
+
+typedef struct ProfileFrame {
+  GLuint begin_query;
+  ProfileRegion regions[MAX_REGIONS_PER_FRAME];
+  int num_regions;
+} ProfileFrame;
+
+typedef struct Profiler {
+  tglGenQueries glGenQueries;
+  tglDeleteQueries glDeleteQueries;
+  tglQueryCounter glQueryCounter;
+  tglGetQueryObjectiv glGetQueryObjectiv;
+  tglGetQueryObjectui64v glGetQueryObjectui64v;
+
+  /* Pool of query objects which are ready to be re-used. */
+  GLuint* free_queries;
+  int num_free_queries;
+  int max_free_queries;
+  /* All the queries ever allocated, so they can be deleted. */
+  GLuint* all_queries;
+  int num_all_queries;
+
+  int frame_latency;
+  ProfileFrame frames[GLCEW_PROFILE_MAX_FRAME_LATENCY + 3];
+  int num_frames;
+  /* Frame which is currently being recorded. */
+  int head;
+  /* Oldest frame which results are not read back yet. */
+  int tail;
+
+  int stack[MAX_REGION_DEPTH];
+  int stack_depth;
+  /* Regions which were begun while the stack was full, their matching ends
+   * are ignored.
+   */
+  int overflow_depth;
+
+  /* Context which was current when profiler was enabled, the owning thread
+   * has owner_generation equal to generation.
+   */
+  GLXContext owner_context;
+  unsigned int generation;
+
+  ProfileSeries* series[MAX_LABELS];
+  int num_labels;
+  ProfileSeries frame_series;
+  uint64_t histogram[GLCEW_PROFILE_HISTOGRAM_SIZE];
+  uint64_t dropped_frames;
+  uint64_t dropped_regions;
+} Profiler;
+
+int glcew_profile_enabled = 0;
+static Profiler profiler;
+static GLCEW_THREAD_LOCAL unsigned int owner_generation = 0;
+
+/* Calling thread and its current context are the ones profiler was enabled
+ * for.
+ */
+static int profiler_is_owner(void) {
+  return owner_generation == profiler.generation &&
+         GLCEW_DISPATCH(glXGetCurrentContext)() == profiler.owner_context;
+}
+
+/* ******************************* Queries. ******************************* */
+
+static int query_pool_grow(void) {
+  GLuint* free_queries;
+  GLuint* all_queries;
+  const int new_max = profiler.max_free_queries + QUERY_POOL_GROW;
+  free_queries = realloc(profiler.free_queries, sizeof(GLuint) * new_max);
+  if (free_queries == NULL) {
+    return 0;
+  }
+  profiler.free_queries = free_queries;
+  all_queries = realloc(profiler.all_queries, sizeof(GLuint) * new_max);
+  if (all_queries == NULL) {
+    return 0;
+  }
+  profiler.all_queries = all_queries;
+  profiler.glGenQueries(QUERY_POOL_GROW,
+                        profiler.free_queries + profiler.num_free_queries);
+  memcpy(profiler.all_queries + profiler.num_all_queries,
+         profiler.free_queries + profiler.num_free_queries,
+         sizeof(GLuint) * QUERY_POOL_GROW);
+  profiler.num_free_queries += QUERY_POOL_GROW;
+  profiler.num_all_queries += QUERY_POOL_GROW;
+  profiler.max_free_queries = new_max;
+  return 1;
+}
+
+/* Issue timestamp query, returns 0 if there is no query available. */
+static GLuint query_timestamp(void) {
+  GLuint query;
+  if (profiler.num_free_queries == 0 && !query_pool_grow()) {
+    return 0;
+  }
+  query = profiler.free_queries[--profiler.num_free_queries];
+  profiler.glQueryCounter(query, GL_TIMESTAMP);
+  return query;
+}
+
+static void query_release(GLuint query) {
+  if (query != 0) {
+    profiler.free_queries[profiler.num_free_queries++] = query;
+  }
+}
+
+static GLuint64 query_result(GLuint query) {
+  GLuint64 result = 0;
+  profiler.glGetQueryObjectui64v(query, GL_QUERY_RESULT, &result);
+  return result;
+}
+
+static int query_available(GLuint query) {
+  GLint available = 0;
+  profiler.glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+  return available;
+}
+
+/* ****************************** Statistics. ***************************** */
+
+static void series_add(ProfileSeries* series, uint64_t time_ns) {
+  if (series->count == 0 || time_ns < series->min_ns) {
+    series->min_ns = time_ns;
+  }
+  if (time_ns > series->max_ns) {
+    series->max_ns = time_ns;
+  }
+  series->samples[series->count % MAX_SAMPLES] = time_ns;
+  series->total_ns += time_ns;
+  ++series->count;
+}
+
+static int compare_uint64(const void* a_v, const void* b_v) {
+  const uint64_t a = *(const uint64_t*)a_v;
+  const uint64_t b = *(const uint64_t*)b_v;
+  return (a > b) - (a < b);
+}
+
+static void series_stats(const ProfileSeries* series,
+                         GLCEWProfileStats* stats) {
+  uint64_t sorted[MAX_SAMPLES];
+  const int num_samples = (series->count < MAX_SAMPLES)
+                              ? (int)series->count
+                              : MAX_SAMPLES;
+  memset(stats, 0, sizeof(*stats));
+  stats->label = series->label;
+  stats->count = series->count;
+  if (num_samples == 0) {
+    return;
+  }
+  stats->total_ms = series->total_ns * 1e-6;
+  stats->min_ms = series->min_ns * 1e-6;
+  stats->max_ms = series->max_ns * 1e-6;
+  stats->mean_ms = stats->total_ms / (double)series->count;
+  memcpy(sorted, series->samples, sizeof(uint64_t) * num_samples);
+  qsort(sorted, num_samples, sizeof(uint64_t), compare_uint64);
+  stats->p50_ms = sorted[(num_samples - 1) * 50 / 100] * 1e-6;
+  stats->p90_ms = sorted[(num_samples - 1) * 90 / 100] * 1e-6;
+  stats->p99_ms = sorted[(num_samples - 1) * 99 / 100] * 1e-6;
+}
+
+static int label_index(const char* label) {
+  ProfileSeries* series;
+  int i;
+  for (i = 0; i < profiler.num_labels; ++i) {
+    if (profiler.series[i]->label == label) {
+      return i;
+    }
+  }
+  for (i = 0; i < profiler.num_labels; ++i) {
+    if (strcmp(profiler.series[i]->label, label) == 0) {
+      return i;
+    }
+  }
+  if (profiler.num_labels == MAX_LABELS) {
+    return -1;
+  }
+  series = calloc(1, sizeof(ProfileSeries));
+  if (series == NULL) {
+    return -1;
+  }
+  series->label = label;
+  profiler.series[profiler.num_labels] = series;
+  return profiler.num_labels++;
+}
+
+/* ******************************** Frames. ******************************* */
+
+static void frame_release(ProfileFrame* frame) {
+  int i;
+  for (i = 0; i < frame->num_regions; ++i) {
+    query_release(frame->regions[i].begin_query);
+    query_release(frame->regions[i].end_query);
+  }
+  frame->num_regions = 0;
+  query_release(frame->begin_query);
+  frame->begin_query = 0;
+}
+
+/* Read results of the given frame. Frame is considered to be finished by the
+ * beginning of the next one.
+ */
+static void frame_collect(ProfileFrame* frame, const ProfileFrame* next) {
+  uint64_t frame_ns;
+  int i;
+  for (i = 0; i < frame->num_regions; ++i) {
+    const ProfileRegion* region = &frame->regions[i];
+    GLuint64 begin, end;
+    if (region->begin_query == 0 || region->end_query == 0) {
+      ++profiler.dropped_regions;
+      continue;
+    }
+    begin = query_result(region->begin_query);
+    end = query_result(region->end_query);
+    series_add(profiler.series[region->label], end > begin ? end - begin : 0);
+  }
+  if (frame->begin_query != 0 && next->begin_query != 0) {
+    const GLuint64 begin = query_result(frame->begin_query);
+    const GLuint64 end = query_result(next->begin_query);
+    int bucket;
+    frame_ns = end > begin ? end - begin : 0;
+    series_add(&profiler.frame_series, frame_ns);
+    bucket = (int)(frame_ns / 1000000);
+    if (bucket >= GLCEW_PROFILE_HISTOGRAM_SIZE) {
+      bucket = GLCEW_PROFILE_HISTOGRAM_SIZE - 1;
+    }
+    ++profiler.histogram[bucket];
+  }
+  frame_release(frame);
+}
+
+/* Read back all the frames which are old enough and which results are
+ * available without waiting.
+ */
+static void frames_collect(void) {
+  const int num_frames = profiler.num_frames;
+  while (profiler.tail != profiler.head) {
+    const int pending = (profiler.head - profiler.tail + num_frames) %
+                        num_frames;
+    ProfileFrame* frame = &profiler.frames[profiler.tail];
+    const ProfileFrame* next =
+        &profiler.frames[(profiler.tail + 1) % num_frames];
+    if (pending <= profiler.frame_latency) {
+      break;
+    }
+    /* Queries complete in order, so the beginning of the next frame being
+     * available means all queries of this frame are available too.
+     */
+    if (next->begin_query != 0 && !query_available(next->begin_query)) {
+      if (pending < num_frames - 1) {
+        break;
+      }
+      /* No more room for new frames, skip results instead of waiting. */
+      frame_release(frame);
+      ++profiler.dropped_frames;
+    }
+    else {
+      frame_collect(frame, next);
+    }
+    profiler.tail = (profiler.tail + 1) % num_frames;
+  }
+}
+
+void glcew_profile_frame_boundary_impl(void) {
+  ProfileFrame* frame = &profiler.frames[profiler.head];
+  if (!profiler_is_owner()) {
+    return;
+  }
+  /* Close regions which were not ended within the frame. */
+  while (profiler.stack_depth > 0) {
+    const int region = profiler.stack[--profiler.stack_depth];
+    if (region != -1) {
+      frame->regions[region].end_query = query_timestamp();
+    }
+  }
+  profiler.overflow_depth = 0;
+  profiler.head = (profiler.head + 1) % profiler.num_frames;
+  frame = &profiler.frames[profiler.head];
+  frame->num_regions = 0;
+  frame->begin_query = query_timestamp();
+  frames_collect();
+}
+
+/* ********************************** API. ******************************** */
+
+int glcewProfileEnable(int frame_latency) {
+  tglXGetProcAddressARB get_proc_address;
+  if (glcew_profile_enabled) {
+    return GLCEW_SUCCESS;
+  }
+  get_proc_address = GLCEW_DISPATCH(glXGetProcAddressARB);
+  if (get_proc_address == NULL) {
+    return GLCEW_ERROR_OPEN_FAILED;
+  }
+#define PROFILE_FIND(name)                                                    \
+  profiler.name = (t##name)get_proc_address((const GLubyte*)#name);           \
+  if (profiler.name == NULL) {                                                \
+    return GLCEW_ERROR_UNSUPPORTED;                                           \
+  }
+  PROFILE_FIND(glGenQueries);
+  PROFILE_FIND(glDeleteQueries);
+  PROFILE_FIND(glQueryCounter);
+  PROFILE_FIND(glGetQueryObjectiv);
+  PROFILE_FIND(glGetQueryObjectui64v);
+#undef PROFILE_FIND
+  if (frame_latency < 1) {
+    frame_latency = 1;
+  }
+  else if (frame_latency > GLCEW_PROFILE_MAX_FRAME_LATENCY) {
+    frame_latency = GLCEW_PROFILE_MAX_FRAME_LATENCY;
+  }
+  profiler.frame_latency = frame_latency;
+  /* One extra frame is being recorded, and one more gives GPU some slack
+   * before results are discarded.
+   */
+  profiler.num_frames = frame_latency + 3;
+  profiler.head = profiler.tail = 0;
+  profiler.stack_depth = 0;
+  profiler.overflow_depth = 0;
+  profiler.owner_context = GLCEW_DISPATCH(glXGetCurrentContext)();
+  owner_generation = ++profiler.generation;
+  profiler.frame_series.label = "frame";
+  profiler.frames[0].num_regions = 0;
+  profiler.frames[0].begin_query = query_timestamp();
+  glcew_profile_enabled = 1;
+  return GLCEW_SUCCESS;
+}
+
+/* Forget all the frames and queries, without deleting query objects. */
+static void profiler_clear_queries(void) {
+  int i;
+  for (i = 0; i < profiler.num_frames; ++i) {
+    profiler.frames[i].num_regions = 0;
+    profiler.frames[i].begin_query = 0;
+  }
+  free(profiler.free_queries);
+  free(profiler.all_queries);
+  profiler.free_queries = profiler.all_queries = NULL;
+  profiler.num_free_queries = profiler.max_free_queries = 0;
+  profiler.num_all_queries = 0;
+}
+
+void glcewProfileDisable(void) {
+  if (!glcew_profile_enabled) {
+    return;
+  }
+  glcew_profile_enabled = 0;
+  if (profiler.num_all_queries != 0) {
+    profiler.glDeleteQueries(profiler.num_all_queries, profiler.all_queries);
+  }
+  profiler_clear_queries();
+}
+
+void glcew_profile_unload(void) {
+  /* Query objects are gone together with the driver. */
+  glcew_profile_enabled = 0;
+  profiler_clear_queries();
+  profiler.glGenQueries = NULL;
+  profiler.glDeleteQueries = NULL;
+  profiler.glQueryCounter = NULL;
+  profiler.glGetQueryObjectiv = NULL;
+  profiler.glGetQueryObjectui64v = NULL;
+}
+
+void glcewProfileReset(void) {
+  int i;
+  /* Labels are kept, since they might be referenced by in-flight frames. */
+  for (i = 0; i < profiler.num_labels; ++i) {
+    const char* label = profiler.series[i]->label;
+    memset(profiler.series[i], 0, sizeof(ProfileSeries));
+    profiler.series[i]->label = label;
+  }
+  memset(&profiler.frame_series, 0, sizeof(profiler.frame_series));
+  profiler.frame_series.label = "frame";
+  memset(profiler.histogram, 0, sizeof(profiler.histogram));
+  profiler.dropped_frames = 0;
+  profiler.dropped_regions = 0;
+}
+
+void glcewProfileBegin(const char* label) {
+  ProfileFrame* frame;
+  ProfileRegion* region;
+  int index;
+  if (!glcew_profile_enabled || !profiler_is_owner()) {
+    return;
+  }
+  /* Queued draws belong to the time before the region. */
+  GLCEW_BATCH_FLUSH();
+  frame = &profiler.frames[profiler.head];
+  /* Keep Begin/End balanced, so the matching End is ignored. */
+  if (profiler.stack_depth == MAX_REGION_DEPTH) {
+    ++profiler.dropped_regions;
+    ++profiler.overflow_depth;
+    return;
+  }
+  if (frame->num_regions == MAX_REGIONS_PER_FRAME ||
+      (index = label_index(label)) == -1) {
+    ++profiler.dropped_regions;
+    profiler.stack[profiler.stack_depth++] = -1;
+    return;
+  }
+  region = &frame->regions[frame->num_regions];
+  region->label = index;
+  region->begin_query = query_timestamp();
+  region->end_query = 0;
+  profiler.stack[profiler.stack_depth++] = frame->num_regions++;
+}
+
+void glcewProfileEnd(void) {
+  int region;
+  if (!glcew_profile_enabled || profiler.stack_depth == 0 ||
+      !profiler_is_owner()) {
+    return;
+  }
+  if (profiler.overflow_depth > 0) {
+    --profiler.overflow_depth;
+    return;
+  }
+  GLCEW_BATCH_FLUSH();
+  region = profiler.stack[--profiler.stack_depth];
+  if (region != -1) {
+    profiler.frames[profiler.head].regions[region].end_query =
+        query_timestamp();
+  }
+}
+
+void glcewProfileFrame(void) {
+  glcew_profile_frame_boundary();
+}
+
+int glcewProfileNumLabels(void) {
+  return profiler.num_labels;
+}
+
+int glcewProfileGetStats(int index, GLCEWProfileStats* stats) {
+  if (index < 0 || index >= profiler.num_labels) {
+    return 0;
+  }
+  series_stats(profiler.series[index], stats);
+  return 1;
+}
+
+int glcewProfileGetFrameStats(GLCEWProfileStats* stats) {
+  series_stats(&profiler.frame_series, stats);
+  return profiler.frame_series.count != 0;
+}
+
+void glcewProfileGetFrameHistogram(
+    uint64_t histogram[GLCEW_PROFILE_HISTOGRAM_SIZE]) {
+  memcpy(histogram, profiler.histogram, sizeof(profiler.histogram));
+}
+
+/* ********************************* JSON. ******************************** */
+
+static void json_write_string(FILE* file, const char* str) {
+  fputc('"', file);
+  for (; *str != '\0'; ++str) {
+    const unsigned char c = (unsigned char)*str;
+    if (c == '"' || c == '\\') {
+      fprintf(file, "\\%c", c);
+    }
+    else if (c < 0x20) {
+      fprintf(file, "\\u%04x", c);
+    }
+    else {
+      fputc(c, file);
+    }
+  }
+  fputc('"', file);
+}
+
+static void json_write_stats(FILE* file, const GLCEWProfileStats* stats) {
+  fprintf(file, "{\"label\": ");
+  json_write_string(file, stats->label);
+  fprintf(file,
+          ", \"count\": %llu, \"total_ms\": %f, \"min_ms\": %f, "
+          "\"max_ms\": %f, \"mean_ms\": %f, \"p50_ms\": %f, "
+          "\"p90_ms\": %f, \"p99_ms\": %f}",
+          (unsigned long long)stats->count,
+          stats->total_ms,
+          stats->min_ms,
+          stats->max_ms,
+          stats->mean_ms,
+          stats->p50_ms,
+          stats->p90_ms,
+          stats->p99_ms);
+}
+
+int glcewProfileDumpJSON(FILE* file) {
+  GLCEWProfileStats stats;
+  int i;
+  fprintf(file, "{\n  \"frame\": ");
+  glcewProfileGetFrameStats(&stats);
+  json_write_stats(file, &stats);
+  fprintf(file, ",\n  \"frame_histogram_ms\": [");
+  for (i = 0; i < GLCEW_PROFILE_HISTOGRAM_SIZE; ++i) {
+    fprintf(file, "%s%llu",
+            (i != 0) ? ", " : "",
+            (unsigned long long)profiler.histogram[i]);
+  }
+  fprintf(file, "],\n  \"regions\": [");
+  for (i = 0; i < profiler.num_labels; ++i) {
+    fprintf(file, "%s\n    ", (i != 0) ? "," : "");
+    series_stats(profiler.series[i], &stats);
+    json_write_stats(file, &stats);
+  }
+  fprintf(file,
+          "\n  ],\n  \"dropped_frames\": %llu,\n  \"dropped_regions\": %llu\n}\n",
+          (unsigned long long)profiler.dropped_frames,
+          (unsigned long long)profiler.dropped_regions);
+  return ferror(file) ? 0 : 1;
+}
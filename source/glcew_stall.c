@@ -0,0 +1,252 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Pipeline stall detector.
+ *
+ * Wrappers of synchronizing calls check a single flag when the detector is
+ * disabled. When it is enabled, only every sample_rate-th call per thread is
+ * timed, and only the calls which took longer than the threshold are taking
+ * the lock and the backtrace.
+ */
+
+#include <glcew.h>
+#include "glcew_intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#  include <pthread.h>
+#endif
+#ifdef __GLIBC__
+#  include <execinfo.h>
+#endif
+
+#define MAX_FRAMES 16
+#define MAX_RECORDS 256
+
+typedef struct StallRecord {
+  const char* function;
+  uint64_t hash;
+  void* frames[MAX_FRAMES];
+  int num_frames;
+  uint64_t hits;
+  uint64_t total_ns;
+  uint64_t max_ns;
+} StallRecord;
+
+typedef struct StallDetector {
+  uint64_t threshold_ns;
+  int sample_rate;
+  int flags;
+  int atexit_registered;
+  StallRecord records[MAX_RECORDS];
+  int num_records;
+  /* Stalls which did not fit into the records table. */
+  uint64_t overflow_hits;
+  uint64_t overflow_ns;
+} StallDetector;
+
+int glcew_stall_enabled = 0;
+static StallDetector detector;
+#ifdef _WIN32
+/* Detector can not be enabled on Windows yet, so nothing is locked. */
+#  define stall_lock()
+#  define stall_unlock()
+#else
+static pthread_mutex_t stall_mutex = PTHREAD_MUTEX_INITIALIZER;
+#  define stall_lock() pthread_mutex_lock(&stall_mutex)
+#  define stall_unlock() pthread_mutex_unlock(&stall_mutex)
+#endif
+static GLCEW_THREAD_LOCAL int sample_counter = 0;
+
+uint64_t glcew_stall_sample_impl(void) {
+  if (++sample_counter < detector.sample_rate) {
+    return 0;
+  }
+  sample_counter = 0;
+  return glcew_time_ns();
+}
+
+static uint64_t hash_backtrace(const char* function,
+                               void* const* frames,
+                               int num_frames) {
+  /* FNV-1a over function name pointer and return addresses. */
+  uint64_t hash = 14695981039346656037ull;
+  int i;
+  hash = (hash ^ (uint64_t)(uintptr_t)function) * 1099511628211ull;
+  for (i = 0; i < num_frames; ++i) {
+    hash = (hash ^ (uint64_t)(uintptr_t)frames[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+GLCEW_NOINLINE void glcew_stall_end_impl(uint64_t start_ns,
+                                         const char* function) {
+  const uint64_t elapsed_ns = glcew_time_ns() - start_ns;
+  void* frames[MAX_FRAMES + 1];
+  int num_frames = 0;
+  uint64_t hash;
+  int i;
+  if (elapsed_ns < detector.threshold_ns) {
+    return;
+  }
+#ifdef __GLIBC__
+  /* Skip frame of this function. */
+  num_frames = backtrace(frames, MAX_FRAMES + 1) - 1;
+  if (num_frames < 0) {
+    num_frames = 0;
+  }
+#endif
+  hash = hash_backtrace(function, frames + 1, num_frames);
+  stall_lock();
+  for (i = 0; i < detector.num_records; ++i) {
+    StallRecord* record = &detector.records[i];
+    if (record->hash == hash && record->function == function &&
+        record->num_frames == num_frames &&
+        memcmp(record->frames, frames + 1, sizeof(void*) * num_frames) == 0) {
+      break;
+    }
+  }
+  if (i == detector.num_records) {
+    if (detector.num_records == MAX_RECORDS) {
+      ++detector.overflow_hits;
+      detector.overflow_ns += elapsed_ns;
+      stall_unlock();
+      return;
+    }
+    memset(&detector.records[i], 0, sizeof(StallRecord));
+    detector.records[i].function = function;
+    detector.records[i].hash = hash;
+    detector.records[i].num_frames = num_frames;
+    memcpy(detector.records[i].frames,
+           frames + 1,
+           sizeof(void*) * num_frames);
+    ++detector.num_records;
+  }
+  ++detector.records[i].hits;
+  detector.records[i].total_ns += elapsed_ns;
+  if (elapsed_ns > detector.records[i].max_ns) {
+    detector.records[i].max_ns = elapsed_ns;
+  }
+  stall_unlock();
+}
+
+void glcew_stall_atfork_prepare(void) {
+  stall_lock();
+}
+
+void glcew_stall_atfork_release(void) {
+  stall_unlock();
+}
+
+static int compare_records(const void* a_v, const void* b_v) {
+  const StallRecord* a = (const StallRecord*)a_v;
+  const StallRecord* b = (const StallRecord*)b_v;
+  return (a->total_ns < b->total_ns) - (a->total_ns > b->total_ns);
+}
+
+static void report_at_exit(void) {
+  if (detector.flags & GLCEW_STALL_REPORT_AT_EXIT) {
+    glcewStallDetectorReport(stderr);
+  }
+}
+
+int glcewStallDetectorEnable(uint64_t threshold_us, int sample_rate, int flags) {
+#ifdef _WIN32
+  (void) threshold_us;  /* Ignored. */
+  (void) sample_rate;  /* Ignored. */
+  (void) flags;  /* Ignored. */
+  return GLCEW_ERROR_UNSUPPORTED;
+#else
+  const int result = glcew_atfork_register();
+  if (result != GLCEW_SUCCESS) {
+    return result;
+  }
+  stall_lock();
+  detector.threshold_ns = threshold_us * 1000;
+  detector.sample_rate = (sample_rate < 1) ? 1 : sample_rate;
+  detector.flags = flags;
+  if ((flags & GLCEW_STALL_REPORT_AT_EXIT) && !detector.atexit_registered) {
+    if (atexit(report_at_exit)) {
+      stall_unlock();
+      return GLCEW_ERROR_ATEXIT_FAILED;
+    }
+    detector.atexit_registered = 1;
+  }
+  stall_unlock();
+  glcew_stall_enabled = 1;
+  return GLCEW_SUCCESS;
+#endif
+}
+
+void glcewStallDetectorDisable(void) {
+  glcew_stall_enabled = 0;
+}
+
+void glcewStallDetectorReset(void) {
+  stall_lock();
+  detector.num_records = 0;
+  detector.overflow_hits = 0;
+  detector.overflow_ns = 0;
+  stall_unlock();
+}
+
+int glcewStallDetectorReport(FILE* file) {
+  StallRecord* records;
+  int num_records, i;
+  stall_lock();
+  num_records = detector.num_records;
+  records = malloc(sizeof(StallRecord) * (num_records + 1));
+  if (records == NULL) {
+    stall_unlock();
+    return 0;
+  }
+  memcpy(records, detector.records, sizeof(StallRecord) * num_records);
+  fprintf(file,
+          "GLCEW stall report (threshold %llu us, sampling 1/%d)\n",
+          (unsigned long long)(detector.threshold_ns / 1000),
+          detector.sample_rate);
+  if (detector.overflow_hits != 0) {
+    fprintf(file, "  <untracked>: %llu hits, %.3f ms total\n",
+            (unsigned long long)detector.overflow_hits,
+            detector.overflow_ns * 1e-6);
+  }
+  stall_unlock();
+  qsort(records, num_records, sizeof(StallRecord), compare_records);
+  for (i = 0; i < num_records; ++i) {
+    const StallRecord* record = &records[i];
+    fprintf(file,
+            "  %s: %llu hits, %.3f ms total, %.3f ms max\n",
+            record->function,
+            (unsigned long long)record->hits,
+            record->total_ns * 1e-6,
+            record->max_ns * 1e-6);
+#ifdef __GLIBC__
+    {
+      char** symbols = backtrace_symbols(record->frames, record->num_frames);
+      int j;
+      for (j = 0; j < record->num_frames; ++j) {
+        fprintf(file, "    #%d %s\n", j,
+                symbols != NULL ? symbols[j] : "?");
+      }
+      free(symbols);
+    }
+#endif
+  }
+  free(records);
+  return ferror(file) ? 0 : 1;
+}
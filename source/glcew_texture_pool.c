@@ -0,0 +1,590 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Texture pool.
+ *
+ * Every texture acquired from the pool has a record, which is found by the
+ * texture name. Records of parked textures are additionally linked into a
+ * chain of textures with the same storage key, and into the LRU list, which
+ * is used for eviction.
+ *
+ * Texture bindings of every unit are tracked by the glActiveTexture() and
+ * glBindTexture() wrappers, so parked textures can be unbound without
+ * querying the context.
+ *
+ * Recycled textures get the default sampling parameters back, so they look
+ * like new ones to the next owner.
+ */
+
+#include <glcew.h>
+#include "glcew_intern.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_BUCKETS 256  /* Must be power of two. */
+#define MAX_LEVELS 32
+#define MAX_TEXTURE_UNITS 192
+#define NUM_TARGETS 2
+#define DELETE_CHUNK_SIZE 64
+
+typedef struct TextureKey {
+  GLenum target;
+  GLenum internal_format;
+  GLsizei width;
+  GLsizei height;
+  GLsizei levels;
+} TextureKey;
+
+typedef struct TextureRecord {
+  GLuint name;
+  TextureKey key;
+  uint64_t bytes;
+  int parked;
+  struct TextureRecord* next_name;
+  /* Following fields are only used while the texture is parked. */
+  struct TextureRecord* next_key;
+  struct TextureRecord* lru_prev;
+  struct TextureRecord* lru_next;
+} TextureRecord;
+
+typedef struct TexturePool {
+  int enabled;
+  int wrap_delete;
+  /* Context supports texture swizzle (OpenGL 3.3). */
+  int has_swizzle;
+  uint64_t max_bytes;
+  TextureRecord* by_name[NUM_BUCKETS];
+  TextureRecord* by_key[NUM_BUCKETS];
+  /* Most recently parked texture is at the head. */
+  TextureRecord* lru_head;
+  TextureRecord* lru_tail;
+  GLCEWTexturePoolStats stats;
+  /* Bindings of the context, as seen by the wrappers since the pool was
+   * enabled. Only accessed from the thread the context is current on.
+   * Unit is -1 when the active unit is beyond the tracked ones.
+   */
+  GLenum active_texture;
+  int active_unit;
+  GLuint bound[MAX_TEXTURE_UNITS][NUM_TARGETS];
+} TexturePool;
+
+int glcew_texture_pool_tracking = 0;
+static TexturePool pool;
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* ******************************** Storage. ******************************** */
+
+static int bytes_per_texel(GLenum internal_format) {
+  switch (internal_format) {
+    case 0x1903:  /* GL_RED */
+    case 0x8229:  /* GL_R8 */
+      return 1;
+    case 0x822B:  /* GL_RG8 */
+    case 0x822D:  /* GL_R16F */
+      return 2;
+    case 0x1907:  /* GL_RGB */
+    case 0x8051:  /* GL_RGB8 */
+      return 3;
+    case 0x822F:  /* GL_RG16F */
+    case 0x822E:  /* GL_R32F */
+      return 4;
+    case 0x881B:  /* GL_RGB16F */
+      return 6;
+    case 0x881A:  /* GL_RGBA16F */
+    case 0x8230:  /* GL_RG32F */
+      return 8;
+    case 0x8815:  /* GL_RGB32F */
+      return 12;
+    case 0x8814:  /* GL_RGBA32F */
+      return 16;
+  }
+  /* GL_RGBA8, GL_SRGB8_ALPHA8, 24 bit depth and everything else. */
+  return 4;
+}
+
+static uint64_t storage_bytes(const TextureKey* key) {
+  const uint64_t texel_bytes = bytes_per_texel(key->internal_format);
+  uint64_t bytes = 0;
+  GLsizei level;
+  for (level = 0; level < key->levels; ++level) {
+    const uint64_t width = (key->width >> level) ? (key->width >> level) : 1;
+    const uint64_t height =
+        (key->height >> level) ? (key->height >> level) : 1;
+    bytes += width * height * texel_bytes;
+  }
+  return bytes;
+}
+
+static int key_equal(const TextureKey* a, const TextureKey* b) {
+  return a->target == b->target &&
+         a->internal_format == b->internal_format &&
+         a->width == b->width &&
+         a->height == b->height &&
+         a->levels == b->levels;
+}
+
+static uint32_t key_hash(const TextureKey* key) {
+  uint32_t hash = 2166136261u;
+  hash = (hash ^ key->target) * 16777619u;
+  hash = (hash ^ key->internal_format) * 16777619u;
+  hash = (hash ^ (uint32_t)key->width) * 16777619u;
+  hash = (hash ^ (uint32_t)key->height) * 16777619u;
+  hash = (hash ^ (uint32_t)key->levels) * 16777619u;
+  return hash;
+}
+
+/* ******************************* Bindings. ******************************* */
+
+/* Index of the target in the binding table, -1 if the target is not pooled. */
+static int target_index(GLenum target) {
+  switch (target) {
+    case GL_TEXTURE_2D:
+      return 0;
+    case GL_TEXTURE_RECTANGLE:
+      return 1;
+  }
+  return -1;
+}
+
+static GLuint binding_get(GLenum target) {
+  const int index = target_index(target);
+  if (index == -1 || pool.active_unit == -1) {
+    return 0;
+  }
+  return pool.bound[pool.active_unit][index];
+}
+
+static void binding_set(GLenum target, GLuint texture) {
+  const int index = target_index(target);
+  if (index != -1 && pool.active_unit != -1) {
+    pool.bound[pool.active_unit][index] = texture;
+  }
+}
+
+static void binding_set_active(GLenum texture) {
+  const GLenum unit = texture - GL_TEXTURE0;
+  pool.active_texture = texture;
+  pool.active_unit = (unit < MAX_TEXTURE_UNITS) ? (int)unit : -1;
+}
+
+/* Texture deleted by the library is unbound from all the units. */
+static void binding_forget(GLuint texture) {
+  int unit, index;
+  for (unit = 0; unit < MAX_TEXTURE_UNITS; ++unit) {
+    for (index = 0; index < NUM_TARGETS; ++index) {
+      if (pool.bound[unit][index] == texture) {
+        pool.bound[unit][index] = 0;
+      }
+    }
+  }
+}
+
+/* ******************************** Records. ******************************** */
+
+static TextureRecord** record_slot(GLuint name) {
+  TextureRecord** slot = &pool.by_name[(name * 2654435761u) &
+                                       (NUM_BUCKETS - 1)];
+  while (*slot != NULL && (*slot)->name != name) {
+    slot = &(*slot)->next_name;
+  }
+  return slot;
+}
+
+static TextureRecord* record_ensure(GLuint name) {
+  TextureRecord** slot = record_slot(name);
+  if (*slot == NULL) {
+    *slot = calloc(1, sizeof(TextureRecord));
+    if (*slot == NULL) {
+      return NULL;
+    }
+    (*slot)->name = name;
+  }
+  return *slot;
+}
+
+static void record_free(TextureRecord* record) {
+  TextureRecord** slot = record_slot(record->name);
+  *slot = record->next_name;
+  free(record);
+}
+
+static void record_park(TextureRecord* record) {
+  TextureRecord** chain = &pool.by_key[key_hash(&record->key) &
+                                       (NUM_BUCKETS - 1)];
+  record->parked = 1;
+  record->next_key = *chain;
+  *chain = record;
+  record->lru_prev = NULL;
+  record->lru_next = pool.lru_head;
+  if (pool.lru_head != NULL) {
+    pool.lru_head->lru_prev = record;
+  }
+  else {
+    pool.lru_tail = record;
+  }
+  pool.lru_head = record;
+  ++pool.stats.num_parked;
+  pool.stats.parked_bytes += record->bytes;
+}
+
+static void record_unpark(TextureRecord* record) {
+  TextureRecord** chain = &pool.by_key[key_hash(&record->key) &
+                                       (NUM_BUCKETS - 1)];
+  while (*chain != record) {
+    chain = &(*chain)->next_key;
+  }
+  *chain = record->next_key;
+  if (record->lru_prev != NULL) {
+    record->lru_prev->lru_next = record->lru_next;
+  }
+  else {
+    pool.lru_head = record->lru_next;
+  }
+  if (record->lru_next != NULL) {
+    record->lru_next->lru_prev = record->lru_prev;
+  }
+  else {
+    pool.lru_tail = record->lru_prev;
+  }
+  record->parked = 0;
+  --pool.stats.num_parked;
+  pool.stats.parked_bytes -= record->bytes;
+}
+
+static TextureRecord* find_parked(const TextureKey* key) {
+  TextureRecord* record = pool.by_key[key_hash(key) & (NUM_BUCKETS - 1)];
+  while (record != NULL && !key_equal(&record->key, key)) {
+    record = record->next_key;
+  }
+  return record;
+}
+
+static void destroy_parked(TextureRecord* record) {
+  const GLuint name = record->name;
+  record_unpark(record);
+  record_free(record);
+  GLCEW_DISPATCH(glDeleteTextures)(1, &name);
+}
+
+static void evict_to_limit(void) {
+  while (pool.max_bytes != 0 &&
+         pool.stats.parked_bytes > pool.max_bytes &&
+         pool.lru_tail != NULL) {
+    destroy_parked(pool.lru_tail);
+    ++pool.stats.num_evictions;
+  }
+}
+
+/* Parked texture is to behave as a deleted one, so unbind it from all the
+ * units it is bound to, restoring the active unit afterwards.
+ */
+static void unbind_parked(const TextureRecord* record) {
+  const int index = target_index(record->key.target);
+  int unit, switched = 0;
+  for (unit = 0; unit < MAX_TEXTURE_UNITS; ++unit) {
+    if (pool.bound[unit][index] != record->name) {
+      continue;
+    }
+    if (unit != pool.active_unit) {
+      GLCEW_DISPATCH(glActiveTexture)(GL_TEXTURE0 + unit);
+      switched = 1;
+    }
+    GLCEW_DISPATCH(glBindTexture)(record->key.target, 0);
+    pool.bound[unit][index] = 0;
+  }
+  if (switched) {
+    GLCEW_DISPATCH(glActiveTexture)(pool.active_texture);
+  }
+}
+
+/* Reset the sampling parameters the previous owner of the recycled texture
+ * is likely to have changed, to the defaults of a new texture. LOD range and
+ * bias, border color and depth stencil mode are kept.
+ */
+static void parameters_reset(const TextureKey* key) {
+  const tglTexParameteri tex_parameter = GLCEW_DISPATCH(glTexParameteri);
+  const GLenum target = key->target;
+  if (target == GL_TEXTURE_RECTANGLE) {
+    tex_parameter(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    tex_parameter(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    tex_parameter(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  }
+  else {
+    tex_parameter(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
+    tex_parameter(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    tex_parameter(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    tex_parameter(target, GL_TEXTURE_MAX_LEVEL, key->levels - 1);
+  }
+  tex_parameter(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  tex_parameter(target, GL_TEXTURE_BASE_LEVEL, 0);
+  tex_parameter(target, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+  if (pool.has_swizzle) {
+    tex_parameter(target, GL_TEXTURE_SWIZZLE_R, GL_RED);
+    tex_parameter(target, GL_TEXTURE_SWIZZLE_G, GL_GREEN);
+    tex_parameter(target, GL_TEXTURE_SWIZZLE_B, GL_BLUE);
+    tex_parameter(target, GL_TEXTURE_SWIZZLE_A, GL_ALPHA);
+  }
+}
+
+/* Park acquired textures, delete the other ones. */
+static void park_or_delete(GLsizei n, const GLuint* textures) {
+  GLuint unknown[DELETE_CHUNK_SIZE];
+  int num_unknown = 0;
+  GLsizei i;
+  for (i = 0; i < n; ++i) {
+    TextureRecord* record;
+    if (textures[i] == 0) {
+      continue;
+    }
+    record = *record_slot(textures[i]);
+    if (record != NULL) {
+      if (!record->parked) {
+        unbind_parked(record);
+        record_park(record);
+      }
+      continue;
+    }
+    binding_forget(textures[i]);
+    unknown[num_unknown++] = textures[i];
+    if (num_unknown == DELETE_CHUNK_SIZE) {
+      GLCEW_DISPATCH(glDeleteTextures)(num_unknown, unknown);
+      num_unknown = 0;
+    }
+  }
+  if (num_unknown != 0) {
+    GLCEW_DISPATCH(glDeleteTextures)(num_unknown, unknown);
+  }
+  evict_to_limit();
+}
+
+/* ****************************** Wrapper hooks. **************************** */
+
+/* Storage of acquired textures which is re-defined by the application. */
+void glcew_texture_pool_tex_image_impl(GLenum target,
+                                       GLint level,
+                                       GLint internal_format,
+                                       GLsizei width,
+                                       GLsizei height) {
+  const GLuint bound = binding_get(target);
+  TextureRecord* record;
+  if (bound == 0 || level < 0 || level >= MAX_LEVELS) {
+    return;
+  }
+  pthread_mutex_lock(&pool_mutex);
+  record = *record_slot(bound);
+  if (record == NULL || record->parked) {
+    pthread_mutex_unlock(&pool_mutex);
+    return;
+  }
+  if (level == 0) {
+    const TextureKey key = {target, (GLenum)internal_format,
+                            width, height, 1};
+    if (record->key.target != key.target ||
+        record->key.internal_format != key.internal_format ||
+        record->key.width != key.width ||
+        record->key.height != key.height) {
+      record->key = key;
+      record->bytes = storage_bytes(&record->key);
+    }
+  }
+  else {
+    /* Mipmap levels only extend storage which is defined by level 0. */
+    if (level >= record->key.levels) {
+      record->key.levels = level + 1;
+      record->bytes = storage_bytes(&record->key);
+    }
+  }
+  pthread_mutex_unlock(&pool_mutex);
+}
+
+int glcew_texture_pool_delete_impl(GLsizei n, const GLuint* textures) {
+  GLsizei i;
+  pthread_mutex_lock(&pool_mutex);
+  if (pool.wrap_delete) {
+    park_or_delete(n, textures);
+    pthread_mutex_unlock(&pool_mutex);
+    return 1;
+  }
+  /* Library deletes the textures, which are not to be recycled anymore. */
+  for (i = 0; i < n; ++i) {
+    TextureRecord* record;
+    if (textures[i] == 0) {
+      continue;
+    }
+    record = *record_slot(textures[i]);
+    if (record != NULL) {
+      if (record->parked) {
+        record_unpark(record);
+      }
+      record_free(record);
+    }
+    binding_forget(textures[i]);
+  }
+  pthread_mutex_unlock(&pool_mutex);
+  return 0;
+}
+
+void glcew_texture_pool_bind_impl(GLenum target, GLuint texture) {
+  binding_set(target, texture);
+}
+
+void glcew_texture_pool_active_texture_impl(GLenum texture) {
+  binding_set_active(texture);
+}
+
+void glcew_texture_pool_atfork_prepare(void) {
+  pthread_mutex_lock(&pool_mutex);
+}
+
+void glcew_texture_pool_atfork_release(void) {
+  pthread_mutex_unlock(&pool_mutex);
+}
+
+/* ********************************* API. ******************************** */
+
+/* Setting the swizzle on older contexts would raise an error which the
+ * application did not cause.
+ */
+static int swizzle_supported(void) {
+  const char* version = (const char*)GLCEW_DISPATCH(glGetString)(GL_VERSION);
+  int major = 0, minor = 0;
+  if (version == NULL || sscanf(version, "%d.%d", &major, &minor) != 2) {
+    return 0;
+  }
+  return major > 3 || (major == 3 && minor >= 3);
+}
+
+int glcewTexturePoolEnable(uint64_t max_bytes, int flags) {
+  GLint active_texture = GL_TEXTURE0;
+  int result;
+  if (GLCEW_DISPATCH(glGenTextures) == NULL) {
+    return GLCEW_ERROR_OPEN_FAILED;
+  }
+  result = glcew_atfork_register();
+  if (result != GLCEW_SUCCESS) {
+    return result;
+  }
+  GLCEW_BATCH_FLUSH();
+  pthread_mutex_lock(&pool_mutex);
+  pool.max_bytes = max_bytes;
+  pool.wrap_delete = (flags & GLCEW_TEXTURE_POOL_WRAP_DELETE) ? 1 : 0;
+  if (!pool.enabled) {
+    /* Textures bound before are never parked, they are not acquired. */
+    GLCEW_DISPATCH(glGetIntegerv)(GL_ACTIVE_TEXTURE, &active_texture);
+    binding_set_active((GLenum)active_texture);
+    memset(pool.bound, 0, sizeof(pool.bound));
+    pool.has_swizzle = swizzle_supported();
+  }
+  pool.enabled = 1;
+  glcew_texture_pool_tracking = 1;
+  evict_to_limit();
+  pthread_mutex_unlock(&pool_mutex);
+  return GLCEW_SUCCESS;
+}
+
+void glcewTexturePoolDisable(void) {
+  int i;
+  GLCEW_BATCH_FLUSH();
+  pthread_mutex_lock(&pool_mutex);
+  glcew_texture_pool_tracking = 0;
+  pool.enabled = 0;
+  while (pool.lru_tail != NULL) {
+    destroy_parked(pool.lru_tail);
+  }
+  /* Textures which are in use are owned by the application again. */
+  for (i = 0; i < NUM_BUCKETS; ++i) {
+    while (pool.by_name[i] != NULL) {
+      record_free(pool.by_name[i]);
+    }
+  }
+  pthread_mutex_unlock(&pool_mutex);
+}
+
+GLuint glcewTexturePoolAcquire(GLenum target,
+                               GLsizei levels,
+                               GLenum internal_format,
+                               GLsizei width,
+                               GLsizei height,
+                               GLenum format,
+                               GLenum type) {
+  const TextureKey key = {target, internal_format, width, height,
+                          (levels > 0) ? levels : 1};
+  TextureRecord* record;
+  GLuint texture = 0;
+  GLsizei level;
+  GLCEW_BATCH_FLUSH();
+  pthread_mutex_lock(&pool_mutex);
+  if (!pool.enabled) {
+    pthread_mutex_unlock(&pool_mutex);
+    return 0;
+  }
+  record = find_parked(&key);
+  if (record != NULL) {
+    record_unpark(record);
+    ++pool.stats.num_hits;
+    texture = record->name;
+    pthread_mutex_unlock(&pool_mutex);
+    GLCEW_DISPATCH(glBindTexture)(target, texture);
+    binding_set(target, texture);
+    parameters_reset(&key);
+    return texture;
+  }
+  ++pool.stats.num_misses;
+  pthread_mutex_unlock(&pool_mutex);
+  GLCEW_DISPATCH(glGenTextures)(1, &texture);
+  GLCEW_DISPATCH(glBindTexture)(target, texture);
+  binding_set(target, texture);
+  for (level = 0; level < key.levels; ++level) {
+    GLCEW_DISPATCH(glTexImage2D)(target,
+                                 level,
+                                 (GLint)internal_format,
+                                 (width >> level) ? (width >> level) : 1,
+                                 (height >> level) ? (height >> level) : 1,
+                                 0,
+                                 format,
+                                 type,
+                                 NULL);
+  }
+  if (target != GL_TEXTURE_RECTANGLE) {
+    GLCEW_DISPATCH(glTexParameteri)(target,
+                                    GL_TEXTURE_MAX_LEVEL,
+                                    key.levels - 1);
+  }
+  pthread_mutex_lock(&pool_mutex);
+  record = record_ensure(texture);
+  if (record != NULL) {
+    record->key = key;
+    record->bytes = storage_bytes(&key);
+  }
+  pthread_mutex_unlock(&pool_mutex);
+  return texture;
+}
+
+void glcewTexturePoolRelease(GLuint texture) {
+  GLCEW_BATCH_FLUSH();
+  pthread_mutex_lock(&pool_mutex);
+  park_or_delete(1, &texture);
+  pthread_mutex_unlock(&pool_mutex);
+}
+
+void glcewTexturePoolGetStats(GLCEWTexturePoolStats* stats) {
+  pthread_mutex_lock(&pool_mutex);
+  *stats = pool.stats;
+  pthread_mutex_unlock(&pool_mutex);
+}
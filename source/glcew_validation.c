@@ -0,0 +1,316 @@
+/*
+ * Copyright 2018 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Validation based on debug output.
+ *
+ * Driver reports errors via the callback, so there are no glGetError()
+ * round-trips. Messages are pushed to a bounded lock-free queue, since the
+ * callback might be invoked from any thread, including the driver's own
+ * ones. Every cell of the queue has a sequence number which tells whether
+ * the cell is ready to be written or to be read.
+ *
+ * Debug output is enabled on the current context, which is not recreated
+ * with the debug flag: the application is to request it when it creates the
+ * context, otherwise the driver might report only a subset of errors.
+ */
+
+#include <glcew.h>
+#include "glcew_intern.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define QUEUE_SIZE 256  /* Must be power of two. */
+
+enum {
+  QUEUE_UNINITIALIZED = 0,
+  QUEUE_INITIALIZING = 1,
+  QUEUE_READY = 2,
+};
+
+#ifndef APIENTRY
+#  define APIENTRY
+#endif
+
+typedef void (APIENTRY *GLDEBUGPROC) (GLenum source,
+                                      GLenum type,
+                                      GLuint id,
+                                      GLenum severity,
+                                      GLsizei length,
+                                      const char* message,
+                                      const void* user_param);
+typedef void (*tglDebugMessageCallback) (GLDEBUGPROC callback,
+                                         const void* user_param);
+typedef void (*tglDebugMessageControl) (GLenum source,
+                                        GLenum type,
+                                        GLenum severity,
+                                        GLsizei count,
+                                        const GLuint* ids,
+                                        GLboolean enabled);
+typedef const GLubyte* (*tglGetStringi) (GLenum name, GLuint index);
+
+typedef enum DebugOutputSupport {
+  DEBUG_OUTPUT_NONE,
+  /* GL_ARB_debug_output: ARB suffixed entry points, no GL_DEBUG_OUTPUT. */
+  DEBUG_OUTPUT_ARB,
+  /* OpenGL 4.3 or GL_KHR_debug. */
+  DEBUG_OUTPUT_KHR,
+} DebugOutputSupport;
+
+typedef struct QueueCell {
+  uint64_t sequence;
+  GLCEWValidationMessage message;
+} QueueCell;
+
+static QueueCell queue[QUEUE_SIZE];
+static uint64_t queue_write = 0;
+static uint64_t queue_read = 0;
+static uint64_t num_dropped = 0;
+static int queue_state = QUEUE_UNINITIALIZED;
+static tglDebugMessageCallback debug_message_callback = NULL;
+static DebugOutputSupport debug_output = DEBUG_OUTPUT_NONE;
+
+/* Initialize the queue once, threads which enable validation at the same
+ * time wait for the one which initializes it.
+ */
+static void queue_init(void) {
+  int expected = QUEUE_UNINITIALIZED;
+  uint64_t i;
+  if (!__atomic_compare_exchange_n(&queue_state, &expected,
+                                   QUEUE_INITIALIZING, 0,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+    while (__atomic_load_n(&queue_state, __ATOMIC_ACQUIRE) != QUEUE_READY) {
+      /* Initialization is 256 stores, not worth sleeping for. */
+    }
+    return;
+  }
+  for (i = 0; i < QUEUE_SIZE; ++i) {
+    __atomic_store_n(&queue[i].sequence, i, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&queue_state, QUEUE_READY, __ATOMIC_RELEASE);
+}
+
+/* Whether the space separated list contains the given word. */
+static int extension_list_has(const char* list, const char* name) {
+  const size_t name_length = strlen(name);
+  const char* found = list;
+  while ((found = strstr(found, name)) != NULL) {
+    if ((found == list || found[-1] == ' ') &&
+        (found[name_length] == ' ' || found[name_length] == '\0')) {
+      return 1;
+    }
+    found += name_length;
+  }
+  return 0;
+}
+
+static int extension_supported(tglXGetProcAddressARB get_proc_address,
+                               const char* name) {
+  const GLubyte* extensions = GLCEW_DISPATCH(glGetString)(GL_EXTENSIONS);
+  tglGetStringi get_string_i;
+  GLint num_extensions = 0;
+  GLint i;
+  if (extensions != NULL) {
+    return extension_list_has((const char*)extensions, name);
+  }
+  /* Core profile only lists extensions one by one. */
+  get_string_i = (tglGetStringi)get_proc_address(
+      (const GLubyte*)"glGetStringi");
+  if (get_string_i == NULL) {
+    return 0;
+  }
+  GLCEW_DISPATCH(glGetIntegerv)(GL_NUM_EXTENSIONS, &num_extensions);
+  for (i = 0; i < num_extensions; ++i) {
+    const GLubyte* extension = get_string_i(GL_EXTENSIONS, (GLuint)i);
+    if (extension != NULL && strcmp((const char*)extension, name) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Debug output support of the current context. Entry points can not tell,
+ * glXGetProcAddressARB() returns non-NULL for any name.
+ */
+static DebugOutputSupport debug_output_support(
+    tglXGetProcAddressARB get_proc_address) {
+  const GLubyte* version = GLCEW_DISPATCH(glGetString)(GL_VERSION);
+  int major, minor;
+  if (version == NULL) {
+    /* No current context. */
+    return DEBUG_OUTPUT_NONE;
+  }
+  if (sscanf((const char*)version, "%d.%d", &major, &minor) == 2 &&
+      (major > 4 || (major == 4 && minor >= 3))) {
+    return DEBUG_OUTPUT_KHR;
+  }
+  if (extension_supported(get_proc_address, "GL_KHR_debug")) {
+    return DEBUG_OUTPUT_KHR;
+  }
+  if (extension_supported(get_proc_address, "GL_ARB_debug_output")) {
+    return DEBUG_OUTPUT_ARB;
+  }
+  return DEBUG_OUTPUT_NONE;
+}
+
+static void APIENTRY debug_callback(GLenum source,
+                                    GLenum type,
+                                    GLuint id,
+                                    GLenum severity,
+                                    GLsizei length,
+                                    const char* message,
+                                    const void* user_param) {
+  uint64_t position = __atomic_load_n(&queue_write, __ATOMIC_RELAXED);
+  GLCEWValidationMessage* destination;
+  QueueCell* cell;
+  (void) user_param;  /* Ignored. */
+  for (;;) {
+    uint64_t sequence;
+    cell = &queue[position & (QUEUE_SIZE - 1)];
+    sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+    if (sequence == position) {
+      if (__atomic_compare_exchange_n(&queue_write, &position, position + 1,
+                                      1, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED)) {
+        break;
+      }
+    }
+    else if (sequence < position) {
+      /* Queue is full, consumer did not free the cell yet. */
+      __atomic_fetch_add(&num_dropped, 1, __ATOMIC_RELAXED);
+      return;
+    }
+    else {
+      position = __atomic_load_n(&queue_write, __ATOMIC_RELAXED);
+    }
+  }
+  destination = &cell->message;
+  destination->source = source;
+  destination->type = type;
+  destination->id = id;
+  destination->severity = severity;
+  destination->function = glcew_last_call;
+  if (length < 0) {
+    length = (GLsizei)strlen(message);
+  }
+  if (length >= GLCEW_VALIDATION_MAX_MESSAGE_LENGTH) {
+    length = GLCEW_VALIDATION_MAX_MESSAGE_LENGTH - 1;
+  }
+  memcpy(destination->message, message, length);
+  destination->message[length] = '\0';
+  __atomic_store_n(&cell->sequence, position + 1, __ATOMIC_RELEASE);
+}
+
+int glcewValidationEnable(int flags) {
+  tglXGetProcAddressARB get_proc_address =
+      GLCEW_DISPATCH(glXGetProcAddressARB);
+  tglDebugMessageCallback debug_message_callback_found;
+  tglDebugMessageControl debug_message_control;
+  tglEnable enable = GLCEW_DISPATCH(glEnable);
+  tglDisable disable = GLCEW_DISPATCH(glDisable);
+  DebugOutputSupport support;
+  const char* suffix;
+  char name[64];
+  if (get_proc_address == NULL) {
+    return GLCEW_ERROR_OPEN_FAILED;
+  }
+  support = debug_output_support(get_proc_address);
+  if (support == DEBUG_OUTPUT_NONE) {
+    return GLCEW_ERROR_UNSUPPORTED;
+  }
+  suffix = (support == DEBUG_OUTPUT_ARB) ? "ARB" : "";
+  snprintf(name, sizeof(name), "glDebugMessageCallback%s", suffix);
+  debug_message_callback_found =
+      (tglDebugMessageCallback)get_proc_address((const GLubyte*)name);
+  snprintf(name, sizeof(name), "glDebugMessageControl%s", suffix);
+  debug_message_control =
+      (tglDebugMessageControl)get_proc_address((const GLubyte*)name);
+  if (debug_message_callback_found == NULL) {
+    return GLCEW_ERROR_UNSUPPORTED;
+  }
+  debug_message_callback = debug_message_callback_found;
+  debug_output = support;
+  queue_init();
+  if (debug_message_control != NULL) {
+    debug_message_control(GL_DONT_CARE,
+                          GL_DONT_CARE,
+                          GL_DEBUG_SEVERITY_NOTIFICATION,
+                          0,
+                          NULL,
+                          (flags & GLCEW_VALIDATION_NOTIFICATIONS) ? 1 : 0);
+  }
+  if (flags & GLCEW_VALIDATION_SYNCHRONOUS) {
+    enable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+  }
+  else {
+    disable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+  }
+  debug_message_callback(debug_callback, NULL);
+  /* GL_ARB_debug_output has no switch, output is always on. */
+  if (support == DEBUG_OUTPUT_KHR) {
+    enable(GL_DEBUG_OUTPUT);
+  }
+  return GLCEW_SUCCESS;
+}
+
+void glcewValidationDisable(void) {
+  if (debug_message_callback == NULL) {
+    return;
+  }
+  if (debug_output == DEBUG_OUTPUT_KHR) {
+    GLCEW_DISPATCH(glDisable)(GL_DEBUG_OUTPUT);
+  }
+  debug_message_callback(NULL, NULL);
+}
+
+void glcew_validation_unload(void) {
+  debug_message_callback = NULL;
+}
+
+int glcewValidationPoll(GLCEWValidationMessage* message) {
+  QueueCell* cell;
+  uint64_t position;
+  if (__atomic_load_n(&queue_state, __ATOMIC_ACQUIRE) != QUEUE_READY) {
+    return 0;
+  }
+  position = __atomic_load_n(&queue_read, __ATOMIC_RELAXED);
+  for (;;) {
+    uint64_t sequence;
+    cell = &queue[position & (QUEUE_SIZE - 1)];
+    sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+    if (sequence == position + 1) {
+      if (__atomic_compare_exchange_n(&queue_read, &position, position + 1,
+                                      1, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED)) {
+        break;
+      }
+    }
+    else if (sequence < position + 1) {
+      /* Queue is empty. */
+      return 0;
+    }
+    else {
+      position = __atomic_load_n(&queue_read, __ATOMIC_RELAXED);
+    }
+  }
+  *message = cell->message;
+  __atomic_store_n(&cell->sequence, position + QUEUE_SIZE, __ATOMIC_RELEASE);
+  return 1;
+}
+
+uint64_t glcewValidationNumDropped(void) {
+  return __atomic_load_n(&num_dropped, __ATOMIC_RELAXED);
+}